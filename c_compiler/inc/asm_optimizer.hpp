@@ -0,0 +1,366 @@
+#ifndef asm_optimizer_hpp
+#define asm_optimizer_hpp
+
+#include "compiler_util.hpp"
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <iostream>
+
+// A line of generated assembly.
+// The body of a function is emitted as text and then parsed back into lines, so that it
+// can be analysed (e.g. liveness) and rewritten before being written to the output.
+// Kind of line:
+// - "instruction": opcode and operands, e.g. addu $t0, $t0, $t1.
+// - "label":       definition of a label, e.g. _end_if_4:.
+// - "other":       comments, directives and empty lines, printed back as they are.
+class AsmLine {
+ private:
+  std::string kind_;
+  std::string label_;
+  std::string opcode_;
+  std::vector<std::string> operands_;
+  std::string comment_;
+  std::string text_;
+
+ public:
+  static AsmLine makeInstruction(const std::string& opcode,
+                                 const std::vector<std::string>& operands,
+                                 const std::string& comment);
+  static AsmLine makeLabel(const std::string& label);
+  static AsmLine makeOther(const std::string& text);
+
+  // Parse a line of text. A line can contain both a label and an instruction (e.g.
+  // "1:  jalr $25"), hence a vector is returned.
+  static std::vector<AsmLine> parse(const std::string& line);
+
+  const std::string& getKind() const;
+  bool isInstruction() const;
+  bool isLabel() const;
+  const std::string& getLabel() const;
+  const std::string& getOpcode() const;
+  const std::vector<std::string>& getOperands() const;
+  const std::string& getOperand(int index) const;
+  void setOperand(int index, const std::string& operand);
+  const std::string& getComment() const;
+
+  // Registers read and written by the instruction. Names are canonical (see
+  // AsmOptimizer::canonicalRegister). The pseudo registers $hi and $lo are included.
+  std::vector<std::string> getUsedRegisters() const;
+  std::vector<std::string> getDefinedRegisters() const;
+
+  // Control flow.
+  // Branch or jump to a label (b, j, beq, bne, ...).
+  bool isBranch() const;
+  bool isConditionalBranch() const;
+  const std::string& getBranchTarget() const;
+  void setBranchTarget(const std::string& label);
+  // Function call (jal, jalr).
+  bool isCall() const;
+  // Jump to a register (j $ra, jr $25).
+  bool isIndirectJump() const;
+  // Jump to a function, which returns directly to the caller of this one (j callee,
+  // jr $25). The arguments are read like for a call.
+  bool isTailCall() const;
+  // Execution never continues with the next line.
+  bool endsBlock() const;
+  bool hasFallThrough() const;
+  // Instruction with unknown semantics: nothing can be assumed about it.
+  bool isUnknown() const;
+
+  // Memory access of lw and sw. The operand is in the form offset(base).
+  bool isLoad() const;
+  bool isStore() const;
+  const std::string& getMemoryOperand() const;
+  std::string getBaseRegister() const;
+  // Returns false if the offset is not an integer constant (e.g. %lo(a)).
+  bool getConstantOffset(int& offset) const;
+
+  // Rewrite the explicit operands that read the register 'from' to read 'to' instead.
+  // Returns false, without changing anything, if 'from' is read implicitly or in a way that
+  // cannot be rewritten (e.g. the argument registers of a call).
+  bool replaceUsedRegister(const std::string& from, const std::string& to);
+  // Rewrite the register written by the instruction. Returns false if the instruction
+  // does not write exactly one register in its first operand.
+  bool replaceDefinedRegister(const std::string& to);
+  // The instruction only computes its defined registers, hence it can be removed if they
+  // are not used.
+  bool hasNoSideEffects() const;
+
+  std::string toString() const;
+};
+
+// Basic block: lines in [first, last] of an AsmFunction.
+class BasicBlock {
+ public:
+  int first;
+  int last;
+  std::vector<int> successors;
+  std::vector<int> predecessors;
+  // The block reaches the end of the function (return, or branch outside of the body).
+  bool is_exit;
+};
+
+// Natural loop: the header dominates every block of the loop, and the latches branch
+// back to it.
+class Loop {
+ public:
+  int header;
+  std::vector<int> latches;
+  // blocks[b] is true if the block b belongs to the loop.
+  std::vector<bool> blocks;
+};
+
+// Body of a function, as a list of assembly lines.
+class AsmFunction {
+ private:
+  std::vector<AsmLine> lines_;
+  std::vector<BasicBlock> blocks_;
+  std::vector<int> line_to_block_;
+
+ public:
+  AsmFunction(const std::string& text);
+
+  std::vector<AsmLine>& getLines();
+  const std::vector<AsmLine>& getLines() const;
+
+  // Split the lines in basic blocks and connect them. Must be called again after any
+  // change to the lines.
+  void buildControlFlowGraph();
+  const std::vector<BasicBlock>& getBlocks() const;
+  int getBlockOfLine(int line) const;
+  // Index of the block starting with the given label, -1 if the label is not in the body.
+  int getBlockOfLabel(const std::string& label) const;
+
+  // Blocks reachable from the given one, following the successors. The block itself is
+  // included only if it belongs to a cycle.
+  std::vector<bool> getBlocksReachableFrom(int block) const;
+  // dominators[b][d] is true if the block d dominates the block b. The entry is the
+  // first block. Blocks unreachable from the entry have no dominators.
+  std::vector<std::vector<bool>> computeDominators() const;
+  // Natural loops of the body, inner loops first. Loops sharing the header are merged.
+  std::vector<Loop> findLoops() const;
+  // Position where code executed once before entering the loop can be inserted: just
+  // before the header, which must be entered from outside the loop only by falling
+  // through from the previous line. Returns -1 if there is no such position.
+  int getPreheaderPosition(const Loop& loop) const;
+
+  // Remove the lines marked to be deleted.
+  void removeLines(const std::vector<bool>& to_remove);
+  // Insert the lines before the given position.
+  void insertLines(int position, const std::vector<AsmLine>& lines);
+  // Remove the labels and instructions of the blocks that cannot be executed.
+  void removeUnreachableBlocks();
+
+  void print(std::ostream& os) const;
+};
+
+class AsmOptimizer {
+ private:
+  // Liveness of registers and spill slots. A spill slot is represented as the pseudo
+  // register "slot:<offset>".
+  static std::vector<std::unordered_set<std::string>> computeLiveOut(
+    const AsmFunction& asm_function, const FunctionContext& function_context);
+
+  static void getLineUsesAndDefinitions(const AsmLine& line,
+                                        const FunctionContext& function_context,
+                                        std::vector<std::string>& uses,
+                                        std::vector<std::string>& definitions);
+
+  static bool isSpillAccess(const AsmLine& line, const FunctionContext& function_context,
+                            int& offset);
+
+  static bool removeDeadSpills(AsmFunction& asm_function,
+                               const FunctionContext& function_context);
+  static bool removeRedundantSpillStores(AsmFunction& asm_function,
+                                         const FunctionContext& function_context);
+  static void moveSpillsToCalleeSavedRegisters(AsmFunction& asm_function,
+                                               FunctionContext& function_context);
+
+  static bool propagateCopiesForward(AsmFunction& asm_function,
+                                     const FunctionContext& function_context);
+  static bool propagateCopiesBackward(AsmFunction& asm_function,
+                                      const FunctionContext& function_context);
+  static bool removeDeadInstructions(AsmFunction& asm_function,
+                                     const FunctionContext& function_context);
+
+  // Registers that can hold a value across a loop, with the offset where they are saved
+  // if they are callee saved (-1 otherwise). Caller saved registers are used only if the
+  // loop contains no call.
+  static std::vector<std::pair<std::string, int>> findFreeRegistersOfLoop(
+    const AsmFunction& asm_function, const FunctionContext& function_context,
+    const Loop& loop, int preheader_position);
+
+  // Hoist the loop invariant instructions of a loop into its preheader. Returns false if
+  // nothing is hoisted.
+  static bool hoistLoopInvariantCodeOfLoop(AsmFunction& asm_function,
+                                           FunctionContext& function_context,
+                                           const Loop& loop);
+
+  // Keep in a register, during a loop, one of the small global variables it writes.
+  // Returns false if no variable is worth it.
+  static bool promoteGlobalVariableOfLoop(AsmFunction& asm_function,
+                                          FunctionContext& function_context,
+                                          const Loop& loop);
+
+  // Replace the loads of words whose value is already in a register with copies. Returns
+  // false if nothing is replaced.
+  static bool forwardStoresToLoads(AsmFunction& asm_function,
+                                   const FunctionContext& function_context);
+  // Remove the stores to words that are not read afterwards: the private words of the
+  // stack frame and the small global variables. Returns false if nothing is removed.
+  static bool removeDeadStores(AsmFunction& asm_function,
+                               const FunctionContext& function_context);
+
+  // Offsets in the stack frame whose address is taken. Returns false if the frame
+  // register is used in an unexpected way, e.g. by an instruction with unknown semantics.
+  static bool findAddressTakenOffsets(const AsmFunction& asm_function,
+                                      const FunctionContext& function_context,
+                                      std::unordered_set<int>& offsets);
+  // The word at the offset of the stack frame may be read after leaving the loop, before
+  // being written.
+  static bool isFrameOffsetLiveAfterLoop(const AsmFunction& asm_function,
+                                         const FunctionContext& function_context,
+                                         const Loop& loop, int offset);
+  // Strength reduce the addresses derived from an induction variable of the loop. Returns
+  // false if there is nothing to reduce.
+  static bool reduceInductionVariableOfLoop(AsmFunction& asm_function,
+                                            FunctionContext& function_context,
+                                            const Loop& loop);
+  // Replace the exit test "variable < limit" with a test on the derived address
+  // base + constant + (variable << shift), and remove the update of the variable, which is
+  // not used anymore. Returns false, without changing anything, if not possible.
+  static bool replaceInductionVariableTest(AsmFunction& asm_function,
+                                           FunctionContext& function_context,
+                                           const std::string& header_label, int offset,
+                                           const std::string& pointer,
+                                           const std::string& base, int constant,
+                                           int shift);
+
+  // Retarget the branches to where they end up, through jumps and tests whose outcome is
+  // known on the way, and resolve the tests whose outcome is known. Returns false if
+  // nothing changes.
+  static bool threadBranches(AsmFunction& asm_function,
+                             const FunctionContext& function_context);
+  // Remove the nops after the branches and the branches to the next line, and invert the
+  // conditional branches over a jump. Returns false if nothing changes.
+  static bool removeRedundantBranches(AsmFunction& asm_function,
+                                      const FunctionContext& function_context);
+  // Move the unlikely paths out of the loops, and place the blocks entered only by jumps
+  // after one of them.
+  static void layoutBlocks(AsmFunction& asm_function,
+                           const FunctionContext& function_context);
+
+  // The instruction requires the stack frame of the function to be set up.
+  static bool needsStackFrame(const AsmLine& line, const FunctionContext& function_context);
+  // Block where the stack frame is set up: it must dominate all the blocks needing the
+  // frame, and all the blocks reachable from it, and it cannot be part of a loop.
+  // Returns -1 if the frame has to be set up before the first block.
+  static int findPrologueBlock(const AsmFunction& asm_function,
+                               const std::vector<bool>& needs_frame);
+
+ public:
+  // Registers preserved by a function call, according to the o32 ABI.
+  static const std::vector<std::string> CALLEE_SAVED_REGISTERS;
+
+  // Returns the conventional name for a register (e.g. $28 --> $gp).
+  static std::string canonicalRegister(const std::string& reg);
+
+  // Save only the temporary registers that are live across a function call, and keep in a
+  // callee saved register the values that cross several calls.
+  static void optimizeCallerSavedRegisters(AsmFunction& asm_function,
+                                           FunctionContext& function_context);
+
+  // Remove register to register moves, either by using the source register in place of
+  // the destination (e.g. the result of a call in $v0), or by computing the value directly
+  // in the destination (e.g. an argument in $a0). Instructions whose result is never used
+  // are removed as well.
+  static void propagateCopies(AsmFunction& asm_function,
+                              const FunctionContext& function_context);
+
+  // Compute once, before entering a loop, the values that do not change in the loop:
+  // addresses of global variables, loads of variables not written in the loop (neither
+  // directly, nor through a pointer, nor by a callee), and arithmetic on them. The loop
+  // keeps the hoisted values in registers it does not use, callee saved ones if the loop
+  // contains a call. Runs before propagateCopies, which removes the copies left in place
+  // of the hoisted instructions.
+  static void hoistLoopInvariantCode(AsmFunction& asm_function,
+                                     FunctionContext& function_context);
+
+  // Keep in a register the address of an array element indexed by an induction variable
+  // (a local increased by a constant in the loop), and increase it together with the
+  // variable, instead of computing it from the variable at each access. If the variable is
+  // only used for the exit test, the test is done on the address and the variable is
+  // removed. Runs after propagateCopies, on loops whose invariants are already hoisted.
+  static void reduceInductionVariables(AsmFunction& asm_function,
+                                       FunctionContext& function_context);
+
+  // Keep in registers the local scalar variables whose address is never taken, instead of
+  // their place in the stack frame: the loads and stores become moves, removed by
+  // propagateCopies. The most accessed variables, weighted by loop nesting, are promoted
+  // first, to temporary registers if the function makes no call, otherwise to callee
+  // saved registers, saved in the place of the variable. Runs after
+  // reduceInductionVariables, which recognizes the induction variables by their place.
+  static void promoteLocalVariables(AsmFunction& asm_function,
+                                    FunctionContext& function_context);
+
+  // Keep the small global variables written in a loop in registers while it runs: loaded
+  // before the loop and stored at its exits. Around the calls and the accesses through
+  // pointers that may read or write a variable, its memory is updated and its register
+  // reloaded. Runs after promoteLocalVariables, which has the first choice of registers.
+  static void promoteGlobalVariablesInLoops(AsmFunction& asm_function,
+                                            FunctionContext& function_context);
+
+  // Remove the memory accesses that are not needed: a load of a word stored or loaded
+  // before on every path, while its value is still in the register, becomes a copy, and a
+  // store overwritten before being read is removed. The calls and the stores through
+  // pointers are taken into account with the mod/ref summaries and the provenance of the
+  // addresses.
+  static void optimizeMemoryAccesses(AsmFunction& asm_function,
+                                     const FunctionContext& function_context);
+
+  // Turn the calls followed by a branch to the tail call label of the function into
+  // jumps (see AsmLine::isTailCall), so that the callee returns directly to the caller.
+  // The other branches to the label, e.g. after a call that was inlined, go to the
+  // epilogue. Runs before shrinkWrap, which releases the stack frame before the jumps.
+  static void eliminateTailCalls(AsmFunction& asm_function,
+                                 const FunctionContext& function_context);
+
+  // Insert the prologue only on the paths that need the stack frame (calls, locals,
+  // callee saved registers), so that e.g. the base case of a recursive function returns
+  // without setting up a frame. Returns:
+  // - "full":    the prologue is executed on every path.
+  // - "partial": the paths without the prologue branch to fast_epilogue_label, where the
+  //              function returns without restoring anything.
+  // - "none":    no path needs the stack frame, the prologue is not inserted.
+  // The arguments homed in the caller's frame are read from $sp on the paths without the
+  // prologue. The tail calls on the paths with the prologue are preceded by
+  // frame_teardown.
+  static std::string shrinkWrap(AsmFunction& asm_function,
+                                const FunctionContext& function_context,
+                                const std::string& prologue,
+                                const std::string& frame_teardown,
+                                const std::string& fast_epilogue_label);
+
+  // Simplify the control flow of the body and lay out its blocks:
+  // - a branch to a jump, or to a test whose outcome is known on the way (e.g. the value
+  //   of && tested again by the if statement), goes directly to where it ends up, and a
+  //   test whose outcome is known is removed;
+  // - the branches to the next line, and the nops after the branches, are removed, and a
+  //   conditional branch over a jump is inverted to go to its target;
+  // - a conditional branch in a loop falling through into a path leaving it (an early
+  //   return or a break), which is unlikely, is inverted, and the path moved after the
+  //   loop, so that the loop falls through its likely path;
+  // - a block entered only by jumps is placed after one of them, the one in the deepest
+  //   loop, and the jump removed, merging the straight-line code.
+  // Runs last, after shrinkWrap.
+  static void optimizeBranches(AsmFunction& asm_function,
+                               const FunctionContext& function_context);
+
+  // The body reads $gp, other than for passing it to a call or a tail call.
+  static bool usesGlobalPointer(const AsmFunction& asm_function);
+};
+
+#endif
@@ -2,8 +2,64 @@
 #define compiler_hpp
 
 #include <string>
+#include <vector>
+
+// Options controlling the generated code, set from the command line.
+class CompilerOptions {
+ public:
+  // -fomit-frame-pointer: address the stack frame from $sp, and use $fp as a general
+  // callee saved register.
+  bool omit_frame_pointer = false;
+  // -fwhole-program: the source file is the whole program, its global variables are not
+  // written by other files. Global variables that are never written are placed in
+  // .rodata and their value is used as a constant. The functions and global variables
+  // that cannot be reached from main or from the exported symbols are not emitted.
+  bool whole_program = false;
+  // -fexport=NAME[,NAME...]: with -fwhole-program, symbols used by other files, kept
+  // together with what they reach. Exported global variables may be written by other
+  // files.
+  std::vector<std::string> exported_symbols;
+  // Loops with a small constant trip count are fully unrolled, unless -fno-unroll-loops
+  // is given.
+  bool unroll_small_loops = true;
+  // -funroll-loops: also unroll counted loops whose trip count is not known at compile
+  // time, by unroll_factor, followed by the rolled loop for the remaining iterations.
+  // Larger loops are fully unrolled too.
+  bool unroll_loops = false;
+  // -funroll-factor=N: number of copies of the body in a partially unrolled loop.
+  int unroll_factor = 4;
+  // -fno-inline: do not inline function calls.
+  bool inline_functions = true;
+  // -fno-optimize-sibling-calls: keep tail calls as calls. By default, a recursive tail
+  // call becomes a jump to the start of the body, and other tail calls reuse the frame of
+  // the caller.
+  bool optimize_sibling_calls = true;
+  // -fno-if-conversion: keep the branches of conditional expressions and of if
+  // statements. By default, "c ? a : b" and "if (c) x = a; else x = b;" with cheap arms
+  // without side effects compute both arms and select the result without branching.
+  bool if_conversion = true;
+  // -march=mips1: the target has no conditional moves (movn, movz), selects are done with
+  // masks.
+  bool conditional_moves = true;
+  // -fopt-report: report on the standard error the optimization decisions, e.g. which
+  // calls are inlined.
+  bool opt_report = false;
+  // -fprofile-generate[=FILE]: count the executions of the functions, branches, loops and
+  // call sites, and write the counters to FILE when the program exits. FILE defaults to
+  // the source file name with the .profile extension.
+  bool profile_generate = false;
+  std::string profile_generate_file;
+  // -fprofile-use=FILE: the counts written by a run of the instrumented program guide the
+  // layout of the if statements, the inlining and the unrolling.
+  std::string profile_use_file;
+
+  // Set the option from a command line argument (e.g. "-fomit-frame-pointer"). Returns
+  // false if the argument is not a known option.
+  bool parseOption(const std::string& option);
+};
 
 int compile(const std::string& source_file_name,
-            const std::string& destination_file_name);
+            const std::string& destination_file_name,
+            const CompilerOptions& compiler_options);
 
 #endif
@@ -4,6 +4,7 @@
 #include "../../common/inc/ast.hpp"
 #include "../../common/inc/util.hpp"
 
+#include <map>
 #include <unordered_map>
 #include <unordered_set>
 #include <stack>
@@ -40,8 +41,43 @@ class CompilerUtil {
   static std::vector<std::string> getArgumentNamesFromFunctionDeclaration(
     const ArgumentListNode* argument_list_node);
   
-  // Evaluates a constant expression of integer.
+  // Evaluates a constant expression of integer. The calls to pure functions with constant
+  // arguments are evaluated by interpreting the callee (see PureFunctionEvaluator).
   static int evaluateConstantExpression(const Node* expr);
+
+  // Check wether an expression can be evaluated at compile time (see
+  // evaluateConstantExpression).
+  static bool isConstantExpression(const Node* expr);
+
+  // Returns the direct children of a node of the AST, in evaluation order.
+  static std::vector<const Node*> getChildren(const Node* ast_node);
+
+  // Check wether a function call appears anywhere in the subtree.
+  static bool containsFunctionCall(const Node* ast_node);
+
+  // Collect the ids of the variables that may be written in the subtree: assigned,
+  // incremented or decremented, declared (a local hiding a global is assumed to write
+  // it) or whose address is taken.
+  static void collectWrittenVariables(const Node* ast_node,
+                                      std::unordered_set<std::string>& ids);
+
+  // Count the references to each variable in the subtree.
+  static void countVariableReferences(const Node* ast_node,
+                                      std::unordered_map<std::string, int>& references);
+
+  // Collect the ids of the variables whose address is taken in the subtree.
+  static void collectAddressTakenVariables(const Node* ast_node,
+                                           std::unordered_set<std::string>& ids);
+
+  // Number of nodes in the subtree, used as an estimate of the size of its code.
+  static int countNodes(const Node* ast_node);
+
+  // Collect the ids of the functions called in the subtree, once per call.
+  static void collectFunctionCalls(const Node* ast_node, std::vector<std::string>& ids);
+
+  // Check wether a node of the given type (e.g. "BreakStatement") appears anywhere in
+  // the subtree.
+  static bool containsNodeOfType(const Node* ast_node, const std::string& type);
 };
 
 class RegisterAllocator {
@@ -49,9 +85,18 @@ class RegisterAllocator {
   // From $t0 to $t7.
   std::vector<bool> tmp_reg_used_;
   const int tmp_reg_size_ = 8;
+  // A trial allocator does not abort when the registers run out (see isExhausted).
+  bool is_trial_ = false;
+  bool is_exhausted_ = false;
  
  public:
   RegisterAllocator();
+  // Copy for a trial compilation, which may be thrown away: the same registers are in
+  // use, but when they run out, $t7 is handed out again instead of aborting, and freeing
+  // a register twice is ignored. If they do not run out, the code compiled with it is
+  // valid with this allocator, which then takes its state with commitTrial.
+  RegisterAllocator makeTrial() const;
+  void commitTrial(const RegisterAllocator& trial);
 
   // Returns a free register. Must be freed at the end of the usage.
   std::string requestFreeRegister();
@@ -59,6 +104,22 @@ class RegisterAllocator {
   void freeRegister(const std::string& reg);
   // Returns a vector of temporary registers currently used.
   std::vector<std::string> getTemporaryRegistersInUse();
+  int countFreeRegisters() const;
+  // A trial allocator ran out of registers: the code needs more than there are.
+  bool isExhausted() const;
+};
+
+// A function call whose callee is being compiled inline.
+class InlinedCall {
+ public:
+  // Index of the first scope of the callee, -1 while the arguments are computed. The
+  // scopes before it belong to the caller and are not visible from the callee.
+  int first_scope;
+  // A return statement leaves the result in the register and jumps to the label.
+  std::string return_label;
+  std::string return_register;
+  // Offsets of the stack frame used before the call.
+  std::unordered_set<int> used_offsets;
 };
 
 class FunctionContext {
@@ -70,14 +131,43 @@ class FunctionContext {
   std::stack<std::string> continue_labels_;
   std::stack<std::string> default_labels_;
   std::string function_epilogue_label_;
+  std::string tail_call_label_;
+  std::string tail_recursion_label_;
+  // Register the stack frame is addressed from: $fp, or $sp if the frame pointer is
+  // omitted.
+  std::string frame_register_;
   int frame_size_; // In bytes.
-  const int word_length_ = 4;
-  const int call_arguments_size_ = 4 * word_length_; // 4 words.
+  static const int word_length_ = 4;
+  static const int call_arguments_size_ = 4 * word_length_; // 4 words.
+  // One word for each temporary register, used to preserve them across function calls.
+  // Placed just below the saved $fp.
+  static const int spill_area_size_ = 8 * word_length_;
+  int spill_area_offset_;
+  // Offsets of the words of the local arrays, accessed from a base address.
+  std::unordered_set<int> array_offsets_;
+  // Callee saved registers used by the function, with the offset where they are saved.
+  std::vector<std::pair<std::string, int>> callee_saved_registers_;
+  // Inlined calls being compiled, the innermost last.
+  std::vector<InlinedCall> inlined_calls_;
+  // Code of the paths run rarely, placed after the body of the function.
+  std::string out_of_line_code_;
+
+  // Index of the outermost scope whose variables are visible.
+  int getFirstVisibleScope() const;
 
  public:
-  FunctionContext(int frame_size, const std::string& function_epilogue_label);
+  FunctionContext(int frame_size, const std::string& function_epilogue_label,
+                  const std::string& frame_register);
 
   const std::string& getFunctionEpilogueLabel() const;
+  // A tail call is followed by a branch to this label instead of the epilogue (see
+  // AsmOptimizer::eliminateTailCalls).
+  const std::string& getTailCallLabel() const;
+  // Start of the body, where a recursive tail call jumps once the arguments are updated.
+  const std::string& getTailRecursionLabel() const;
+  const std::string& getFrameRegister() const;
+  int getFrameSize() const;
+  bool isFramePointerOmitted() const;
   
   // Record loop labels in case of a break/continue statement.
   const std::string& getBreakLabel() const;
@@ -92,8 +182,24 @@ class FunctionContext {
                           const std::string& break_label);
   void removeSwitchLabels();
   void insertScope(const std::string& scope_id);
+  // Leave the innermost scope. The places in the stack frame of its variables are reused
+  // by the following ones.
   void removeScope();
 
+  // Start compiling an inlined call. A return statement of the callee leaves the result
+  // in the register and jumps to the label.
+  void insertInlinedCall(const std::string& return_label,
+                         const std::string& return_register);
+  // Once the arguments are computed, compile the body of the callee in the given scope,
+  // which hides the variables of the caller.
+  void insertInlinedCallScope(const std::string& scope_id);
+  // Stop compiling the inlined call. The places in the stack frame of the variables of the
+  // callee become free, to be used by the following variables.
+  void removeInlinedCall();
+  bool isCompilingInlinedCall() const;
+  const std::string& getInlinedReturnLabel() const;
+  const std::string& getInlinedReturnRegister() const;
+
   // Record the offset for a variable in the current stack frame. 
   int placeVariableInStack(const std::string& var_name, const std::string& scope_id,
                            const bool& is_declaration);
@@ -115,6 +221,24 @@ class FunctionContext {
   int getBaseOffsetForArray(const std::string& array_name);
 
   bool isLocalVariable(const std::string& id);
+
+  // Offset of the spill slot for a temporary register (e.g. $t3).
+  int getSpillOffsetForRegister(const std::string& reg) const;
+  bool isSpillOffset(int offset) const;
+  // The offset only holds scalar local variables, in any scope: it is not an argument, a
+  // spill slot, or part of an array.
+  bool isScalarVariableOffset(int offset) const;
+  // Temporary registers that have a spill slot.
+  std::vector<std::string> getSpillRegisters() const;
+
+  // Record a callee saved register to be saved in the prologue and restored in the
+  // epilogue.
+  void addCalleeSavedRegister(const std::string& reg, int offset);
+  const std::vector<std::pair<std::string, int>>& getCalleeSavedRegisters() const;
+
+  // Move code out of the way of the hot paths. It must end with a branch.
+  void addOutOfLineCode(const std::string& code);
+  const std::string& getOutOfLineCode() const;
 };
 
 class GlobalVariables {
@@ -123,17 +247,213 @@ class GlobalVariables {
   // "a" --> "normal"    (say declared as: int a = 2;)
   // "b" --> "array"
   std::unordered_map<std::string, std::string> id_to_info_;
+  // Maps global variables id to their size in bytes.
+  std::unordered_map<std::string, int> id_to_size_;
+  // Global variables placed in .rodata.
+  std::unordered_set<std::string> read_only_ids_;
  
  public:
-  void addNewGlobalVariable(const std::string& id, const std::string& info);
+  // Global variables up to this size are placed in the small data sections (.sdata and
+  // .sbss) and accessed relative to $gp, as with gcc -G 8.
+  static const int SMALL_DATA_MAX_SIZE = 8;
+
+  void addNewGlobalVariable(const std::string& id, const std::string& info,
+                            int size_in_bytes);
 
   bool isGlobalVariable(const std::string& id) const;
 
+  // The variable is never written, hence it is placed in .rodata.
+  void markReadOnly(const std::string& id);
+  bool isReadOnly(const std::string& id) const;
+
+  // The variable is addressed as %gp_rel(id)($gp). Read only variables are not small data.
+  bool isSmallData(const std::string& id) const;
+
   const std::string& getInfoForVariable(const std::string& id) const;
 
   const std::vector<std::string> getAllGlobalVariableIds() const;
 };
 
+// Identifiers with a value known at compile time: enumerators and, when compiling the
+// whole program, global variables that are never written. Their value is used as an
+// immediate instead of being loaded from memory.
+class CompileTimeConstants {
+ private:
+  std::unordered_map<std::string, int> id_to_value_;
+
+ public:
+  void addNewConstant(const std::string& id, int value);
+
+  // Forget a constant, e.g. the counter of a fully unrolled loop once its body has been
+  // compiled.
+  void removeConstant(const std::string& id);
+
+  bool isConstant(const std::string& id) const;
+
+  int getValueOfConstant(const std::string& id) const;
+};
+
+// Compile time constants of the translation unit.
+extern CompileTimeConstants compile_time_constants;
+
+// Functions defined in the translation unit and the calls between them, used to decide
+// which calls are inlined.
+class CallGraph {
+ private:
+  std::unordered_map<std::string, const FunctionDefinition*> id_to_definition_;
+  // Functions called by each function, once per call.
+  std::unordered_map<std::string, std::vector<std::string>> id_to_callees_;
+  // Number of calls to each function in the translation unit.
+  std::unordered_map<std::string, int> id_to_calls_;
+  // Functions that can call themselves, directly or not.
+  std::unordered_set<std::string> recursive_ids_;
+
+ public:
+  void addFunctionDefinition(const FunctionDefinition* function_definition);
+
+  // Find the recursive functions. To be called once all the definitions are added.
+  void findRecursiveFunctions();
+
+  // Returns nullptr if the function is not defined in the translation unit.
+  const FunctionDefinition* getFunctionDefinition(const std::string& id) const;
+
+  bool isRecursive(const std::string& id) const;
+
+  int countCalls(const std::string& id) const;
+
+  // Functions called by the function, once per call. Empty if it is not defined in the
+  // translation unit.
+  const std::vector<std::string>& getCallees(const std::string& id) const;
+};
+
+// Call graph of the translation unit.
+extern CallGraph call_graph;
+
+// Memory read and written by a function, including by the functions it calls.
+class ModRefSummary {
+ public:
+  std::unordered_set<std::string> read_globals;
+  std::unordered_set<std::string> written_globals;
+  // Memory accessed through pointers: the global variables a pointer may point to (see
+  // ModRefSummaries::mayPointTo), and the local variables of the callers.
+  bool reads_through_pointers = false;
+  bool writes_through_pointers = false;
+  // Calls a function not defined in the translation unit, which may access any memory.
+  bool is_unknown = false;
+};
+
+// Flow insensitive points-to and mod/ref analysis of the translation unit.
+class ModRefSummaries {
+ private:
+  std::unordered_map<std::string, ModRefSummary> id_to_summary_;
+  // Global variables whose address is taken, and which a pointer may hence point to.
+  std::unordered_set<std::string> pointed_globals_;
+  // Without the whole program, other files may take the address of any global variable.
+  bool all_globals_pointed_ = true;
+
+ public:
+  // Compute the summaries bottom-up over the call graph. To be called once the call
+  // graph, the global variables and the declared only functions are known.
+  void analyze(const std::vector<const FunctionDefinition*>& function_definitions,
+               const GlobalVariables& global_variables, bool whole_program,
+               const std::vector<std::string>& exported_symbols);
+
+  // Summary of a call to the function. Unknown if the function is not defined in the
+  // translation unit.
+  const ModRefSummary& getSummary(const std::string& id) const;
+
+  bool mayPointTo(const std::string& global_id) const;
+
+  // Make every function of the translation unit read and write the global variable, e.g.
+  // the profile counters incremented by the instrumented code (see ExecutionProfile).
+  void addGlobalAccessedByAllFunctions(const std::string& global_id);
+};
+
+// Mod/ref summaries of the functions of the translation unit.
+extern ModRefSummaries mod_ref_summaries;
+
+// Compile time evaluation of the calls to pure functions with constant arguments, e.g.
+// fib(20): the body of the callee is interpreted. A function is pure if it writes no global
+// variable and nothing through pointers (see ModRefSummaries), and reads no global
+// variable that is not a compile time constant. The evaluation gives up on what it does
+// not model (pointers, arrays, undefined behaviour) and past a budget of steps, in which
+// case the call is left to run time.
+class PureFunctionEvaluator {
+ private:
+  std::unordered_map<std::string, const FunctionDefinition*> id_to_definition_;
+  // The enumerators and read only global variables, without the counters of the loops
+  // being unrolled in the caller.
+  CompileTimeConstants global_constants_;
+  // Result of each call already evaluated, by callee and arguments. False if it cannot be
+  // evaluated.
+  std::map<std::pair<std::string, std::vector<int>>, std::pair<bool, int>> results_;
+
+ public:
+  // Find the pure functions. To be called once the mod/ref summaries and the global
+  // constants are known.
+  void analyze(const std::vector<const FunctionDefinition*>& function_definitions);
+
+  // Returns false if the call cannot be evaluated at compile time.
+  bool evaluateCall(const FunctionCall* function_call, int& result);
+
+  const FunctionDefinition* getPureFunction(const std::string& id) const;
+
+  const CompileTimeConstants& getGlobalConstants() const;
+};
+
+// Pure functions of the translation unit.
+extern PureFunctionEvaluator pure_function_evaluator;
+
+// First word of a profile file, "PROF" in ASCII, followed by the number of counters, the
+// checksum of the source (see ExecutionProfile) and the counters, all big endian words.
+#define PROFILE_MAGIC 0x50524f46
+#define PROFILE_HEADER_WORDS 3
+
+// Execution counts of the translation unit, written by a run of the program compiled with
+// -fprofile-generate and read back with -fprofile-use. The counters are numbered in the
+// order of the AST, hence both builds of the same source agree on them. A function has one
+// counter for its calls, an if statement one for its executions and one for its then arm,
+// a loop one for its entries and one for its iterations, and a call site one for its
+// executions. Inlined and unrolled copies of a node share its counters.
+class ExecutionProfile {
+ private:
+  // Index of the first counter of each instrumented node.
+  std::unordered_map<const Node*, int> node_to_counter_;
+  int counters_size_ = 0;
+  // Hash of the instrumented nodes, to reject the profile of another source.
+  unsigned int checksum_ = 2166136261u;
+  // Counts read from the profile file, empty if there is none.
+  std::vector<unsigned int> counts_;
+  unsigned int max_count_ = 0;
+
+ public:
+  // Number the counters of the functions of the translation unit.
+  void analyze(const std::vector<const FunctionDefinition*>& function_definitions);
+
+  // Index of a counter of the node: 0 for the first one, 1 for the second one (e.g. the
+  // then arm of an if statement). -1 if the node has no counters.
+  int getCounter(const Node* node, int which) const;
+
+  int countCounters() const;
+
+  unsigned int getChecksum() const;
+
+  // Read the counts written by the instrumented program. Returns false, with the reason,
+  // if the file cannot be read or was written for another source.
+  bool load(const std::string& file_name, std::string& error);
+
+  bool hasCounts() const;
+
+  // Count of a counter of the node (see getCounter), or -1 if it is not known.
+  long long getCount(const Node* node, int which) const;
+
+  // A count is hot if it is a significant fraction of the largest count of the profile.
+  bool isHot(long long count) const;
+};
+
+// Profile of the translation unit.
+extern ExecutionProfile execution_profile;
+
 class FunctionDeclarations {
  private:
   std::unordered_set<std::string> ids_;
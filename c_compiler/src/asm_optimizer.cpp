@@ -0,0 +1,3736 @@
+#include "../inc/asm_optimizer.hpp"
+
+#include <sstream>
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <functional>
+#include <map>
+#include <set>
+#include <tuple>
+
+// AsmLine.
+
+namespace {
+
+std::string trim(const std::string& str) {
+  size_t first = str.find_first_not_of(" \t\r\n");
+  if (first == std::string::npos) {
+    return "";
+  }
+  size_t last = str.find_last_not_of(" \t\r\n");
+  return str.substr(first, last - first + 1);
+}
+
+bool isRegister(const std::string& operand) {
+  return !operand.empty() && operand[0] == '$';
+}
+
+const std::unordered_set<std::string> THREE_REGISTERS_OPCODES = {
+  "addu", "add", "subu", "sub", "and", "or", "xor", "nor", "slt", "sltu", "sllv", "srlv",
+  "srav", "mul"
+};
+const std::unordered_set<std::string> IMMEDIATE_OPCODES = {
+  "addiu", "addi", "andi", "ori", "xori", "slti", "sltiu", "sll", "srl", "sra"
+};
+const std::unordered_set<std::string> MOVE_OPCODES = {"move", "not", "negu", "neg"};
+const std::unordered_set<std::string> LOAD_IMMEDIATE_OPCODES = {"li", "lui", "la"};
+const std::unordered_set<std::string> MULT_DIV_OPCODES = {"mult", "multu", "div", "divu"};
+const std::unordered_set<std::string> TWO_REGISTERS_BRANCH_OPCODES = {"beq", "bne"};
+const std::unordered_set<std::string> ONE_REGISTER_BRANCH_OPCODES = {
+  "beqz", "bnez", "blez", "bgtz", "bltz", "bgez"
+};
+
+// Registers that a function call may overwrite.
+const std::vector<std::string> CALLER_SAVED_REGISTERS = {
+  "$at", "$v0", "$v1", "$a0", "$a1", "$a2", "$a3", "$t0", "$t1", "$t2", "$t3", "$t4",
+  "$t5", "$t6", "$t7", "$t8", "$t9", "$ra", "$hi", "$lo"
+};
+
+// Registers that must hold a meaningful value when leaving the function.
+const std::vector<std::string> EXIT_REGISTERS = {
+  "$v0", "$v1", "$sp", "$fp", "$ra", "$gp", "$s0", "$s1", "$s2", "$s3", "$s4", "$s5",
+  "$s6", "$s7"
+};
+
+const std::vector<std::string> ALL_REGISTERS = {
+  "$at", "$v0", "$v1", "$a0", "$a1", "$a2", "$a3", "$t0", "$t1", "$t2", "$t3", "$t4",
+  "$t5", "$t6", "$t7", "$s0", "$s1", "$s2", "$s3", "$s4", "$s5", "$s6", "$s7", "$t8",
+  "$t9", "$k0", "$k1", "$gp", "$sp", "$fp", "$ra", "$hi", "$lo"
+};
+
+const std::string NO_OPERAND = "";
+
+} // namespace
+
+AsmLine AsmLine::makeInstruction(const std::string& opcode,
+                                 const std::vector<std::string>& operands,
+                                 const std::string& comment) {
+  AsmLine line;
+  line.kind_ = "instruction";
+  line.opcode_ = opcode;
+  line.operands_ = operands;
+  line.comment_ = comment;
+  return line;
+}
+
+AsmLine AsmLine::makeLabel(const std::string& label) {
+  AsmLine line;
+  line.kind_ = "label";
+  line.label_ = label;
+  return line;
+}
+
+AsmLine AsmLine::makeOther(const std::string& text) {
+  AsmLine line;
+  line.kind_ = "other";
+  line.text_ = text;
+  return line;
+}
+
+std::vector<AsmLine> AsmLine::parse(const std::string& text) {
+  std::vector<AsmLine> lines;
+  std::string line = trim(text);
+
+  if (line.empty() || line[0] == '#' || line[0] == '.') {
+    // Comment, directive or empty line.
+    lines.push_back(makeOther(text));
+    return lines;
+  }
+
+  // Label definition, possibly followed by an instruction.
+  size_t colon = line.find(':');
+  size_t first_space = line.find_first_of(" \t");
+  if (colon != std::string::npos && (first_space == std::string::npos ||
+                                     colon < first_space)) {
+    lines.push_back(makeLabel(line.substr(0, colon)));
+    line = trim(line.substr(colon + 1));
+    if (line.empty()) {
+      return lines;
+    }
+    if (line[0] == '#') {
+      lines.push_back(makeOther(line));
+      return lines;
+    }
+  }
+
+  // Instruction: opcode operand1, operand2, ... # comment.
+  std::string comment;
+  bool has_comment = false;
+  size_t hash = line.find('#');
+  if (hash != std::string::npos) {
+    comment = line.substr(hash + 1);
+    has_comment = true;
+    line = trim(line.substr(0, hash));
+  }
+  size_t opcode_end = line.find_first_of(" \t");
+  std::string opcode = line.substr(0, opcode_end);
+  std::vector<std::string> operands;
+  if (opcode_end != std::string::npos) {
+    std::stringstream operands_stream(line.substr(opcode_end));
+    std::string operand;
+    while (std::getline(operands_stream, operand, ',')) {
+      operands.push_back(trim(operand));
+    }
+  }
+  AsmLine instruction = makeInstruction(opcode, operands, comment);
+  // Keep the original text, so that unchanged instructions are printed as they were.
+  if (lines.empty()) {
+    instruction.text_ = text;
+  } else {
+    instruction.text_ = line + (has_comment ? "\t#" + comment : "");
+  }
+  lines.push_back(instruction);
+  return lines;
+}
+
+const std::string& AsmLine::getKind() const {
+  return kind_;
+}
+
+bool AsmLine::isInstruction() const {
+  return kind_ == "instruction";
+}
+
+bool AsmLine::isLabel() const {
+  return kind_ == "label";
+}
+
+const std::string& AsmLine::getLabel() const {
+  return label_;
+}
+
+const std::string& AsmLine::getOpcode() const {
+  return opcode_;
+}
+
+const std::vector<std::string>& AsmLine::getOperands() const {
+  return operands_;
+}
+
+const std::string& AsmLine::getOperand(int index) const {
+  if (index < 0 || index >= (int)operands_.size()) {
+    return NO_OPERAND;
+  }
+  return operands_[index];
+}
+
+void AsmLine::setOperand(int index, const std::string& operand) {
+  operands_[index] = operand;
+  text_.clear();
+}
+
+const std::string& AsmLine::getComment() const {
+  return comment_;
+}
+
+std::vector<std::string> AsmLine::getUsedRegisters() const {
+  std::vector<std::string> used;
+  if (!isInstruction()) {
+    return used;
+  }
+
+  if (THREE_REGISTERS_OPCODES.count(opcode_) || IMMEDIATE_OPCODES.count(opcode_) ||
+      MOVE_OPCODES.count(opcode_)) {
+    for (unsigned int i = 1; i < operands_.size(); i++) {
+      if (isRegister(operands_[i])) {
+        used.push_back(AsmOptimizer::canonicalRegister(operands_[i]));
+      }
+    }
+  }
+  else if (opcode_ == "movn" || opcode_ == "movz") {
+    // Conditional move: the destination keeps its value if the condition fails.
+    for (const std::string& operand : operands_) {
+      used.push_back(AsmOptimizer::canonicalRegister(operand));
+    }
+  }
+  else if (MULT_DIV_OPCODES.count(opcode_) || TWO_REGISTERS_BRANCH_OPCODES.count(opcode_) ||
+           ONE_REGISTER_BRANCH_OPCODES.count(opcode_)) {
+    for (const std::string& operand : operands_) {
+      if (isRegister(operand)) {
+        used.push_back(AsmOptimizer::canonicalRegister(operand));
+      }
+    }
+  }
+  else if (opcode_ == "mflo") {
+    used.push_back("$lo");
+  }
+  else if (opcode_ == "mfhi") {
+    used.push_back("$hi");
+  }
+  else if (opcode_ == "lw") {
+    used.push_back(getBaseRegister());
+  }
+  else if (opcode_ == "sw") {
+    used.push_back(AsmOptimizer::canonicalRegister(operands_[0]));
+    used.push_back(getBaseRegister());
+  }
+  else if (opcode_ == "jal" || (opcode_ == "j" && !isIndirectJump())) {
+    used = {"$a0", "$a1", "$a2", "$a3", "$gp", "$sp"};
+  }
+  else if (opcode_ == "jalr" || isIndirectJump()) {
+    used = {"$a0", "$a1", "$a2", "$a3", "$gp", "$sp"};
+    used.push_back(AsmOptimizer::canonicalRegister(operands_.back()));
+  }
+  else if (isUnknown()) {
+    used = ALL_REGISTERS;
+  }
+  return used;
+}
+
+std::vector<std::string> AsmLine::getDefinedRegisters() const {
+  std::vector<std::string> defined;
+  if (!isInstruction()) {
+    return defined;
+  }
+
+  if (THREE_REGISTERS_OPCODES.count(opcode_) || IMMEDIATE_OPCODES.count(opcode_) ||
+      MOVE_OPCODES.count(opcode_) || LOAD_IMMEDIATE_OPCODES.count(opcode_) ||
+      opcode_ == "movn" || opcode_ == "movz" || opcode_ == "mflo" || opcode_ == "mfhi" ||
+      opcode_ == "lw") {
+    defined.push_back(AsmOptimizer::canonicalRegister(operands_[0]));
+  }
+  else if (MULT_DIV_OPCODES.count(opcode_)) {
+    defined = {"$hi", "$lo"};
+  }
+  else if (isCall()) {
+    defined = CALLER_SAVED_REGISTERS;
+  }
+  return defined;
+}
+
+bool AsmLine::isBranch() const {
+  if (!isInstruction()) {
+    return false;
+  }
+  return opcode_ == "b" || (opcode_ == "j" && !isRegister(getOperand(0))) ||
+         TWO_REGISTERS_BRANCH_OPCODES.count(opcode_) ||
+         ONE_REGISTER_BRANCH_OPCODES.count(opcode_);
+}
+
+bool AsmLine::isConditionalBranch() const {
+  return isBranch() && opcode_ != "b" && opcode_ != "j";
+}
+
+const std::string& AsmLine::getBranchTarget() const {
+  return operands_.back();
+}
+
+void AsmLine::setBranchTarget(const std::string& label) {
+  operands_.back() = label;
+  text_.clear();
+}
+
+bool AsmLine::isCall() const {
+  return isInstruction() && (opcode_ == "jal" || opcode_ == "jalr");
+}
+
+bool AsmLine::isIndirectJump() const {
+  return isInstruction() && (opcode_ == "jr" ||
+                             (opcode_ == "j" && isRegister(getOperand(0))));
+}
+
+bool AsmLine::isTailCall() const {
+  return isInstruction() &&
+         ((opcode_ == "j" && !isRegister(getOperand(0))) ||
+          (opcode_ == "jr" && AsmOptimizer::canonicalRegister(getOperand(0)) == "$t9"));
+}
+
+bool AsmLine::endsBlock() const {
+  return isBranch() || isIndirectJump();
+}
+
+bool AsmLine::hasFallThrough() const {
+  return !(isIndirectJump() || (isBranch() && !isConditionalBranch()));
+}
+
+bool AsmLine::isUnknown() const {
+  if (!isInstruction()) {
+    return false;
+  }
+  return !(THREE_REGISTERS_OPCODES.count(opcode_) || IMMEDIATE_OPCODES.count(opcode_) ||
+           MOVE_OPCODES.count(opcode_) || LOAD_IMMEDIATE_OPCODES.count(opcode_) ||
+           MULT_DIV_OPCODES.count(opcode_) || opcode_ == "movn" || opcode_ == "movz" ||
+           opcode_ == "mflo" || opcode_ == "mfhi" || opcode_ == "lw" || opcode_ == "sw" ||
+           opcode_ == "nop" || isBranch() || isCall() || isIndirectJump());
+}
+
+bool AsmLine::isLoad() const {
+  return isInstruction() && opcode_ == "lw";
+}
+
+bool AsmLine::isStore() const {
+  return isInstruction() && opcode_ == "sw";
+}
+
+const std::string& AsmLine::getMemoryOperand() const {
+  return operands_[1];
+}
+
+std::string AsmLine::getBaseRegister() const {
+  const std::string& memory_operand = getMemoryOperand();
+  size_t open = memory_operand.rfind('(');
+  size_t close = memory_operand.rfind(')');
+  return AsmOptimizer::canonicalRegister(
+    trim(memory_operand.substr(open + 1, close - open - 1)));
+}
+
+bool AsmLine::getConstantOffset(int& offset) const {
+  const std::string& memory_operand = getMemoryOperand();
+  std::string offset_string = trim(memory_operand.substr(0, memory_operand.rfind('(')));
+  if (offset_string.empty()) {
+    offset = 0;
+    return true;
+  }
+  size_t start = (offset_string[0] == '-') ? 1 : 0;
+  if (start == offset_string.size() ||
+      offset_string.find_first_not_of("0123456789", start) != std::string::npos) {
+    return false;
+  }
+  offset = std::stoi(offset_string);
+  return true;
+}
+
+bool AsmLine::replaceUsedRegister(const std::string& from, const std::string& to) {
+  std::vector<std::string> used = getUsedRegisters();
+  if (std::find(used.begin(), used.end(), from) == used.end()) {
+    return true;
+  }
+  if (opcode_ == "movn" || opcode_ == "movz" || isUnknown() || isCall() ||
+      isIndirectJump()) {
+    return false;
+  }
+
+  unsigned int first_used_operand = 0;
+  if (THREE_REGISTERS_OPCODES.count(opcode_) || IMMEDIATE_OPCODES.count(opcode_) ||
+      MOVE_OPCODES.count(opcode_)) {
+    first_used_operand = 1;
+  }
+  if (isLoad() || isStore()) {
+    if (getBaseRegister() == from) {
+      std::string& memory_operand = operands_[1];
+      memory_operand = memory_operand.substr(0, memory_operand.rfind('(')) + "(" + to + ")";
+    }
+    if (isStore() && AsmOptimizer::canonicalRegister(operands_[0]) == from) {
+      operands_[0] = to;
+    }
+  } else {
+    for (unsigned int i = first_used_operand; i < operands_.size(); i++) {
+      if (isRegister(operands_[i]) &&
+          AsmOptimizer::canonicalRegister(operands_[i]) == from) {
+        operands_[i] = to;
+      }
+    }
+  }
+  text_.clear();
+  return true;
+}
+
+bool AsmLine::replaceDefinedRegister(const std::string& to) {
+  std::vector<std::string> defined = getDefinedRegisters();
+  if (defined.size() != 1 || operands_.empty() || opcode_ == "movn" || opcode_ == "movz" ||
+      AsmOptimizer::canonicalRegister(operands_[0]) != defined[0]) {
+    return false;
+  }
+  operands_[0] = to;
+  text_.clear();
+  return true;
+}
+
+bool AsmLine::hasNoSideEffects() const {
+  if (!isInstruction() || getDefinedRegisters().empty()) {
+    return false;
+  }
+  return THREE_REGISTERS_OPCODES.count(opcode_) || IMMEDIATE_OPCODES.count(opcode_) ||
+         MOVE_OPCODES.count(opcode_) || LOAD_IMMEDIATE_OPCODES.count(opcode_) ||
+         opcode_ == "mflo" || opcode_ == "mfhi" || opcode_ == "lw";
+}
+
+std::string AsmLine::toString() const {
+  if (!text_.empty()) {
+    return text_;
+  }
+  if (kind_ == "label") {
+    return label_ + ":";
+  }
+  std::string result = opcode_;
+  for (unsigned int i = 0; i < operands_.size(); i++) {
+    result += (i == 0 ? "\t " : ", ") + operands_[i];
+  }
+  if (!comment_.empty()) {
+    result += "\t#" + comment_;
+  }
+  return result;
+}
+
+// AsmFunction.
+
+AsmFunction::AsmFunction(const std::string& text) {
+  std::stringstream text_stream(text);
+  std::string line;
+  while (std::getline(text_stream, line)) {
+    for (const AsmLine& asm_line : AsmLine::parse(line)) {
+      lines_.push_back(asm_line);
+    }
+  }
+  buildControlFlowGraph();
+}
+
+std::vector<AsmLine>& AsmFunction::getLines() {
+  return lines_;
+}
+
+const std::vector<AsmLine>& AsmFunction::getLines() const {
+  return lines_;
+}
+
+void AsmFunction::buildControlFlowGraph() {
+  blocks_.clear();
+  line_to_block_ = std::vector<int>(lines_.size(), -1);
+
+  // Split in blocks: a block starts at a label or after a branch.
+  std::unordered_map<std::string, int> label_to_block;
+  bool start_new_block = true;
+  for (unsigned int i = 0; i < lines_.size(); i++) {
+    if (lines_[i].isLabel() && !blocks_.empty() && blocks_.back().first != (int)i) {
+      // Consecutive labels at the beginning of a block belong to the same block.
+      bool only_labels = true;
+      for (int j = blocks_.back().first; j < (int)i; j++) {
+        if (!lines_[j].isLabel()) {
+          only_labels = false;
+        }
+      }
+      if (!only_labels) {
+        start_new_block = true;
+      }
+    }
+    if (start_new_block) {
+      BasicBlock block;
+      block.first = i;
+      block.is_exit = false;
+      blocks_.push_back(block);
+      start_new_block = false;
+    }
+    blocks_.back().last = i;
+    line_to_block_[i] = blocks_.size() - 1;
+    if (lines_[i].isLabel()) {
+      label_to_block[lines_[i].getLabel()] = blocks_.size() - 1;
+    }
+    if (lines_[i].endsBlock()) {
+      start_new_block = true;
+    }
+  }
+
+  // Connect the blocks.
+  for (unsigned int b = 0; b < blocks_.size(); b++) {
+    BasicBlock& block = blocks_[b];
+    const AsmLine* last_instruction = nullptr;
+    for (int i = block.last; i >= block.first; i--) {
+      if (lines_[i].isInstruction()) {
+        last_instruction = &lines_[i];
+        break;
+      }
+    }
+    bool falls_through = true;
+    if (last_instruction != nullptr && last_instruction->endsBlock()) {
+      falls_through = last_instruction->hasFallThrough();
+      if (last_instruction->isBranch()) {
+        auto target = label_to_block.find(last_instruction->getBranchTarget());
+        if (target != label_to_block.end()) {
+          block.successors.push_back(target->second);
+        } else {
+          // Branch outside of the body (e.g. to the epilogue).
+          block.is_exit = true;
+        }
+      } else {
+        block.is_exit = true;
+      }
+    }
+    if (falls_through) {
+      if (b + 1 < blocks_.size()) {
+        if (std::find(block.successors.begin(), block.successors.end(), b + 1) ==
+            block.successors.end()) {
+          block.successors.push_back(b + 1);
+        }
+      } else {
+        block.is_exit = true;
+      }
+    }
+  }
+  for (unsigned int b = 0; b < blocks_.size(); b++) {
+    for (int successor : blocks_[b].successors) {
+      blocks_[successor].predecessors.push_back(b);
+    }
+  }
+}
+
+const std::vector<BasicBlock>& AsmFunction::getBlocks() const {
+  return blocks_;
+}
+
+int AsmFunction::getBlockOfLine(int line) const {
+  return line_to_block_[line];
+}
+
+int AsmFunction::getBlockOfLabel(const std::string& label) const {
+  for (unsigned int i = 0; i < lines_.size(); i++) {
+    if (lines_[i].isLabel() && lines_[i].getLabel() == label) {
+      return line_to_block_[i];
+    }
+  }
+  return -1;
+}
+
+void AsmFunction::removeLines(const std::vector<bool>& to_remove) {
+  std::vector<AsmLine> kept_lines;
+  for (unsigned int i = 0; i < lines_.size(); i++) {
+    if (!to_remove[i]) {
+      kept_lines.push_back(lines_[i]);
+    }
+  }
+  lines_ = kept_lines;
+  buildControlFlowGraph();
+}
+
+void AsmFunction::insertLines(int position, const std::vector<AsmLine>& lines) {
+  lines_.insert(lines_.begin() + position, lines.begin(), lines.end());
+  buildControlFlowGraph();
+}
+
+std::vector<bool> AsmFunction::getBlocksReachableFrom(int block) const {
+  std::vector<bool> reachable(blocks_.size(), false);
+  std::vector<int> to_visit = blocks_[block].successors;
+  while (!to_visit.empty()) {
+    int current = to_visit.back();
+    to_visit.pop_back();
+    if (reachable[current]) {
+      continue;
+    }
+    reachable[current] = true;
+    for (int successor : blocks_[current].successors) {
+      to_visit.push_back(successor);
+    }
+  }
+  return reachable;
+}
+
+std::vector<std::vector<bool>> AsmFunction::computeDominators() const {
+  int blocks_number = blocks_.size();
+  std::vector<std::vector<bool>> dominators(blocks_number);
+  if (blocks_number == 0) {
+    return dominators;
+  }
+  std::vector<bool> reachable = getBlocksReachableFrom(0);
+  reachable[0] = true;
+  for (int b = 0; b < blocks_number; b++) {
+    dominators[b] = std::vector<bool>(blocks_number, reachable[b] && b != 0);
+  }
+  dominators[0][0] = true;
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int b = 1; b < blocks_number; b++) {
+      if (!reachable[b]) {
+        continue;
+      }
+      // Intersection of the dominators of the reachable predecessors, plus the block.
+      std::vector<bool> new_dominators(blocks_number, true);
+      for (int predecessor : blocks_[b].predecessors) {
+        if (!reachable[predecessor]) {
+          continue;
+        }
+        for (int d = 0; d < blocks_number; d++) {
+          new_dominators[d] = new_dominators[d] && dominators[predecessor][d];
+        }
+      }
+      new_dominators[b] = true;
+      if (new_dominators != dominators[b]) {
+        dominators[b] = new_dominators;
+        changed = true;
+      }
+    }
+  }
+  return dominators;
+}
+
+std::vector<Loop> AsmFunction::findLoops() const {
+  std::vector<Loop> loops;
+  std::vector<std::vector<bool>> dominators = computeDominators();
+  int blocks_number = blocks_.size();
+  for (int header = 0; header < blocks_number; header++) {
+    Loop loop;
+    loop.header = header;
+    // Back edges: the header dominates their source.
+    for (int predecessor : blocks_[header].predecessors) {
+      if (dominators[predecessor][header]) {
+        loop.latches.push_back(predecessor);
+      }
+    }
+    if (loop.latches.empty()) {
+      continue;
+    }
+    // The blocks reaching a latch without going through the header.
+    loop.blocks = std::vector<bool>(blocks_number, false);
+    loop.blocks[header] = true;
+    std::vector<int> to_visit = loop.latches;
+    while (!to_visit.empty()) {
+      int current = to_visit.back();
+      to_visit.pop_back();
+      if (loop.blocks[current]) {
+        continue;
+      }
+      loop.blocks[current] = true;
+      for (int predecessor : blocks_[current].predecessors) {
+        to_visit.push_back(predecessor);
+      }
+    }
+    loops.push_back(loop);
+  }
+  std::stable_sort(loops.begin(), loops.end(), [](const Loop& a, const Loop& b) {
+    return std::count(a.blocks.begin(), a.blocks.end(), true) <
+           std::count(b.blocks.begin(), b.blocks.end(), true);
+  });
+  return loops;
+}
+
+int AsmFunction::getPreheaderPosition(const Loop& loop) const {
+  int position = blocks_[loop.header].first;
+  if (position == 0) {
+    return -1;
+  }
+  int previous_block = line_to_block_[position - 1];
+  if (loop.blocks[previous_block]) {
+    return -1;
+  }
+  for (int predecessor : blocks_[loop.header].predecessors) {
+    if (!loop.blocks[predecessor] && predecessor != previous_block) {
+      return -1;
+    }
+  }
+  // The previous line must really fall through: a nop in the delay slot of a jump does
+  // not.
+  int last = position - 1;
+  while (last >= 0 && !lines_[last].isInstruction()) {
+    last--;
+  }
+  if (last >= 0 && lines_[last].getOpcode() == "nop") {
+    int branch = last - 1;
+    while (branch >= 0 && !lines_[branch].isInstruction()) {
+      branch--;
+    }
+    if (branch >= 0 && lines_[branch].endsBlock()) {
+      last = branch;
+    }
+  }
+  if (last >= 0 && !lines_[last].hasFallThrough()) {
+    return -1;
+  }
+  return position;
+}
+
+void AsmFunction::removeUnreachableBlocks() {
+  if (blocks_.empty()) {
+    return;
+  }
+  std::vector<bool> reachable = getBlocksReachableFrom(0);
+  reachable[0] = true;
+  std::vector<bool> to_remove(lines_.size(), false);
+  bool removed = false;
+  for (unsigned int b = 0; b < blocks_.size(); b++) {
+    if (reachable[b]) {
+      continue;
+    }
+    for (int i = blocks_[b].first; i <= blocks_[b].last; i++) {
+      // Comments are kept.
+      if (lines_[i].isInstruction() || lines_[i].isLabel()) {
+        to_remove[i] = true;
+        removed = true;
+      }
+    }
+  }
+  if (removed) {
+    removeLines(to_remove);
+  }
+}
+
+void AsmFunction::print(std::ostream& os) const {
+  for (const AsmLine& line : lines_) {
+    os << line.toString() << std::endl;
+  }
+}
+
+// AsmOptimizer.
+
+const std::vector<std::string> AsmOptimizer::CALLEE_SAVED_REGISTERS = {
+  "$s0", "$s1", "$s2", "$s3", "$s4", "$s5", "$s6", "$s7"
+};
+
+std::string AsmOptimizer::canonicalRegister(const std::string& reg) {
+  static const std::vector<std::string> names = {
+    "$0", "$at", "$v0", "$v1", "$a0", "$a1", "$a2", "$a3", "$t0", "$t1", "$t2", "$t3",
+    "$t4", "$t5", "$t6", "$t7", "$s0", "$s1", "$s2", "$s3", "$s4", "$s5", "$s6", "$s7",
+    "$t8", "$t9", "$k0", "$k1", "$gp", "$sp", "$fp", "$ra"
+  };
+  if (reg == "$zero") {
+    return "$0";
+  }
+  if (reg == "$s8") {
+    return "$fp";
+  }
+  if (reg.size() > 1 && reg.find_first_not_of("0123456789", 1) == std::string::npos) {
+    int number = std::stoi(reg.substr(1));
+    if (number >= 0 && number < 32) {
+      return names[number];
+    }
+  }
+  return reg;
+}
+
+bool AsmOptimizer::isSpillAccess(const AsmLine& line,
+                                 const FunctionContext& function_context, int& offset) {
+  if (!line.isLoad() && !line.isStore()) {
+    return false;
+  }
+  return line.getBaseRegister() == function_context.getFrameRegister() &&
+         line.getConstantOffset(offset) &&
+         function_context.isSpillOffset(offset);
+}
+
+void AsmOptimizer::getLineUsesAndDefinitions(const AsmLine& line,
+                                             const FunctionContext& function_context,
+                                             std::vector<std::string>& uses,
+                                             std::vector<std::string>& definitions) {
+  uses = line.getUsedRegisters();
+  definitions = line.getDefinedRegisters();
+  int offset;
+  if (isSpillAccess(line, function_context, offset)) {
+    if (line.isLoad()) {
+      uses.push_back("slot:" + std::to_string(offset));
+    } else {
+      definitions.push_back("slot:" + std::to_string(offset));
+    }
+  }
+  else if (line.isUnknown()) {
+    for (const std::string& reg : function_context.getSpillRegisters()) {
+      uses.push_back("slot:" +
+                     std::to_string(function_context.getSpillOffsetForRegister(reg)));
+    }
+  }
+  // Writes to $0 are discarded.
+  definitions.erase(std::remove(definitions.begin(), definitions.end(), "$0"),
+                    definitions.end());
+  uses.erase(std::remove(uses.begin(), uses.end(), "$0"), uses.end());
+}
+
+std::vector<std::unordered_set<std::string>> AsmOptimizer::computeLiveOut(
+  const AsmFunction& asm_function, const FunctionContext& function_context) {
+  const std::vector<AsmLine>& lines = asm_function.getLines();
+  const std::vector<BasicBlock>& blocks = asm_function.getBlocks();
+
+  // Uses and definitions of each block.
+  std::vector<std::unordered_set<std::string>> block_uses(blocks.size());
+  std::vector<std::unordered_set<std::string>> block_definitions(blocks.size());
+  for (unsigned int b = 0; b < blocks.size(); b++) {
+    for (int i = blocks[b].last; i >= blocks[b].first; i--) {
+      std::vector<std::string> uses, definitions;
+      getLineUsesAndDefinitions(lines[i], function_context, uses, definitions);
+      for (const std::string& definition : definitions) {
+        block_uses[b].erase(definition);
+        block_definitions[b].insert(definition);
+      }
+      for (const std::string& use : uses) {
+        block_uses[b].insert(use);
+      }
+    }
+  }
+
+  // Iterate until a fixed point is reached.
+  std::vector<std::unordered_set<std::string>> block_live_in(blocks.size());
+  std::vector<std::unordered_set<std::string>> block_live_out(blocks.size());
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int b = blocks.size() - 1; b >= 0; b--) {
+      std::unordered_set<std::string> live_out;
+      if (blocks[b].is_exit) {
+        live_out.insert(EXIT_REGISTERS.begin(), EXIT_REGISTERS.end());
+      }
+      for (int successor : blocks[b].successors) {
+        live_out.insert(block_live_in[successor].begin(), block_live_in[successor].end());
+      }
+      std::unordered_set<std::string> live_in = block_uses[b];
+      for (const std::string& live : live_out) {
+        if (!block_definitions[b].count(live)) {
+          live_in.insert(live);
+        }
+      }
+      if (live_in.size() != block_live_in[b].size() ||
+          live_out.size() != block_live_out[b].size()) {
+        changed = true;
+      }
+      block_live_in[b] = live_in;
+      block_live_out[b] = live_out;
+    }
+  }
+
+  // Liveness after each line.
+  std::vector<std::unordered_set<std::string>> line_live_out(lines.size());
+  for (unsigned int b = 0; b < blocks.size(); b++) {
+    std::unordered_set<std::string> live = block_live_out[b];
+    for (int i = blocks[b].last; i >= blocks[b].first; i--) {
+      line_live_out[i] = live;
+      std::vector<std::string> uses, definitions;
+      getLineUsesAndDefinitions(lines[i], function_context, uses, definitions);
+      for (const std::string& definition : definitions) {
+        live.erase(definition);
+      }
+      live.insert(uses.begin(), uses.end());
+    }
+  }
+  return line_live_out;
+}
+
+bool AsmOptimizer::removeDeadSpills(AsmFunction& asm_function,
+                                    const FunctionContext& function_context) {
+  bool changed = false;
+  bool removed = true;
+  while (removed) {
+    removed = false;
+    std::vector<AsmLine>& lines = asm_function.getLines();
+    std::vector<std::unordered_set<std::string>> live_out =
+      computeLiveOut(asm_function, function_context);
+    std::vector<bool> to_remove(lines.size(), false);
+    for (unsigned int i = 0; i < lines.size(); i++) {
+      int offset;
+      if (!isSpillAccess(lines[i], function_context, offset)) {
+        continue;
+      }
+      // Restore of a register that is not used after the call.
+      if (lines[i].isLoad() &&
+          !live_out[i].count(canonicalRegister(lines[i].getOperand(0)))) {
+        to_remove[i] = true;
+        removed = true;
+      }
+      // Save of a register that is never restored.
+      if (lines[i].isStore() && !live_out[i].count("slot:" + std::to_string(offset))) {
+        to_remove[i] = true;
+        removed = true;
+      }
+    }
+    if (removed) {
+      asm_function.removeLines(to_remove);
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+bool AsmOptimizer::removeRedundantSpillStores(AsmFunction& asm_function,
+                                              const FunctionContext& function_context) {
+  const std::vector<AsmLine>& lines = asm_function.getLines();
+  std::vector<bool> to_remove(lines.size(), false);
+  bool removed = false;
+
+  for (const BasicBlock& block : asm_function.getBlocks()) {
+    // Spill slot --> register that holds the same value.
+    std::unordered_map<int, std::string> slot_to_register;
+    for (int i = block.first; i <= block.last; i++) {
+      int offset;
+      if (isSpillAccess(lines[i], function_context, offset)) {
+        std::string reg = canonicalRegister(lines[i].getOperand(0));
+        if (lines[i].isStore()) {
+          auto slot = slot_to_register.find(offset);
+          if (slot != slot_to_register.end() && slot->second == reg) {
+            // The slot already contains the value of the register.
+            to_remove[i] = true;
+            removed = true;
+            continue;
+          }
+        } else {
+          for (auto it = slot_to_register.begin(); it != slot_to_register.end();) {
+            it = (it->second == reg) ? slot_to_register.erase(it) : std::next(it);
+          }
+        }
+        slot_to_register[offset] = reg;
+        continue;
+      }
+      if (lines[i].isUnknown()) {
+        slot_to_register.clear();
+      }
+      for (const std::string& definition : lines[i].getDefinedRegisters()) {
+        for (auto it = slot_to_register.begin(); it != slot_to_register.end();) {
+          it = (it->second == definition) ? slot_to_register.erase(it) : std::next(it);
+        }
+      }
+    }
+  }
+
+  if (removed) {
+    asm_function.removeLines(to_remove);
+  }
+  return removed;
+}
+
+void AsmOptimizer::moveSpillsToCalleeSavedRegisters(AsmFunction& asm_function,
+                                                    FunctionContext& function_context) {
+  std::vector<AsmLine>& lines = asm_function.getLines();
+
+  // Callee saved registers not used in the function.
+  std::unordered_set<std::string> used_registers;
+  for (const AsmLine& line : lines) {
+    for (const std::string& operand : line.getOperands()) {
+      size_t dollar = operand.find('$');
+      if (dollar != std::string::npos) {
+        size_t end = operand.find_first_of(")", dollar);
+        used_registers.insert(canonicalRegister(operand.substr(dollar, end - dollar)));
+      }
+    }
+  }
+  std::vector<std::string> callee_saved_registers = CALLEE_SAVED_REGISTERS;
+  if (function_context.isFramePointerOmitted()) {
+    // $fp is a general callee saved register.
+    callee_saved_registers.push_back("$fp");
+  }
+  std::vector<std::string> free_registers;
+  for (const std::string& reg : callee_saved_registers) {
+    if (!used_registers.count(reg)) {
+      free_registers.push_back(reg);
+    }
+  }
+
+  for (const std::string& spilled_register : function_context.getSpillRegisters()) {
+    int spill_offset = function_context.getSpillOffsetForRegister(spilled_register);
+    std::vector<int> accesses;
+    int restores = 0;
+    for (unsigned int i = 0; i < lines.size(); i++) {
+      int offset;
+      if (isSpillAccess(lines[i], function_context, offset) && offset == spill_offset) {
+        accesses.push_back(i);
+        restores += lines[i].isLoad() ? 1 : 0;
+      }
+    }
+    // Worth it only if the value crosses several calls: the callee saved register is
+    // saved and restored once per function, while the spill slot once per call.
+    if (restores < 2 || free_registers.empty()) {
+      continue;
+    }
+    std::string callee_saved_register = free_registers.front();
+    free_registers.erase(free_registers.begin());
+    for (int i : accesses) {
+      std::string reg = lines[i].getOperand(0);
+      if (lines[i].isStore()) {
+        lines[i] = AsmLine::makeInstruction(
+          "move", {callee_saved_register, reg},
+          " Keep " + reg + " in a callee saved register.");
+      } else {
+        lines[i] = AsmLine::makeInstruction("move", {reg, callee_saved_register},
+                                            " Restore " + reg + " after the call.");
+      }
+    }
+    // The spill slot is not used anymore: use it to save the callee saved register.
+    function_context.addCalleeSavedRegister(callee_saved_register, spill_offset);
+  }
+  asm_function.buildControlFlowGraph();
+}
+
+void AsmOptimizer::optimizeCallerSavedRegisters(AsmFunction& asm_function,
+                                                FunctionContext& function_context) {
+  bool changed = true;
+  while (changed) {
+    changed = removeDeadSpills(asm_function, function_context);
+    changed = removeRedundantSpillStores(asm_function, function_context) || changed;
+  }
+  moveSpillsToCalleeSavedRegisters(asm_function, function_context);
+}
+
+namespace {
+
+bool isCopy(const AsmLine& line) {
+  return line.isInstruction() && line.getOpcode() == "move" &&
+         isRegister(line.getOperand(0)) && isRegister(line.getOperand(1));
+}
+
+// Registers with a special role, never renamed.
+bool isReservedRegister(const std::string& reg) {
+  return reg == "$sp" || reg == "$fp" || reg == "$gp" || reg == "$ra" || reg == "$0";
+}
+
+bool contains(const std::vector<std::string>& registers, const std::string& reg) {
+  return std::find(registers.begin(), registers.end(), reg) != registers.end();
+}
+
+} // namespace
+
+bool AsmOptimizer::propagateCopiesForward(AsmFunction& asm_function,
+                                          const FunctionContext& function_context) {
+  std::vector<AsmLine>& lines = asm_function.getLines();
+  std::vector<std::unordered_set<std::string>> live_out =
+    computeLiveOut(asm_function, function_context);
+  std::vector<bool> to_remove(lines.size(), false);
+  bool removed = false;
+
+  for (const BasicBlock& block : asm_function.getBlocks()) {
+    for (int i = block.first; i <= block.last; i++) {
+      if (!isCopy(lines[i])) {
+        continue;
+      }
+      std::string destination = canonicalRegister(lines[i].getOperand(0));
+      std::string source = canonicalRegister(lines[i].getOperand(1));
+      if (destination == source) {
+        to_remove[i] = true;
+        removed = true;
+        continue;
+      }
+      if (isReservedRegister(destination)) {
+        continue;
+      }
+
+      // Use the source in place of the destination, until one of the two is overwritten.
+      std::vector<AsmLine> rewritten_lines;
+      int last = i;
+      bool can_remove = true;
+      for (int j = i + 1; j <= block.last; j++) {
+        AsmLine line = lines[j];
+        if (!line.replaceUsedRegister(destination, lines[i].getOperand(1))) {
+          can_remove = false;
+          break;
+        }
+        rewritten_lines.push_back(line);
+        last = j;
+        std::vector<std::string> definitions = line.getDefinedRegisters();
+        if (contains(definitions, destination) || contains(definitions, source)) {
+          break;
+        }
+      }
+      // The copy is still needed if its value is used after the last rewritten line.
+      bool redefined = last != i &&
+                       contains(rewritten_lines.back().getDefinedRegisters(), destination);
+      if (!can_remove || (live_out[last].count(destination) && !redefined)) {
+        continue;
+      }
+      for (unsigned int k = 0; k < rewritten_lines.size(); k++) {
+        lines[i + 1 + k] = rewritten_lines[k];
+      }
+      to_remove[i] = true;
+      removed = true;
+      // The liveness is not valid anymore.
+      break;
+    }
+    if (removed) {
+      break;
+    }
+  }
+
+  if (removed) {
+    asm_function.removeLines(to_remove);
+  }
+  return removed;
+}
+
+bool AsmOptimizer::propagateCopiesBackward(AsmFunction& asm_function,
+                                           const FunctionContext& function_context) {
+  std::vector<AsmLine>& lines = asm_function.getLines();
+  std::vector<std::unordered_set<std::string>> live_out =
+    computeLiveOut(asm_function, function_context);
+  std::vector<bool> to_remove(lines.size(), false);
+  bool removed = false;
+
+  for (const BasicBlock& block : asm_function.getBlocks()) {
+    for (int i = block.first; i <= block.last; i++) {
+      if (!isCopy(lines[i])) {
+        continue;
+      }
+      std::string destination = canonicalRegister(lines[i].getOperand(0));
+      std::string source = canonicalRegister(lines[i].getOperand(1));
+      if (isReservedRegister(destination) || isReservedRegister(source) ||
+          live_out[i].count(source)) {
+        continue;
+      }
+      // Look for the instruction computing the source, and compute it directly in the
+      // destination. In between, the source must not be read and the destination must
+      // not be read nor written. A copy removed in this pass ends the search: the line
+      // computing its source already computes it in another register.
+      for (int j = i - 1; j >= block.first; j--) {
+        if (to_remove[j]) {
+          break;
+        }
+        std::vector<std::string> uses = lines[j].getUsedRegisters();
+        std::vector<std::string> definitions = lines[j].getDefinedRegisters();
+        if (contains(definitions, source)) {
+          if (!contains(definitions, destination) &&
+              lines[j].replaceDefinedRegister(lines[i].getOperand(0))) {
+            to_remove[i] = true;
+            removed = true;
+          }
+          break;
+        }
+        if (contains(uses, source) || contains(uses, destination) ||
+            contains(definitions, destination) || lines[j].isUnknown()) {
+          break;
+        }
+      }
+    }
+  }
+
+  if (removed) {
+    asm_function.removeLines(to_remove);
+  }
+  return removed;
+}
+
+bool AsmOptimizer::removeDeadInstructions(AsmFunction& asm_function,
+                                          const FunctionContext& function_context) {
+  std::vector<AsmLine>& lines = asm_function.getLines();
+  std::vector<std::unordered_set<std::string>> live_out =
+    computeLiveOut(asm_function, function_context);
+  std::vector<bool> to_remove(lines.size(), false);
+  bool removed = false;
+
+  for (unsigned int i = 0; i < lines.size(); i++) {
+    int offset;
+    if (!lines[i].hasNoSideEffects() || isSpillAccess(lines[i], function_context, offset)) {
+      continue;
+    }
+    bool is_dead = true;
+    for (const std::string& definition : lines[i].getDefinedRegisters()) {
+      if (live_out[i].count(definition)) {
+        is_dead = false;
+      }
+    }
+    if (is_dead) {
+      to_remove[i] = true;
+      removed = true;
+    }
+  }
+
+  if (removed) {
+    asm_function.removeLines(to_remove);
+  }
+  return removed;
+}
+
+void AsmOptimizer::propagateCopies(AsmFunction& asm_function,
+                                   const FunctionContext& function_context) {
+  bool changed = true;
+  while (changed) {
+    changed = propagateCopiesBackward(asm_function, function_context);
+    changed = propagateCopiesForward(asm_function, function_context) || changed;
+    changed = removeDeadInstructions(asm_function, function_context) || changed;
+  }
+}
+
+namespace {
+
+// Global variable accessed by a load or a store (e.g. %gp_rel(a)($gp), %lo(a+8)($t0)).
+// Empty if the address is not relative to a symbol.
+std::string getAccessedSymbol(const AsmLine& line) {
+  const std::string& memory_operand = line.getMemoryOperand();
+  if (memory_operand.empty() || memory_operand[0] != '%') {
+    return "";
+  }
+  size_t open = memory_operand.find('(');
+  size_t end = memory_operand.find_first_of("+-)", open + 1);
+  return memory_operand.substr(open + 1, end - open - 1);
+}
+
+// Registers appearing in the operands of a line, e.g. the base of a memory operand.
+std::unordered_set<std::string> getRegisterOperands(const AsmLine& line) {
+  std::unordered_set<std::string> registers;
+  for (const std::string& operand : line.getOperands()) {
+    size_t dollar = operand.find('$');
+    if (dollar != std::string::npos) {
+      size_t end = operand.find_first_of(")", dollar);
+      registers.insert(
+        AsmOptimizer::canonicalRegister(operand.substr(dollar, end - dollar)));
+    }
+  }
+  return registers;
+}
+
+// Integer written in decimal, e.g. an immediate operand.
+bool parseInteger(const std::string& text, int& value) {
+  size_t start = (!text.empty() && text[0] == '-') ? 1 : 0;
+  if (start == text.size() || text.size() > 10 ||
+      text.find_first_not_of("0123456789", start) != std::string::npos) {
+    return false;
+  }
+  long long number = std::stoll(text);
+  if (number < INT_MIN || number > INT_MAX) {
+    return false;
+  }
+  value = number;
+  return true;
+}
+
+bool fitsInImmediate(int value) {
+  return value >= -32768 && value <= 32767;
+}
+
+// li of a value fitting in 16 bits: a single instruction, as cheap as a copy.
+bool isShortLoadImmediate(const AsmLine& line) {
+  int value;
+  return line.getOpcode() == "li" && parseInteger(line.getOperand(1), value) &&
+         value >= -32768 && value <= 65535;
+}
+
+// Registers that can hold a hoisted value in a loop without calls.
+const std::vector<std::string> LOOP_INVARIANT_REGISTERS = {
+  "$t0", "$t1", "$t2", "$t3", "$t4", "$t5", "$t6", "$t7", "$t8", "$t9", "$v1", "$a0",
+  "$a1", "$a2", "$a3"
+};
+
+// What an address held in a register may point to.
+class AddressProvenance {
+ public:
+  // Any memory, e.g. a pointer loaded from memory or received as an argument.
+  bool is_any = false;
+  // The stack frame, e.g. an element of a local array.
+  bool is_frame = false;
+  // Global variables.
+  std::set<std::string> symbols;
+
+  // Returns true if the provenance changes.
+  bool merge(const AddressProvenance& other) {
+    size_t size = symbols.size();
+    symbols.insert(other.symbols.begin(), other.symbols.end());
+    bool changed = symbols.size() != size || (other.is_any && !is_any) ||
+                   (other.is_frame && !is_frame);
+    is_any = is_any || other.is_any;
+    is_frame = is_frame || other.is_frame;
+    return changed;
+  }
+};
+
+// Symbol of an address operand, e.g. %hi(a), %lo(a+8) or a. Empty if it is an integer.
+std::string getAddressSymbol(const std::string& operand) {
+  size_t start = 0;
+  if (operand.find("%hi(") == 0 || operand.find("%lo(") == 0) {
+    start = 4;
+  } else if (operand.find("%gp_rel(") == 0) {
+    start = 8;
+  } else if (operand.empty() || operand[0] == '-' || isdigit(operand[0])) {
+    return "";
+  }
+  return operand.substr(start, operand.find_first_of("+-)", start) - start);
+}
+
+// Provenance of the address a line computes into the register it defines, given the
+// provenance of the registers it reads.
+AddressProvenance computeProvenance(
+  const AsmLine& line,
+  const std::function<AddressProvenance(const std::string&)>& provenance_of) {
+  AddressProvenance provenance;
+  const std::string& opcode = line.getOpcode();
+  if (line.isCall() || line.isLoad()) {
+    provenance.is_any = true;
+  } else if (opcode == "lui" || opcode == "la") {
+    std::string symbol = getAddressSymbol(line.getOperand(1));
+    if (!symbol.empty() && (opcode == "la" || line.getOperand(1).find("%hi(") == 0)) {
+      provenance.symbols.insert(symbol);
+    }
+  } else if (opcode == "addiu" || opcode == "addi" || opcode == "ori" ||
+             opcode == "andi" || opcode == "xori") {
+    provenance = provenance_of(AsmOptimizer::canonicalRegister(line.getOperand(1)));
+    std::string symbol = getAddressSymbol(line.getOperand(2));
+    if (!symbol.empty()) {
+      provenance.symbols.insert(symbol);
+    }
+  } else if (opcode == "addu" || opcode == "add" || opcode == "subu" || opcode == "sub" ||
+             opcode == "or" || opcode == "and" || opcode == "xor") {
+    provenance = provenance_of(AsmOptimizer::canonicalRegister(line.getOperand(1)));
+    provenance.merge(provenance_of(AsmOptimizer::canonicalRegister(line.getOperand(2))));
+  } else if (opcode == "move") {
+    provenance = provenance_of(AsmOptimizer::canonicalRegister(line.getOperand(1)));
+  } else if (opcode == "movn" || opcode == "movz") {
+    // The register keeps its value if the condition is false.
+    provenance = provenance_of(AsmOptimizer::canonicalRegister(line.getOperand(0)));
+    provenance.merge(provenance_of(AsmOptimizer::canonicalRegister(line.getOperand(1))));
+  }
+  // Otherwise an integer: a constant, a shift, a comparison, a product...
+  return provenance;
+}
+
+// Provenance of the addresses held in each register anywhere in the function, ignoring
+// the order of the lines. The arguments may point to anything.
+std::unordered_map<std::string, AddressProvenance> findRegisterProvenances(
+  const AsmFunction& asm_function, const std::string& frame_register) {
+  std::unordered_map<std::string, AddressProvenance> provenances;
+  for (const char* reg : {"$a0", "$a1", "$a2", "$a3"}) {
+    provenances[reg].is_any = true;
+  }
+  std::function<AddressProvenance(const std::string&)> provenance_of =
+    [&](const std::string& reg) {
+      AddressProvenance provenance;
+      if (reg == frame_register || reg == "$sp" || reg == "$fp") {
+        provenance.is_frame = true;
+      } else if (provenances.count(reg)) {
+        provenance = provenances.at(reg);
+      }
+      return provenance;
+    };
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (const AsmLine& line : asm_function.getLines()) {
+      for (const std::string& definition : line.getDefinedRegisters()) {
+        if (definition == frame_register || isReservedRegister(definition)) {
+          continue;
+        }
+        AddressProvenance provenance =
+          line.getDefinedRegisters().size() == 1 ?
+          computeProvenance(line, provenance_of) : AddressProvenance();
+        if (line.isCall()) {
+          provenance.is_any = true;
+        }
+        changed = provenances[definition].merge(provenance) || changed;
+      }
+    }
+  }
+  return provenances;
+}
+
+// The word at the offset of the stack frame is accessed only by the function, and only
+// directly: a scalar variable whose address is not taken, a spill slot or an argument.
+// The callees may write the area of the call arguments.
+bool isPrivateFrameOffset(const FunctionContext& function_context,
+                          const std::unordered_set<int>& address_taken_offsets,
+                          int offset) {
+  return address_taken_offsets.count(offset) == 0 &&
+         (function_context.isScalarVariableOffset(offset) ||
+          function_context.isSpillOffset(offset) ||
+          offset >= function_context.getFrameSize());
+}
+
+// Provenance of the address in the register before the line, following its definitions
+// back to the start of the block, then falling back on the provenances in the function.
+AddressProvenance findProvenanceAtLine(
+  const AsmFunction& asm_function, int line_index, const std::string& reg,
+  const std::string& frame_register,
+  const std::unordered_map<std::string, AddressProvenance>& provenances, int depth = 0) {
+  const std::vector<AsmLine>& lines = asm_function.getLines();
+  int block_first = asm_function.getBlocks()[asm_function.getBlockOfLine(line_index)].first;
+  if (reg != frame_register && reg != "$sp" && reg != "$fp" && depth < 8) {
+    for (int j = line_index - 1; j >= block_first; j--) {
+      if (!contains(lines[j].getDefinedRegisters(), reg)) {
+        continue;
+      }
+      if (lines[j].getDefinedRegisters().size() != 1) {
+        break;
+      }
+      return computeProvenance(lines[j], [&](const std::string& use) {
+        return findProvenanceAtLine(asm_function, j, use, frame_register, provenances,
+                                    depth + 1);
+      });
+    }
+  }
+  AddressProvenance provenance;
+  if (reg == frame_register || reg == "$sp" || reg == "$fp") {
+    provenance.is_frame = true;
+  } else if (provenances.count(reg)) {
+    provenance = provenances.at(reg);
+  }
+  return provenance;
+}
+
+} // namespace
+
+std::vector<std::pair<std::string, int>> AsmOptimizer::findFreeRegistersOfLoop(
+  const AsmFunction& asm_function, const FunctionContext& function_context,
+  const Loop& loop, int preheader_position) {
+  const std::vector<AsmLine>& lines = asm_function.getLines();
+  const std::vector<BasicBlock>& blocks = asm_function.getBlocks();
+  std::unordered_set<std::string> referenced_registers;
+  bool has_call = false;
+  for (unsigned int b = 0; b < blocks.size(); b++) {
+    if (!loop.blocks[b]) {
+      continue;
+    }
+    for (int i = blocks[b].first; i <= blocks[b].last; i++) {
+      has_call = has_call || lines[i].isCall();
+      for (const std::string& reg : getRegisterOperands(lines[i])) {
+        referenced_registers.insert(reg);
+      }
+    }
+  }
+
+  // A call overwrites the caller saved registers.
+  std::vector<std::pair<std::string, int>> free_registers;
+  if (!has_call) {
+    std::unordered_set<std::string> live_in =
+      computeLiveOut(asm_function, function_context)[preheader_position - 1];
+    for (const std::string& reg : LOOP_INVARIANT_REGISTERS) {
+      if (!referenced_registers.count(reg) && !live_in.count(reg)) {
+        free_registers.push_back({reg, -1});
+      }
+    }
+  }
+  std::unordered_set<std::string> used_registers;
+  std::unordered_set<int> used_offsets;
+  for (const AsmLine& line : lines) {
+    for (const std::string& reg : getRegisterOperands(line)) {
+      used_registers.insert(reg);
+    }
+    int offset;
+    if (isSpillAccess(line, function_context, offset)) {
+      used_offsets.insert(offset);
+    }
+  }
+  for (const auto& callee_saved_register : function_context.getCalleeSavedRegisters()) {
+    used_registers.insert(callee_saved_register.first);
+    used_offsets.insert(callee_saved_register.second);
+  }
+  std::vector<std::string> spill_registers = function_context.getSpillRegisters();
+  for (const std::string& reg : CALLEE_SAVED_REGISTERS) {
+    if (used_registers.count(reg)) {
+      continue;
+    }
+    // A spill slot that is not used saves the callee saved register.
+    for (const std::string& spill_register : spill_registers) {
+      int offset = function_context.getSpillOffsetForRegister(spill_register);
+      if (!used_offsets.count(offset)) {
+        free_registers.push_back({reg, offset});
+        used_offsets.insert(offset);
+        break;
+      }
+    }
+  }
+  return free_registers;
+}
+
+bool AsmOptimizer::hoistLoopInvariantCodeOfLoop(AsmFunction& asm_function,
+                                                FunctionContext& function_context,
+                                                const Loop& loop) {
+  int preheader_position = asm_function.getPreheaderPosition(loop);
+  if (preheader_position < 0) {
+    return false;
+  }
+  std::vector<AsmLine>& lines = asm_function.getLines();
+  const std::vector<BasicBlock>& blocks = asm_function.getBlocks();
+  const std::string& frame_register = function_context.getFrameRegister();
+
+  // What the loop reads and writes. A store through a pointer writes what its base
+  // register may point to, and a call what the callee may write (see ModRefSummaries).
+  std::unordered_map<std::string, AddressProvenance> provenances =
+    findRegisterProvenances(asm_function, frame_register);
+  std::vector<int> loop_lines;
+  std::unordered_set<std::string> defined_registers;
+  std::unordered_set<int> stored_offsets;
+  std::unordered_set<std::string> stored_symbols;
+  bool has_call = false;
+  bool writes_frame = false;
+  bool writes_through_pointers = false;
+  bool writes_anything = false;
+  for (unsigned int b = 0; b < blocks.size(); b++) {
+    if (!loop.blocks[b]) {
+      continue;
+    }
+    for (int i = blocks[b].first; i <= blocks[b].last; i++) {
+      const AsmLine& line = lines[i];
+      if (line.isUnknown()) {
+        return false;
+      }
+      loop_lines.push_back(i);
+      for (const std::string& definition : line.getDefinedRegisters()) {
+        defined_registers.insert(definition);
+      }
+      if (line.isCall()) {
+        has_call = true;
+        if (line.getOpcode() != "jal") {
+          writes_anything = true;
+          continue;
+        }
+        const ModRefSummary& summary = mod_ref_summaries.getSummary(line.getOperand(0));
+        stored_symbols.insert(summary.written_globals.begin(),
+                              summary.written_globals.end());
+        writes_through_pointers =
+          writes_through_pointers || summary.writes_through_pointers;
+        writes_anything = writes_anything || summary.is_unknown;
+      }
+      if (line.isStore()) {
+        int offset;
+        std::string symbol = getAccessedSymbol(line);
+        if (line.getBaseRegister() == frame_register && line.getConstantOffset(offset)) {
+          stored_offsets.insert(offset);
+        } else if (!symbol.empty()) {
+          stored_symbols.insert(symbol);
+        } else {
+          AddressProvenance provenance = findProvenanceAtLine(
+            asm_function, i, line.getBaseRegister(), frame_register, provenances);
+          stored_symbols.insert(provenance.symbols.begin(), provenance.symbols.end());
+          writes_frame = writes_frame || provenance.is_frame;
+          writes_through_pointers = writes_through_pointers || provenance.is_any;
+        }
+      }
+    }
+  }
+  std::unordered_set<int> address_taken_offsets;
+  bool are_offsets_known =
+    findAddressTakenOffsets(asm_function, function_context, address_taken_offsets);
+  auto is_private_offset = [&](int offset) {
+    return are_offsets_known &&
+           isPrivateFrameOffset(function_context, address_taken_offsets, offset);
+  };
+
+  // Registers for the hoisted values.
+  std::vector<std::pair<std::string, int>> free_registers =
+    findFreeRegistersOfLoop(asm_function, function_context, loop, preheader_position);
+
+  // Hoisted line --> placeholder register holding its value, e.g. $invariant0. The
+  // registers are assigned once it is known which values are used in the loop.
+  std::unordered_map<int, std::string> hoisted;
+  std::unordered_map<std::string, std::string> computation_to_placeholder;
+  std::vector<AsmLine> preheader_lines;
+  for (int i : loop_lines) {
+    const AsmLine& line = lines[i];
+    if (preheader_lines.size() == free_registers.size()) {
+      break;
+    }
+    if (!line.hasNoSideEffects() || isCopy(line) || isShortLoadImmediate(line) ||
+        line.getOpcode() == "mflo" || line.getOpcode() == "mfhi") {
+      continue;
+    }
+    std::vector<std::string> definitions = line.getDefinedRegisters();
+    if (definitions.size() != 1 || isReservedRegister(definitions[0])) {
+      continue;
+    }
+    // The memory read must not be written in the loop, directly or not.
+    if (line.isLoad()) {
+      int offset;
+      std::string symbol = getAccessedSymbol(line);
+      if (line.getBaseRegister() == frame_register && line.getConstantOffset(offset)) {
+        if (stored_offsets.count(offset) ||
+            ((has_call || writes_frame || writes_through_pointers || writes_anything) &&
+             !is_private_offset(offset))) {
+          continue;
+        }
+      } else if (symbol.empty() || stored_symbols.count(symbol) || writes_anything ||
+                 (writes_through_pointers && mod_ref_summaries.mayPointTo(symbol))) {
+        continue;
+      }
+    }
+    // The registers read must not be written in the loop, or be written by a line already
+    // hoisted.
+    AsmLine hoisted_line = line;
+    bool is_invariant = true;
+    int block_first = blocks[asm_function.getBlockOfLine(i)].first;
+    for (const std::string& use : line.getUsedRegisters()) {
+      if (use == "$0") {
+        continue;
+      }
+      int reaching = -1;
+      for (int j = i - 1; j >= block_first; j--) {
+        if (contains(lines[j].getDefinedRegisters(), use)) {
+          reaching = j;
+          break;
+        }
+      }
+      if (reaching >= 0) {
+        auto reaching_hoisted = hoisted.find(reaching);
+        if (reaching_hoisted == hoisted.end() ||
+            !hoisted_line.replaceUsedRegister(use, reaching_hoisted->second)) {
+          is_invariant = false;
+          break;
+        }
+      } else if (defined_registers.count(use)) {
+        is_invariant = false;
+        break;
+      }
+    }
+    if (!is_invariant) {
+      continue;
+    }
+    // The same value may be computed more than once in the loop.
+    std::string computation = hoisted_line.getOpcode();
+    for (unsigned int k = 1; k < hoisted_line.getOperands().size(); k++) {
+      computation += " " + hoisted_line.getOperand(k);
+    }
+    auto computed = computation_to_placeholder.find(computation);
+    if (computed != computation_to_placeholder.end()) {
+      hoisted[i] = computed->second;
+      continue;
+    }
+    std::string placeholder = "$invariant" + std::to_string(preheader_lines.size());
+    hoisted_line.replaceDefinedRegister(placeholder);
+    preheader_lines.push_back(hoisted_line);
+    hoisted[i] = placeholder;
+    computation_to_placeholder[computation] = placeholder;
+  }
+  if (hoisted.empty()) {
+    return false;
+  }
+
+  // The hoisted lines become copies. A copy whose value is not used in the loop (e.g. the
+  // upper half of an address) is removed, and its value lives only in the preheader.
+  std::vector<bool> to_remove(lines.size(), false);
+  int removed_before_preheader = 0;
+  for (const auto& hoisted_line : hoisted) {
+    int i = hoisted_line.first;
+    bool is_load = lines[i].isLoad();
+    lines[i] = AsmLine::makeInstruction(
+      "move", {lines[i].getOperand(0), hoisted_line.second}, " Loop invariant.");
+    // The copy has no load delay slot.
+    if (is_load && i + 1 < (int)lines.size() && lines[i + 1].isInstruction() &&
+        lines[i + 1].getOpcode() == "nop") {
+      to_remove[i + 1] = true;
+      removed_before_preheader += (i + 1 < preheader_position) ? 1 : 0;
+    }
+  }
+  asm_function.buildControlFlowGraph();
+  std::vector<std::unordered_set<std::string>> live_out =
+    computeLiveOut(asm_function, function_context);
+  std::unordered_set<std::string> used_in_loop;
+  for (const auto& hoisted_line : hoisted) {
+    int i = hoisted_line.first;
+    if (live_out[i].count(canonicalRegister(lines[i].getOperand(0)))) {
+      used_in_loop.insert(hoisted_line.second);
+    } else {
+      to_remove[i] = true;
+      removed_before_preheader += (i < preheader_position) ? 1 : 0;
+    }
+  }
+
+  // Assign the registers in the preheader. A value not used in the loop frees its register
+  // after its last use.
+  std::unordered_map<std::string, int> last_use;
+  for (unsigned int k = 0; k < preheader_lines.size(); k++) {
+    for (const std::string& use : preheader_lines[k].getUsedRegisters()) {
+      last_use[use] = k;
+    }
+  }
+  std::unordered_map<std::string, std::string> assigned_registers;
+  std::vector<bool> is_register_free(free_registers.size(), true);
+  std::unordered_set<std::string> callee_saved_registers;
+  std::vector<AsmLine> assigned_lines = {AsmLine::makeOther("# Loop invariant code.")};
+  for (unsigned int k = 0; k < preheader_lines.size(); k++) {
+    AsmLine line = preheader_lines[k];
+    std::string placeholder = line.getOperand(0);
+    if (!used_in_loop.count(placeholder) && !last_use.count(placeholder)) {
+      continue;
+    }
+    for (const std::string& use : preheader_lines[k].getUsedRegisters()) {
+      auto assigned = assigned_registers.find(use);
+      if (assigned == assigned_registers.end()) {
+        continue;
+      }
+      line.replaceUsedRegister(use, assigned->second);
+      if (last_use[use] == (int)k && !used_in_loop.count(use)) {
+        for (unsigned int r = 0; r < free_registers.size(); r++) {
+          if (free_registers[r].first == assigned->second) {
+            is_register_free[r] = true;
+          }
+        }
+      }
+    }
+    unsigned int r = std::find(is_register_free.begin(), is_register_free.end(), true) -
+                     is_register_free.begin();
+    is_register_free[r] = false;
+    assigned_registers[placeholder] = free_registers[r].first;
+    line.replaceDefinedRegister(free_registers[r].first);
+    assigned_lines.push_back(line);
+    if (free_registers[r].second >= 0 &&
+        !callee_saved_registers.count(free_registers[r].first)) {
+      callee_saved_registers.insert(free_registers[r].first);
+      function_context.addCalleeSavedRegister(free_registers[r].first,
+                                              free_registers[r].second);
+    }
+  }
+  for (const auto& hoisted_line : hoisted) {
+    if (!to_remove[hoisted_line.first]) {
+      lines[hoisted_line.first].replaceUsedRegister(
+        hoisted_line.second, assigned_registers[hoisted_line.second]);
+    }
+  }
+
+  asm_function.removeLines(to_remove);
+  asm_function.insertLines(preheader_position - removed_before_preheader, assigned_lines);
+  return true;
+}
+
+void AsmOptimizer::hoistLoopInvariantCode(AsmFunction& asm_function,
+                                          FunctionContext& function_context) {
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (const Loop& loop : asm_function.findLoops()) {
+      if (hoistLoopInvariantCodeOfLoop(asm_function, function_context, loop)) {
+        // The loops are not valid anymore.
+        changed = true;
+        break;
+      }
+    }
+  }
+}
+
+namespace {
+
+// Load or store of the word at the given offset of the stack frame.
+bool accessesFrameOffset(const AsmLine& line, const std::string& frame_register,
+                         int offset) {
+  int line_offset;
+  return (line.isLoad() || line.isStore()) && line.getBaseRegister() == frame_register &&
+         line.getConstantOffset(line_offset) && line_offset == offset;
+}
+
+// Last line before 'line', in the block starting at 'first', writing the register. -1 if
+// the register is not written in the block before the line.
+int findReachingDefinition(const std::vector<AsmLine>& lines, int first, int line,
+                           const std::string& reg) {
+  for (int i = line - 1; i >= first; i--) {
+    if (contains(lines[i].getDefinedRegisters(), reg)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// First line after 'line', up to 'last', reading the value the register has after 'line'.
+// -1 if the register is overwritten before being read.
+int findNextUse(const std::vector<AsmLine>& lines, int line, int last,
+                const std::string& reg) {
+  for (int i = line + 1; i <= last; i++) {
+    if (contains(lines[i].getUsedRegisters(), reg)) {
+      return i;
+    }
+    if (contains(lines[i].getDefinedRegisters(), reg)) {
+      return -1;
+    }
+  }
+  return -1;
+}
+
+// The register holds the address of a global variable, computed by the given line.
+bool isGlobalAddress(const AsmLine& line) {
+  if (line.getOpcode() == "la") {
+    return true;
+  }
+  return line.getOpcode() == "addiu" &&
+         (line.getOperand(2).find("%lo(") == 0 || line.getOperand(2).find("%gp_rel(") == 0);
+}
+
+} // namespace
+
+bool AsmOptimizer::findAddressTakenOffsets(const AsmFunction& asm_function,
+                                           const FunctionContext& function_context,
+                                           std::unordered_set<int>& offsets) {
+  const std::string& frame_register = function_context.getFrameRegister();
+  for (const AsmLine& line : asm_function.getLines()) {
+    if (line.isUnknown()) {
+      return false;
+    }
+    if (!line.isInstruction() || line.isLoad() || line.isStore() ||
+        !contains(line.getUsedRegisters(), frame_register)) {
+      continue;
+    }
+    int offset;
+    if (line.getOpcode() == "addiu" &&
+        canonicalRegister(line.getOperand(1)) == frame_register &&
+        parseInteger(line.getOperand(2), offset)) {
+      // Address operator, or the frame being allocated.
+      offsets.insert(offset);
+    } else if (line.getOpcode() == "addu") {
+      // Element of a local array: the offset is relative to the array.
+      continue;
+    } else if (!line.isCall() && !(line.getOpcode() == "move" &&
+                                   canonicalRegister(line.getOperand(0)) == "$fp")) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool AsmOptimizer::isFrameOffsetLiveAfterLoop(const AsmFunction& asm_function,
+                                              const FunctionContext& function_context,
+                                              const Loop& loop, int offset) {
+  const std::vector<AsmLine>& lines = asm_function.getLines();
+  const std::vector<BasicBlock>& blocks = asm_function.getBlocks();
+  const std::string& frame_register = function_context.getFrameRegister();
+  std::vector<bool> visited(blocks.size(), false);
+  std::vector<int> to_visit;
+  for (unsigned int b = 0; b < blocks.size(); b++) {
+    if (loop.blocks[b]) {
+      for (int successor : blocks[b].successors) {
+        if (!loop.blocks[successor]) {
+          to_visit.push_back(successor);
+        }
+      }
+    }
+  }
+  while (!to_visit.empty()) {
+    int current = to_visit.back();
+    to_visit.pop_back();
+    if (visited[current]) {
+      continue;
+    }
+    visited[current] = true;
+    bool is_overwritten = false;
+    for (int i = blocks[current].first; i <= blocks[current].last; i++) {
+      if (accessesFrameOffset(lines[i], frame_register, offset)) {
+        if (lines[i].isLoad()) {
+          return true;
+        }
+        is_overwritten = true;
+        break;
+      }
+    }
+    // Locals are dead once the function returns.
+    if (!is_overwritten) {
+      for (int successor : blocks[current].successors) {
+        to_visit.push_back(successor);
+      }
+    }
+  }
+  return false;
+}
+
+bool AsmOptimizer::reduceInductionVariableOfLoop(AsmFunction& asm_function,
+                                                 FunctionContext& function_context,
+                                                 const Loop& loop) {
+  int preheader_position = asm_function.getPreheaderPosition(loop);
+  std::unordered_set<int> address_taken_offsets;
+  if (preheader_position < 0 ||
+      !findAddressTakenOffsets(asm_function, function_context, address_taken_offsets)) {
+    return false;
+  }
+  std::vector<AsmLine>& lines = asm_function.getLines();
+  const std::vector<BasicBlock>& blocks = asm_function.getBlocks();
+  const std::string& frame_register = function_context.getFrameRegister();
+  std::string header_label = lines[blocks[loop.header].first].getLabel();
+
+  // Stores to the stack frame and registers written in the loop.
+  std::vector<int> loop_lines;
+  std::unordered_set<std::string> defined_registers;
+  std::map<int, std::vector<int>> offset_to_stores;
+  for (unsigned int b = 0; b < blocks.size(); b++) {
+    if (!loop.blocks[b]) {
+      continue;
+    }
+    for (int i = blocks[b].first; i <= blocks[b].last; i++) {
+      loop_lines.push_back(i);
+      for (const std::string& definition : lines[i].getDefinedRegisters()) {
+        defined_registers.insert(definition);
+      }
+      int offset;
+      if (lines[i].isStore() && lines[i].getBaseRegister() == frame_register &&
+          lines[i].getConstantOffset(offset)) {
+        offset_to_stores[offset].push_back(i);
+      }
+    }
+  }
+  std::vector<std::vector<bool>> dominators = asm_function.computeDominators();
+
+  for (const auto& stores : offset_to_stores) {
+    // Induction variable: a local, whose address is not taken, updated once in the loop
+    // by adding a constant: lw x, offset; addiu r, x, step; sw r, offset.
+    int offset = stores.first;
+    if (stores.second.size() != 1 || address_taken_offsets.count(offset) ||
+        function_context.isSpillOffset(offset)) {
+      continue;
+    }
+    int store = stores.second.front();
+    int store_block = asm_function.getBlockOfLine(store);
+    int add = findReachingDefinition(lines, blocks[store_block].first, store,
+                                     canonicalRegister(lines[store].getOperand(0)));
+    int step;
+    if (add < 0 || lines[add].getOpcode() != "addiu" ||
+        !parseInteger(lines[add].getOperand(2), step)) {
+      continue;
+    }
+    int load = findReachingDefinition(lines, blocks[store_block].first, add,
+                                      canonicalRegister(lines[add].getOperand(1)));
+    if (load < 0 || !lines[load].isLoad() ||
+        !accessesFrameOffset(lines[load], frame_register, offset)) {
+      continue;
+    }
+
+    // Addresses computed from the variable: base + constant + (variable << shift), as
+    // done to access an element of an array:
+    //   lw i, offset; sll i, i, shift; [addiu a, i, constant;] addu a, a, base
+    // The base must not change in the loop.
+    std::map<std::tuple<std::string, int, int>, std::vector<int>> addresses;
+    for (int i : loop_lines) {
+      int shift;
+      if (lines[i].getOpcode() != "sll" || !parseInteger(lines[i].getOperand(2), shift)) {
+        continue;
+      }
+      const BasicBlock& block = blocks[asm_function.getBlockOfLine(i)];
+      int index_load = findReachingDefinition(lines, block.first, i,
+                                              canonicalRegister(lines[i].getOperand(1)));
+      if (index_load < 0 || !lines[index_load].isLoad() ||
+          !accessesFrameOffset(lines[index_load], frame_register, offset)) {
+        continue;
+      }
+      std::string value = canonicalRegister(lines[i].getOperand(0));
+      int address = findNextUse(lines, i, block.last, value);
+      int constant = 0;
+      if (address >= 0 && lines[address].getOpcode() == "addiu" &&
+          canonicalRegister(lines[address].getOperand(1)) == value &&
+          parseInteger(lines[address].getOperand(2), constant)) {
+        value = canonicalRegister(lines[address].getOperand(0));
+        address = findNextUse(lines, address, block.last, value);
+      }
+      if (address < 0 || lines[address].getOpcode() != "addu") {
+        continue;
+      }
+      std::string first = canonicalRegister(lines[address].getOperand(1));
+      std::string second = canonicalRegister(lines[address].getOperand(2));
+      std::string base = (first == value) ? second : first;
+      if ((first == value) == (second == value) || defined_registers.count(base)) {
+        continue;
+      }
+      // The variable must not be updated between its load and the address.
+      if (store > index_load && store < address) {
+        continue;
+      }
+      addresses[std::make_tuple(base, constant, shift)].push_back(address);
+    }
+    if (addresses.empty()) {
+      continue;
+    }
+    std::vector<std::pair<std::string, int>> free_registers =
+      findFreeRegistersOfLoop(asm_function, function_context, loop, preheader_position);
+    if (free_registers.size() < addresses.size()) {
+      continue;
+    }
+
+    // Keep each address in a register, set up before the loop and increased together
+    // with the variable.
+    std::vector<AsmLine> preheader_lines = {
+      AsmLine::makeOther("# Induction variable at offset " + std::to_string(offset) + ".")
+    };
+    std::vector<AsmLine> increment_lines;
+    std::vector<std::tuple<std::string, std::string, int, int, bool>> pointers;
+    bool can_increment = true;
+    for (const auto& address : addresses) {
+      const std::string& base = std::get<0>(address.first);
+      int constant = std::get<1>(address.first);
+      int shift = std::get<2>(address.first);
+      if (shift < 0 || shift > 15 || !fitsInImmediate(step * (1 << shift))) {
+        can_increment = false;
+        break;
+      }
+      const std::string& pointer = free_registers[pointers.size()].first;
+      preheader_lines.push_back(AsmLine::makeInstruction(
+        "lw", {pointer, lines[load].getOperand(1)}, " Load the induction variable."));
+      if (shift != 0) {
+        preheader_lines.push_back(AsmLine::makeInstruction(
+          "sll", {pointer, pointer, std::to_string(shift)}, ""));
+      }
+      if (constant != 0) {
+        preheader_lines.push_back(AsmLine::makeInstruction(
+          "addiu", {pointer, pointer, std::to_string(constant)}, ""));
+      }
+      preheader_lines.push_back(AsmLine::makeInstruction(
+        "addu", {pointer, pointer, base}, " Address derived from the induction variable."));
+      increment_lines.push_back(AsmLine::makeInstruction(
+        "addiu", {pointer, pointer, std::to_string(step * (1 << shift))},
+        " Increase the derived address."));
+      // The address is computed in every iteration reaching a latch.
+      bool dominates_latches = false;
+      for (int line : address.second) {
+        int block = asm_function.getBlockOfLine(line);
+        bool dominates = true;
+        for (int latch : loop.latches) {
+          dominates = dominates && dominators[latch][block];
+        }
+        dominates_latches = dominates_latches || dominates;
+        lines[line] = AsmLine::makeInstruction(
+          "move", {lines[line].getOperand(0), pointer}, " Derived address.");
+      }
+      pointers.push_back(
+        std::make_tuple(pointer, base, constant, shift, dominates_latches));
+    }
+    if (!can_increment) {
+      continue;
+    }
+    for (unsigned int p = 0; p < pointers.size(); p++) {
+      if (free_registers[p].second >= 0) {
+        function_context.addCalleeSavedRegister(free_registers[p].first,
+                                                free_registers[p].second);
+      }
+    }
+    if (store + 1 > preheader_position) {
+      asm_function.insertLines(store + 1, increment_lines);
+      asm_function.insertLines(preheader_position, preheader_lines);
+    } else {
+      asm_function.insertLines(preheader_position, preheader_lines);
+      asm_function.insertLines(store + 1, increment_lines);
+    }
+
+    // The variable may be replaced entirely by an address into a global array.
+    for (const auto& pointer : pointers) {
+      const std::string& base = std::get<1>(pointer);
+      int base_definition = -1;
+      for (int i = preheader_position - 1; i >= 0 && base_definition < 0; i--) {
+        if (contains(asm_function.getLines()[i].getDefinedRegisters(), base)) {
+          base_definition = i;
+        }
+      }
+      if (std::get<4>(pointer) && base_definition >= 0 &&
+          isGlobalAddress(asm_function.getLines()[base_definition]) &&
+          replaceInductionVariableTest(asm_function, function_context, header_label, offset,
+                                       std::get<0>(pointer), base, std::get<2>(pointer),
+                                       std::get<3>(pointer))) {
+        break;
+      }
+    }
+    return true;
+  }
+  return false;
+}
+
+bool AsmOptimizer::replaceInductionVariableTest(AsmFunction& asm_function,
+                                                FunctionContext& function_context,
+                                                const std::string& header_label,
+                                                int offset, const std::string& pointer,
+                                                const std::string& base, int constant,
+                                                int shift) {
+  // Work on a copy, without the instructions made dead by the derived addresses.
+  AsmFunction reduced_function = asm_function;
+  propagateCopies(reduced_function, function_context);
+  std::vector<AsmLine>& lines = reduced_function.getLines();
+  const std::vector<BasicBlock>& blocks = reduced_function.getBlocks();
+  const std::string& frame_register = function_context.getFrameRegister();
+  int header = reduced_function.getBlockOfLabel(header_label);
+  const Loop* loop = nullptr;
+  std::vector<Loop> loops = reduced_function.findLoops();
+  for (const Loop& candidate : loops) {
+    if (candidate.header == header) {
+      loop = &candidate;
+    }
+  }
+  if (loop == nullptr || reduced_function.getPreheaderPosition(*loop) < 0 ||
+      isFrameOffsetLiveAfterLoop(reduced_function, function_context, *loop, offset)) {
+    return false;
+  }
+
+  // Left in the loop: the update of the variable, and the exit test
+  //   lw x, offset; slti t, x, limit
+  std::vector<int> loads;
+  std::vector<int> stores;
+  for (unsigned int b = 0; b < blocks.size(); b++) {
+    for (int i = blocks[b].first; loop->blocks[b] && i <= blocks[b].last; i++) {
+      if (accessesFrameOffset(lines[i], frame_register, offset)) {
+        (lines[i].isLoad() ? loads : stores).push_back(i);
+      }
+    }
+  }
+  if (loads.size() != 2 || stores.size() != 1) {
+    return false;
+  }
+  std::vector<std::unordered_set<std::string>> live_out =
+    computeLiveOut(reduced_function, function_context);
+  int store = stores.front();
+  const BasicBlock& store_block = blocks[reduced_function.getBlockOfLine(store)];
+  std::string updated = canonicalRegister(lines[store].getOperand(0));
+  int add = findReachingDefinition(lines, store_block.first, store, updated);
+  if (add < 0 || live_out[store].count(updated) ||
+      findNextUse(lines, add, store_block.last, updated) != store) {
+    return false;
+  }
+  std::string old_value = canonicalRegister(lines[add].getOperand(1));
+  int update_load = findReachingDefinition(lines, store_block.first, add, old_value);
+  int test_load = (loads[0] == update_load) ? loads[1] : loads[0];
+  if (update_load < 0 || (loads[0] != update_load && loads[1] != update_load) ||
+      (old_value != updated && live_out[add].count(old_value)) ||
+      findNextUse(lines, update_load, store_block.last, old_value) != add) {
+    return false;
+  }
+  const BasicBlock& test_block = blocks[reduced_function.getBlockOfLine(test_load)];
+  std::string tested = canonicalRegister(lines[test_load].getOperand(0));
+  int test = findNextUse(lines, test_load, test_block.last, tested);
+  int limit;
+  if (test < 0 || lines[test].getOpcode() != "slti" ||
+      canonicalRegister(lines[test].getOperand(1)) != tested ||
+      (canonicalRegister(lines[test].getOperand(0)) != tested &&
+       live_out[test].count(tested)) ||
+      !parseInteger(lines[test].getOperand(2), limit) ||
+      (long long)limit * (1 << shift) + constant < -32768 ||
+      (long long)limit * (1 << shift) + constant > 32767) {
+    return false;
+  }
+  // The address where the loop ends.
+  int preheader_position = reduced_function.getPreheaderPosition(*loop);
+  std::vector<std::pair<std::string, int>> free_registers =
+    findFreeRegistersOfLoop(reduced_function, function_context, *loop, preheader_position);
+  if (free_registers.empty()) {
+    return false;
+  }
+  const std::string& end = free_registers.front().first;
+  int pointer_setup = -1;
+  for (int i = preheader_position - 1; i >= 0 && pointer_setup < 0; i--) {
+    if (contains(lines[i].getDefinedRegisters(), pointer)) {
+      pointer_setup = i;
+    }
+  }
+  if (pointer_setup < 0 || lines[pointer_setup].getOpcode() != "addu" ||
+      !contains(lines[pointer_setup].getUsedRegisters(), base)) {
+    return false;
+  }
+
+  lines[test] = AsmLine::makeInstruction("slt", {lines[test].getOperand(0), pointer, end},
+                                         " Compare the derived address with its end.");
+  std::vector<bool> to_remove(lines.size(), false);
+  to_remove[test_load] = to_remove[update_load] = to_remove[add] = to_remove[store] = true;
+  reduced_function.removeLines(to_remove);
+  int removed_before_setup = (int)(test_load < pointer_setup) +
+                             (int)(update_load < pointer_setup) +
+                             (int)(add < pointer_setup) + (int)(store < pointer_setup);
+  reduced_function.insertLines(pointer_setup + 1 - removed_before_setup, {
+    AsmLine::makeInstruction("addiu", {end, base,
+                                       std::to_string(limit * (1 << shift) + constant)},
+                             " End of the induction variable.")
+  });
+  if (free_registers.front().second >= 0) {
+    function_context.addCalleeSavedRegister(end, free_registers.front().second);
+  }
+  asm_function = reduced_function;
+  return true;
+}
+
+void AsmOptimizer::reduceInductionVariables(AsmFunction& asm_function,
+                                            FunctionContext& function_context) {
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (const Loop& loop : asm_function.findLoops()) {
+      if (reduceInductionVariableOfLoop(asm_function, function_context, loop)) {
+        // The loops are not valid anymore.
+        changed = true;
+        break;
+      }
+    }
+  }
+}
+
+void AsmOptimizer::promoteLocalVariables(AsmFunction& asm_function,
+                                         FunctionContext& function_context) {
+  std::unordered_set<int> address_taken_offsets;
+  if (!findAddressTakenOffsets(asm_function, function_context, address_taken_offsets)) {
+    return;
+  }
+  std::vector<AsmLine>& lines = asm_function.getLines();
+  const std::vector<BasicBlock>& blocks = asm_function.getBlocks();
+  const std::string& frame_register = function_context.getFrameRegister();
+
+  // An access in a loop counts as 8 accesses, in a nested loop as 64, and so on.
+  std::vector<int> line_weights(lines.size(), 1);
+  for (const Loop& loop : asm_function.findLoops()) {
+    for (unsigned int b = 0; b < blocks.size(); b++) {
+      if (!loop.blocks[b]) {
+        continue;
+      }
+      for (int i = blocks[b].first; i <= blocks[b].last; i++) {
+        line_weights[i] = std::min(line_weights[i] * 8, 1 << 12);
+      }
+    }
+  }
+
+  std::map<int, int> offset_weights;
+  std::unordered_set<std::string> used_registers;
+  bool has_call = false;
+  for (unsigned int i = 0; i < lines.size(); i++) {
+    has_call = has_call || lines[i].isCall();
+    for (const std::string& reg : getRegisterOperands(lines[i])) {
+      used_registers.insert(reg);
+    }
+    if ((lines[i].isLoad() || lines[i].isStore()) &&
+        lines[i].getBaseRegister() == frame_register) {
+      int offset;
+      if (!lines[i].getConstantOffset(offset)) {
+        return;
+      }
+      offset_weights[offset] += line_weights[i];
+    }
+  }
+  for (const auto& callee_saved_register : function_context.getCalleeSavedRegisters()) {
+    used_registers.insert(callee_saved_register.first);
+  }
+
+  // Free registers: the temporary ones are preserved only if there is no call.
+  std::vector<std::string> free_registers;
+  if (!has_call) {
+    for (const std::string& reg : LOOP_INVARIANT_REGISTERS) {
+      if (!used_registers.count(reg)) {
+        free_registers.push_back(reg);
+      }
+    }
+  }
+  std::vector<std::string> callee_saved_registers = CALLEE_SAVED_REGISTERS;
+  if (function_context.isFramePointerOmitted()) {
+    callee_saved_registers.push_back("$fp");
+  }
+  for (const std::string& reg : callee_saved_registers) {
+    if (!used_registers.count(reg)) {
+      free_registers.push_back(reg);
+    }
+  }
+
+  std::vector<std::pair<int, int>> candidates;
+  for (const auto& offset_weight : offset_weights) {
+    if (function_context.isScalarVariableOffset(offset_weight.first) &&
+        !address_taken_offsets.count(offset_weight.first)) {
+      candidates.push_back(offset_weight);
+    }
+  }
+  std::stable_sort(candidates.begin(), candidates.end(),
+                   [](const std::pair<int, int>& a, const std::pair<int, int>& b) {
+                     return a.second > b.second;
+                   });
+
+  for (const auto& candidate : candidates) {
+    if (free_registers.empty()) {
+      break;
+    }
+    const int offset = candidate.first;
+    const std::string reg = free_registers.front();
+    const bool is_callee_saved =
+      std::find(callee_saved_registers.begin(), callee_saved_registers.end(), reg) !=
+      callee_saved_registers.end();
+    // A callee saved register costs a save and a restore.
+    if (is_callee_saved && candidate.second <= 2) {
+      continue;
+    }
+    free_registers.erase(free_registers.begin());
+    for (AsmLine& line : lines) {
+      if (!accessesFrameOffset(line, frame_register, offset)) {
+        continue;
+      }
+      const std::string value_register = line.getOperand(0);
+      if (line.isStore()) {
+        line = AsmLine::makeInstruction("move", {reg, value_register},
+                                        " Store the variable at offset " +
+                                        std::to_string(offset) + ", kept in " + reg + ".");
+      } else {
+        line = AsmLine::makeInstruction("move", {value_register, reg},
+                                        " Load the variable at offset " +
+                                        std::to_string(offset) + ", kept in " + reg + ".");
+      }
+    }
+    if (is_callee_saved) {
+      // The place of the variable is not used anymore: use it to save the register.
+      function_context.addCalleeSavedRegister(reg, offset);
+    }
+  }
+  asm_function.buildControlFlowGraph();
+}
+
+// Lines of a piece of assembly text, e.g. the prologue.
+std::vector<AsmLine> parseLines(const std::string& text) {
+  std::vector<AsmLine> lines;
+  std::stringstream text_stream(text);
+  std::string line;
+  while (std::getline(text_stream, line)) {
+    for (const AsmLine& asm_line : AsmLine::parse(line)) {
+      lines.push_back(asm_line);
+    }
+  }
+  return lines;
+}
+
+void AsmOptimizer::eliminateTailCalls(AsmFunction& asm_function,
+                                      const FunctionContext& function_context) {
+  std::vector<AsmLine>& lines = asm_function.getLines();
+  std::vector<AsmLine> new_lines;
+  bool changed = false;
+  for (unsigned int i = 0; i < lines.size(); i++) {
+    if (!lines[i].isBranch() ||
+        lines[i].getBranchTarget() != function_context.getTailCallLabel()) {
+      new_lines.push_back(lines[i]);
+      continue;
+    }
+    changed = true;
+    // Look for the call, with its nop, right before the branch.
+    int nop = new_lines.size() - 1;
+    while (nop >= 0 && !new_lines[nop].isInstruction() && !new_lines[nop].isLabel()) {
+      nop--;
+    }
+    int call = nop - 1;
+    while (call >= 0 && !new_lines[call].isInstruction() && !new_lines[call].isLabel()) {
+      call--;
+    }
+    if (call < 0 || new_lines[nop].getOpcode() != "nop" || !new_lines[call].isCall()) {
+      AsmLine branch = lines[i];
+      branch.setBranchTarget(function_context.getFunctionEpilogueLabel());
+      new_lines.push_back(branch);
+      continue;
+    }
+    AsmLine jump = new_lines[call].getOpcode() == "jal" ?
+      AsmLine::makeInstruction("j", {new_lines[call].getOperand(0)},
+                               " Tail call to: " + new_lines[call].getOperand(0) + ".") :
+      AsmLine::makeInstruction("jr", {new_lines[call].getOperand(0)}, " Tail call.");
+    new_lines.resize(call);
+    // The hint for the linker about the jalr of an external call ("1:" and its .reloc)
+    // does not apply to the jump.
+    if (!new_lines.empty() && new_lines.back().isLabel() &&
+        new_lines.back().getLabel() == "1") {
+      new_lines.pop_back();
+    }
+    if (!new_lines.empty() && new_lines.back().toString().find(".reloc") == 0) {
+      new_lines.pop_back();
+    }
+    new_lines.push_back(jump);
+    new_lines.push_back(AsmLine::makeInstruction("nop", {}, ""));
+  }
+  if (changed) {
+    lines = new_lines;
+    asm_function.buildControlFlowGraph();
+  }
+}
+
+namespace {
+
+// Small global variable accessed as a word relative to $gp, e.g. lw $t0, %gp_rel(a)($gp).
+// Empty for any other line.
+std::string getGlobalPointerRelativeSymbol(const AsmLine& line) {
+  if (!line.isLoad() && !line.isStore()) {
+    return "";
+  }
+  std::string symbol = getAccessedSymbol(line);
+  if (symbol.empty() || line.getBaseRegister() != "$gp" ||
+      line.getMemoryOperand().find("%gp_rel(" + symbol + ")") != 0) {
+    return "";
+  }
+  return symbol;
+}
+
+// Position before a call and the hint for the linker preceding an external call ("1:"
+// and its .reloc).
+int findPositionBeforeCall(const std::vector<AsmLine>& lines, int call) {
+  int position = call;
+  if (position > 0 && lines[position - 1].isLabel() &&
+      lines[position - 1].getLabel() == "1") {
+    position--;
+  }
+  if (position > 0 && lines[position - 1].toString().find(".reloc") == 0) {
+    position--;
+  }
+  return position;
+}
+
+// Position after the delay slot if the line at the position is in the delay slot of the
+// previous instruction.
+int skipDelaySlot(const std::vector<AsmLine>& lines, int position) {
+  int previous = position - 1;
+  while (previous >= 0 && !lines[previous].isInstruction() && !lines[previous].isLabel()) {
+    previous--;
+  }
+  if (previous < 0 || !lines[previous].isInstruction() ||
+      !(lines[previous].isBranch() || lines[previous].isCall() ||
+        lines[previous].endsBlock())) {
+    return position;
+  }
+  while (position < (int)lines.size() && !lines[position].isInstruction()) {
+    position++;
+  }
+  return position + 1;
+}
+
+} // namespace
+
+bool AsmOptimizer::promoteGlobalVariableOfLoop(AsmFunction& asm_function,
+                                               FunctionContext& function_context,
+                                               const Loop& loop) {
+  int preheader_position = asm_function.getPreheaderPosition(loop);
+  if (preheader_position < 0) {
+    return false;
+  }
+  std::vector<AsmLine>& lines = asm_function.getLines();
+  const std::vector<BasicBlock>& blocks = asm_function.getBlocks();
+  const std::string& frame_register = function_context.getFrameRegister();
+
+  // Accesses to the small global variables in the loop. A variable whose address is
+  // computed, or accessed in another way, is left in memory.
+  std::vector<int> loop_lines;
+  std::map<std::string, int> accesses;
+  std::set<std::string> stored_symbols;
+  std::set<std::string> other_symbols;
+  for (unsigned int b = 0; b < blocks.size(); b++) {
+    if (!loop.blocks[b]) {
+      continue;
+    }
+    if (blocks[b].is_exit) {
+      return false;
+    }
+    for (int i = blocks[b].first; i <= blocks[b].last; i++) {
+      const AsmLine& line = lines[i];
+      if (line.isUnknown()) {
+        return false;
+      }
+      loop_lines.push_back(i);
+      std::string symbol = getGlobalPointerRelativeSymbol(line);
+      if (!symbol.empty()) {
+        accesses[symbol]++;
+        if (line.isStore()) {
+          stored_symbols.insert(symbol);
+        }
+        continue;
+      }
+      for (const std::string& operand : line.getOperands()) {
+        size_t percent = operand.find('%');
+        if (percent != std::string::npos) {
+          other_symbols.insert(getAddressSymbol(operand.substr(percent)));
+        } else if (line.getOpcode() == "la") {
+          other_symbols.insert(getAddressSymbol(operand));
+        }
+      }
+    }
+  }
+
+  // The memory of the variable is brought up to date before the lines that may read it
+  // (calls, loads through a pointer), and the register reloaded after the lines that may
+  // write it. A variable is promoted if that saves accesses.
+  std::unordered_map<std::string, AddressProvenance> provenances =
+    findRegisterProvenances(asm_function, frame_register);
+  auto find_effects = [&](int i, const std::string& symbol, bool& reads, bool& writes) {
+    const AsmLine& line = lines[i];
+    reads = false;
+    writes = false;
+    if (line.isCall()) {
+      if (line.getOpcode() != "jal") {
+        reads = writes = true;
+        return;
+      }
+      const ModRefSummary& summary = mod_ref_summaries.getSummary(line.getOperand(0));
+      bool is_pointed = mod_ref_summaries.mayPointTo(symbol);
+      reads = summary.is_unknown || summary.read_globals.count(symbol) ||
+              (summary.reads_through_pointers && is_pointed);
+      writes = summary.is_unknown || summary.written_globals.count(symbol) ||
+               (summary.writes_through_pointers && is_pointed);
+    } else if ((line.isLoad() || line.isStore()) &&
+               line.getBaseRegister() != frame_register &&
+               getAccessedSymbol(line).empty()) {
+      AddressProvenance provenance = findProvenanceAtLine(
+        asm_function, i, line.getBaseRegister(), frame_register, provenances);
+      bool may_alias = provenance.symbols.count(symbol) ||
+                       (provenance.is_any && mod_ref_summaries.mayPointTo(symbol));
+      reads = may_alias && line.isLoad();
+      writes = may_alias && line.isStore();
+    }
+  };
+  std::string promoted;
+  int best_saving = 0;
+  for (const std::string& symbol : stored_symbols) {
+    if (other_symbols.count(symbol)) {
+      continue;
+    }
+    int synchronizations = 0;
+    bool is_possible = true;
+    for (int i : loop_lines) {
+      bool reads;
+      bool writes;
+      find_effects(i, symbol, reads, writes);
+      if (!reads && !writes) {
+        continue;
+      }
+      synchronizations += writes ? 2 : 1;
+      // Nothing can be inserted in the delay slot of a branch.
+      int previous = lines[i].isCall() ? findPositionBeforeCall(lines, i) - 1 : i - 1;
+      if (previous >= 0 && lines[previous].isInstruction() &&
+          (lines[previous].isBranch() || lines[previous].isCall() ||
+           lines[previous].endsBlock())) {
+        is_possible = false;
+      }
+    }
+    if (is_possible && accesses[symbol] - synchronizations > best_saving) {
+      best_saving = accesses[symbol] - synchronizations;
+      promoted = symbol;
+    }
+  }
+  if (promoted.empty()) {
+    return false;
+  }
+
+  // The memory is written back at each exit of the loop: at the start of an exit block
+  // entered only from the loop, or when falling through into an exit block.
+  std::set<int> exit_positions;
+  for (unsigned int b = 0; b < blocks.size(); b++) {
+    if (!loop.blocks[b]) {
+      continue;
+    }
+    for (int successor : blocks[b].successors) {
+      if (loop.blocks[successor]) {
+        continue;
+      }
+      bool is_dedicated = true;
+      for (int predecessor : blocks[successor].predecessors) {
+        is_dedicated = is_dedicated && loop.blocks[predecessor];
+      }
+      int branch = blocks[b].last;
+      while (branch > blocks[b].first &&
+             !(lines[branch].isInstruction() && lines[branch].isBranch())) {
+        branch--;
+      }
+      bool is_branch_target =
+        lines[branch].isInstruction() && lines[branch].isBranch() &&
+        asm_function.getBlockOfLabel(lines[branch].getBranchTarget()) == successor;
+      if (is_dedicated) {
+        int position = blocks[successor].first;
+        while (position < blocks[successor].last && lines[position].isLabel()) {
+          position++;
+        }
+        exit_positions.insert(skipDelaySlot(lines, position));
+      } else if (successor == (int)b + 1 && !is_branch_target) {
+        exit_positions.insert(skipDelaySlot(lines, blocks[successor].first));
+      } else {
+        return false;
+      }
+    }
+  }
+
+  std::vector<std::pair<std::string, int>> free_registers =
+    findFreeRegistersOfLoop(asm_function, function_context, loop, preheader_position);
+  if (free_registers.empty()) {
+    return false;
+  }
+  const std::string& reg = free_registers[0].first;
+  const std::string memory_operand = "%gp_rel(" + promoted + ")($gp)";
+  const AsmLine load = AsmLine::makeInstruction(
+    "lw", {reg, memory_operand},
+    " Load the global variable " + promoted + ", kept in " + reg + " in the loop.");
+  const AsmLine store = AsmLine::makeInstruction(
+    "sw", {reg, memory_operand},
+    " Store the global variable " + promoted + ", kept in " + reg + " in the loop.");
+  const AsmLine nop = AsmLine::makeInstruction("nop", {}, "");
+
+  // Lines to insert before each position.
+  std::map<int, std::vector<AsmLine>> inserted;
+  std::vector<bool> to_remove(lines.size(), false);
+  inserted[preheader_position] = {load, nop};
+  for (int i : loop_lines) {
+    AsmLine& line = lines[i];
+    if (getGlobalPointerRelativeSymbol(line) == promoted) {
+      std::string comment = " Global variable " + promoted + ", kept in " + reg + ".";
+      line = line.isLoad() ?
+        AsmLine::makeInstruction("move", {line.getOperand(0), reg}, comment) :
+        AsmLine::makeInstruction("move", {reg, line.getOperand(0)}, comment);
+      if (i + 1 < (int)lines.size() && lines[i + 1].isInstruction() &&
+          lines[i + 1].getOpcode() == "nop") {
+        to_remove[i + 1] = true;
+      }
+      continue;
+    }
+    bool reads;
+    bool writes;
+    find_effects(i, promoted, reads, writes);
+    if (!reads && !writes) {
+      continue;
+    }
+    int before = line.isCall() ? findPositionBeforeCall(lines, i) : i;
+    inserted[before].push_back(store);
+    if (writes) {
+      int after = skipDelaySlot(lines, i + 1);
+      inserted[after].push_back(load);
+      inserted[after].push_back(nop);
+    }
+  }
+  for (int position : exit_positions) {
+    inserted[position].push_back(store);
+  }
+
+  std::vector<AsmLine> new_lines;
+  for (unsigned int i = 0; i <= lines.size(); i++) {
+    auto inserted_lines = inserted.find(i);
+    if (inserted_lines != inserted.end()) {
+      new_lines.insert(new_lines.end(), inserted_lines->second.begin(),
+                       inserted_lines->second.end());
+    }
+    if (i < lines.size() && !to_remove[i]) {
+      new_lines.push_back(lines[i]);
+    }
+  }
+  lines = new_lines;
+  if (free_registers[0].second >= 0) {
+    function_context.addCalleeSavedRegister(reg, free_registers[0].second);
+  }
+  asm_function.buildControlFlowGraph();
+  return true;
+}
+
+void AsmOptimizer::promoteGlobalVariablesInLoops(AsmFunction& asm_function,
+                                                 FunctionContext& function_context) {
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (const Loop& loop : asm_function.findLoops()) {
+      if (promoteGlobalVariableOfLoop(asm_function, function_context, loop)) {
+        // The loops are not valid anymore.
+        changed = true;
+        break;
+      }
+    }
+  }
+}
+
+namespace {
+
+// Word of memory accessed by a load or a store.
+class MemoryLocation {
+ public:
+  // Unique name: "frame:<offset>" for the stack frame, otherwise the memory operand (e.g.
+  // %gp_rel(a)($gp), 4($t0)).
+  std::string name;
+  // Base register of the address, other than the frame registers.
+  std::string base;
+  bool is_frame = false;
+  int offset = 0;
+  // Global variable the address is relative to, if any.
+  std::string symbol;
+};
+
+MemoryLocation getMemoryLocation(const AsmLine& line, const std::string& frame_register) {
+  MemoryLocation location;
+  std::string base = line.getBaseRegister();
+  if ((base == frame_register || base == "$sp") &&
+      line.getConstantOffset(location.offset)) {
+    location.is_frame = true;
+    location.name = "frame:" + std::to_string(location.offset);
+    return location;
+  }
+  location.base = base;
+  location.symbol = getAccessedSymbol(line);
+  const std::string& memory_operand = line.getMemoryOperand();
+  location.name = memory_operand.substr(0, memory_operand.rfind('(')) + "(" + base + ")";
+  return location;
+}
+
+// What a line may write in memory, other than the word it stores to.
+class MemoryWrite {
+ public:
+  // The words of the stack frame that are not private (see isPrivateFrameOffset).
+  bool writes_frame = false;
+  // Global variables, or any global variable a pointer may point to.
+  std::set<std::string> symbols;
+  bool writes_through_pointers = false;
+  bool writes_anything = false;
+
+  bool mayWrite(const MemoryLocation& location, bool is_private) const {
+    if (writes_anything) {
+      return !(location.is_frame && is_private);
+    }
+    if (location.is_frame) {
+      return !is_private && (writes_frame || writes_through_pointers);
+    }
+    if (!location.symbol.empty() &&
+        (symbols.count(location.symbol) ||
+         (writes_through_pointers && mod_ref_summaries.mayPointTo(location.symbol)))) {
+      return true;
+    }
+    // An address computed in a register may point anywhere.
+    return location.symbol.empty() || location.base != "$gp";
+  }
+};
+
+} // namespace
+
+bool AsmOptimizer::forwardStoresToLoads(AsmFunction& asm_function,
+                                        const FunctionContext& function_context) {
+  std::vector<AsmLine>& lines = asm_function.getLines();
+  const std::vector<BasicBlock>& blocks = asm_function.getBlocks();
+  const std::string& frame_register = function_context.getFrameRegister();
+  for (const AsmLine& line : lines) {
+    if (line.isUnknown()) {
+      return false;
+    }
+  }
+  std::unordered_set<int> address_taken_offsets;
+  if (!findAddressTakenOffsets(asm_function, function_context, address_taken_offsets)) {
+    return false;
+  }
+  std::unordered_map<std::string, AddressProvenance> provenances =
+    findRegisterProvenances(asm_function, frame_register);
+
+  // Memory location --> register holding its value.
+  typedef std::map<std::string, std::pair<MemoryLocation, std::string>> Values;
+  auto kill_register = [](Values& values, const std::string& reg) {
+    for (auto it = values.begin(); it != values.end();) {
+      bool is_killed = it->second.second == reg || it->second.first.base == reg;
+      it = is_killed ? values.erase(it) : std::next(it);
+    }
+  };
+  auto kill_memory = [&](Values& values, const MemoryWrite& write) {
+    for (auto it = values.begin(); it != values.end();) {
+      const MemoryLocation& location = it->second.first;
+      bool is_private = location.is_frame &&
+        isPrivateFrameOffset(function_context, address_taken_offsets, location.offset);
+      it = write.mayWrite(location, is_private) ? values.erase(it) : std::next(it);
+    }
+  };
+  // Effect of a line on the values. The loads of a value already in a register are
+  // replaced with copies if 'rewrite' is set.
+  bool changed = false;
+  std::vector<bool> to_remove(lines.size(), false);
+  auto transfer = [&](Values& values, int i, bool rewrite) {
+    AsmLine& line = lines[i];
+    if (line.isLoad() || line.isStore()) {
+      MemoryLocation location = getMemoryLocation(line, frame_register);
+      std::string reg = canonicalRegister(line.getOperand(0));
+      if (line.isLoad()) {
+        auto value = values.find(location.name);
+        if (rewrite && value != values.end()) {
+          const std::string& source = value->second.second;
+          if (source == reg) {
+            to_remove[i] = true;
+          } else {
+            line = AsmLine::makeInstruction(
+              "move", {reg, source},
+              " The value of " + location.name + " is in " + source + ".");
+          }
+          if (i + 1 < (int)lines.size() && lines[i + 1].isInstruction() &&
+              lines[i + 1].getOpcode() == "nop") {
+            to_remove[i + 1] = true;
+          }
+          changed = true;
+        }
+        // The value stays where it was found, which may live longer than the register
+        // loaded.
+        kill_register(values, reg);
+        if (reg != location.base && reg != "$0" && !values.count(location.name)) {
+          values[location.name] = {location, reg};
+        }
+        return;
+      }
+      // A store to the frame may also write the words read through a pointer.
+      MemoryWrite write;
+      if (!location.is_frame && !location.symbol.empty()) {
+        write.symbols.insert(location.symbol);
+      } else {
+        AddressProvenance provenance = findProvenanceAtLine(
+          asm_function, i, location.base, frame_register, provenances);
+        write.writes_frame = provenance.is_frame;
+        write.symbols = provenance.symbols;
+        write.writes_through_pointers = provenance.is_any;
+      }
+      kill_memory(values, write);
+      values[location.name] = {location, reg};
+      return;
+    }
+    if (line.isCall()) {
+      MemoryWrite write;
+      write.writes_frame = true;
+      if (line.getOpcode() == "jal") {
+        const ModRefSummary& summary = mod_ref_summaries.getSummary(line.getOperand(0));
+        write.symbols.insert(summary.written_globals.begin(),
+                             summary.written_globals.end());
+        write.writes_through_pointers = summary.writes_through_pointers;
+        write.writes_anything = summary.is_unknown;
+      } else {
+        write.writes_anything = true;
+      }
+      kill_memory(values, write);
+    }
+    for (const std::string& definition : line.getDefinedRegisters()) {
+      kill_register(values, definition);
+    }
+  };
+
+  // The arguments are in their registers at the entry, and in their place in the frame
+  // of the caller.
+  Values entry_values;
+  for (int k = 0; k < 4; k++) {
+    MemoryLocation location;
+    location.is_frame = true;
+    location.offset = function_context.getFrameSize() + 4 * k;
+    location.name = "frame:" + std::to_string(location.offset);
+    entry_values[location.name] = {location, "$a" + std::to_string(k)};
+  }
+
+  auto is_same = [](const Values& a, const Values& b) {
+    if (a.size() != b.size()) {
+      return false;
+    }
+    for (const auto& value : a) {
+      auto other = b.find(value.first);
+      if (other == b.end() || other->second.second != value.second.second) {
+        return false;
+      }
+    }
+    return true;
+  };
+
+  // Values available at the entry of each block: on every path to it.
+  std::vector<Values> block_in(blocks.size());
+  std::vector<Values> block_out(blocks.size());
+  std::vector<bool> is_computed(blocks.size(), false);
+  bool is_changed = true;
+  while (is_changed) {
+    is_changed = false;
+    for (unsigned int b = 0; b < blocks.size(); b++) {
+      bool is_first = true;
+      Values in;
+      if (b == 0) {
+        in = entry_values;
+        is_first = false;
+      }
+      for (int predecessor : blocks[b].predecessors) {
+        if (!is_computed[predecessor]) {
+          continue;
+        }
+        if (is_first) {
+          in = block_out[predecessor];
+          is_first = false;
+          continue;
+        }
+        for (auto it = in.begin(); it != in.end();) {
+          auto other = block_out[predecessor].find(it->first);
+          bool is_kept = other != block_out[predecessor].end() &&
+                         other->second.second == it->second.second;
+          it = is_kept ? std::next(it) : in.erase(it);
+        }
+      }
+      if (is_first) {
+        // Not reachable (yet), it must not constrain its successors.
+        continue;
+      }
+      Values out = in;
+      for (int i = blocks[b].first; i <= blocks[b].last; i++) {
+        transfer(out, i, false);
+      }
+      if (!is_computed[b] || !is_same(in, block_in[b]) || !is_same(out, block_out[b])) {
+        is_changed = true;
+      }
+      is_computed[b] = true;
+      block_in[b] = in;
+      block_out[b] = out;
+    }
+  }
+
+  for (unsigned int b = 0; b < blocks.size(); b++) {
+    Values values = block_in[b];
+    for (int i = blocks[b].first; i <= blocks[b].last; i++) {
+      transfer(values, i, true);
+    }
+  }
+  if (changed) {
+    asm_function.removeLines(to_remove);
+  }
+  return changed;
+}
+
+bool AsmOptimizer::removeDeadStores(AsmFunction& asm_function,
+                                    const FunctionContext& function_context) {
+  const std::vector<AsmLine>& lines = asm_function.getLines();
+  const std::vector<BasicBlock>& blocks = asm_function.getBlocks();
+  const std::string& frame_register = function_context.getFrameRegister();
+  for (const AsmLine& line : lines) {
+    if (line.isUnknown()) {
+      return false;
+    }
+  }
+  std::unordered_set<int> address_taken_offsets;
+  if (!findAddressTakenOffsets(asm_function, function_context, address_taken_offsets)) {
+    return false;
+  }
+  std::unordered_map<std::string, AddressProvenance> provenances =
+    findRegisterProvenances(asm_function, frame_register);
+
+  // The words tracked: the private words of the frame, which are dead once the function
+  // returns, and the small global variables, which are live.
+  std::set<std::string> globals;
+  for (const AsmLine& line : lines) {
+    std::string symbol = getGlobalPointerRelativeSymbol(line);
+    if (!symbol.empty()) {
+      globals.insert(symbol);
+    }
+  }
+  auto get_tracked_location = [&](const AsmLine& line) -> std::string {
+    MemoryLocation location = getMemoryLocation(line, frame_register);
+    if (location.is_frame &&
+        isPrivateFrameOffset(function_context, address_taken_offsets, location.offset)) {
+      return location.name;
+    }
+    std::string symbol = getGlobalPointerRelativeSymbol(line);
+    return symbol.empty() ? "" : "global:" + symbol;
+  };
+
+  // Words read and written by each line.
+  std::vector<std::vector<std::string>> line_uses(lines.size());
+  std::vector<std::string> line_definition(lines.size());
+  for (unsigned int i = 0; i < lines.size(); i++) {
+    const AsmLine& line = lines[i];
+    std::vector<std::string>& uses = line_uses[i];
+    if (line.isLoad() || line.isStore()) {
+      std::string location = get_tracked_location(line);
+      if (line.isStore()) {
+        line_definition[i] = location;
+      } else if (!location.empty()) {
+        uses.push_back(location);
+      } else if (line.getBaseRegister() != frame_register &&
+                 line.getBaseRegister() != "$sp") {
+        AddressProvenance provenance = findProvenanceAtLine(
+          asm_function, i, line.getBaseRegister(), frame_register, provenances);
+        for (const std::string& symbol : globals) {
+          if (provenance.symbols.count(symbol) ||
+              (provenance.is_any && mod_ref_summaries.mayPointTo(symbol))) {
+            uses.push_back("global:" + symbol);
+          }
+        }
+      }
+    } else if (line.isCall()) {
+      const ModRefSummary& summary = mod_ref_summaries.getSummary(
+        line.getOpcode() == "jal" ? line.getOperand(0) : "");
+      for (const std::string& symbol : globals) {
+        if (summary.is_unknown || summary.read_globals.count(symbol) ||
+            (summary.reads_through_pointers && mod_ref_summaries.mayPointTo(symbol))) {
+          uses.push_back("global:" + symbol);
+        }
+      }
+    }
+  }
+
+  // Liveness of the words, until a fixed point is reached.
+  std::vector<std::set<std::string>> block_live_in(blocks.size());
+  std::vector<std::set<std::string>> block_live_out(blocks.size());
+  auto step = [&](std::set<std::string>& live, int i) {
+    if (!line_definition[i].empty()) {
+      live.erase(line_definition[i]);
+    }
+    live.insert(line_uses[i].begin(), line_uses[i].end());
+  };
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int b = blocks.size() - 1; b >= 0; b--) {
+      std::set<std::string> live;
+      if (blocks[b].is_exit) {
+        for (const std::string& symbol : globals) {
+          live.insert("global:" + symbol);
+        }
+      }
+      for (int successor : blocks[b].successors) {
+        live.insert(block_live_in[successor].begin(), block_live_in[successor].end());
+      }
+      block_live_out[b] = live;
+      for (int i = blocks[b].last; i >= blocks[b].first; i--) {
+        step(live, i);
+      }
+      if (live != block_live_in[b]) {
+        block_live_in[b] = live;
+        changed = true;
+      }
+    }
+  }
+
+  // A store is dead if the word is not read before being written again, or before the
+  // function returns for a word of the frame.
+  std::vector<bool> to_remove(lines.size(), false);
+  bool removed = false;
+  for (unsigned int b = 0; b < blocks.size(); b++) {
+    std::set<std::string> live = block_live_out[b];
+    for (int i = blocks[b].last; i >= blocks[b].first; i--) {
+      if (!line_definition[i].empty() && !live.count(line_definition[i])) {
+        to_remove[i] = true;
+        if (i + 1 < (int)lines.size() && lines[i + 1].isInstruction() &&
+            lines[i + 1].getOpcode() == "nop") {
+          to_remove[i + 1] = true;
+        }
+        removed = true;
+      }
+      step(live, i);
+    }
+  }
+  if (removed) {
+    asm_function.removeLines(to_remove);
+  }
+  return removed;
+}
+
+void AsmOptimizer::optimizeMemoryAccesses(AsmFunction& asm_function,
+                                          const FunctionContext& function_context) {
+  bool changed = true;
+  while (changed) {
+    changed = forwardStoresToLoads(asm_function, function_context);
+    changed = removeDeadStores(asm_function, function_context) || changed;
+  }
+}
+
+bool AsmOptimizer::needsStackFrame(const AsmLine& line,
+                                   const FunctionContext& function_context) {
+  if (!line.isInstruction()) {
+    return false;
+  }
+  if (line.isCall() || line.isUnknown()) {
+    return true;
+  }
+  if (line.isTailCall()) {
+    // The frame, if any, is released before jumping.
+    return false;
+  }
+  std::vector<std::string> registers = line.getUsedRegisters();
+  std::vector<std::string> definitions = line.getDefinedRegisters();
+  registers.insert(registers.end(), definitions.begin(), definitions.end());
+  // Accesses to the arguments, homed in the caller's frame, can be done from $sp.
+  int offset;
+  if ((line.isLoad() || line.isStore()) &&
+      line.getBaseRegister() == function_context.getFrameRegister() &&
+      line.getConstantOffset(offset) && offset >= function_context.getFrameSize()) {
+    registers = {canonicalRegister(line.getOperand(0))};
+  }
+  for (const std::string& reg : registers) {
+    if (reg == "$sp" || reg == "$fp" ||
+        std::find(CALLEE_SAVED_REGISTERS.begin(), CALLEE_SAVED_REGISTERS.end(), reg) !=
+        CALLEE_SAVED_REGISTERS.end()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+int AsmOptimizer::findPrologueBlock(const AsmFunction& asm_function,
+                                    const std::vector<bool>& needs_frame) {
+  const std::vector<BasicBlock>& blocks = asm_function.getBlocks();
+  std::vector<std::vector<bool>> dominators = asm_function.computeDominators();
+  int blocks_number = blocks.size();
+
+  // Common dominators of the blocks needing the frame.
+  std::vector<bool> common_dominators(blocks_number, true);
+  for (int b = 0; b < blocks_number; b++) {
+    if (needs_frame[b]) {
+      for (int d = 0; d < blocks_number; d++) {
+        common_dominators[d] = common_dominators[d] && dominators[b][d];
+      }
+    }
+  }
+
+  // Try from the closest one to the blocks needing the frame, i.e. the one dominated by
+  // all the others.
+  std::vector<int> candidates;
+  for (int d = 0; d < blocks_number; d++) {
+    if (common_dominators[d]) {
+      candidates.push_back(d);
+    }
+  }
+  std::sort(candidates.begin(), candidates.end(), [&dominators](int a, int b) {
+    return std::count(dominators[a].begin(), dominators[a].end(), true) >
+           std::count(dominators[b].begin(), dominators[b].end(), true);
+  });
+  for (int candidate : candidates) {
+    std::vector<bool> reachable = asm_function.getBlocksReachableFrom(candidate);
+    if (reachable[candidate]) {
+      // Part of a loop: the prologue would be executed more than once.
+      continue;
+    }
+    bool dominates_reachable = true;
+    for (int b = 0; b < blocks_number; b++) {
+      if (reachable[b] && !dominators[b][candidate]) {
+        dominates_reachable = false;
+      }
+    }
+    if (dominates_reachable) {
+      return candidate;
+    }
+  }
+  return -1;
+}
+
+std::string AsmOptimizer::shrinkWrap(AsmFunction& asm_function,
+                                     const FunctionContext& function_context,
+                                     const std::string& prologue,
+                                     const std::string& frame_teardown,
+                                     const std::string& fast_epilogue_label) {
+  asm_function.removeUnreachableBlocks();
+  std::vector<AsmLine>& lines = asm_function.getLines();
+  const std::vector<BasicBlock>& blocks = asm_function.getBlocks();
+
+  std::vector<bool> needs_frame(blocks.size(), false);
+  bool any_needs_frame = false;
+  for (unsigned int b = 0; b < blocks.size(); b++) {
+    for (int i = blocks[b].first; i <= blocks[b].last; i++) {
+      if (needsStackFrame(lines[i], function_context)) {
+        needs_frame[b] = true;
+        any_needs_frame = true;
+      }
+    }
+  }
+
+  // Blocks executed after the prologue.
+  std::vector<bool> with_frame(blocks.size(), any_needs_frame);
+  int prologue_position = 0;
+  std::string result = any_needs_frame ? "full" : "none";
+  if (any_needs_frame) {
+    int prologue_block = findPrologueBlock(asm_function, needs_frame);
+    if (prologue_block > 0) {
+      with_frame = asm_function.getBlocksReachableFrom(prologue_block);
+      with_frame[prologue_block] = true;
+      prologue_position = blocks[prologue_block].first;
+      while (prologue_position < (int)lines.size() && lines[prologue_position].isLabel()) {
+        prologue_position++;
+      }
+      // The block may start with the label of the hint for the linker of an external call
+      // ("1:"), which must stay just before the call.
+      if (prologue_position < (int)lines.size() && lines[prologue_position].isCall()) {
+        prologue_position = findPositionBeforeCall(lines, prologue_position);
+      }
+      result = "partial";
+    }
+  }
+
+  if (result != "full") {
+    const std::string& epilogue_label = function_context.getFunctionEpilogueLabel();
+    int frame_size = function_context.getFrameSize();
+    for (unsigned int b = 0; b < blocks.size(); b++) {
+      if (with_frame[b]) {
+        continue;
+      }
+      for (int i = blocks[b].first; i <= blocks[b].last; i++) {
+        AsmLine& line = lines[i];
+        // Arguments are in the caller's frame, just above $sp.
+        int offset;
+        if ((line.isLoad() || line.isStore()) &&
+            line.getBaseRegister() == function_context.getFrameRegister() &&
+            line.getConstantOffset(offset)) {
+          line.setOperand(1, std::to_string(offset - frame_size) + "($sp)");
+        }
+        // Return without restoring anything.
+        if (result == "partial" && line.isBranch() &&
+            line.getBranchTarget() == epilogue_label) {
+          line.setBranchTarget(fast_epilogue_label);
+        }
+      }
+    }
+    // The last block would fall through into the epilogue.
+    if (result == "partial" && !with_frame[blocks.size() - 1] && blocks.back().is_exit) {
+      const AsmLine* last_instruction = nullptr;
+      for (int i = blocks.back().last; i >= blocks.back().first; i--) {
+        if (lines[i].isInstruction()) {
+          last_instruction = &lines[i];
+          break;
+        }
+      }
+      if (last_instruction == nullptr || last_instruction->hasFallThrough()) {
+        lines.push_back(AsmLine::makeInstruction("b", {fast_epilogue_label},
+                                                 " Return without stack frame."));
+      }
+    }
+  }
+
+  // Insert the prologue, and release the frame before the tail calls done with it.
+  const std::vector<AsmLine> prologue_lines = parseLines(prologue);
+  const std::vector<AsmLine> teardown_lines = parseLines(frame_teardown);
+  std::vector<AsmLine> new_lines;
+  for (unsigned int i = 0; i <= lines.size(); i++) {
+    if (result != "none" && (int)i == prologue_position) {
+      new_lines.insert(new_lines.end(), prologue_lines.begin(), prologue_lines.end());
+    }
+    if (i == lines.size()) {
+      break;
+    }
+    if (lines[i].isTailCall() && with_frame[asm_function.getBlockOfLine(i)]) {
+      new_lines.insert(new_lines.end(), teardown_lines.begin(), teardown_lines.end());
+    }
+    new_lines.push_back(lines[i]);
+  }
+  lines = new_lines;
+  asm_function.buildControlFlowGraph();
+  return result;
+}
+
+// Branches and block layout.
+
+namespace {
+
+// Branch taken exactly when the given one is not.
+const std::unordered_map<std::string, std::string> INVERTED_BRANCH_OPCODES = {
+  {"beq", "bne"}, {"bne", "beq"}, {"beqz", "bnez"}, {"bnez", "beqz"},
+  {"blez", "bgtz"}, {"bgtz", "blez"}, {"bltz", "bgez"}, {"bgez", "bltz"}
+};
+
+// Register compared with zero by a branch (e.g. beq $t0, $0, label or bnez $t0, label),
+// and whether the branch is taken when it is zero. Returns false for the other lines.
+bool getZeroTest(const AsmLine& line, std::string& reg, bool& is_taken_if_zero) {
+  if (!line.isConditionalBranch()) {
+    return false;
+  }
+  const std::string& opcode = line.getOpcode();
+  if (opcode == "beqz" || opcode == "bnez") {
+    reg = AsmOptimizer::canonicalRegister(line.getOperand(0));
+    is_taken_if_zero = opcode == "beqz";
+    return reg != "$0";
+  }
+  if (opcode != "beq" && opcode != "bne") {
+    return false;
+  }
+  const std::string first = AsmOptimizer::canonicalRegister(line.getOperand(0));
+  const std::string second = AsmOptimizer::canonicalRegister(line.getOperand(1));
+  if (second == "$0") {
+    reg = first;
+  } else if (first == "$0") {
+    reg = second;
+  } else {
+    return false;
+  }
+  is_taken_if_zero = opcode == "beq";
+  return reg != "$0";
+}
+
+// Registers known to be zero (true) or not (false) after the line.
+void updateZeroRegisters(const AsmLine& line,
+                         std::unordered_map<std::string, bool>& is_zero) {
+  if (line.isUnknown()) {
+    is_zero.clear();
+    return;
+  }
+  for (const std::string& reg : line.getDefinedRegisters()) {
+    is_zero.erase(reg);
+  }
+  int value;
+  if (line.getOpcode() == "li" && parseInteger(line.getOperand(1), value)) {
+    is_zero[AsmOptimizer::canonicalRegister(line.getOperand(0))] = value == 0;
+  } else if (line.getOpcode() == "move" &&
+             AsmOptimizer::canonicalRegister(line.getOperand(1)) == "$0") {
+    is_zero[AsmOptimizer::canonicalRegister(line.getOperand(0))] = true;
+  }
+}
+
+// Outcome of a branch comparing a register with zero, if the register is known to be zero
+// or not. Returns false if the outcome is not known.
+bool getKnownOutcome(const AsmLine& line,
+                     const std::unordered_map<std::string, bool>& is_zero,
+                     bool& is_taken) {
+  std::string reg;
+  bool is_taken_if_zero;
+  if (!getZeroTest(line, reg, is_taken_if_zero) || !is_zero.count(reg)) {
+    return false;
+  }
+  is_taken = is_zero.at(reg) == is_taken_if_zero;
+  return true;
+}
+
+// First instruction executed from the position, skipping the labels, the comments, the
+// nops and the removed lines. The number of lines if the body ends first.
+int skipToInstruction(const std::vector<AsmLine>& lines, const std::vector<bool>& removed,
+                      int position) {
+  while (position < (int)lines.size() &&
+         (!lines[position].isInstruction() || removed[position] ||
+          lines[position].getOpcode() == "nop")) {
+    position++;
+  }
+  return position;
+}
+
+// A label placed right before the position, with only comments and nops in between.
+// Empty if there is none. Numeric labels (e.g. "1:" before a call) cannot be branched
+// to by name.
+std::string findLabelBefore(const std::vector<AsmLine>& lines,
+                            const std::vector<bool>& removed, int position) {
+  for (int i = position - 1; i >= 0 && (!lines[i].isInstruction() || removed[i] ||
+                                         lines[i].getOpcode() == "nop"); i--) {
+    if (lines[i].isLabel() && !removed[i] && !std::isdigit(lines[i].getLabel()[0])) {
+      return lines[i].getLabel();
+    }
+  }
+  return "";
+}
+
+// Position of the first instruction a branch to the label executes, following the jumps
+// and the branches whose outcome is known from the registers known to be zero or not.
+// Returns -1 if the branch leaves the body, with the label outside of it in 'label', or
+// -2 if the jumps form a cycle.
+int followBranch(const std::vector<AsmLine>& lines, const std::vector<bool>& removed,
+                 const std::unordered_map<std::string, int>& label_lines,
+                 const std::unordered_map<std::string, bool>& is_zero,
+                 std::string& label) {
+  for (unsigned int jumps = 0; jumps <= lines.size(); jumps++) {
+    auto label_line = label_lines.find(label);
+    if (label_line == label_lines.end()) {
+      return -1;
+    }
+    int position = skipToInstruction(lines, removed, label_line->second);
+    bool is_taken = false;
+    while (position < (int)lines.size() &&
+           getKnownOutcome(lines[position], is_zero, is_taken) && !is_taken) {
+      position = skipToInstruction(lines, removed, position + 1);
+    }
+    if (position == (int)lines.size() || !lines[position].isBranch() ||
+        (lines[position].isConditionalBranch() && !is_taken)) {
+      return position;
+    }
+    label = lines[position].getBranchTarget();
+  }
+  return -2;
+}
+
+// The block has no fall through into the next one: it ends with a jump.
+bool endsWithJump(const AsmFunction& asm_function, int block) {
+  const std::vector<AsmLine>& lines = asm_function.getLines();
+  const BasicBlock& basic_block = asm_function.getBlocks()[block];
+  for (int i = basic_block.last; i >= basic_block.first; i--) {
+    if (lines[i].isInstruction()) {
+      return !lines[i].hasFallThrough();
+    }
+  }
+  return false;
+}
+
+// The block has neither labels nor instructions, e.g. the comments left by unreachable
+// code.
+bool isCommentBlock(const AsmFunction& asm_function, int block) {
+  const std::vector<AsmLine>& lines = asm_function.getLines();
+  const BasicBlock& basic_block = asm_function.getBlocks()[block];
+  for (int i = basic_block.first; i <= basic_block.last; i++) {
+    if (lines[i].isInstruction() || lines[i].isLabel()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// The execution can continue after the last line, into the epilogue.
+bool fallsIntoEpilogue(const std::vector<AsmLine>& lines) {
+  for (int i = lines.size() - 1; i >= 0; i--) {
+    if (lines[i].isInstruction()) {
+      return lines[i].hasFallThrough();
+    }
+  }
+  return true;
+}
+
+// Label of the first line of the block, added if it has none.
+std::string getOrAddLabel(std::vector<AsmLine>& lines, int first) {
+  for (int i = first; i < (int)lines.size() && !lines[i].isInstruction(); i++) {
+    if (lines[i].isLabel() && !std::isdigit(lines[i].getLabel()[0])) {
+      return lines[i].getLabel();
+    }
+  }
+  const std::string label = CompilerUtil::makeUniqueId("block");
+  lines.insert(lines.begin() + first, AsmLine::makeLabel(label));
+  return label;
+}
+
+std::unordered_map<std::string, int> findLabelLines(const std::vector<AsmLine>& lines) {
+  std::unordered_map<std::string, int> label_lines;
+  for (unsigned int i = 0; i < lines.size(); i++) {
+    if (lines[i].isLabel()) {
+      label_lines[lines[i].getLabel()] = i;
+    }
+  }
+  return label_lines;
+}
+
+} // namespace
+
+bool AsmOptimizer::threadBranches(AsmFunction& asm_function,
+                                  const FunctionContext& function_context) {
+  std::vector<AsmLine>& lines = asm_function.getLines();
+  const std::unordered_map<std::string, int> label_lines = findLabelLines(lines);
+  std::vector<bool> removed(lines.size(), false);
+  // Labels to add before the lines reached by threaded branches.
+  std::map<int, std::string> new_labels;
+  bool changed = false;
+
+  // What is known about the registers is reset at the labels, where other paths join.
+  std::unordered_map<std::string, bool> is_zero;
+  for (unsigned int i = 0; i < lines.size(); i++) {
+    AsmLine& line = lines[i];
+    if (line.isLabel()) {
+      is_zero.clear();
+    }
+    if (!line.isInstruction()) {
+      continue;
+    }
+    if (!line.isBranch()) {
+      updateZeroRegisters(line, is_zero);
+      continue;
+    }
+    // A test already done on the way, e.g. by the && operator and then the if statement
+    // using its value.
+    bool is_taken;
+    if (getKnownOutcome(line, is_zero, is_taken)) {
+      changed = true;
+      if (!is_taken) {
+        removed[i] = true;
+        continue;
+      }
+      line = AsmLine::makeInstruction("b", {line.getBranchTarget()}, line.getComment());
+    }
+
+    // Values on the branch, and after it.
+    std::unordered_map<std::string, bool> is_zero_if_taken = is_zero;
+    std::string reg;
+    bool is_taken_if_zero;
+    if (getZeroTest(line, reg, is_taken_if_zero)) {
+      is_zero_if_taken[reg] = is_taken_if_zero;
+      is_zero[reg] = !is_taken_if_zero;
+    } else if (!line.isConditionalBranch()) {
+      is_zero.clear();
+    }
+
+    const std::string& target = line.getBranchTarget();
+    if (!label_lines.count(target)) {
+      continue;
+    }
+    std::string new_target = target;
+    int position = followBranch(lines, removed, label_lines, is_zero_if_taken, new_target);
+    if (position == -2 ||
+        position == skipToInstruction(lines, removed, label_lines.at(target))) {
+      continue;
+    }
+    if (position == (int)lines.size()) {
+      new_target = function_context.getFunctionEpilogueLabel();
+    } else if (position >= 0) {
+      new_target = findLabelBefore(lines, removed, position);
+      if (new_target.empty()) {
+        if (!new_labels.count(position)) {
+          new_labels[position] = CompilerUtil::makeUniqueId("threaded");
+        }
+        new_target = new_labels[position];
+      }
+    }
+    if (new_target != target) {
+      line.setBranchTarget(new_target);
+      changed = true;
+    }
+  }
+
+  if (changed) {
+    std::vector<AsmLine> new_lines;
+    for (unsigned int i = 0; i < lines.size(); i++) {
+      if (new_labels.count(i)) {
+        new_lines.push_back(AsmLine::makeLabel(new_labels[i]));
+      }
+      if (!removed[i]) {
+        new_lines.push_back(lines[i]);
+      }
+    }
+    lines = new_lines;
+    asm_function.buildControlFlowGraph();
+  }
+  return changed;
+}
+
+bool AsmOptimizer::removeRedundantBranches(AsmFunction& asm_function,
+                                           const FunctionContext& function_context) {
+  std::vector<AsmLine>& lines = asm_function.getLines();
+  const std::unordered_map<std::string, int> label_lines = findLabelLines(lines);
+  const std::string& epilogue_label = function_context.getFunctionEpilogueLabel();
+  std::vector<bool> to_remove(lines.size(), false);
+  // No instruction is executed from the first position up to the second one, excluded
+  // (the end of the body if -1).
+  auto is_empty_range = [&lines, &to_remove](int first, int last, bool allow_labels) {
+    for (int i = first; i < (last < 0 ? (int)lines.size() : last); i++) {
+      if ((lines[i].isInstruction() && !to_remove[i]) ||
+          (lines[i].isLabel() && !allow_labels)) {
+        return false;
+      }
+    }
+    return true;
+  };
+  bool changed = false;
+  for (unsigned int i = 0; i < lines.size(); i++) {
+    if (!lines[i].isBranch() || to_remove[i]) {
+      continue;
+    }
+    // The nop after a branch is not in its delay slot, which the assembler fills: it is
+    // only executed when the branch is not taken.
+    if (i + 1 < lines.size() && lines[i + 1].isInstruction() &&
+        lines[i + 1].getOpcode() == "nop") {
+      to_remove[i + 1] = true;
+      changed = true;
+    }
+    // Branch to the next line.
+    const std::string& target = lines[i].getBranchTarget();
+    auto label_line = label_lines.find(target);
+    if ((label_line != label_lines.end() && label_line->second > (int)i &&
+         is_empty_range(i + 1, label_line->second, true)) ||
+        (target == epilogue_label && is_empty_range(i + 1, -1, true))) {
+      to_remove[i] = true;
+      changed = true;
+      continue;
+    }
+    // Conditional branch over a jump, reached only from it: the branch is inverted to go
+    // to the target of the jump.
+    auto inverted_opcode = INVERTED_BRANCH_OPCODES.find(lines[i].getOpcode());
+    if (label_line == label_lines.end() || label_line->second <= (int)i ||
+        inverted_opcode == INVERTED_BRANCH_OPCODES.end()) {
+      continue;
+    }
+    unsigned int jump = i + 1;
+    while (jump < lines.size() && (!lines[jump].isInstruction() || to_remove[jump])) {
+      jump++;
+    }
+    if (jump >= lines.size() || (int)jump > label_line->second ||
+        lines[jump].getOpcode() != "b" || !is_empty_range(i + 1, jump, false) ||
+        !is_empty_range(jump + 1, label_line->second, true)) {
+      continue;
+    }
+    const std::string& jump_target = lines[jump].getBranchTarget();
+    if (!label_lines.count(jump_target) && jump_target != epilogue_label) {
+      continue;
+    }
+    std::vector<std::string> operands = lines[i].getOperands();
+    operands.back() = jump_target;
+    lines[i] = AsmLine::makeInstruction(inverted_opcode->second, operands,
+                                        lines[i].getComment());
+    to_remove[jump] = true;
+    changed = true;
+  }
+  if (changed) {
+    asm_function.removeLines(to_remove);
+  }
+  const int lines_number = lines.size();
+  asm_function.removeUnreachableBlocks();
+  return changed || (int)lines.size() != lines_number;
+}
+
+void AsmOptimizer::layoutBlocks(AsmFunction& asm_function,
+                                const FunctionContext& function_context) {
+  std::vector<AsmLine>& lines = asm_function.getLines();
+  const std::vector<BasicBlock>& blocks = asm_function.getBlocks();
+  const std::string& epilogue_label = function_context.getFunctionEpilogueLabel();
+
+  // Unlikely blocks: a conditional branch in a loop falling through into blocks out of it,
+  // i.e. an early return or a break, is inverted, and the blocks are moved after the loop.
+  bool moved = true;
+  for (unsigned int moves = 0; moved && moves < blocks.size(); moves++) {
+    moved = false;
+    const std::vector<Loop> loops = asm_function.findLoops();
+    const std::unordered_map<std::string, int> label_lines = findLabelLines(lines);
+    for (int b = 0; b + 1 < (int)blocks.size() && !moved; b++) {
+      const int branch = blocks[b].last;
+      if (!lines[branch].isConditionalBranch() ||
+          !INVERTED_BRANCH_OPCODES.count(lines[branch].getOpcode()) ||
+          !label_lines.count(lines[branch].getBranchTarget())) {
+        continue;
+      }
+      // Innermost loop of the branch, found first.
+      auto loop = std::find_if(loops.begin(), loops.end(), [b](const Loop& loop) {
+        return loop.blocks[b];
+      });
+      if (loop == loops.end() || loop->blocks[b + 1]) {
+        continue;
+      }
+      // The unlikely blocks are entered only from the branch, up to a jump, and the target
+      // of the branch follows them.
+      int last = b + 1;
+      while (last < (int)blocks.size() && !endsWithJump(asm_function, last)) {
+        last++;
+      }
+      const int target_block =
+        asm_function.getBlockOfLine(label_lines.at(lines[branch].getBranchTarget()));
+      int next = last + 1;
+      while (next < (int)blocks.size() && isCommentBlock(asm_function, next)) {
+        next++;
+      }
+      if (last == (int)blocks.size() || target_block != next) {
+        continue;
+      }
+      bool is_entered_elsewhere = false;
+      for (int u = b + 1; u <= last; u++) {
+        for (int predecessor : blocks[u].predecessors) {
+          is_entered_elsewhere = is_entered_elsewhere || predecessor < b ||
+                                 predecessor > last;
+        }
+      }
+      if (is_entered_elsewhere) {
+        continue;
+      }
+      // They are placed after the first block ending with a jump after the loop, where
+      // nothing falls through, or else at the end of the body.
+      int position = lines.size();
+      int last_of_loop = loop->blocks.size() - 1;
+      while (!loop->blocks[last_of_loop]) {
+        last_of_loop--;
+      }
+      for (int u = std::max(last, last_of_loop) + 1; u + 1 < (int)blocks.size(); u++) {
+        const bool is_in_loop =
+          std::any_of(loops.begin(), loops.end(), [u](const Loop& loop) {
+            return loop.blocks[u];
+          });
+        if (endsWithJump(asm_function, u) && !is_in_loop) {
+          position = blocks[u].last + 1;
+          break;
+        }
+      }
+      const int first_line = blocks[b + 1].first;
+      const int end_line = blocks[last].last + 1;
+      std::vector<AsmLine> unlikely_lines(lines.begin() + first_line,
+                                          lines.begin() + end_line);
+      const std::string label = getOrAddLabel(unlikely_lines, 0);
+      std::vector<std::string> operands = lines[branch].getOperands();
+      operands.back() = label;
+      lines[branch] = AsmLine::makeInstruction(
+        INVERTED_BRANCH_OPCODES.at(lines[branch].getOpcode()), operands,
+        " Unlikely path, out of the loop.");
+      if (position == (int)lines.size() && fallsIntoEpilogue(lines)) {
+        lines.push_back(AsmLine::makeInstruction("b", {epilogue_label}, ""));
+        position++;
+      }
+      lines.insert(lines.begin() + position, unlikely_lines.begin(), unlikely_lines.end());
+      lines.erase(lines.begin() + first_line, lines.begin() + end_line);
+      asm_function.buildControlFlowGraph();
+      moved = true;
+    }
+  }
+
+  // Chains of blocks falling through into each other. The comments left by unreachable
+  // code belong to the previous chain.
+  std::vector<bool> reachable = asm_function.getBlocksReachableFrom(0);
+  reachable[0] = true;
+  std::vector<std::vector<int>> chains;
+  std::vector<int> block_chain(blocks.size());
+  for (int b = 0; b < (int)blocks.size(); b++) {
+    const bool is_fall_through = b > 0 && reachable[b - 1] &&
+                                 !endsWithJump(asm_function, b - 1);
+    if (b == 0 || (reachable[b] && !is_fall_through)) {
+      chains.push_back({});
+    }
+    chains.back().push_back(b);
+    block_chain[b] = chains.size() - 1;
+  }
+
+  // A chain ending with a jump to a chain entered only by jumps is followed by it, and the
+  // jump removed. The jumps in the deepest loops are chosen first.
+  const std::vector<Loop> loops = asm_function.findLoops();
+  const std::unordered_map<std::string, int> label_lines = findLabelLines(lines);
+  std::vector<std::tuple<int, int, int, int>> jumps;
+  for (int c = 0; c < (int)chains.size(); c++) {
+    int jump = blocks[chains[c].back()].last;
+    while (jump >= blocks[chains[c].front()].first && !lines[jump].isInstruction()) {
+      jump--;
+    }
+    if (jump < blocks[chains[c].front()].first || lines[jump].getOpcode() != "b" ||
+        !label_lines.count(lines[jump].getBranchTarget())) {
+      continue;
+    }
+    const int target_block =
+      asm_function.getBlockOfLine(label_lines.at(lines[jump].getBranchTarget()));
+    const int target_chain = block_chain[target_block];
+    if (target_chain == 0 || target_chain == c ||
+        chains[target_chain][0] != target_block) {
+      continue;
+    }
+    const int depth = std::count_if(loops.begin(), loops.end(), [&](const Loop& loop) {
+      return loop.blocks[chains[c].back()];
+    });
+    jumps.push_back(std::make_tuple(-depth, c, target_chain, jump));
+  }
+  if (jumps.empty()) {
+    return;
+  }
+  std::sort(jumps.begin(), jumps.end());
+  std::vector<int> next_chain(chains.size(), -1);
+  std::vector<int> previous_chain(chains.size(), -1);
+  std::vector<bool> to_remove(lines.size(), false);
+  for (const auto& jump : jumps) {
+    const int c = std::get<1>(jump);
+    const int target_chain = std::get<2>(jump);
+    if (next_chain[c] >= 0 || previous_chain[target_chain] >= 0) {
+      continue;
+    }
+    int first = c;
+    while (previous_chain[first] >= 0) {
+      first = previous_chain[first];
+    }
+    if (first == target_chain) {
+      continue;
+    }
+    next_chain[c] = target_chain;
+    previous_chain[target_chain] = c;
+    to_remove[std::get<3>(jump)] = true;
+  }
+
+  // The chains are placed in their order, each followed by the ones it jumps to. The end
+  // of the body falls through into the epilogue, it needs a jump if moved.
+  std::vector<AsmLine> new_lines;
+  for (int c = 0; c < (int)chains.size(); c++) {
+    for (int d = previous_chain[c] < 0 ? c : -1; d >= 0; d = next_chain[d]) {
+      const int end_line = blocks[chains[d].back()].last;
+      for (int i = blocks[chains[d].front()].first; i <= end_line; i++) {
+        if (!to_remove[i]) {
+          new_lines.push_back(lines[i]);
+        }
+      }
+      if (chains[d].back() == (int)blocks.size() - 1 &&
+          !endsWithJump(asm_function, blocks.size() - 1)) {
+        new_lines.push_back(AsmLine::makeInstruction("b", {epilogue_label}, ""));
+      }
+    }
+  }
+  lines = new_lines;
+  asm_function.buildControlFlowGraph();
+}
+
+void AsmOptimizer::optimizeBranches(AsmFunction& asm_function,
+                                    const FunctionContext& function_context) {
+  auto simplify = [&asm_function, &function_context]() {
+    bool changed = true;
+    while (changed) {
+      changed = threadBranches(asm_function, function_context);
+      changed = removeRedundantBranches(asm_function, function_context) || changed;
+    }
+  };
+  simplify();
+  layoutBlocks(asm_function, function_context);
+  // The jumps added around the moved blocks may go to the next line.
+  simplify();
+}
+
+bool AsmOptimizer::usesGlobalPointer(const AsmFunction& asm_function) {
+  for (const AsmLine& line : asm_function.getLines()) {
+    if (line.isInstruction() && !line.isCall() && !line.isTailCall() &&
+        contains(line.getUsedRegisters(), "$gp")) {
+      return true;
+    }
+  }
+  return false;
+}
@@ -1,42 +1,207 @@
 #include "../inc/compiler.hpp"
 #include "../inc/compiler_util.hpp"
+#include "../inc/asm_optimizer.hpp"
 
 #include "../../common/inc/ast.hpp"
 #include "../../common/inc/util.hpp"
 
 #include <fstream>
+#include <functional>
+#include <memory>
+#include <sstream>
 #include <unordered_set>
+#include <algorithm>
+#include <climits>
 
 #define WORD_LENGTH 4
+// Large global arrays are aligned to a cache line (2^5 = 32 bytes).
+#define CACHE_LINE_ALIGNMENT 5
+// Limits on the size of a fully unrolled loop, in AST nodes (see CompilerUtil::countNodes).
+// They are larger with -funroll-loops, which also limits the size of the body of a
+// partially unrolled loop.
+#define FULL_UNROLL_MAX_NODES 64
+#define AGGRESSIVE_UNROLL_MAX_NODES 256
+#define FULL_UNROLL_MAX_TRIP_COUNT 64
+// Functions are inlined if their body has at most this number of AST nodes, or at most
+// the second number if they are called only once.
+#define INLINE_MAX_NODES 40
+#define INLINE_CALLED_ONCE_MAX_NODES 400
+// With a profile, the limit of the call sites that are hot, and of the ones never run.
+#define INLINE_HOT_MAX_NODES 160
+#define INLINE_COLD_MAX_NODES 12
+// Counters of the instrumented code (see ExecutionProfile).
+#define PROFILE_COUNTERS "__profile_counters"
+// Name of the stack slot of the accumulator of a tail recursion, not a valid identifier.
+#define TAIL_RECURSION_ACCUMULATOR "?tail_recursion_accumulator"
+// The arms of a conditional are computed both, and the result selected without branching,
+// if each has at most this number of AST nodes.
+#define IF_CONVERSION_MAX_NODES 8
 
 GlobalVariables global_variables;
 // List of ids of all the functions that has only been declared, not implemented.
 FunctionDeclarations function_declarations;
+// Options given on the command line.
+CompilerOptions compiler_options;
+
+// Definition of a global variable. They are emitted once all of them are known, grouped
+// by section.
+class GlobalVariableDefinition {
+ public:
+  std::string section;
+  // Assembly lines defining the variable.
+  std::string definition;
+  // Number of references to the variable in the functions.
+  int references;
+};
+std::vector<GlobalVariableDefinition> global_variable_definitions;
+// Variables that may be written by the functions (see
+// CompilerUtil::collectWrittenVariables).
+std::unordered_set<std::string> written_variables;
+// Number of references to each variable in the functions.
+std::unordered_map<std::string, int> variable_references;
+// With -fwhole-program and an entry point (main or an exported symbol), only the
+// functions and global variables reachable from the entry points are emitted.
+bool drop_unreachable_symbols = false;
+std::unordered_set<std::string> reachable_symbols;
+// Functions called by the code emitted for each function, once the calls are inlined.
+std::unordered_map<std::string, std::unordered_set<std::string>> emitted_calls;
+// Summary of the symbols that are not emitted.
+std::vector<std::string> dropped_symbols;
+// Variables whose address is taken in the function being compiled.
+std::unordered_set<std::string> address_taken_variables;
+// Id of the function being compiled.
+std::string function_id_being_compiled;
+// Definition of the function whose body is being compiled: the callee while compiling an
+// inlined call.
+const FunctionDefinition* function_definition_being_compiled;
+// A recursive tail call of the function being compiled jumps to the start of its body.
+bool function_has_tail_recursion;
+// Operator ("+" or "*") of the recursive calls returned as "operand op call", whose
+// operands are accumulated in the stack frame while looping. Empty if there are none.
+std::string tail_recursion_operator;
+int tail_recursion_accumulator_offset;
+// Code being compiled before knowing whether the free registers suffice for it (see
+// compileIfRegistersSuffice), the innermost last: its decisions are reported, and its
+// calls recorded, only if they do.
+class CompilationAttempt {
+ public:
+  std::vector<std::string> reports;
+  std::vector<std::string> emitted_calls;
+};
+std::vector<CompilationAttempt> compilation_attempts;
+
+bool CompilerOptions::parseOption(const std::string& option) {
+  if (option == "-fomit-frame-pointer") {
+    omit_frame_pointer = true;
+    return true;
+  }
+  if (option == "-fwhole-program") {
+    whole_program = true;
+    return true;
+  }
+  if (option == "-funroll-loops") {
+    unroll_loops = true;
+    unroll_small_loops = true;
+    return true;
+  }
+  if (option == "-fno-unroll-loops") {
+    unroll_loops = false;
+    unroll_small_loops = false;
+    return true;
+  }
+  if (option == "-fno-inline") {
+    inline_functions = false;
+    return true;
+  }
+  if (option == "-fno-optimize-sibling-calls") {
+    optimize_sibling_calls = false;
+    return true;
+  }
+  if (option == "-fno-if-conversion") {
+    if_conversion = false;
+    return true;
+  }
+  if (option == "-march=mips1") {
+    conditional_moves = false;
+    return true;
+  }
+  if (option == "-fopt-report") {
+    opt_report = true;
+    return true;
+  }
+  if (option == "-fprofile-generate") {
+    profile_generate = true;
+    return true;
+  }
+  const std::string profile_generate_option = "-fprofile-generate=";
+  if (option.compare(0, profile_generate_option.size(), profile_generate_option) == 0) {
+    profile_generate = true;
+    profile_generate_file = option.substr(profile_generate_option.size());
+    return !profile_generate_file.empty();
+  }
+  const std::string profile_use_option = "-fprofile-use=";
+  if (option.compare(0, profile_use_option.size(), profile_use_option) == 0) {
+    profile_use_file = option.substr(profile_use_option.size());
+    return !profile_use_file.empty();
+  }
+  const std::string export_option = "-fexport=";
+  if (option.compare(0, export_option.size(), export_option) == 0) {
+    std::stringstream names(option.substr(export_option.size()));
+    std::string name;
+    while (std::getline(names, name, ',')) {
+      if (name.empty()) {
+        return false;
+      }
+      exported_symbols.push_back(name);
+    }
+    return !exported_symbols.empty();
+  }
+  const std::string unroll_factor_option = "-funroll-factor=";
+  if (option.compare(0, unroll_factor_option.size(), unroll_factor_option) == 0) {
+    const std::string value = option.substr(unroll_factor_option.size());
+    if (value.empty() || value.size() > 3 ||
+        value.find_first_not_of("0123456789") != std::string::npos) {
+      return false;
+    }
+    unroll_factor = std::stoi(value);
+    return unroll_factor >= 1;
+  }
+  return false;
+}
 
-void loadVariableIntoRegister(std::ofstream& asm_out, const Variable* variable,
+void reportOptimization(const std::string& message);
+
+void loadVariableIntoRegister(std::ostream& asm_out, const Variable* variable,
                               const std::string& dest_reg,
                               FunctionContext& function_context,
                               RegisterAllocator& register_allocator,
                               const std::string& scope_id);
-void storeVariableFromRegister(std::ofstream& asm_out, const Variable* variable,
+void storeVariableFromRegister(std::ostream& asm_out, const Variable* variable,
                                const std::string& src_reg,
                                FunctionContext& function_context,
                                RegisterAllocator& register_allocator,
                                const std::string& scope_id,
                                const bool is_declaration);
-void compileArithmeticOrLogicalExpression(std::ofstream& asm_out,
+void compileArithmeticOrLogicalExpression(std::ostream& asm_out,
                                           const Node* arithmetic_or_logical_expression,
                                           const std::string& dest_reg,
                                           FunctionContext& function_context,
                                           RegisterAllocator& register_allocator,
                                           const std::string& scope_id);
 
-void compileFunctionCall(std::ofstream& asm_out, const FunctionCall* function_call,
+void compileConditionalExpression(std::ostream& asm_out, const Node* condition,
+                                  const Node* expression1, const Node* expression2,
+                                  const std::string& dest_reg,
+                                  FunctionContext& function_context,
+                                  RegisterAllocator& register_allocator,
+                                  const std::string& scope_id);
+
+void compileFunctionCall(std::ostream& asm_out, const FunctionCall* function_call,
                          const std::string& dest_reg, FunctionContext& function_context,
                          RegisterAllocator& register_allocator,
                          const std::string& scope_id);
 
-void compileFunctionCallParametersList(std::ofstream& asm_out,
+void compileFunctionCallParametersList(std::ostream& asm_out,
                                        const ParametersListNode* parameters_list_node,
                                        int param_number,
                                        std::vector<std::string>& argument_registers,
@@ -44,56 +209,58 @@ void compileFunctionCallParametersList(std::ofstream& asm_out,
                                        RegisterAllocator& register_allocator,
                                        const std::string& scope_id);
 
-void compileDeclarationExpressionList(std::ofstream& asm_out,
+void compileDeclarationExpressionList(std::ostream& asm_out,
                                     const DeclarationExpressionList* declaration_expression_list,
                                     FunctionContext& function_context,
                                     RegisterAllocator& register_allocator,
                                     const std::string& scope_id);
-void compileAssignmentExpression(std::ofstream& asm_out,
+void compileAssignmentExpression(std::ostream& asm_out,
                                  const AssignmentExpression* assignment_expression,
                                  const std::string& dest_reg,
                                  FunctionContext& function_context,
                                  RegisterAllocator& register_allocator,
                                  const std::string& scope_id);
 
-void compileReturnStatement(std::ofstream& asm_out,
+void compileReturnStatement(std::ostream& asm_out,
                             const ReturnStatement* return_statement,
                             FunctionContext& function_context,
                             RegisterAllocator& register_allocator,
                             const std::string& scope_id);
 
-void compileBreakStatement(std::ofstream& asm_out,
+void compileBreakStatement(std::ostream& asm_out,
                             const BreakStatement* break_statement,
                             FunctionContext& function_context,
                             RegisterAllocator& register_allocator);
 
-void compileContinueStatement(std::ofstream& asm_out,
+void compileContinueStatement(std::ostream& asm_out,
                             const ContinueStatement* continue_statement,
                             FunctionContext& function_context,
                             RegisterAllocator& register_allocator);
 
-void compileIfStatement(std::ofstream& asm_out, const IfStatement* if_statement,
+void compileIfStatement(std::ostream& asm_out, const IfStatement* if_statement,
                         FunctionContext& function_context,
                         RegisterAllocator& register_allocator,
                         const std::string& scope_id);
 
-void compileWhileStatement(std::ofstream& asm_out, const WhileStatement* while_statement,
+// The loop init is the statement preceding the while loop, if any (e.g. i = 0;).
+void compileWhileStatement(std::ostream& asm_out, const WhileStatement* while_statement,
                            FunctionContext& function_context,
                            RegisterAllocator& register_allocator,
-                           const std::string& scope_id);
+                           const std::string& scope_id,
+                           const Node* loop_init = nullptr);
 
-void compileForStatement(std::ofstream& asm_out, const ForStatement* for_statement,
+void compileForStatement(std::ostream& asm_out, const ForStatement* for_statement,
                            FunctionContext& function_context,
                            RegisterAllocator& register_allocator,
                            const std::string& scope_id);
 
-void compileSwitchStatement(std::ofstream& asm_out,
+void compileSwitchStatement(std::ostream& asm_out,
                             const SwitchStatement* switch_statement,
                             FunctionContext& function_context,
                             RegisterAllocator& register_allocator,
                             const std::string& scope_id);
 
-void compileCaseStatementList(std::ofstream& asm_out,
+void compileCaseStatementList(std::ostream& asm_out,
                               const CaseStatementListNode* case_statement_list_node,
                               const std::string& test_reg, const Node* switch_test,
                               const std::string& def_reg, bool& there_is_default,
@@ -102,14 +269,14 @@ void compileCaseStatementList(std::ofstream& asm_out,
                               const std::string& end_switch_id,
                               const std::string& scope_id);
 
-void compileCaseStatement(std::ofstream& asm_out,
+void compileCaseStatement(std::ostream& asm_out,
                           const CaseStatement* case_statement,
                           const std::string& test_reg, const Node* switch_test,
                           const std::string& def_reg, FunctionContext& function_context,
                           RegisterAllocator& register_allocator,
                           const std::string& scope_id);
 
-void compileDefaultStatement(std::ofstream& asm_out,
+void compileDefaultStatement(std::ostream& asm_out,
                              const DefaultStatement* default_statement,
                              const std::string& def_reg,
                              FunctionContext& function_context,
@@ -117,41 +284,319 @@ void compileDefaultStatement(std::ofstream& asm_out,
                              const std::string& end_switch_id,
                              const std::string& scope_id);
 
-void compileStatement(std::ofstream& asm_out, const Node* statement,
+void compileStatement(std::ostream& asm_out, const Node* statement,
                       FunctionContext& function_context,
                       RegisterAllocator& register_allocator,
-                      const std::string& scope_id);
+                      const std::string& scope_id,
+                      const Node* previous_statement = nullptr);
 
-void compileStatementList(std::ofstream& asm_out,
+void compileStatementList(std::ostream& asm_out,
                           const StatementListNode* statement_list_node,
                           FunctionContext& function_context,
                           RegisterAllocator& register_allocator,
-                          const std::string& scope_id);
-void compileCompoundStatement(std::ofstream& asm_out,
+                          const std::string& scope_id,
+                          const Node* previous_statement = nullptr);
+void compileCompoundStatement(std::ostream& asm_out,
                               const CompoundStatement* compound_statement,
                               FunctionContext& function_context,
                               RegisterAllocator& register_allocator,
                               const std::string& scope_id);
 
-void compileFunctionDefinition(std::ofstream& asm_out,
+void compileFunctionDefinition(std::ostream& asm_out,
                                const FunctionDefinition* function_definition,
                                RegisterAllocator& register_allocator);
 
-void compileFunctionCallParametersList(std::ofstream& asm_out,
+void compileFunctionCallParametersList(std::ostream& asm_out,
                                        ParametersListNode* parameters_list_node,
                                        FunctionContext& function_context,
                                        RegisterAllocator& register_allocator,
                                        const std::string& scope_id);
 
-void compileRootLevel(std::ofstream& asm_out, const Node* ast,
+void compileRootLevel(std::ostream& asm_out, const Node* ast,
                       RegisterAllocator& register_allocator);
 
-void compileAst(std::ofstream& asm_out, const std::vector<const Node*>& ast_roots,
+// Symbols reachable from the entry points, following the references of each function.
+std::unordered_set<std::string> findReachableSymbols(
+  const std::vector<std::string>& entry_points,
+  const std::unordered_map<std::string, std::vector<std::string>>& references) {
+  std::unordered_set<std::string> reachable;
+  std::vector<std::string> to_visit = entry_points;
+  while (!to_visit.empty()) {
+    std::string id = to_visit.back();
+    to_visit.pop_back();
+    if (!reachable.insert(id).second) {
+      continue;
+    }
+    auto it = references.find(id);
+    if (it != references.end()) {
+      to_visit.insert(to_visit.end(), it->second.begin(), it->second.end());
+    }
+  }
+  return reachable;
+}
+
+bool isReachableFunction(const Node* function_definition) {
+  const std::string& id = dynamic_cast<const Variable*>(
+    dynamic_cast<const FunctionDefinition*>(function_definition)->getName())->getId();
+  return !drop_unreachable_symbols || reachable_symbols.count(id) != 0;
+}
+
+void compileAst(std::ostream& asm_out, const std::vector<const Node*>& ast_roots,
                 RegisterAllocator& register_allocator);
 
+// Instruction selection for constant operands.
+
+bool fitsInSignedImmediate(long long value) {
+  return value >= -32768 && value <= 32767;
+}
+
+bool fitsInUnsignedImmediate(long long value) {
+  return value >= 0 && value <= 65535;
+}
+
+// Load a constant into a register. Constants that fit in 16 bits take one instruction
+// (li is expanded to addiu or ori), the others are built with lui and ori.
+void loadImmediateIntoRegister(std::ostream& asm_out, const std::string& dest_reg,
+                               int value) {
+  if (fitsInSignedImmediate(value) || fitsInUnsignedImmediate(value)) {
+    asm_out << "li\t " << dest_reg << ", " << value
+            << "\t# Add immediate constant into destination register." << std::endl;
+    return;
+  }
+  unsigned int bits = value;
+  asm_out << "lui\t " << dest_reg << ", " << (bits >> 16)
+          << "\t# Upper half of constant: " << value << "." << std::endl;
+  if ((bits & 0xffff) != 0) {
+    asm_out << "ori\t " << dest_reg << ", " << dest_reg << ", " << (bits & 0xffff)
+            << "\t# Lower half of constant: " << value << "." << std::endl;
+  }
+}
+
+// Check wether 'lhs <op> immediate' can be computed with the immediate form of an
+// instruction. The operators are the ones of the binary expressions and of the compound
+// assignments.
+bool hasImmediateForm(const std::string& op, long long immediate) {
+  if (op == "+" || op == "<") {
+    return fitsInSignedImmediate(immediate);
+  }
+  if (op == "-") {
+    return fitsInSignedImmediate(-immediate);
+  }
+  if (op == "<=" || op == ">") {
+    return fitsInSignedImmediate(immediate + 1);
+  }
+  if (op == ">=") {
+    return fitsInSignedImmediate(immediate);
+  }
+  if (op == "&" || op == "|" || op == "^" || op == "==" || op == "!=") {
+    return fitsInUnsignedImmediate(immediate);
+  }
+  if (op == "<<" || op == ">>") {
+    return immediate >= 0 && immediate < 32;
+  }
+  if (op == "*") {
+    // Power of two, computed with a shift.
+    return immediate > 0 && immediate <= (1 << 30) && (immediate & (immediate - 1)) == 0;
+  }
+  return false;
+}
+
+// Emit 'dest_reg = src_reg <op> immediate'. Must be called only if hasImmediateForm.
+void compileImmediateOperation(std::ostream& asm_out, const std::string& op,
+                               const std::string& dest_reg, const std::string& src_reg,
+                               int immediate) {
+  if (op == "+") {
+    asm_out << "addiu\t " << dest_reg << ", " << src_reg << ", " << immediate
+            << "\t# Addition." << std::endl;
+  }
+  else if (op == "-") {
+    asm_out << "addiu\t " << dest_reg << ", " << src_reg << ", " << -immediate
+            << "\t# Subtraction." << std::endl;
+  }
+  else if (op == "*") {
+    int shift = 0;
+    while ((1 << shift) != immediate) {
+      shift++;
+    }
+    asm_out << "sll\t " << dest_reg << ", " << src_reg << ", " << shift
+            << "\t# Multiplication by a power of two." << std::endl;
+  }
+  else if (op == "<<") {
+    asm_out << "sll\t " << dest_reg << ", " << src_reg << ", " << immediate
+            << "\t# Left shift." << std::endl;
+  }
+  else if (op == ">>") {
+    asm_out << "srl\t " << dest_reg << ", " << src_reg << ", " << immediate
+            << "\t# Right shift." << std::endl;
+  }
+  else if (op == "<") {
+    asm_out << "slti\t " << dest_reg << ", " << src_reg << ", " << immediate
+            << "\t# Less than." << std::endl;
+  }
+  else if (op == "<=") {
+    // a <= c is a < c + 1.
+    asm_out << "slti\t " << dest_reg << ", " << src_reg << ", " << immediate + 1
+            << "\t# Less or equal." << std::endl;
+  }
+  else if (op == ">") {
+    // a > c is the opposite of a < c + 1.
+    asm_out << "slti\t " << dest_reg << ", " << src_reg << ", " << immediate + 1
+            << std::endl;
+    asm_out << "xori\t " << dest_reg << ", " << dest_reg << ", 1"
+            << "\t# Greater than." << std::endl;
+  }
+  else if (op == ">=") {
+    asm_out << "slti\t " << dest_reg << ", " << src_reg << ", " << immediate << std::endl;
+    asm_out << "xori\t " << dest_reg << ", " << dest_reg << ", 1"
+            << "\t# Greater or equal." << std::endl;
+  }
+  else if (op == "&") {
+    asm_out << "andi\t " << dest_reg << ", " << src_reg << ", " << immediate
+            << "\t# Bitwise and." << std::endl;
+  }
+  else if (op == "|") {
+    asm_out << "ori\t " << dest_reg << ", " << src_reg << ", " << immediate
+            << "\t# Bitwise or." << std::endl;
+  }
+  else if (op == "^") {
+    asm_out << "xori\t " << dest_reg << ", " << src_reg << ", " << immediate
+            << "\t# Bitwise xor." << std::endl;
+  }
+  else if (op == "==" || op == "!=") {
+    std::string difference_reg = src_reg;
+    if (immediate != 0) {
+      // This will give in dest_reg 0 if lhs == rhs, and !0 otherwise.
+      asm_out << "xori\t " << dest_reg << ", " << src_reg << ", " << immediate << std::endl;
+      difference_reg = dest_reg;
+    }
+    if (op == "==") {
+      asm_out << "sltiu\t " << dest_reg << ", " << difference_reg << ", 1"
+              << "\t# Equal to." << std::endl;
+    } else {
+      asm_out << "sltu\t " << dest_reg << ", $0, " << difference_reg
+              << "\t# Not equal to." << std::endl;
+    }
+  }
+  else {
+    if (Util::DEBUG) {
+      std::cerr << "No immediate form for operator: " << op << "." << std::endl;
+    }
+    Util::abort();
+  }
+}
+
+// Extract operator and operands of a binary arithmetic or bitwise expression. Returns
+// false for any other node.
+bool getBinaryOperation(const Node* expression, std::string& op, const Node*& lhs,
+                        const Node*& rhs) {
+  const std::string& type = expression->getType();
+  if (type == "MultiplicativeExpression") {
+    const MultiplicativeExpression* node =
+      dynamic_cast<const MultiplicativeExpression*>(expression);
+    op = node->getMultiplicativeType();
+    lhs = node->getLhs();
+    rhs = node->getRhs();
+  }
+  else if (type == "AdditiveExpression") {
+    const AdditiveExpression* node = dynamic_cast<const AdditiveExpression*>(expression);
+    op = node->getAdditiveType();
+    lhs = node->getLhs();
+    rhs = node->getRhs();
+  }
+  else if (type == "ShiftExpression") {
+    const ShiftExpression* node = dynamic_cast<const ShiftExpression*>(expression);
+    op = node->getShiftType();
+    lhs = node->getLhs();
+    rhs = node->getRhs();
+  }
+  else if (type == "RelationalExpression") {
+    const RelationalExpression* node = dynamic_cast<const RelationalExpression*>(expression);
+    op = node->getRelationalType();
+    lhs = node->getLhs();
+    rhs = node->getRhs();
+  }
+  else if (type == "EqualityExpression") {
+    const EqualityExpression* node = dynamic_cast<const EqualityExpression*>(expression);
+    op = node->getEqualityType();
+    lhs = node->getLhs();
+    rhs = node->getRhs();
+  }
+  else if (type == "AndExpression") {
+    const AndExpression* node = dynamic_cast<const AndExpression*>(expression);
+    op = "&";
+    lhs = node->getLhs();
+    rhs = node->getRhs();
+  }
+  else if (type == "ExclusiveOrExpression") {
+    const ExclusiveOrExpression* node =
+      dynamic_cast<const ExclusiveOrExpression*>(expression);
+    op = "^";
+    lhs = node->getLhs();
+    rhs = node->getRhs();
+  }
+  else if (type == "InclusiveOrExpression") {
+    const InclusiveOrExpression* node =
+      dynamic_cast<const InclusiveOrExpression*>(expression);
+    op = "|";
+    lhs = node->getLhs();
+    rhs = node->getRhs();
+  }
+  else {
+    return false;
+  }
+  return true;
+}
+
+// Compile a binary expression into dest_reg with the immediate form of the instruction,
+// if one of the operands is a constant that fits in it. Returns false, without emitting
+// anything, otherwise.
+bool compileBinaryExpressionWithImmediate(std::ostream& asm_out, const Node* expression,
+                                          const std::string& dest_reg,
+                                          FunctionContext& function_context,
+                                          RegisterAllocator& register_allocator,
+                                          const std::string& scope_id) {
+  std::string op;
+  const Node* lhs;
+  const Node* rhs;
+  if (!getBinaryOperation(expression, op, lhs, rhs)) {
+    return false;
+  }
+  // Operator to use when the operands are swapped (e.g. 1 < a is a > 1).
+  static const std::unordered_map<std::string, std::string> swapped_operators = {
+    {"+", "+"}, {"*", "*"}, {"&", "&"}, {"|", "|"}, {"^", "^"}, {"==", "=="},
+    {"!=", "!="}, {"<", ">"}, {">", "<"}, {"<=", ">="}, {">=", "<="}
+  };
+  std::string selected_op = op;
+  if (!CompilerUtil::isConstantExpression(rhs) && CompilerUtil::isConstantExpression(lhs) &&
+      swapped_operators.count(op)) {
+    std::swap(lhs, rhs);
+    selected_op = swapped_operators.at(op);
+  }
+  if (!CompilerUtil::isConstantExpression(rhs)) {
+    return false;
+  }
+  int immediate = CompilerUtil::evaluateConstantExpression(rhs);
+  if (!hasImmediateForm(selected_op, immediate)) {
+    return false;
+  }
+  compileArithmeticOrLogicalExpression(asm_out, lhs, dest_reg, function_context,
+                                       register_allocator, scope_id);
+  compileImmediateOperation(asm_out, selected_op, dest_reg, dest_reg, immediate);
+  return true;
+}
+
+// Name of a global variable with a constant offset in bytes (e.g. a+8), to be used in
+// relocations.
+std::string getGlobalSymbolWithOffset(const std::string& id, int offset) {
+  if (offset == 0) {
+    return id;
+  }
+  return id + (offset > 0 ? "+" : "") + std::to_string(offset);
+}
+
 // Generate assembly to load the value of a variable into a destination register, both
 // if it is a local or global variable.
-void loadVariableIntoRegister(std::ofstream& asm_out, const Variable* variable,
+void loadVariableIntoRegister(std::ostream& asm_out, const Variable* variable,
                               const std::string& dest_reg,
                               FunctionContext& function_context,
                               RegisterAllocator& register_allocator,
@@ -163,8 +608,19 @@ void loadVariableIntoRegister(std::ofstream& asm_out, const Variable* variable,
       int var_offset = function_context.getOffsetForVariable(variable->getId());
 
       asm_out << "lw\t " << dest_reg << ", " << var_offset
-              << "($fp)" << "\t# Load variable " << variable->getId()
-              << " from the stack." << std::endl;
+              << "(" << function_context.getFrameRegister() << ")" << "\t# Load variable "
+              << variable->getId() << " from the stack." << std::endl;
+    }
+
+    else if (variable->getInfo() == "array" &&
+             CompilerUtil::isConstantExpression(variable->getArrayIndexOrSize())) {
+      // Constant index: the offset of the element in the frame is known.
+      int offset = function_context.getBaseOffsetForArray(variable->getId()) + 4 *
+        CompilerUtil::evaluateConstantExpression(variable->getArrayIndexOrSize());
+      asm_out << "lw\t " << dest_reg << ", " << offset << "("
+              << function_context.getFrameRegister() << ")"
+              << "\t # Local array load: " << variable->getId() << "." << std::endl;
+      asm_out << "nop" << "\t # nop for local array load." << std::endl;
     }
 
     else if (variable->getInfo() == "array") {
@@ -183,7 +639,8 @@ void loadVariableIntoRegister(std::ofstream& asm_out, const Variable* variable,
               << "\t # Sum base address and offset for local array load: "
               << variable->getId() << "." << std::endl;
       // Sum address with frame pointer.
-      asm_out << "addu\t " << dest_reg << ", " << dest_reg << ", $fp"
+      asm_out << "addu\t " << dest_reg << ", " << dest_reg << ", "
+              << function_context.getFrameRegister()
               << "\t # Sum address with frame pointer." << std::endl;
       // Finally load word.
       asm_out << "lw\t " << dest_reg << ", 0(" << dest_reg << ")"
@@ -195,7 +652,8 @@ void loadVariableIntoRegister(std::ofstream& asm_out, const Variable* variable,
     else if (variable->getInfo() == "pointer") {
       int offset = function_context.getOffsetForVariable(variable->getId());
       const std::string ptrreg = register_allocator.requestFreeRegister();
-      asm_out << "lw\t " << ptrreg << ", " << offset << "($fp)"
+      asm_out << "lw\t " << ptrreg << ", " << offset << "("
+              << function_context.getFrameRegister() << ")"
               << "\t# Reading the address of the pointer. "  << std::endl;
       asm_out << "lw\t " << dest_reg << ", 0(" << ptrreg <<")"
               << "\t# Loading the value at the address pointed by pointer. " << std::endl;
@@ -213,24 +671,53 @@ void loadVariableIntoRegister(std::ofstream& asm_out, const Variable* variable,
   else if (global_variables.isGlobalVariable(variable->getId())) {
     // Global variable.
     if (variable->getInfo() == "normal") {
-      asm_out << "lui\t " << dest_reg << ", %hi(" << variable->getId() << ")"
-              << "\t # Loading global variable (hi): " << variable->getId() << "."
-              << std::endl;
-      asm_out << "lw\t " << dest_reg << ", %lo(" << variable->getId() << ")"
-              << "(" << dest_reg << ")" << "\t # Loading global variable (lo): "
-              << variable->getId() << "."
-              << std::endl;
+      if (global_variables.isSmallData(variable->getId())) {
+        asm_out << "lw\t " << dest_reg << ", %gp_rel(" << variable->getId() << ")($gp)"
+                << "\t # Loading global variable: " << variable->getId() << "."
+                << std::endl;
+      } else {
+        asm_out << "lui\t " << dest_reg << ", %hi(" << variable->getId() << ")"
+                << "\t # Loading global variable (hi): " << variable->getId() << "."
+                << std::endl;
+        asm_out << "lw\t " << dest_reg << ", %lo(" << variable->getId() << ")"
+                << "(" << dest_reg << ")" << "\t # Loading global variable (lo): "
+                << variable->getId() << "."
+                << std::endl;
+      }
       asm_out << "nop" << "\t # nop for global variable load." << std::endl;
     }
 
+    else if (variable->getInfo() == "array" &&
+             CompilerUtil::isConstantExpression(variable->getArrayIndexOrSize())) {
+      // Constant index: the offset is folded in the address of the element.
+      const std::string& element = getGlobalSymbolWithOffset(variable->getId(), 4 *
+        CompilerUtil::evaluateConstantExpression(variable->getArrayIndexOrSize()));
+      if (global_variables.isSmallData(variable->getId())) {
+        asm_out << "lw\t " << dest_reg << ", %gp_rel(" << element << ")($gp)"
+                << "\t # Global array load: " << variable->getId() << "." << std::endl;
+      } else {
+        asm_out << "lui\t " << dest_reg << ", %hi(" << element << ")"
+                << "\t # Global array load (hi): " << variable->getId() << "." << std::endl;
+        asm_out << "lw\t " << dest_reg << ", %lo(" << element << ")(" << dest_reg << ")"
+                << "\t # Global array load (lo): " << variable->getId() << "." << std::endl;
+      }
+      asm_out << "nop" << "\t # nop for global array load." << std::endl;
+    }
+
     else if (variable->getInfo() == "array") {
-      asm_out << "lui\t " << dest_reg << ", %hi(" << variable->getId() << ")"
-              << "\t # Preparing address for global array load: " << variable->getId()
-              << "." << std::endl;
-      asm_out << "addiu\t " << dest_reg << ", " << dest_reg << ", %lo("
-              << variable->getId() << ")"
-              << "\t # Preparing address for global array load: " << variable->getId()
-              << "." << std::endl;
+      if (global_variables.isSmallData(variable->getId())) {
+        asm_out << "addiu\t " << dest_reg << ", $gp, %gp_rel(" << variable->getId() << ")"
+                << "\t # Preparing address for global array load: " << variable->getId()
+                << "." << std::endl;
+      } else {
+        asm_out << "lui\t " << dest_reg << ", %hi(" << variable->getId() << ")"
+                << "\t # Preparing address for global array load: " << variable->getId()
+                << "." << std::endl;
+        asm_out << "addiu\t " << dest_reg << ", " << dest_reg << ", %lo("
+                << variable->getId() << ")"
+                << "\t # Preparing address for global array load: " << variable->getId()
+                << "." << std::endl;
+      }
       // At this point, dest_reg contains the base address of the array.
       // Calculate offset.
       asm_out << "# Calculate offset for global array load." << std::endl;
@@ -253,13 +740,19 @@ void loadVariableIntoRegister(std::ofstream& asm_out, const Variable* variable,
     }
 
     else if (variable->getInfo() == "pointer") {
-      asm_out << "lui\t " << dest_reg << ", %hi(" << variable->getId() << ")"
-              << "\t # Loading global variable (hi): " << variable->getId() << "."
-              << std::endl;
-      asm_out << "lw\t " << dest_reg << ", %lo(" << variable->getId() << ")"
-              << "(" << dest_reg << ")" << "\t # Loading global variable (lo): "
-              << variable->getId() << "."
-              << std::endl;
+      if (global_variables.isSmallData(variable->getId())) {
+        asm_out << "lw\t " << dest_reg << ", %gp_rel(" << variable->getId() << ")($gp)"
+                << "\t # Loading global variable: " << variable->getId() << "."
+                << std::endl;
+      } else {
+        asm_out << "lui\t " << dest_reg << ", %hi(" << variable->getId() << ")"
+                << "\t # Loading global variable (hi): " << variable->getId() << "."
+                << std::endl;
+        asm_out << "lw\t " << dest_reg << ", %lo(" << variable->getId() << ")"
+                << "(" << dest_reg << ")" << "\t # Loading global variable (lo): "
+                << variable->getId() << "."
+                << std::endl;
+      }
       asm_out << "nop" << "\t # nop for global variable load." << std::endl;
       asm_out << "lw\t " << dest_reg << ", 0(" << dest_reg << ")"
               << " #\t Load value pointed by global pointer." << std::endl;
@@ -286,7 +779,7 @@ void loadVariableIntoRegister(std::ofstream& asm_out, const Variable* variable,
 // if it is a local or global variable.
 // This function is not suitable to store temporary registers because they are not from
 // a Variable node.
-void storeVariableFromRegister(std::ofstream& asm_out, const Variable* variable,
+void storeVariableFromRegister(std::ostream& asm_out, const Variable* variable,
                                const std::string& src_reg,
                                FunctionContext& function_context,
                                RegisterAllocator& register_allocator,
@@ -300,10 +793,22 @@ void storeVariableFromRegister(std::ofstream& asm_out, const Variable* variable,
       // for that variable, placeVariableInStack will reserve a place for it.
       int offset = function_context.placeVariableInStack(variable->getId(), scope_id,
                                                          is_declaration);
-      asm_out << "sw\t " << src_reg << ", " << offset << "($fp)" << "\t# Store variable "
+      asm_out << "sw\t " << src_reg << ", " << offset << "("
+              << function_context.getFrameRegister() << ")" << "\t# Store variable "
               << variable->getId() << "." << std::endl;
     }
 
+    else if (variable->getInfo() == "array" &&
+             CompilerUtil::isConstantExpression(variable->getArrayIndexOrSize())) {
+      // Constant index: the offset of the element in the frame is known.
+      int offset = function_context.getBaseOffsetForArray(variable->getId()) + 4 *
+        CompilerUtil::evaluateConstantExpression(variable->getArrayIndexOrSize());
+      asm_out << "sw\t " << src_reg << ", " << offset << "("
+              << function_context.getFrameRegister() << ")"
+              << "\t # Local array store: " << variable->getId() << "." << std::endl;
+      asm_out << "nop" << "\t # nop for local array store." << std::endl;
+    }
+
     else if (variable->getInfo() == "array") {
       int base_address = function_context.getBaseOffsetForArray(variable->getId());
       // Calculate offset.
@@ -320,7 +825,8 @@ void storeVariableFromRegister(std::ofstream& asm_out, const Variable* variable,
               << "\t # Sum base address and offset for local array store: "
               << variable->getId() << "." << std::endl;
       // Sum address with frame pointer.
-      asm_out << "addu\t " << offset_reg << ", " << offset_reg << ", $fp"
+      asm_out << "addu\t " << offset_reg << ", " << offset_reg << ", "
+              << function_context.getFrameRegister()
               << "\t # Sum address with frame pointer." << std::endl;
       // Finally store word.
       asm_out << "sw\t " << src_reg << ", 0(" << offset_reg << ")"
@@ -332,7 +838,8 @@ void storeVariableFromRegister(std::ofstream& asm_out, const Variable* variable,
     else if (variable->getInfo() == "pointer") {
       int offset = function_context.getOffsetForVariable(variable->getId());
       const std::string ptrreg = register_allocator.requestFreeRegister();
-      asm_out << "lw\t " << ptrreg << ", " << offset << "($fp)"
+      asm_out << "lw\t " << ptrreg << ", " << offset << "("
+              << function_context.getFrameRegister() << ")"
               << "\t# Reading the address of the pointer. "  << std::endl;
       asm_out << "sw\t " << src_reg << ", 0(" << ptrreg <<")"
               << "\t# Storing the value at the address pointed by pointer. " << std::endl;
@@ -350,28 +857,59 @@ void storeVariableFromRegister(std::ofstream& asm_out, const Variable* variable,
   else if (global_variables.isGlobalVariable(variable->getId())) {
     // Global variable.
     if (variable->getInfo() == "normal") {
-      const std::string& addr_reg = register_allocator.requestFreeRegister();
-      asm_out << "lui\t " << addr_reg << ", %hi(" << variable->getId() << ")"
-              << "\t # Storing global variable (hi): " << variable->getId() << "."
-              << std::endl;
-      asm_out << "sw\t " << src_reg << ", %lo(" << variable->getId() << ")"
-              << "(" << addr_reg << ")" << "\t # Storing global variable (lo): "
-              << variable->getId() << "."
-              << std::endl;
+      if (global_variables.isSmallData(variable->getId())) {
+        asm_out << "sw\t " << src_reg << ", %gp_rel(" << variable->getId() << ")($gp)"
+                << "\t # Storing global variable: " << variable->getId() << "."
+                << std::endl;
+      } else {
+        const std::string& addr_reg = register_allocator.requestFreeRegister();
+        asm_out << "lui\t " << addr_reg << ", %hi(" << variable->getId() << ")"
+                << "\t # Storing global variable (hi): " << variable->getId() << "."
+                << std::endl;
+        asm_out << "sw\t " << src_reg << ", %lo(" << variable->getId() << ")"
+                << "(" << addr_reg << ")" << "\t # Storing global variable (lo): "
+                << variable->getId() << "."
+                << std::endl;
+        register_allocator.freeRegister(addr_reg);
+      }
       asm_out << "nop" << "\t # nop for global variable store." << std::endl;
-      register_allocator.freeRegister(addr_reg);
+    }
+
+    else if (variable->getInfo() == "array" &&
+             CompilerUtil::isConstantExpression(variable->getArrayIndexOrSize())) {
+      // Constant index: the offset is folded in the address of the element.
+      const std::string& element = getGlobalSymbolWithOffset(variable->getId(), 4 *
+        CompilerUtil::evaluateConstantExpression(variable->getArrayIndexOrSize()));
+      if (global_variables.isSmallData(variable->getId())) {
+        asm_out << "sw\t " << src_reg << ", %gp_rel(" << element << ")($gp)"
+                << "\t # Global array store: " << variable->getId() << "." << std::endl;
+      } else {
+        const std::string& addr_reg = register_allocator.requestFreeRegister();
+        asm_out << "lui\t " << addr_reg << ", %hi(" << element << ")"
+                << "\t # Global array store (hi): " << variable->getId() << "." << std::endl;
+        asm_out << "sw\t " << src_reg << ", %lo(" << element << ")(" << addr_reg << ")"
+                << "\t # Global array store (lo): " << variable->getId() << "." << std::endl;
+        register_allocator.freeRegister(addr_reg);
+      }
+      asm_out << "nop" << "\t # nop for global array store." << std::endl;
     }
 
     else if (variable->getInfo() == "array") {
       const std::string& addr_reg = register_allocator.requestFreeRegister();
 
-      asm_out << "lui\t " << addr_reg << ", %hi(" << variable->getId() << ")"
-              << "\t # Preparing address for global array store: " << variable->getId()
-              << "." << std::endl;
-      asm_out << "addiu\t " << addr_reg << ", " << addr_reg << ", %lo("
-              << variable->getId() << ")"
-              << "\t # Preparing address for global array store: " << variable->getId()
-              << "." << std::endl;
+      if (global_variables.isSmallData(variable->getId())) {
+        asm_out << "addiu\t " << addr_reg << ", $gp, %gp_rel(" << variable->getId() << ")"
+                << "\t # Preparing address for global array store: " << variable->getId()
+                << "." << std::endl;
+      } else {
+        asm_out << "lui\t " << addr_reg << ", %hi(" << variable->getId() << ")"
+                << "\t # Preparing address for global array store: " << variable->getId()
+                << "." << std::endl;
+        asm_out << "addiu\t " << addr_reg << ", " << addr_reg << ", %lo("
+                << variable->getId() << ")"
+                << "\t # Preparing address for global array store: " << variable->getId()
+                << "." << std::endl;
+      }
       // At this point, addr_reg contains the base address of the array.
       // Calculate offset.
       asm_out << "# Calculate offset for global array store." << std::endl;
@@ -396,13 +934,19 @@ void storeVariableFromRegister(std::ofstream& asm_out, const Variable* variable,
 
     else if (variable->getInfo() == "pointer") {
       const std::string ptr_reg = register_allocator.requestFreeRegister();
-      asm_out << "lui\t " << ptr_reg << ", %hi(" << variable->getId() << ")"
-              << "\t # Storing global variable (hi): " << variable->getId() << "."
-              << std::endl;
-      asm_out << "lw\t " << ptr_reg << ", %lo(" << variable->getId() << ")"
-              << "(" << ptr_reg << ")" << "\t # Storing global variable (lo): "
-              << variable->getId() << "."
-              << std::endl;
+      if (global_variables.isSmallData(variable->getId())) {
+        asm_out << "lw\t " << ptr_reg << ", %gp_rel(" << variable->getId() << ")($gp)"
+                << "\t # Loading global pointer: " << variable->getId() << "."
+                << std::endl;
+      } else {
+        asm_out << "lui\t " << ptr_reg << ", %hi(" << variable->getId() << ")"
+                << "\t # Storing global variable (hi): " << variable->getId() << "."
+                << std::endl;
+        asm_out << "lw\t " << ptr_reg << ", %lo(" << variable->getId() << ")"
+                << "(" << ptr_reg << ")" << "\t # Storing global variable (lo): "
+                << variable->getId() << "."
+                << std::endl;
+      }
       asm_out << "nop" << "\t # nop for global variable store." << std::endl;
       asm_out << "sw\t " << src_reg << ", 0(" << ptr_reg << ")"
               << " #\t Store value pointed by global pointer." << std::endl;
@@ -439,7 +983,7 @@ void storeVariableFromRegister(std::ofstream& asm_out, const Variable* variable,
 // - function call
 // - ( arithmetic expression ) --> no need for an if because it is implicitly built in the
 //                                 structure of AST.
-void compileArithmeticOrLogicalExpression(std::ofstream& asm_out,
+void compileArithmeticOrLogicalExpression(std::ostream& asm_out,
                                           const Node* arithmetic_or_logical_expression,
                                           const std::string& dest_reg,
                                           FunctionContext& function_context,
@@ -455,8 +999,20 @@ void compileArithmeticOrLogicalExpression(std::ofstream& asm_out,
       dynamic_cast<const IntegerConstant*>(arithmetic_or_logical_expression);
 
     // Add immediate constant into destination register.
-    asm_out << "li\t " << dest_reg << ", " << integer_constant->getValue()
-            << "\t# Add immediate constant into destination register." << std::endl;
+    loadImmediateIntoRegister(asm_out, dest_reg, integer_constant->getValue());
+  }
+
+  else if (CompilerUtil::isConstantExpression(arithmetic_or_logical_expression)) {
+    // Computed at compile time.
+    if (arithmetic_or_logical_expression->getType() == "FunctionCall") {
+      reportOptimization(
+        "evaluated call to " +
+        dynamic_cast<const FunctionCall*>(arithmetic_or_logical_expression)->getFunctionId() +
+        " at compile time.");
+    }
+    loadImmediateIntoRegister(
+      asm_out, dest_reg,
+      CompilerUtil::evaluateConstantExpression(arithmetic_or_logical_expression));
   }
 
   else if (arithmetic_or_logical_expression->getType() == "Variable") {
@@ -467,6 +1023,12 @@ void compileArithmeticOrLogicalExpression(std::ofstream& asm_out,
   }
 
   // Recursive cases.
+  else if (compileBinaryExpressionWithImmediate(asm_out, arithmetic_or_logical_expression,
+                                                dest_reg, function_context,
+                                                register_allocator, scope_id)) {
+    // Binary operation with a constant operand, already compiled.
+  }
+
   else if (arithmetic_or_logical_expression->getType() == "UnaryExpression") {
     const UnaryExpression* unary_expression =
       dynamic_cast<const UnaryExpression*>(arithmetic_or_logical_expression);
@@ -542,14 +1104,19 @@ void compileArithmeticOrLogicalExpression(std::ofstream& asm_out,
       if (function_context.isLocalVariable(variable_id)) {
         // Getting address of local variable.
         int variable_offset = function_context.getOffsetForVariable(variable_id);
-        asm_out << "addiu\t " << dest_reg << ", $fp, " <<  variable_offset
-                << "\t# Address operator." << std::endl;
+        asm_out << "addiu\t " << dest_reg << ", " << function_context.getFrameRegister()
+                << ", " << variable_offset << "\t# Address operator." << std::endl;
       } else if (global_variables.isGlobalVariable(variable_id)) {
         // Getting address of global variable.
-        asm_out << "lui\t " << dest_reg << ", %hi(" << variable_id << ")"
-                << "\t # Extracting address of global variable." << std::endl;
-        asm_out << "addiu\t " << dest_reg << ", " << dest_reg << ", %lo(" << variable_id
-                << ")" << "\t # Extracting address of global variable." << std::endl;
+        if (global_variables.isSmallData(variable_id)) {
+          asm_out << "addiu\t " << dest_reg << ", $gp, %gp_rel(" << variable_id << ")"
+                  << "\t # Extracting address of global variable." << std::endl;
+        } else {
+          asm_out << "lui\t " << dest_reg << ", %hi(" << variable_id << ")"
+                  << "\t # Extracting address of global variable." << std::endl;
+          asm_out << "addiu\t " << dest_reg << ", " << dest_reg << ", %lo(" << variable_id
+                  << ")" << "\t # Extracting address of global variable." << std::endl;
+        }
       }
     }
 
@@ -899,35 +1466,10 @@ void compileArithmeticOrLogicalExpression(std::ofstream& asm_out,
   else if (arithmetic_or_logical_expression->getType() == "ConditionalExpression") {
     const ConditionalExpression* conditional_expression =
       dynamic_cast<const ConditionalExpression*>(arithmetic_or_logical_expression);
-
-    std::string exp1_reg = register_allocator.requestFreeRegister();
-
-    compileArithmeticOrLogicalExpression(asm_out, conditional_expression->getCondition(),
-                                         dest_reg, function_context, register_allocator,
-                                         scope_id);
-
-    // if condition true --> return exp1, else --> return exp2.
-    std::string end_cond_id = CompilerUtil::makeUniqueId("end_cond");
-
-    asm_out << "## Start of conditional expression ##" << std::endl;
-    asm_out << "beq\t " << dest_reg << ", $0, " <<end_cond_id << std::endl;
-    asm_out << "nop" << std::endl;
-    compileArithmeticOrLogicalExpression(asm_out,
-                                         conditional_expression->getExpression1(),
-                                         exp1_reg, function_context, register_allocator,
-                                         scope_id);
-
-    compileArithmeticOrLogicalExpression(asm_out,
-                                         conditional_expression->getExpression2(),
-                                         dest_reg, function_context, register_allocator,
-                                         scope_id);
-
-
-    asm_out << "move\t " << dest_reg << ", " << exp1_reg << std::endl;
-    asm_out << end_cond_id << ":" << std::endl;
-    asm_out << "## End of conditional expression ##" << std::endl;
-
-    register_allocator.freeRegister(exp1_reg);
+    compileConditionalExpression(asm_out, conditional_expression->getCondition(),
+                                 conditional_expression->getExpression1(),
+                                 conditional_expression->getExpression2(), dest_reg,
+                                 function_context, register_allocator, scope_id);
   }
 
   else if (arithmetic_or_logical_expression->getType() == "FunctionCall") {
@@ -953,89 +1495,499 @@ void compileArithmeticOrLogicalExpression(std::ofstream& asm_out,
   }
 }
 
-void compileFunctionCall(std::ofstream& asm_out, const FunctionCall* function_call,
-                         const std::string& dest_reg, FunctionContext& function_context,
-                         RegisterAllocator& register_allocator,
-                         const std::string& scope_id) {
-  if (Util::DEBUG) {
-    std::cerr << "==> Compiling function call." << std::endl;
+// The expression can be computed even when its value is not used: it has no side effects,
+// cannot fault (no memory access other than scalar variables, no division), and is cheap.
+bool isSpeculatableExpression(const Node* expression) {
+  if (CompilerUtil::countNodes(expression) > IF_CONVERSION_MAX_NODES) {
+    return false;
   }
-
-  const std::string& function_id = function_call->getFunctionId();
-  const ParametersListNode* parameters_list_node =
-    dynamic_cast<const ParametersListNode*>(function_call->getParametersList());
-
-  // Check wether it is defined in this file or not.
-  if (function_declarations.isIdOfDeclaredOnlyFunction(function_id)) {
-    asm_out << "lui\t	$28, %hi(__gnu_local_gp)\t # Calling externally defined function."
-            << std::endl;
-	  asm_out << "addiu\t	$28, $28, %lo(__gnu_local_gp)\t # Calling externally defined "
-            << "function." << std::endl;
+  std::vector<const Node*> nodes = {expression};
+  while (!nodes.empty()) {
+    const Node* node = nodes.back();
+    nodes.pop_back();
+    const std::string& type = node->getType();
+    if (type == "Variable") {
+      if (dynamic_cast<const Variable*>(node)->getInfo() != "normal") {
+        return false;
+      }
+    } else if (type == "UnaryExpression") {
+      const std::string& unary_type =
+        dynamic_cast<const UnaryExpression*>(node)->getUnaryType();
+      if (unary_type != "-" && unary_type != "~" && unary_type != "!" &&
+          unary_type != "+") {
+        return false;
+      }
+    } else if (type == "MultiplicativeExpression") {
+      if (dynamic_cast<const MultiplicativeExpression*>(node)->getMultiplicativeType() !=
+          "*") {
+        return false;
+      }
+    } else if (type != "IntegerConstant" && type != "AdditiveExpression" &&
+               type != "ShiftExpression" && type != "RelationalExpression" &&
+               type != "EqualityExpression" && type != "AndExpression" &&
+               type != "ExclusiveOrExpression" && type != "InclusiveOrExpression") {
+      return false;
+    }
+    for (const Node* child : CompilerUtil::getChildren(node)) {
+      nodes.push_back(child);
+    }
   }
+  return true;
+}
 
-  // Store temporary registers to stack before performing call.
-  const std::vector<std::string>& temporary_registers_in_use =
-    register_allocator.getTemporaryRegistersInUse();
-  // Make unique id to store the arguments.
-  std::string arg_scope = CompilerUtil::makeUniqueId("arg_scope");
-  function_context.insertScope(arg_scope);
+// The value of the expression is always 0 or 1.
+bool isBooleanExpression(const Node* expression) {
+  const std::string& type = expression->getType();
+  return type == "RelationalExpression" || type == "EqualityExpression" ||
+         type == "LogicalAndExpression" || type == "LogicalOrExpression" ||
+         (type == "UnaryExpression" &&
+          dynamic_cast<const UnaryExpression*>(expression)->getUnaryType() == "!");
+}
 
-  for (const std::string& temporary_register : temporary_registers_in_use){
-    int offset = function_context.placeVariableInStack(temporary_register, arg_scope,
-                                                       true);
-    asm_out << "sw\t " << temporary_register << ", " << offset << "($fp)"
-            << "\t# Storing temporary register in stack: " << temporary_register << "."
-            << std::endl;
+// Report an optimization decision, with -fopt-report.
+void reportOptimization(const std::string& message) {
+  if (!compiler_options.opt_report) {
+    return;
+  }
+  if (!compilation_attempts.empty()) {
+    compilation_attempts.back().reports.push_back(message);
+    return;
   }
+  std::cerr << function_id_being_compiled << ": " << message << std::endl;
+}
 
-  // Every register in this vector contains an argument for the function call.
-  // Need to move the value to argument registers (a0 - a3) before performing the call.
-  // Need to free the registers in the vector once done.
-  std::vector<std::string> argument_registers;
+// The code emitted for the function being compiled calls the function.
+void recordEmittedCall(const std::string& function_id) {
+  if (!compilation_attempts.empty()) {
+    compilation_attempts.back().emitted_calls.push_back(function_id);
+    return;
+  }
+  emitted_calls[function_id_being_compiled].insert(function_id);
+}
 
-  compileFunctionCallParametersList(asm_out, parameters_list_node, /*param_number=*/0,
-                                    argument_registers, function_context,
-                                    register_allocator, scope_id);
+// Compiles code into a stream, with a function context and a register allocator.
+typedef std::function<void(std::ostream&, FunctionContext&, RegisterAllocator&)>
+  CodeCompiler;
 
-  // Move the values of the paramaters to argument registers.
-  for (unsigned int i = 0; i < argument_registers.size(); i++) {
-    asm_out << "move\t " << "$a" << i << ", " << argument_registers[i]
-            << " \t# Move the values of the paramaters to argument registers."
-            << std::endl;
-    register_allocator.freeRegister(argument_registers[i]);
+// Compile code that may need more registers than are free, e.g. an inlined call: it is
+// compiled with copies of the function context and of the register allocator, in which
+// running out of registers is not fatal (see RegisterAllocator::makeTrial). If they do
+// not run out, the code is emitted and the copies replace the originals, as if it had
+// been compiled directly. Otherwise nothing is emitted, and false is returned.
+bool compileIfRegistersSuffice(std::ostream& asm_out, FunctionContext& function_context,
+                               RegisterAllocator& register_allocator,
+                               const CodeCompiler& compile) {
+  FunctionContext trial_function_context = function_context;
+  RegisterAllocator trial_register_allocator = register_allocator.makeTrial();
+  std::stringstream trial_out;
+  compilation_attempts.push_back(CompilationAttempt());
+  compile(trial_out, trial_function_context, trial_register_allocator);
+  const CompilationAttempt attempt = compilation_attempts.back();
+  compilation_attempts.pop_back();
+  if (trial_register_allocator.isExhausted()) {
+    return false;
+  }
+  for (const std::string& report : attempt.reports) {
+    reportOptimization(report);
   }
+  for (const std::string& function_id : attempt.emitted_calls) {
+    recordEmittedCall(function_id);
+  }
+  asm_out << trial_out.str();
+  function_context = trial_function_context;
+  register_allocator.commitTrial(trial_register_allocator);
+  return true;
+}
 
-  // Call function.
-  // Externally defined function.
-  if (function_declarations.isIdOfDeclaredOnlyFunction(function_id)) {
-    const std::string tmp_reg = register_allocator.requestFreeRegister();
-    asm_out << "lw\t " << tmp_reg << ", %call16(" << function_id << ")($28)" << std::endl;
-    asm_out << "move\t $25, " << tmp_reg << std::endl;
-    register_allocator.freeRegister(tmp_reg);
-    asm_out << ".reloc 1f,R_MIPS_JALR," << function_id << std::endl;
-    asm_out << "1:	jalr	$25" << std::endl;
-    asm_out << "nop" << std::endl;
+// Value of condition ? expression1 : expression2 in dest_reg, without branching: both
+// expressions are computed, and the result is selected by a conditional move, or by masks
+// if the target has none.
+void compileSelect(std::ostream& asm_out, const Node* condition, const Node* expression1,
+                   const Node* expression2, const std::string& dest_reg,
+                   FunctionContext& function_context,
+                   RegisterAllocator& register_allocator, const std::string& scope_id) {
+  const std::string cond_reg = register_allocator.requestFreeRegister();
+  compileArithmeticOrLogicalExpression(asm_out, condition, cond_reg, function_context,
+                                       register_allocator, scope_id);
+  compileArithmeticOrLogicalExpression(asm_out, expression2, dest_reg, function_context,
+                                       register_allocator, scope_id);
+  const std::string exp1_reg = register_allocator.requestFreeRegister();
+  compileArithmeticOrLogicalExpression(asm_out, expression1, exp1_reg, function_context,
+                                       register_allocator, scope_id);
+  if (compiler_options.conditional_moves) {
+    asm_out << "movn\t " << dest_reg << ", " << exp1_reg << ", " << cond_reg
+            << "\t# Select the first expression if the condition holds." << std::endl;
   } else {
-    asm_out << "jal\t " << function_id << "\t# Function call to: " << function_id << "."
-            << std::endl;
-    asm_out << "nop" << std::endl;
+    // mask = -(condition != 0), dest = exp2 ^ ((exp1 ^ exp2) & mask).
+    if (!isBooleanExpression(condition)) {
+      asm_out << "sltu\t " << cond_reg << ", $0, " << cond_reg << std::endl;
+    }
+    asm_out << "subu\t " << cond_reg << ", $0, " << cond_reg
+            << "\t# Mask of the condition." << std::endl;
+    asm_out << "xor\t " << exp1_reg << ", " << exp1_reg << ", " << dest_reg << std::endl;
+    asm_out << "and\t " << exp1_reg << ", " << exp1_reg << ", " << cond_reg << std::endl;
+    asm_out << "xor\t " << dest_reg << ", " << dest_reg << ", " << exp1_reg
+            << "\t# Select the first expression if the condition holds." << std::endl;
   }
+  register_allocator.freeRegister(exp1_reg);
+  register_allocator.freeRegister(cond_reg);
+}
 
-  // Restore temporary registers from stack.
+// Value of condition ? expression1 : expression2 in dest_reg.
+// If-conversion: if both expressions can be computed speculatively, and there are enough
+// free registers for both, they are (see compileSelect) instead of branching. Otherwise
+// only the expression selected by the condition is computed.
+void compileConditionalExpression(std::ostream& asm_out, const Node* condition,
+                                  const Node* expression1, const Node* expression2,
+                                  const std::string& dest_reg,
+                                  FunctionContext& function_context,
+                                  RegisterAllocator& register_allocator,
+                                  const std::string& scope_id) {
+  asm_out << "## Start of conditional expression ##" << std::endl;
+  if (compiler_options.if_conversion && isSpeculatableExpression(expression1) &&
+      isSpeculatableExpression(expression2)) {
+    auto compile_select = [&](std::ostream& select_out,
+                              FunctionContext& select_function_context,
+                              RegisterAllocator& select_register_allocator) {
+      compileSelect(select_out, condition, expression1, expression2, dest_reg,
+                    select_function_context, select_register_allocator, scope_id);
+    };
+    if (compileIfRegistersSuffice(asm_out, function_context, register_allocator,
+                                  compile_select)) {
+      asm_out << "## End of conditional expression ##" << std::endl;
+      return;
+    }
+    reportOptimization("conditional expression not converted to a select: "
+                       "not enough free registers.");
+  }
+
+  compileArithmeticOrLogicalExpression(asm_out, condition, dest_reg, function_context,
+                                       register_allocator, scope_id);
+  const std::string else_cond_id = CompilerUtil::makeUniqueId("else_cond");
+  const std::string end_cond_id = CompilerUtil::makeUniqueId("end_cond");
+  asm_out << "beq\t " << dest_reg << ", $0, " << else_cond_id << std::endl;
+  asm_out << "nop" << std::endl;
+  compileArithmeticOrLogicalExpression(asm_out, expression1, dest_reg, function_context,
+                                       register_allocator, scope_id);
+  asm_out << "b\t " << end_cond_id << std::endl;
+  asm_out << "nop" << std::endl;
+  asm_out << else_cond_id << ":" << std::endl;
+  compileArithmeticOrLogicalExpression(asm_out, expression2, dest_reg, function_context,
+                                       register_allocator, scope_id);
+  asm_out << end_cond_id << ":" << std::endl;
+  asm_out << "## End of conditional expression ##" << std::endl;
+}
+
+
+// Instrumentation, with -fprofile-generate: increment a counter of the node (see
+// ExecutionProfile). The counters are not small data: they are addressed with %hi and %lo
+// like large global variables.
+void compileProfileCounterIncrement(std::ostream& asm_out, const Node* node, int which,
+                                    RegisterAllocator& register_allocator) {
+  const int counter = execution_profile.getCounter(node, which);
+  if (!compiler_options.profile_generate || counter < 0) {
+    return;
+  }
+  const std::string& counter_symbol = getGlobalSymbolWithOffset(
+    PROFILE_COUNTERS, (PROFILE_HEADER_WORDS + counter) * WORD_LENGTH);
+  const std::string addr_reg = register_allocator.requestFreeRegister();
+  const std::string count_reg = register_allocator.requestFreeRegister();
+  asm_out << "lui\t " << addr_reg << ", %hi(" << counter_symbol << ")"
+          << "\t# Address of profile counter (hi): " << counter << "." << std::endl;
+  asm_out << "lw\t " << count_reg << ", %lo(" << counter_symbol << ")(" << addr_reg << ")"
+          << "\t# Load profile counter: " << counter << "." << std::endl;
+  asm_out << "nop" << std::endl;
+  asm_out << "addiu\t " << count_reg << ", " << count_reg << ", 1" << std::endl;
+  asm_out << "sw\t " << count_reg << ", %lo(" << counter_symbol << ")(" << addr_reg << ")"
+          << "\t# Store profile counter: " << counter << "." << std::endl;
+  register_allocator.freeRegister(count_reg);
+  register_allocator.freeRegister(addr_reg);
+}
+
+// The call passes as many parameters as the function has arguments.
+bool hasMatchingArguments(const FunctionCall* function_call,
+                          const FunctionDefinition* function_definition) {
+  std::vector<std::string> argument_names =
+    CompilerUtil::getArgumentNamesFromFunctionDeclaration(
+      dynamic_cast<const ArgumentListNode*>(function_definition->getArgumentList()));
+  int arguments = std::count_if(argument_names.begin(), argument_names.end(),
+                                [](const std::string& argument_name) {
+                                  return argument_name != CompilerUtil::NO_ARGUMENT;
+                                });
+  int parameters = 0;
+  const ParametersListNode* parameters_list_node =
+    dynamic_cast<const ParametersListNode*>(function_call->getParametersList());
+  while (!parameters_list_node->isEmptyParameterList()) {
+    parameters++;
+    if (!parameters_list_node->hasNextParameter()) {
+      break;
+    }
+    parameters_list_node =
+      dynamic_cast<const ParametersListNode*>(parameters_list_node->getNextParameter());
+  }
+  return arguments == parameters;
+}
+
+// Inlining: the cost model only looks at the callee. It must be defined in the
+// translation unit and not be recursive, with the same number of arguments as the call.
+// Small functions are always inlined, larger ones only if this is their only call.
+// Returns false, with the reason, if the call is not inlined.
+bool isInlinableFunctionCall(const FunctionCall* function_call, std::string& reason) {
+  const std::string& function_id = function_call->getFunctionId();
+  const FunctionDefinition* function_definition =
+    call_graph.getFunctionDefinition(function_id);
+  if (!compiler_options.inline_functions) {
+    reason = "inlining disabled";
+    return false;
+  }
+  if (function_definition == nullptr) {
+    reason = "not defined in the translation unit";
+    return false;
+  }
+  if (call_graph.isRecursive(function_id)) {
+    reason = "recursive";
+    return false;
+  }
+  if (!hasMatchingArguments(function_call, function_definition)) {
+    reason = "wrong number of arguments";
+    return false;
+  }
+  const int size = CompilerUtil::countNodes(function_definition->getBody());
+  int max_size = call_graph.countCalls(function_id) == 1 ?
+                 INLINE_CALLED_ONCE_MAX_NODES : INLINE_MAX_NODES;
+  // With a profile, larger callees are inlined at the hot call sites, and only the
+  // smallest ones at the call sites that were never run.
+  const long long count = execution_profile.getCount(function_call, 0);
+  std::string profile_reason;
+  if (execution_profile.isHot(count)) {
+    max_size = std::max(max_size, INLINE_HOT_MAX_NODES);
+    profile_reason = ", hot call site";
+  } else if (count == 0 && call_graph.countCalls(function_id) != 1) {
+    max_size = INLINE_COLD_MAX_NODES;
+    profile_reason = ", call site never run";
+  }
+  if (size > max_size) {
+    reason = "too large (size " + std::to_string(size) + profile_reason + ")";
+    return false;
+  }
+  reason = "size " + std::to_string(size) + profile_reason;
+  return true;
+}
+
+// Bytes of the stack frame needed by the calls inlined in the subtree: the arguments and
+// the variables of the callees. The ones of an inlined call are freed at its end, so only
+// the nested calls add up.
+int countBytesForInlinedCalls(const Node* ast_node) {
+  int bytes = 0;
+  for (const Node* child : CompilerUtil::getChildren(ast_node)) {
+    bytes = std::max(bytes, countBytesForInlinedCalls(child));
+  }
+  std::string reason;
+  if (ast_node->getType() == "FunctionCall" &&
+      isInlinableFunctionCall(dynamic_cast<const FunctionCall*>(ast_node), reason)) {
+    const FunctionDefinition* callee = call_graph.getFunctionDefinition(
+      dynamic_cast<const FunctionCall*>(ast_node)->getFunctionId());
+    bytes = std::max(bytes, 4 * WORD_LENGTH +
+                            CompilerUtil::countBytesForDeclarationsInFunction(callee) +
+                            countBytesForInlinedCalls(callee->getBody()));
+  }
+  return bytes;
+}
+
+// Compile the body of the callee in place of the call. Each argument is computed in the
+// scope of the caller and stored in its variable of the callee, in a new scope.
+void compileInlinedFunctionCall(std::ostream& asm_out, const FunctionCall* function_call,
+                                const std::string& dest_reg,
+                                FunctionContext& function_context,
+                                RegisterAllocator& register_allocator,
+                                const std::string& scope_id) {
+  const std::string& function_id = function_call->getFunctionId();
+  const FunctionDefinition* function_definition =
+    call_graph.getFunctionDefinition(function_id);
+  std::vector<std::string> argument_names =
+    CompilerUtil::getArgumentNamesFromFunctionDeclaration(
+      dynamic_cast<const ArgumentListNode*>(function_definition->getArgumentList()));
+
+  asm_out << "# Inlined call to: " << function_id << "." << std::endl;
+  std::string inlined_scope = CompilerUtil::makeUniqueId(function_id + "_inlined");
+  std::string inlined_end_id = CompilerUtil::makeUniqueId(function_id + "_inlined_end");
+  function_context.insertInlinedCall(inlined_end_id, dest_reg);
+  const ParametersListNode* parameters_list_node =
+    dynamic_cast<const ParametersListNode*>(function_call->getParametersList());
+  for (int i = 0; !parameters_list_node->isEmptyParameterList(); i++) {
+    std::string argument_register = register_allocator.requestFreeRegister();
+    compileArithmeticOrLogicalExpression(asm_out, parameters_list_node->getParameter(),
+                                         argument_register, function_context,
+                                         register_allocator, scope_id);
+    int offset = function_context.placeVariableInStack(argument_names[i], inlined_scope,
+                                                       /*is_declaration=*/true);
+    asm_out << "sw\t " << argument_register << ", " << offset << "("
+            << function_context.getFrameRegister() << ")\t# Store inlined argument: "
+            << argument_names[i] << "." << std::endl;
+    register_allocator.freeRegister(argument_register);
+    if (!parameters_list_node->hasNextParameter()) {
+      break;
+    }
+    parameters_list_node =
+      dynamic_cast<const ParametersListNode*>(parameters_list_node->getNextParameter());
+  }
+  function_context.insertInlinedCallScope(inlined_scope);
+  // The variables of the callee are not visible from the rest of the caller.
+  CompilerUtil::collectAddressTakenVariables(function_definition->getBody(),
+                                             address_taken_variables);
+  std::stringstream body_out;
+  compileProfileCounterIncrement(body_out, function_definition, 0, register_allocator);
+  const FunctionDefinition* caller_definition = function_definition_being_compiled;
+  function_definition_being_compiled = function_definition;
+  compileCompoundStatement(
+    body_out, dynamic_cast<const CompoundStatement*>(function_definition->getBody()),
+    function_context, register_allocator, inlined_scope);
+  function_definition_being_compiled = caller_definition;
+  function_context.removeInlinedCall();
+  // A return statement at the end of the body does not need to jump.
+  std::string body = body_out.str();
+  const std::string final_return =
+    "b\t " + inlined_end_id + "\t# Return statement of an inlined function.\nnop\n";
+  if (body.size() >= final_return.size() &&
+      body.compare(body.size() - final_return.size(), final_return.size(),
+                   final_return) == 0) {
+    body.erase(body.size() - final_return.size());
+  }
+  asm_out << body;
+  asm_out << inlined_end_id << ":" << std::endl;
+}
+
+// Inline the call if the callee is inlinable (see isInlinableFunctionCall) and the
+// registers in use leave enough free ones for its body (see compileIfRegistersSuffice).
+// Returns false if the call is not inlined.
+bool compileFunctionCallInline(std::ostream& asm_out, const FunctionCall* function_call,
+                               const std::string& dest_reg,
+                               FunctionContext& function_context,
+                               RegisterAllocator& register_allocator,
+                               const std::string& scope_id) {
+  const std::string& function_id = function_call->getFunctionId();
+  std::string reason;
+  if (!isInlinableFunctionCall(function_call, reason)) {
+    reportOptimization("not inlined call to " + function_id + ": " + reason + ".");
+    return false;
+  }
+  // The names of the callee must not be loop counters replaced by constants in the caller
+  // (see compileFullyUnrolledLoop).
+  std::unordered_map<std::string, int> callee_references;
+  CompilerUtil::countVariableReferences(
+    call_graph.getFunctionDefinition(function_id), callee_references);
+  for (const auto& callee_reference : callee_references) {
+    if (compile_time_constants.isConstant(callee_reference.first) &&
+        function_context.isLocalVariable(callee_reference.first)) {
+      reportOptimization("not inlined call to " + function_id +
+                         ": uses the name of an unrolled loop counter.");
+      return false;
+    }
+  }
+
+  auto compile_inlined_call = [&](std::ostream& inlined_out,
+                                  FunctionContext& inlined_function_context,
+                                  RegisterAllocator& inlined_register_allocator) {
+    reportOptimization("inlined call to " + function_id + " (" + reason + ").");
+    compileInlinedFunctionCall(inlined_out, function_call, dest_reg,
+                               inlined_function_context, inlined_register_allocator,
+                               scope_id);
+  };
+  if (!compileIfRegistersSuffice(asm_out, function_context, register_allocator,
+                                 compile_inlined_call)) {
+    reportOptimization("not inlined call to " + function_id +
+                       ": not enough free registers.");
+    return false;
+  }
+  return true;
+}
+
+void compileFunctionCall(std::ostream& asm_out, const FunctionCall* function_call,
+                         const std::string& dest_reg, FunctionContext& function_context,
+                         RegisterAllocator& register_allocator,
+                         const std::string& scope_id) {
+  if (Util::DEBUG) {
+    std::cerr << "==> Compiling function call." << std::endl;
+  }
+
+  compileProfileCounterIncrement(asm_out, function_call, 0, register_allocator);
+  if (compileFunctionCallInline(asm_out, function_call, dest_reg, function_context,
+                                register_allocator, scope_id)) {
+    return;
+  }
+
+  const std::string& function_id = function_call->getFunctionId();
+  const ParametersListNode* parameters_list_node =
+    dynamic_cast<const ParametersListNode*>(function_call->getParametersList());
+
+  // Store temporary registers to their spill slots before performing call. The ones that
+  // are not live across the call are removed later (see AsmOptimizer).
+  const std::vector<std::string>& temporary_registers_in_use =
+    register_allocator.getTemporaryRegistersInUse();
+
+  for (const std::string& temporary_register : temporary_registers_in_use){
+    int offset = function_context.getSpillOffsetForRegister(temporary_register);
+    asm_out << "sw\t " << temporary_register << ", " << offset << "("
+            << function_context.getFrameRegister() << ")"
+            << "\t# Storing temporary register in stack: " << temporary_register << "."
+            << std::endl;
+  }
+
+  // Every register in this vector contains an argument for the function call.
+  // Need to move the value to argument registers (a0 - a3) before performing the call.
+  // Need to free the registers in the vector once done.
+  std::vector<std::string> argument_registers;
+
+  compileFunctionCallParametersList(asm_out, parameters_list_node, /*param_number=*/0,
+                                    argument_registers, function_context,
+                                    register_allocator, scope_id);
+
+  // Move the values of the paramaters to argument registers.
+  for (unsigned int i = 0; i < argument_registers.size(); i++) {
+    if (argument_registers[i] == "$a" + std::to_string(i)) {
+      // Already computed in the argument register.
+      continue;
+    }
+    asm_out << "move\t " << "$a" << i << ", " << argument_registers[i]
+            << " \t# Move the values of the paramaters to argument registers."
+            << std::endl;
+    register_allocator.freeRegister(argument_registers[i]);
+  }
+
+  recordEmittedCall(function_id);
+
+  // Call function.
+  // Externally defined function.
+  if (function_declarations.isIdOfDeclaredOnlyFunction(function_id)) {
+    const std::string tmp_reg = register_allocator.requestFreeRegister();
+    asm_out << "lw\t " << tmp_reg << ", %call16(" << function_id << ")($28)" << std::endl;
+    asm_out << "move\t $25, " << tmp_reg << std::endl;
+    register_allocator.freeRegister(tmp_reg);
+    asm_out << ".reloc 1f,R_MIPS_JALR," << function_id << std::endl;
+    asm_out << "1:	jalr	$25" << std::endl;
+    asm_out << "nop" << std::endl;
+  } else {
+    asm_out << "jal\t " << function_id << "\t# Function call to: " << function_id << "."
+            << std::endl;
+    asm_out << "nop" << std::endl;
+  }
+
+  // Restore temporary registers from stack.
   for (const std::string& temporary_register : temporary_registers_in_use){
-    int offset = function_context.getOffsetForVariable(temporary_register);
-    asm_out << "lw\t " << temporary_register << ", " << offset << "($fp)"
+    int offset = function_context.getSpillOffsetForRegister(temporary_register);
+    asm_out << "lw\t " << temporary_register << ", " << offset << "("
+            << function_context.getFrameRegister() << ")"
             << "\t# Restoring temporary register from stack: " << temporary_register
             << "." << std::endl;
   }
   // Move return value into temp register.
-  asm_out << "move\t " << dest_reg << ", $v0" << "\t# Save result of function call."
-          << std::endl;
-
-  function_context.removeScope();
+  if (dest_reg != "$v0") {
+    asm_out << "move\t " << dest_reg << ", $v0" << "\t# Save result of function call."
+            << std::endl;
+  }
 }
 
-void compileFunctionCallParametersList(std::ofstream& asm_out,
+void compileFunctionCallParametersList(std::ostream& asm_out,
                                        const ParametersListNode* parameters_list_node,
                                        int param_number,
                                        std::vector<std::string>& argument_registers,
@@ -1054,14 +2006,22 @@ void compileFunctionCallParametersList(std::ofstream& asm_out,
     Util::abort();
   }
 
-  std::string argument_register = register_allocator.requestFreeRegister();
-  argument_registers.push_back(argument_register);
-
   // Base cases.
   if (parameters_list_node->isEmptyParameterList()) {
     return;
   }
-  else if(!parameters_list_node->hasNextParameter()) {
+
+  // If no function call is performed from this parameter onward, the argument register
+  // cannot be overwritten anymore: compute the parameter directly in it.
+  std::string argument_register;
+  if (!CompilerUtil::containsFunctionCall(parameters_list_node)) {
+    argument_register = "$a" + std::to_string(param_number);
+  } else {
+    argument_register = register_allocator.requestFreeRegister();
+  }
+  argument_registers.push_back(argument_register);
+
+  if (!parameters_list_node->hasNextParameter()) {
     // Only one parameter left.
     const Node* parameter = parameters_list_node->getParameter();
     compileArithmeticOrLogicalExpression(asm_out, parameter, argument_register,
@@ -1082,7 +2042,7 @@ void compileFunctionCallParametersList(std::ofstream& asm_out,
 }
 
 void compileDeclarationExpressionList(
-  std::ofstream& asm_out, const DeclarationExpressionList* declaration_expression_list,
+  std::ostream& asm_out, const DeclarationExpressionList* declaration_expression_list,
   FunctionContext& function_context, RegisterAllocator& register_allocator,
   const std::string& scope_id) {
   if (Util::DEBUG) {
@@ -1135,11 +2095,13 @@ void compileDeclarationExpressionList(
                                              declaration_expression_list_node->getRhs(),
                                              rhs_reg, function_context,
                                              register_allocator, scope_id);
-        asm_out << "sw\t " << rhs_reg << ", " << offset << "($fp)"
+        asm_out << "sw\t " << rhs_reg << ", " << offset << "("
+                << function_context.getFrameRegister() << ")"
                 << "\t# Initialising pointer to rhs value. " << std::endl;
         register_allocator.freeRegister(rhs_reg);
       } else {
-        asm_out << "sw\t " << "$0, " << offset << "($fp)"
+        asm_out << "sw\t " << "$0, " << offset << "("
+                << function_context.getFrameRegister() << ")"
                 << "\t# Initialising pointer to 0. " << std::endl;
       }
     }
@@ -1169,7 +2131,7 @@ void compileDeclarationExpressionList(
   }
 }
 
-void compileAssignmentExpression(std::ofstream& asm_out,
+void compileAssignmentExpression(std::ostream& asm_out,
                                  const AssignmentExpression* assignment_expression,
                                  const std::string& dest_reg,
                                  FunctionContext& function_context,
@@ -1184,6 +2146,24 @@ void compileAssignmentExpression(std::ofstream& asm_out,
       dynamic_cast<const Variable*>(assignment_expression->getVariable());
   const std::string& variable_id = variable->getId();
 
+  // Compound assignment with a constant operand (e.g. a <<= 3).
+  const std::string& assignment_type = assignment_expression->getAssignmentType();
+  if (assignment_type != "=" &&
+      CompilerUtil::isConstantExpression(assignment_expression->getRhs())) {
+    // Operator without the trailing '='.
+    const std::string op = assignment_type.substr(0, assignment_type.size() - 1);
+    int immediate =
+      CompilerUtil::evaluateConstantExpression(assignment_expression->getRhs());
+    if (hasImmediateForm(op, immediate)) {
+      loadVariableIntoRegister(asm_out, variable, dest_reg, function_context,
+                               register_allocator, scope_id);
+      compileImmediateOperation(asm_out, op, dest_reg, dest_reg, immediate);
+      storeVariableFromRegister(asm_out, variable, dest_reg, function_context,
+                                register_allocator, scope_id, false);
+      return;
+    }
+  }
+
   // Register to hold the evaluation of the right hand side of the assignment expression.
   std::string tmp_reg = register_allocator.requestFreeRegister();
   compileArithmeticOrLogicalExpression(asm_out, assignment_expression->getRhs(), tmp_reg,
@@ -1284,7 +2264,157 @@ void compileAssignmentExpression(std::ofstream& asm_out,
   register_allocator.freeRegister(tmp_reg);
 }
 
-void compileReturnStatement(std::ofstream& asm_out,
+// The returned expression is a call to the function being compiled, that can be done
+// by updating the arguments and executing the body again. Not possible if the address of
+// a local variable may be used by the call.
+bool isTailRecursion(const Node* expression) {
+  if (!compiler_options.optimize_sibling_calls || expression->getType() != "FunctionCall" ||
+      !address_taken_variables.empty() || function_id_being_compiled == "main") {
+    return false;
+  }
+  const FunctionCall* function_call = dynamic_cast<const FunctionCall*>(expression);
+  const FunctionDefinition* function_definition =
+    call_graph.getFunctionDefinition(function_id_being_compiled);
+  return function_call->getFunctionId() == function_id_being_compiled &&
+         function_definition != nullptr &&
+         hasMatchingArguments(function_call, function_definition);
+}
+
+// The returned expression is "operand op call" or "call op operand", with op "+" or "*",
+// where the call is a tail recursion once the operand is accumulated. The operand must
+// not contain calls. Returns the call, or nullptr.
+const FunctionCall* matchAccumulatedTailRecursion(const Node* expression,
+                                                  std::string& op,
+                                                  const Node*& operand) {
+  const Node* lhs;
+  const Node* rhs;
+  if (expression->getType() == "AdditiveExpression") {
+    const AdditiveExpression* additive_expression =
+      dynamic_cast<const AdditiveExpression*>(expression);
+    op = additive_expression->getAdditiveType();
+    lhs = additive_expression->getLhs();
+    rhs = additive_expression->getRhs();
+  } else if (expression->getType() == "MultiplicativeExpression") {
+    const MultiplicativeExpression* multiplicative_expression =
+      dynamic_cast<const MultiplicativeExpression*>(expression);
+    op = multiplicative_expression->getMultiplicativeType();
+    lhs = multiplicative_expression->getLhs();
+    rhs = multiplicative_expression->getRhs();
+  } else {
+    return nullptr;
+  }
+  if (op != "+" && op != "*") {
+    return nullptr;
+  }
+  if (isTailRecursion(rhs) && !CompilerUtil::containsFunctionCall(lhs)) {
+    operand = lhs;
+    return dynamic_cast<const FunctionCall*>(rhs);
+  }
+  if (isTailRecursion(lhs) && !CompilerUtil::containsFunctionCall(rhs)) {
+    operand = rhs;
+    return dynamic_cast<const FunctionCall*>(lhs);
+  }
+  return nullptr;
+}
+
+// Operator of the accumulated tail recursions in the return statements of the subtree
+// (see matchAccumulatedTailRecursion). Empty if there are none, or if they use different
+// operators.
+std::string findTailRecursionOperator(const Node* ast_node) {
+  std::unordered_set<std::string> operators;
+  std::vector<const Node*> nodes = {ast_node};
+  while (!nodes.empty()) {
+    const Node* node = nodes.back();
+    nodes.pop_back();
+    if (node->getType() == "ReturnStatement") {
+      const ReturnStatement* return_statement = dynamic_cast<const ReturnStatement*>(node);
+      std::string op;
+      const Node* operand;
+      if (return_statement->hasExpression() &&
+          matchAccumulatedTailRecursion(return_statement->getExpression(), op, operand)) {
+        operators.insert(op);
+      }
+    }
+    for (const Node* child : CompilerUtil::getChildren(node)) {
+      nodes.push_back(child);
+    }
+  }
+  return operators.size() == 1 ? *operators.begin() : "";
+}
+
+// dest_reg = dest_reg op src_reg, with the operator of the accumulated tail recursion.
+void compileAccumulation(std::ostream& asm_out, const std::string& dest_reg,
+                         const std::string& src_reg) {
+  if (tail_recursion_operator == "+") {
+    asm_out << "addu\t " << dest_reg << ", " << dest_reg << ", " << src_reg
+            << "\t# Addition." << std::endl;
+  } else {
+    asm_out << "mult\t " << dest_reg << ", " << src_reg << std::endl;
+    asm_out << "mflo\t " << dest_reg << std::endl;
+    asm_out << "nop" << std::endl;
+    asm_out << "nop" << "\t# Multiplication." << std::endl;
+  }
+}
+
+// The returned expression is a call to another function, that can reuse the stack frame
+// of the caller (see AsmOptimizer::eliminateTailCalls). The arguments are all passed in
+// registers, since calls have at most 4 of them. Not possible if the result has to be
+// combined with the accumulator of a tail recursion.
+bool isSiblingCall(const Node* expression) {
+  return compiler_options.optimize_sibling_calls &&
+         expression->getType() == "FunctionCall" && address_taken_variables.empty() &&
+         tail_recursion_operator.empty();
+}
+
+// Recursive tail call: the parameters of the call become the new values of the
+// arguments, and the body is executed again in the same stack frame.
+void compileTailRecursion(std::ostream& asm_out, const FunctionCall* function_call,
+                          FunctionContext& function_context,
+                          RegisterAllocator& register_allocator,
+                          const std::string& scope_id) {
+  const FunctionDefinition* function_definition =
+    call_graph.getFunctionDefinition(function_id_being_compiled);
+  std::vector<std::string> argument_names =
+    CompilerUtil::getArgumentNamesFromFunctionDeclaration(
+      dynamic_cast<const ArgumentListNode*>(function_definition->getArgumentList()));
+  const ParametersListNode* parameters_list_node =
+    dynamic_cast<const ParametersListNode*>(function_call->getParametersList());
+
+  // All the parameters are computed before updating the arguments, which they may read.
+  std::vector<std::string> argument_registers;
+  compileFunctionCallParametersList(asm_out, parameters_list_node, /*param_number=*/0,
+                                    argument_registers, function_context,
+                                    register_allocator, scope_id);
+  for (unsigned int i = 0; i < argument_registers.size(); i++) {
+    const Node* parameter = parameters_list_node->getParameter();
+    const int offset = function_context.getFrameSize() + i * WORD_LENGTH;
+    // An argument passed unchanged keeps its value.
+    const bool is_unchanged =
+      parameter->getType() == "Variable" &&
+      dynamic_cast<const Variable*>(parameter)->getId() == argument_names[i] &&
+      function_context.getOffsetForVariable(argument_names[i]) == offset;
+    if (!is_unchanged) {
+      asm_out << "sw\t " << argument_registers[i] << ", " << offset << "("
+              << function_context.getFrameRegister() << ")"
+              << "\t# Store argument for the tail recursion: " << argument_names[i] << "."
+              << std::endl;
+    }
+    if (argument_registers[i] != "$a" + std::to_string(i)) {
+      register_allocator.freeRegister(argument_registers[i]);
+    }
+    if (parameters_list_node->hasNextParameter()) {
+      parameters_list_node =
+        dynamic_cast<const ParametersListNode*>(parameters_list_node->getNextParameter());
+    }
+  }
+  function_has_tail_recursion = true;
+  reportOptimization("tail recursion turned into a loop");
+  asm_out << "b\t " << function_context.getTailRecursionLabel() << "\t# Tail recursion."
+          << std::endl;
+  asm_out << "nop" << std::endl;
+}
+
+void compileReturnStatement(std::ostream& asm_out,
                             const ReturnStatement* return_statement,
                             FunctionContext& function_context,
                             RegisterAllocator& register_allocator,
@@ -1293,22 +2423,88 @@ void compileReturnStatement(std::ofstream& asm_out,
     std::cerr << "==> Compiling return statement." << std::endl;
   }
 
-  if (return_statement->hasExpression()) {
+  // The body of an inlined function leaves the result in the register of the call, and
+  // jumps to the end of the body.
+  const bool is_inlined = function_context.isCompilingInlinedCall();
 
-    std::string dest_reg = register_allocator.requestFreeRegister();
-    compileArithmeticOrLogicalExpression(asm_out, return_statement->getExpression(),
-                                         dest_reg, function_context, register_allocator,
-                                         scope_id);
-
-    // move return value in $2.
-    asm_out << "move\t $v0, " << dest_reg <<std::endl;
-    asm_out << "b " << function_context.getFunctionEpilogueLabel()
-            << "\t# Return statement." << std::endl;
-    register_allocator.freeRegister(dest_reg);
+  if (!is_inlined && return_statement->hasExpression()) {
+    const Node* expression = return_statement->getExpression();
+    if (isTailRecursion(expression)) {
+      compileTailRecursion(asm_out, dynamic_cast<const FunctionCall*>(expression),
+                           function_context, register_allocator, scope_id);
+      return;
+    }
+    std::string op;
+    const Node* operand;
+    const FunctionCall* accumulated_call =
+      matchAccumulatedTailRecursion(expression, op, operand);
+    if (accumulated_call != nullptr && op == tail_recursion_operator) {
+      // accumulator = accumulator op operand, then the recursive call.
+      const std::string operand_reg = register_allocator.requestFreeRegister();
+      compileArithmeticOrLogicalExpression(asm_out, operand, operand_reg,
+                                           function_context, register_allocator,
+                                           scope_id);
+      const std::string accumulator_reg = register_allocator.requestFreeRegister();
+      asm_out << "lw\t " << accumulator_reg << ", " << tail_recursion_accumulator_offset
+              << "(" << function_context.getFrameRegister() << ")"
+              << "\t# Load the accumulator of the tail recursion." << std::endl;
+      compileAccumulation(asm_out, accumulator_reg, operand_reg);
+      asm_out << "sw\t " << accumulator_reg << ", " << tail_recursion_accumulator_offset
+              << "(" << function_context.getFrameRegister() << ")"
+              << "\t# Store the accumulator of the tail recursion." << std::endl;
+      register_allocator.freeRegister(accumulator_reg);
+      register_allocator.freeRegister(operand_reg);
+      compileTailRecursion(asm_out, accumulated_call, function_context, register_allocator,
+                           scope_id);
+      return;
+    }
+  }
+  const std::string result_reg =
+    is_inlined ? function_context.getInlinedReturnRegister() : "$v0";
+  if (return_statement->hasExpression()) {
+    const Node* expression = return_statement->getExpression();
+
+    // Compute the return value directly in $2, unless a function call in the expression
+    // would overwrite it while the value is being computed.
+    if (result_reg != "$v0" || expression->getType() == "FunctionCall" ||
+        !CompilerUtil::containsFunctionCall(expression)) {
+      compileArithmeticOrLogicalExpression(asm_out, expression, result_reg,
+                                           function_context, register_allocator,
+                                           scope_id);
+    } else {
+      std::string dest_reg = register_allocator.requestFreeRegister();
+      compileArithmeticOrLogicalExpression(asm_out, expression, dest_reg,
+                                           function_context, register_allocator, scope_id);
+      // move return value in $2.
+      asm_out << "move\t $v0, " << dest_reg <<std::endl;
+      register_allocator.freeRegister(dest_reg);
+    }
+    if (!is_inlined && !tail_recursion_operator.empty()) {
+      // Combine the result with the operands accumulated by the tail recursion.
+      const std::string accumulator_reg = register_allocator.requestFreeRegister();
+      asm_out << "lw\t " << accumulator_reg << ", " << tail_recursion_accumulator_offset
+              << "(" << function_context.getFrameRegister() << ")"
+              << "\t# Load the accumulator of the tail recursion." << std::endl;
+      compileAccumulation(asm_out, "$v0", accumulator_reg);
+      register_allocator.freeRegister(accumulator_reg);
+    }
+    if (!is_inlined) {
+      // The branch after a tail call tells that the result of the call is returned as it
+      // is.
+      asm_out << "b " << (isSiblingCall(expression) ?
+                          function_context.getTailCallLabel() :
+                          function_context.getFunctionEpilogueLabel())
+              << "\t# Return statement." << std::endl;
+    }
+  }
+  if (is_inlined) {
+    asm_out << "b\t " << function_context.getInlinedReturnLabel()
+            << "\t# Return statement of an inlined function." << std::endl;
+    asm_out << "nop" << std::endl;
   }
 }
 
-void compileBreakStatement(std::ofstream& asm_out,
+void compileBreakStatement(std::ostream& asm_out,
                             const BreakStatement* break_statement,
                             FunctionContext& function_context,
                             RegisterAllocator& register_allocator) {
@@ -1321,7 +2517,7 @@ void compileBreakStatement(std::ofstream& asm_out,
             <<"\t# Break statement." << std::endl;
 }
 
-void compileContinueStatement(std::ofstream& asm_out,
+void compileContinueStatement(std::ostream& asm_out,
                             const ContinueStatement* continue_statement,
                             FunctionContext& function_context,
                             RegisterAllocator& register_allocator) {
@@ -1334,7 +2530,89 @@ void compileContinueStatement(std::ofstream& asm_out,
             << "\t# Continue statement." << std::endl;
 }
 
-void compileIfStatement(std::ofstream& asm_out, const IfStatement* if_statement,
+// Append the statements of a body (e.g. of a loop) to the vector.
+void collectStatements(const Node* body, std::vector<const Node*>& statements) {
+  if (body->getType() != "CompoundStatement") {
+    statements.push_back(body);
+    return;
+  }
+  const CompoundStatement* compound_statement = dynamic_cast<const CompoundStatement*>(body);
+  if (!compound_statement->hasStatementList()) {
+    return;
+  }
+  const StatementListNode* statement_list_node =
+    dynamic_cast<const StatementListNode*>(compound_statement->getStatementList());
+  while (!statement_list_node->isEmptyStatementList()) {
+    statements.push_back(statement_list_node->getStatement());
+    if (!statement_list_node->hasNextStatement()) {
+      break;
+    }
+    statement_list_node =
+      dynamic_cast<const StatementListNode*>(statement_list_node->getNextStatement());
+  }
+}
+
+// If-conversion of "if (c) x = e1; else x = e2;", and of "if (c) x = e1;" (where e2 is
+// x itself), with speculatable e1 and e2 (see compileConditionalExpression).
+bool matchConditionalAssignment(const IfStatement* if_statement, const Variable*& variable,
+                                const Node*& expression1, const Node*& expression2) {
+  if (!compiler_options.if_conversion) {
+    return false;
+  }
+  std::vector<const AssignmentExpression*> assignments;
+  std::vector<const Node*> bodies = {if_statement->getIfBody()};
+  if (if_statement->hasElseBody()) {
+    bodies.push_back(if_statement->getElseBody());
+  }
+  for (const Node* body : bodies) {
+    std::vector<const Node*> statements;
+    collectStatements(body, statements);
+    if (statements.size() != 1 || statements[0]->getType() != "AssignmentExpression") {
+      return false;
+    }
+    const AssignmentExpression* assignment =
+      dynamic_cast<const AssignmentExpression*>(statements[0]);
+    const Node* lhs = assignment->getVariable();
+    if (assignment->getAssignmentType() != "=" || lhs->getType() != "Variable" ||
+        dynamic_cast<const Variable*>(lhs)->getInfo() != "normal" ||
+        compile_time_constants.isConstant(dynamic_cast<const Variable*>(lhs)->getId())) {
+      return false;
+    }
+    assignments.push_back(assignment);
+  }
+  variable = dynamic_cast<const Variable*>(assignments[0]->getVariable());
+  expression1 = assignments[0]->getRhs();
+  if (assignments.size() == 2) {
+    if (dynamic_cast<const Variable*>(assignments[1]->getVariable())->getId() !=
+        variable->getId()) {
+      return false;
+    }
+    expression2 = assignments[1]->getRhs();
+  } else {
+    expression2 = variable;
+  }
+  return isSpeculatableExpression(expression1) && isSpeculatableExpression(expression2);
+}
+
+// Compile an arm of an if statement in its own scope.
+void compileIfArm(std::ostream& asm_out, const Node* body, const std::string& scope_name,
+                  FunctionContext& function_context,
+                  RegisterAllocator& register_allocator) {
+  std::string arm_scope = CompilerUtil::makeUniqueId(scope_name);
+  function_context.insertScope(arm_scope);
+  // We could have a single statement (no brackets) or a compound statement.
+  if (body->getType() == "CompoundStatement") {
+    // Compound statement (brackets).
+    compileCompoundStatement(asm_out, dynamic_cast<const CompoundStatement*>(body),
+                             function_context, register_allocator, arm_scope);
+  } else {
+    // Single statement (no brackets).
+    compileStatement(asm_out, body, function_context, register_allocator, arm_scope);
+  }
+  function_context.removeScope();
+}
+
+void compileIfStatement(std::ostream& asm_out, const IfStatement* if_statement,
                         FunctionContext& function_context,
                         RegisterAllocator& register_allocator,
                         const std::string& scope_id) {
@@ -1342,6 +2620,49 @@ void compileIfStatement(std::ofstream& asm_out, const IfStatement* if_statement,
     std::cerr << "==> Compiling if statement." << std::endl;
   }
 
+  compileProfileCounterIncrement(asm_out, if_statement, 0, register_allocator);
+
+  const Variable* variable;
+  const Node* expression1;
+  const Node* expression2;
+  if (matchConditionalAssignment(if_statement, variable, expression1, expression2)) {
+    auto compile_conditional_assignment = [&](
+      std::ostream& select_out, FunctionContext& select_function_context,
+      RegisterAllocator& select_register_allocator) {
+      reportOptimization("if statement assigning " + variable->getId() +
+                         " converted to a select");
+      select_out << "## Start of conditional expression ##" << std::endl;
+      std::string value_reg = select_register_allocator.requestFreeRegister();
+      compileSelect(select_out, if_statement->getCondition(), expression1, expression2,
+                    value_reg, select_function_context, select_register_allocator,
+                    scope_id);
+      storeVariableFromRegister(select_out, variable, value_reg, select_function_context,
+                                select_register_allocator, scope_id, false);
+      select_register_allocator.freeRegister(value_reg);
+      select_out << "## End of conditional expression ##" << std::endl;
+    };
+    if (compileIfRegistersSuffice(asm_out, function_context, register_allocator,
+                                  compile_conditional_assignment)) {
+      return;
+    }
+    reportOptimization("if statement assigning " + variable->getId() +
+                       " not converted to a select: not enough free registers.");
+  }
+
+  // With a profile, an else arm run less often than the if arm is moved out of line,
+  // after the body of the function: the if arm does not need to jump over it. The if arm
+  // is not moved, as the branch to the else arm is taken and costs no more than the
+  // branch to an if arm out of line.
+  const long long executions = execution_profile.getCount(if_statement, 0);
+  const long long then_executions = execution_profile.getCount(if_statement, 1);
+  const bool is_else_out_of_line = then_executions >= 0 && if_statement->hasElseBody() &&
+                                   executions - then_executions < then_executions;
+  if (is_else_out_of_line) {
+    reportOptimization("else arm moved out of line (run " +
+                       std::to_string(executions - then_executions) + " times out of " +
+                       std::to_string(executions) + ").");
+  }
+
   asm_out << "## If condition ##" << std::endl;
   // Compile condition.
   std::string cond_reg = register_allocator.requestFreeRegister();
@@ -1355,85 +2676,918 @@ void compileIfStatement(std::ofstream& asm_out, const IfStatement* if_statement,
   asm_out << "## End if condition ##" << std::endl;
 
   // Compile if body.
-  std::string if_scope = CompilerUtil::makeUniqueId("if_scope");
-  function_context.insertScope(if_scope);
-  // We could have a single statement (no brackets) or a compound statement.
-  asm_out << "## If body ##" << std::endl;
-  if (if_statement->getIfBody()->getType() == "CompoundStatement") {
-    // Compound statement (brackets).
-    const CompoundStatement* body =
-      dynamic_cast<const CompoundStatement*>(if_statement->getIfBody());
+  std::stringstream if_body_out;
+  if_body_out << "## If body ##" << std::endl;
+  compileProfileCounterIncrement(if_body_out, if_statement, 1, register_allocator);
+  compileIfArm(if_body_out, if_statement->getIfBody(), "if_scope", function_context,
+               register_allocator);
+  if_body_out << "## End if body ##" << std::endl;
+
+  // Translate else body, if present.
+  std::stringstream else_body_out;
+  else_body_out << "## Else body ##" << std::endl;
+  else_body_out << top_else_id << ":" << std::endl;
+  if (if_statement->hasElseBody()) {
+    compileIfArm(else_body_out, if_statement->getElseBody(), "else_scope",
+                 function_context, register_allocator);
+  }
+  else_body_out << "## End else body ##" << std::endl;
+
+  // The if body jumps over the else body, which jumps back if it is out of line.
+  std::string end_if_id = CompilerUtil::makeUniqueId("end_if");
+  std::stringstream jump_to_end_out;
+  jump_to_end_out << "b\t " << end_if_id << "\t# Jump to the end of the if statement."
+                  << std::endl;
+  jump_to_end_out << "nop" << std::endl;
+  if (is_else_out_of_line) {
+    asm_out << if_body_out.str();
+    function_context.addOutOfLineCode(else_body_out.str() + jump_to_end_out.str());
+  } else {
+    asm_out << if_body_out.str() << jump_to_end_out.str() << else_body_out.str();
+  }
+
+  // End of the statement label.
+  asm_out << end_if_id << ":" << std::endl;
+  asm_out << "## End of the whole if statement ##" << std::endl;
+}
+
+// Compile the condition of a loop and branch to the label if it is equal (beq) or not
+// equal (bne) to zero. A constant condition gives an unconditional branch, or nothing.
+void compileLoopConditionBranch(std::ostream& asm_out, const Node* condition,
+                                const std::string& branch_opcode,
+                                const std::string& label,
+                                FunctionContext& function_context,
+                                RegisterAllocator& register_allocator,
+                                const std::string& scope_id) {
+  if (CompilerUtil::isConstantExpression(condition)) {
+    bool is_true = CompilerUtil::evaluateConstantExpression(condition) != 0;
+    if (is_true == (branch_opcode == "bne")) {
+      asm_out << "b\t " << label << std::endl;
+      asm_out << "nop" << std::endl;
+    }
+    return;
+  }
+  std::string cond_reg = register_allocator.requestFreeRegister();
+  compileArithmeticOrLogicalExpression(asm_out, condition, cond_reg, function_context,
+                                       register_allocator, scope_id);
+  asm_out << branch_opcode << "\t " << cond_reg << ", $0, " << label << std::endl;
+  asm_out << "nop" << std::endl;
+  register_allocator.freeRegister(cond_reg);
+}
+
+// A loop stepping a local variable by a constant towards a limit that does not change in
+// the loop, e.g.:
+// for (i = 0; i < n; i++) body
+// i = 0; while (i < n) { body i++; }
+// Its iterations can be copied, see loop unrolling below.
+class CountedLoop {
+ public:
+  const Variable* counter;
+  // Comparison of the condition, with the counter on the left hand side.
+  std::string relational_type;
+  const Node* limit;
+  int step;
+  // The start value is known if the loop init assigns a constant to the counter.
+  bool has_start = false;
+  int start = 0;
+  // Statements of one iteration, followed by the increment.
+  std::vector<const Node*> body;
+  const Node* increment;
+  // Number of AST nodes of one iteration.
+  int size = 0;
+  // The loop statement, whose iterations are counted in each copy of the body.
+  const Node* loop = nullptr;
+};
+
+// A scalar local variable that can only be accessed by name.
+bool isPrivateLocalVariable(const Node* node, FunctionContext& function_context) {
+  if (node->getType() != "Variable") {
+    return false;
+  }
+  const Variable* variable = dynamic_cast<const Variable*>(node);
+  return variable->getInfo() == "normal" &&
+         function_context.isLocalVariable(variable->getId()) &&
+         address_taken_variables.count(variable->getId()) == 0 &&
+         !compile_time_constants.isConstant(variable->getId());
+}
+
+// Match the increment of a counted loop: i++, ++i, i--, --i, i += c, i -= c or
+// i = i + c.
+bool matchCounterIncrement(const Node* increment, const Node*& counter, int& step) {
+  const std::string& type = increment->getType();
+  if (type == "PostfixExpression") {
+    const PostfixExpression* postfix_expression =
+      dynamic_cast<const PostfixExpression*>(increment);
+    counter = postfix_expression->getPostfixExpression();
+    step = postfix_expression->getPostfixType() == "++" ? 1 : -1;
+    return true;
+  }
+  if (type == "UnaryExpression") {
+    const UnaryExpression* unary_expression =
+      dynamic_cast<const UnaryExpression*>(increment);
+    const std::string& unary_type = unary_expression->getUnaryType();
+    counter = unary_expression->getUnaryExpression();
+    step = unary_type == "++" ? 1 : -1;
+    return unary_type == "++" || unary_type == "--";
+  }
+  if (type != "AssignmentExpression") {
+    return false;
+  }
+  const AssignmentExpression* assignment_expression =
+    dynamic_cast<const AssignmentExpression*>(increment);
+  const std::string& assignment_type = assignment_expression->getAssignmentType();
+  counter = assignment_expression->getVariable();
+  const Node* rhs = assignment_expression->getRhs();
+  std::string additive_type = assignment_type == "+=" ? "+" : "-";
+  if (assignment_type == "=" && rhs->getType() == "AdditiveExpression") {
+    const AdditiveExpression* additive_expression =
+      dynamic_cast<const AdditiveExpression*>(rhs);
+    const Node* lhs = additive_expression->getLhs();
+    if (lhs->getType() != "Variable" || counter->getType() != "Variable" ||
+        dynamic_cast<const Variable*>(lhs)->getId() !=
+          dynamic_cast<const Variable*>(counter)->getId()) {
+      return false;
+    }
+    additive_type = additive_expression->getAdditiveType();
+    rhs = additive_expression->getRhs();
+  }
+  else if (assignment_type != "+=" && assignment_type != "-=") {
+    return false;
+  }
+  if (!CompilerUtil::isConstantExpression(rhs)) {
+    return false;
+  }
+  step = CompilerUtil::evaluateConstantExpression(rhs);
+  if (additive_type == "-") {
+    step = -step;
+  }
+  return true;
+}
+
+// Match the condition of a counted loop, a comparison between the counter and the limit.
+bool matchCounterCondition(const Node* condition, const std::string& counter_id,
+                           std::string& relational_type, const Node*& limit) {
+  const Node* lhs;
+  const Node* rhs;
+  if (condition->getType() == "RelationalExpression") {
+    const RelationalExpression* relational_expression =
+      dynamic_cast<const RelationalExpression*>(condition);
+    lhs = relational_expression->getLhs();
+    rhs = relational_expression->getRhs();
+    relational_type = relational_expression->getRelationalType();
+  }
+  else if (condition->getType() == "EqualityExpression") {
+    const EqualityExpression* equality_expression =
+      dynamic_cast<const EqualityExpression*>(condition);
+    lhs = equality_expression->getLhs();
+    rhs = equality_expression->getRhs();
+    relational_type = equality_expression->getEqualityType();
+    if (relational_type != "!=") {
+      return false;
+    }
+  }
+  else {
+    return false;
+  }
+  auto isCounter = [&counter_id](const Node* node) {
+    return node->getType() == "Variable" &&
+           dynamic_cast<const Variable*>(node)->getId() == counter_id;
+  };
+  if (isCounter(lhs)) {
+    limit = rhs;
+    return true;
+  }
+  if (isCounter(rhs)) {
+    // Mirror the comparison: n > i is i < n.
+    limit = lhs;
+    if (relational_type == "<") {
+      relational_type = ">";
+    } else if (relational_type == ">") {
+      relational_type = "<";
+    } else if (relational_type == "<=") {
+      relational_type = ">=";
+    } else if (relational_type == ">=") {
+      relational_type = "<=";
+    }
+    return true;
+  }
+  return false;
+}
+
+// Recognise a counted loop, given its init (or nullptr), condition, body and increment.
+// The counter and the limit must not be written by the body, and the body must not
+// declare variables, since it is going to be compiled more than once.
+bool matchCountedLoop(const Node* init, const Node* condition,
+                      const std::vector<const Node*>& body, const Node* increment,
+                      FunctionContext& function_context, CountedLoop& counted_loop) {
+  const Node* counter;
+  if (!matchCounterIncrement(increment, counter, counted_loop.step) ||
+      !isPrivateLocalVariable(counter, function_context) || counted_loop.step == 0) {
+    return false;
+  }
+  counted_loop.counter = dynamic_cast<const Variable*>(counter);
+  const std::string& counter_id = counted_loop.counter->getId();
+  if (!matchCounterCondition(condition, counter_id, counted_loop.relational_type,
+                             counted_loop.limit)) {
+    return false;
+  }
+  const Node* limit = counted_loop.limit;
+  if (!CompilerUtil::isConstantExpression(limit) &&
+      (!isPrivateLocalVariable(limit, function_context) ||
+       dynamic_cast<const Variable*>(limit)->getId() == counter_id)) {
+    return false;
+  }
+  // The counter must move towards the limit.
+  const std::string& relational_type = counted_loop.relational_type;
+  if (((relational_type == "<" || relational_type == "<=") && counted_loop.step < 0) ||
+      ((relational_type == ">" || relational_type == ">=") && counted_loop.step > 0)) {
+    return false;
+  }
+
+  std::unordered_set<std::string> written_in_body;
+  counted_loop.size = CompilerUtil::countNodes(increment);
+  for (const Node* statement : body) {
+    if (CompilerUtil::containsNodeOfType(statement, "DeclarationExpressionList")) {
+      return false;
+    }
+    CompilerUtil::collectWrittenVariables(statement, written_in_body);
+    counted_loop.size += CompilerUtil::countNodes(statement);
+  }
+  if (written_in_body.count(counter_id) ||
+      (limit->getType() == "Variable" &&
+       written_in_body.count(dynamic_cast<const Variable*>(limit)->getId()))) {
+    return false;
+  }
+  counted_loop.body = body;
+  counted_loop.increment = increment;
+
+  // Start value.
+  const Node* initialized = nullptr;
+  const Node* start = nullptr;
+  if (init != nullptr && init->getType() == "AssignmentExpression") {
+    const AssignmentExpression* assignment_expression =
+      dynamic_cast<const AssignmentExpression*>(init);
+    if (assignment_expression->getAssignmentType() == "=") {
+      initialized = assignment_expression->getVariable();
+      start = assignment_expression->getRhs();
+    }
+  }
+  else if (init != nullptr && init->getType() == "DeclarationExpressionList") {
+    const DeclarationExpressionListNode* declaration_node =
+      dynamic_cast<const DeclarationExpressionListNode*>(
+        dynamic_cast<const DeclarationExpressionList*>(init)->getDeclarationList());
+    if (!declaration_node->hasNext() && declaration_node->hasRhs()) {
+      initialized = declaration_node->getVariable();
+      start = declaration_node->getRhs();
+    }
+  }
+  if (initialized != nullptr && initialized->getType() == "Variable" &&
+      dynamic_cast<const Variable*>(initialized)->getId() == counter_id &&
+      CompilerUtil::isConstantExpression(start)) {
+    counted_loop.has_start = true;
+    counted_loop.start = CompilerUtil::evaluateConstantExpression(start);
+  }
+  return true;
+}
+
+// Number of iterations of a counted loop if it is known at compile time and it is at most
+// max_trip_count, -1 otherwise.
+int getTripCount(const CountedLoop& counted_loop, int max_trip_count) {
+  if (!counted_loop.has_start || !CompilerUtil::isConstantExpression(counted_loop.limit)) {
+    return -1;
+  }
+  const long long limit = CompilerUtil::evaluateConstantExpression(counted_loop.limit);
+  const std::string& relational_type = counted_loop.relational_type;
+  long long value = counted_loop.start;
+  for (int trip_count = 0; trip_count <= max_trip_count; trip_count++) {
+    const bool holds = (relational_type == "<" && value < limit) ||
+                       (relational_type == "<=" && value <= limit) ||
+                       (relational_type == ">" && value > limit) ||
+                       (relational_type == ">=" && value >= limit) ||
+                       (relational_type == "!=" && value != limit);
+    if (!holds) {
+      return trip_count;
+    }
+    value += counted_loop.step;
+    if (value < INT_MIN || value > INT_MAX) {
+      return -1;
+    }
+  }
+  return -1;
+}
+
+// Owner of the AST nodes built by the compiler, e.g. for the closed forms of loops.
+class ExpressionBuilder {
+ private:
+  std::vector<std::unique_ptr<Node>> nodes_;
+
+  const Node* own(Node* node) {
+    nodes_.emplace_back(node);
+    return node;
+  }
+
+ public:
+  const Node* constant(int value) {
+    return own(new IntegerConstant(value));
+  }
+
+  const Node* add(const Node* lhs, const Node* rhs) {
+    return own(new AdditiveExpression(lhs, "+", rhs));
+  }
+
+  const Node* subtract(const Node* lhs, const Node* rhs) {
+    return own(new AdditiveExpression(lhs, "-", rhs));
+  }
+
+  const Node* multiply(const Node* lhs, const Node* rhs) {
+    return own(new MultiplicativeExpression(lhs, "*", rhs));
+  }
+
+  const Node* shiftRight(const Node* lhs, int amount) {
+    return own(new ShiftExpression(lhs, ">>", constant(amount)));
+  }
+
+  const Node* bitwiseAnd(const Node* lhs, const Node* rhs) {
+    return own(new AndExpression(lhs, rhs));
+  }
+
+  const Node* compare(const Node* lhs, const std::string& relational_type,
+                      const Node* rhs) {
+    return own(new RelationalExpression(lhs, relational_type, rhs));
+  }
+
+  const Node* select(const Node* condition, const Node* expression1,
+                     const Node* expression2) {
+    return own(new ConditionalExpression(condition, expression1, expression2));
+  }
+};
+
+// Statement of a loop body that accumulates alpha * counter + beta, where beta is loop
+// invariant, in a variable: s += e, s -= e, s = s + e, s = s - e, s++ or s--.
+class LoopReduction {
+ public:
+  const Variable* accumulator;
+  int alpha = 0;
+  // nullptr for 0.
+  const Node* beta = nullptr;
+};
+
+// Match e = alpha * counter + beta, where beta is a speculatable expression that does not
+// read the variables written in the loop.
+bool matchAffineExpression(const Node* expression, const std::string& counter_id,
+                           const std::unordered_set<std::string>& written_in_loop,
+                           ExpressionBuilder& builder, int& alpha, const Node*& beta) {
+  std::unordered_map<std::string, int> references;
+  CompilerUtil::countVariableReferences(expression, references);
+  bool is_invariant = isSpeculatableExpression(expression);
+  for (const auto& reference : references) {
+    is_invariant = is_invariant && written_in_loop.count(reference.first) == 0;
+  }
+  if (is_invariant) {
+    alpha = 0;
+    beta = expression;
+    return true;
+  }
+  const std::string& type = expression->getType();
+  if (type == "Variable") {
+    alpha = 1;
+    beta = nullptr;
+    return dynamic_cast<const Variable*>(expression)->getId() == counter_id;
+  }
+  if (type == "MultiplicativeExpression") {
+    // c * i or i * c.
+    const MultiplicativeExpression* multiplicative_expression =
+      dynamic_cast<const MultiplicativeExpression*>(expression);
+    const Node* lhs = multiplicative_expression->getLhs();
+    const Node* rhs = multiplicative_expression->getRhs();
+    if (multiplicative_expression->getMultiplicativeType() != "*") {
+      return false;
+    }
+    if (CompilerUtil::isConstantExpression(lhs)) {
+      std::swap(lhs, rhs);
+    }
+    if (!CompilerUtil::isConstantExpression(rhs) ||
+        !matchAffineExpression(lhs, counter_id, written_in_loop, builder, alpha, beta) ||
+        beta != nullptr) {
+      return false;
+    }
+    alpha = (unsigned int)alpha * CompilerUtil::evaluateConstantExpression(rhs);
+    return true;
+  }
+  if (type == "AdditiveExpression") {
+    const AdditiveExpression* additive_expression =
+      dynamic_cast<const AdditiveExpression*>(expression);
+    int lhs_alpha;
+    int rhs_alpha;
+    const Node* lhs_beta;
+    const Node* rhs_beta;
+    if (!matchAffineExpression(additive_expression->getLhs(), counter_id, written_in_loop,
+                               builder, lhs_alpha, lhs_beta) ||
+        !matchAffineExpression(additive_expression->getRhs(), counter_id, written_in_loop,
+                               builder, rhs_alpha, rhs_beta)) {
+      return false;
+    }
+    const bool is_subtraction = additive_expression->getAdditiveType() == "-";
+    alpha = is_subtraction ? (unsigned int)lhs_alpha - rhs_alpha :
+                             (unsigned int)lhs_alpha + rhs_alpha;
+    if (rhs_beta == nullptr) {
+      beta = lhs_beta;
+    } else if (lhs_beta == nullptr) {
+      beta = is_subtraction ? builder.subtract(builder.constant(0), rhs_beta) : rhs_beta;
+    } else {
+      beta = is_subtraction ? builder.subtract(lhs_beta, rhs_beta) :
+                              builder.add(lhs_beta, rhs_beta);
+    }
+    return true;
+  }
+  return false;
+}
+
+// The sum of the additive terms of the expression but the variable, e.g. a - b for
+// (s + a) - b, or nullptr if the variable is not one of them with a + sign.
+const Node* removeAdditiveTerm(const Node* expression, const std::string& id,
+                               ExpressionBuilder& builder) {
+  if (expression->getType() == "Variable" &&
+      dynamic_cast<const Variable*>(expression)->getId() == id) {
+    return builder.constant(0);
+  }
+  if (expression->getType() != "AdditiveExpression") {
+    return nullptr;
+  }
+  const AdditiveExpression* additive_expression =
+    dynamic_cast<const AdditiveExpression*>(expression);
+  const bool is_subtraction = additive_expression->getAdditiveType() == "-";
+  const Node* lhs = additive_expression->getLhs();
+  const Node* rhs = additive_expression->getRhs();
+  const Node* remainder = removeAdditiveTerm(lhs, id, builder);
+  if (remainder != nullptr) {
+    return is_subtraction ? builder.subtract(remainder, rhs) : builder.add(remainder, rhs);
+  }
+  remainder = is_subtraction ? nullptr : removeAdditiveTerm(rhs, id, builder);
+  return remainder == nullptr ? nullptr : builder.add(lhs, remainder);
+}
+
+bool matchLoopReduction(const Node* statement, const std::string& counter_id,
+                        const std::unordered_set<std::string>& written_in_loop,
+                        ExpressionBuilder& builder, LoopReduction& reduction) {
+  const std::string& type = statement->getType();
+  const Node* accumulator = nullptr;
+  const Node* expression = nullptr;
+  bool is_subtraction = false;
+  if (type == "PostfixExpression" || type == "UnaryExpression") {
+    std::string increment_type;
+    if (type == "PostfixExpression") {
+      const PostfixExpression* postfix_expression =
+        dynamic_cast<const PostfixExpression*>(statement);
+      accumulator = postfix_expression->getPostfixExpression();
+      increment_type = postfix_expression->getPostfixType();
+    } else {
+      const UnaryExpression* unary_expression =
+        dynamic_cast<const UnaryExpression*>(statement);
+      accumulator = unary_expression->getUnaryExpression();
+      increment_type = unary_expression->getUnaryType();
+    }
+    if (increment_type != "++" && increment_type != "--") {
+      return false;
+    }
+    expression = builder.constant(1);
+    is_subtraction = increment_type == "--";
+  }
+  else if (type == "AssignmentExpression") {
+    const AssignmentExpression* assignment_expression =
+      dynamic_cast<const AssignmentExpression*>(statement);
+    const std::string& assignment_type = assignment_expression->getAssignmentType();
+    accumulator = assignment_expression->getVariable();
+    expression = assignment_expression->getRhs();
+    is_subtraction = assignment_type == "-=";
+    if (assignment_type == "=") {
+      // s = s + e, s = e + s, s = s + e1 - e2...
+      if (accumulator->getType() != "Variable") {
+        return false;
+      }
+      expression = removeAdditiveTerm(
+        expression, dynamic_cast<const Variable*>(accumulator)->getId(), builder);
+      if (expression == nullptr) {
+        return false;
+      }
+    } else if (assignment_type != "+=" && assignment_type != "-=") {
+      return false;
+    }
+  }
+  else {
+    return false;
+  }
+  if (accumulator->getType() != "Variable" ||
+      !matchAffineExpression(expression, counter_id, written_in_loop, builder,
+                             reduction.alpha, reduction.beta)) {
+    return false;
+  }
+  reduction.accumulator = dynamic_cast<const Variable*>(accumulator);
+  if (is_subtraction) {
+    reduction.alpha = -(unsigned int)reduction.alpha;
+    if (reduction.beta != nullptr) {
+      reduction.beta = builder.subtract(builder.constant(0), reduction.beta);
+    }
+  }
+  return true;
+}
+
+// Closed form of a counted loop whose body only has reductions (see LoopReduction): with t
+// iterations, the counter starting at i and moving by step, an accumulator gets
+//   t * (alpha * i + beta) + alpha * step * t * (t - 1) / 2
+// and the counter ends at i + step * t, in 32 bits wraparound arithmetic. The trip count
+// must be known at compile time, or the step must be 1 or -1. An empty body only leaves
+// the final value of the counter. The init of the loop (or nullptr) is compiled first.
+// Returns false, with nothing compiled, if the loop has no closed form.
+bool compileClosedFormLoop(std::ostream& asm_out, const CountedLoop& counted_loop,
+                           const Node* init, FunctionContext& function_context,
+                           RegisterAllocator& register_allocator,
+                           const std::string& scope_id) {
+  const std::string& counter_id = counted_loop.counter->getId();
+  const std::string& relational_type = counted_loop.relational_type;
+  std::unordered_set<std::string> written_in_loop = {counter_id};
+  for (const Node* statement : counted_loop.body) {
+    CompilerUtil::collectWrittenVariables(statement, written_in_loop);
+  }
+  ExpressionBuilder builder;
+  std::vector<LoopReduction> reductions;
+  std::unordered_set<std::string> accumulators;
+  for (const Node* statement : counted_loop.body) {
+    LoopReduction reduction;
+    if (!matchLoopReduction(statement, counter_id, written_in_loop, builder, reduction) ||
+        !isPrivateLocalVariable(reduction.accumulator, function_context) ||
+        !accumulators.insert(reduction.accumulator->getId()).second) {
+      return false;
+    }
+    reductions.push_back(reduction);
+  }
+
+  // Trip count, and the sum of the iteration numbers t * (t - 1) / 2. The value of the
+  // counter before the loop, and after it.
+  const Node* trip_count;
+  const Node* iterations_sum;
+  const Node* start_value = counted_loop.counter;
+  const Node* end_value;
+  const Node* limit = counted_loop.limit;
+  const int step = counted_loop.step;
+  if (counted_loop.has_start && CompilerUtil::isConstantExpression(limit)) {
+    const long long start = counted_loop.start;
+    const long long end = CompilerUtil::evaluateConstantExpression(limit);
+    long long distance = end - start;
+    if (relational_type == "<=" || relational_type == ">=") {
+      distance += step > 0 ? 1 : -1;
+    }
+    long long t = 0;
+    if (relational_type == "!=") {
+      if (distance % step != 0 || distance / step < 0) {
+        return false;
+      }
+      t = distance / step;
+    } else if ((distance > 0) == (step > 0) && distance != 0) {
+      t = (distance + step + (step > 0 ? -1 : 1)) / step;
+    }
+    if (start + t * step < INT_MIN || start + t * step > INT_MAX) {
+      return false;
+    }
+    trip_count = builder.constant(t);
+    iterations_sum = builder.constant((unsigned int)((unsigned long long)t * (t - 1) / 2));
+    start_value = builder.constant(start);
+    end_value = builder.constant(start + t * step);
+  } else if (step == 1 || step == -1) {
+    // i < n ? n - i : 0, i <= n ? n - i + 1 : 0, i != n: n - i, and the same from above
+    // with step -1.
+    const Node* counter = counted_loop.counter;
+    const Node* distance = step == 1 ? builder.subtract(limit, counter) :
+                                       builder.subtract(counter, limit);
+    if (relational_type == "<=" || relational_type == ">=") {
+      distance = builder.add(distance, builder.constant(1));
+    }
+    trip_count = relational_type == "!=" ? distance :
+      builder.select(builder.compare(counter, relational_type, limit), distance,
+                     builder.constant(0));
+    // (t >> 1) * (t - 1 + (t & 1)), exact modulo 2^32 since >> is a logical shift.
+    // The deepest operands come first, to use fewer registers.
+    iterations_sum = builder.multiply(
+      builder.add(builder.subtract(trip_count, builder.constant(1)),
+                  builder.bitwiseAnd(trip_count, builder.constant(1))),
+      builder.shiftRight(trip_count, 1));
+    end_value = step == 1 ? builder.add(counter, trip_count) :
+                            builder.subtract(counter, trip_count);
+  } else {
+    return false;
+  }
+
+  if (init != nullptr) {
+    compileStatement(asm_out, init, function_context, register_allocator, scope_id);
+  }
+  reportOptimization("loop on " + counter_id + " replaced by its closed form.");
+  asm_out << "# Closed form of the loop on: " << counter_id << "." << std::endl;
+  for (const LoopReduction& reduction : reductions) {
+    const Node* value = reduction.beta;
+    if (reduction.alpha != 0) {
+      const Node* counter_term =
+        builder.multiply(builder.constant(reduction.alpha), start_value);
+      value = value == nullptr ? counter_term : builder.add(counter_term, value);
+    }
+    // Two separate increments, to use fewer registers.
+    if (value != nullptr) {
+      AssignmentExpression assignment(reduction.accumulator, "+=",
+                                      builder.multiply(trip_count, value));
+      compileStatement(asm_out, &assignment, function_context, register_allocator,
+                       scope_id);
+    }
+    if (reduction.alpha != 0) {
+      AssignmentExpression assignment(
+        reduction.accumulator, "+=",
+        builder.multiply(iterations_sum,
+                         builder.constant((unsigned int)reduction.alpha * step)));
+      compileStatement(asm_out, &assignment, function_context, register_allocator,
+                       scope_id);
+    }
+  }
+  AssignmentExpression final_assignment(counted_loop.counter, "=", end_value);
+  compileStatement(asm_out, &final_assignment, function_context, register_allocator,
+                   scope_id);
+  return true;
+}
 
-    compileCompoundStatement(asm_out, body, function_context, register_allocator,
-                             if_scope);
-  } else {
-    // Single statement (no brackets).
-    compileStatement(asm_out, if_statement->getIfBody(), function_context,
-                     register_allocator, if_scope);
+// Count the references to each variable that read it, i.e. not as the declarator of a
+// declaration nor as the left hand side of a plain assignment.
+void countVariableReads(const Node* ast_node,
+                        std::unordered_map<std::string, int>& reads) {
+  const std::string& type = ast_node->getType();
+  if (type == "Variable") {
+    reads[dynamic_cast<const Variable*>(ast_node)->getId()]++;
   }
-  function_context.removeScope();
+  const Node* written = nullptr;
+  if (type == "DeclarationExpressionListNode") {
+    written = dynamic_cast<const DeclarationExpressionListNode*>(ast_node)->getVariable();
+  } else if (type == "AssignmentExpression" &&
+             dynamic_cast<const AssignmentExpression*>(ast_node)->getAssignmentType() ==
+               "=") {
+    written = dynamic_cast<const AssignmentExpression*>(ast_node)->getVariable();
+  }
+  for (const Node* child : CompilerUtil::getChildren(ast_node)) {
+    // The index of an array element is read.
+    if (child != written || written->getType() != "Variable" ||
+        dynamic_cast<const Variable*>(written)->getInfo() != "normal") {
+      countVariableReads(child, reads);
+    }
+  }
+}
 
-  // If the body has been executed, then we need to jump the else.
-  std::string end_if_id = CompilerUtil::makeUniqueId("end_if");
-  asm_out << "b\t " << end_if_id << "\t# Need to jump the else if executed the if body."
-          << std::endl;
-  asm_out << "nop" << std::endl;
-  asm_out << "## End if body ##" << std::endl;
+// A loop can be removed if it has no observable effect: it only writes local scalar
+// variables that are not read anywhere else in the function, it has no call and no return,
+// and its condition is not constant, so that it is assumed to terminate (C11 6.8.5p6).
+bool isLoopWithoutEffects(const Node* loop, const Node* condition,
+                          FunctionContext& function_context) {
+  if (condition->getType() == "EmptyExpression" ||
+      (CompilerUtil::isConstantExpression(condition) &&
+       CompilerUtil::evaluateConstantExpression(condition) != 0) ||
+      CompilerUtil::containsFunctionCall(loop) ||
+      CompilerUtil::containsNodeOfType(loop, "ReturnStatement")) {
+    return false;
+  }
+  std::unordered_set<std::string> declared_in_loop;
+  std::vector<const Variable*> written_in_loop;
+  std::vector<const Node*> nodes = {loop};
+  while (!nodes.empty()) {
+    const Node* node = nodes.back();
+    nodes.pop_back();
+    const std::string& type = node->getType();
+    const Node* written = nullptr;
+    if (type == "AssignmentExpression") {
+      written = dynamic_cast<const AssignmentExpression*>(node)->getVariable();
+    } else if (type == "PostfixExpression") {
+      written = dynamic_cast<const PostfixExpression*>(node)->getPostfixExpression();
+    } else if (type == "UnaryExpression") {
+      const UnaryExpression* unary_expression = dynamic_cast<const UnaryExpression*>(node);
+      if (unary_expression->getUnaryType() == "++" ||
+          unary_expression->getUnaryType() == "--") {
+        written = unary_expression->getUnaryExpression();
+      }
+    } else if (type == "DeclarationExpressionListNode") {
+      written = dynamic_cast<const DeclarationExpressionListNode*>(node)->getVariable();
+    }
+    if (written != nullptr) {
+      if (written->getType() != "Variable" ||
+          dynamic_cast<const Variable*>(written)->getInfo() != "normal") {
+        return false;
+      }
+      written_in_loop.push_back(dynamic_cast<const Variable*>(written));
+      if (type == "DeclarationExpressionListNode") {
+        declared_in_loop.insert(written_in_loop.back()->getId());
+      }
+    }
+    for (const Node* child : CompilerUtil::getChildren(node)) {
+      nodes.push_back(child);
+    }
+  }
+  std::unordered_map<std::string, int> reads_in_loop;
+  std::unordered_map<std::string, int> reads_in_function;
+  countVariableReads(loop, reads_in_loop);
+  countVariableReads(function_definition_being_compiled->getBody(), reads_in_function);
+  for (const Variable* variable : written_in_loop) {
+    const std::string& id = variable->getId();
+    if ((declared_in_loop.count(id) == 0 &&
+         !isPrivateLocalVariable(variable, function_context)) ||
+        reads_in_function[id] != reads_in_loop[id]) {
+      return false;
+    }
+  }
+  return true;
+}
 
-  asm_out << "## Else body ##" << std::endl;
-  asm_out << top_else_id << ":" << std::endl;
+// Full unrolling: the body is compiled once for each iteration, with the counter as a
+// compile time constant, and the final value of the counter is stored. Only loops with a
+// known small trip count whose body does not break out of them are fully unrolled.
+// Returns false if the loop cannot be fully unrolled.
+bool compileFullyUnrolledLoop(std::ostream& asm_out, const CountedLoop& counted_loop,
+                              FunctionContext& function_context,
+                              RegisterAllocator& register_allocator,
+                              const std::string& scope_id) {
+  if (!compiler_options.unroll_small_loops) {
+    return false;
+  }
+  for (const Node* statement : counted_loop.body) {
+    if (CompilerUtil::containsNodeOfType(statement, "BreakStatement") ||
+        CompilerUtil::containsNodeOfType(statement, "ContinueStatement")) {
+      return false;
+    }
+  }
+  const int trip_count = getTripCount(counted_loop, FULL_UNROLL_MAX_TRIP_COUNT);
+  const int max_nodes =
+    compiler_options.unroll_loops ? AGGRESSIVE_UNROLL_MAX_NODES : FULL_UNROLL_MAX_NODES;
+  if (trip_count < 0 || trip_count * counted_loop.size > max_nodes) {
+    return false;
+  }
 
-  // Translate else body, if present.
-  std::string else_scope = CompilerUtil::makeUniqueId("else_scope");
-  function_context.insertScope(else_scope);
-  if (if_statement->hasElseBody()) {
-    if (if_statement->getElseBody()->getType() == "CompoundStatement") {
-      // Compound statement (brackets).
-      const CompoundStatement* body =
-        dynamic_cast<const CompoundStatement*>(if_statement->getElseBody());
+  const std::string& counter_id = counted_loop.counter->getId();
+  // With a profile, a loop that was never run is kept rolled, as it is smaller.
+  if (execution_profile.getCount(counted_loop.loop, 0) == 0) {
+    reportOptimization("loop on " + counter_id + " not unrolled: never run.");
+    return false;
+  }
+  int value = counted_loop.start;
+  for (int i = 0; i < trip_count; i++) {
+    asm_out << "# Unrolled iteration: " << counter_id << " = " << value << "." << std::endl;
+    compileProfileCounterIncrement(asm_out, counted_loop.loop, 1, register_allocator);
+    compile_time_constants.addNewConstant(counter_id, value);
+    for (const Node* statement : counted_loop.body) {
+      compileStatement(asm_out, statement, function_context, register_allocator,
+                       scope_id);
+    }
+    compile_time_constants.removeConstant(counter_id);
+    value += counted_loop.step;
+  }
+  // The counter may be used after the loop.
+  IntegerConstant final_value(value);
+  AssignmentExpression final_assignment(counted_loop.counter, "=", &final_value);
+  compileStatement(asm_out, &final_assignment, function_context, register_allocator,
+                   scope_id);
+  return true;
+}
 
-      compileCompoundStatement(asm_out, body, function_context, register_allocator,
-                               else_scope);
-    } else {
-      // Single statement (no brackets).
-      compileStatement(asm_out, if_statement->getElseBody(), function_context,
-                       register_allocator, else_scope);
+// Partial unrolling, with -funroll-loops or a profile: the iterations of the loop are run
+// unroll_factor at a time, while all of them have to be run, i.e. while the counter
+// would still satisfy the condition after unroll_factor - 1 increments. The rolled loop
+// compiled after this runs the remaining iterations. A break statement in the body jumps
+// to the break label, the end of the rolled loop.
+void compilePartiallyUnrolledLoop(std::ostream& asm_out, const CountedLoop& counted_loop,
+                                  const std::string& break_label,
+                                  FunctionContext& function_context,
+                                  RegisterAllocator& register_allocator,
+                                  const std::string& scope_id) {
+  int unroll_factor = compiler_options.unroll_factor;
+  bool is_enabled = compiler_options.unroll_loops;
+  // With a profile, the hot loops are unrolled even without -funroll-loops, and the other
+  // ones are not. The factor is halved, down to 4, until the average trip count is at
+  // least four times it, so that the remaining iterations are few: unrolling by 2 does
+  // not pay for the extra exit test.
+  const long long entries = execution_profile.getCount(counted_loop.loop, 0);
+  const long long iterations = execution_profile.getCount(counted_loop.loop, 1);
+  if (entries >= 0 && compiler_options.unroll_small_loops) {
+    const long long average_trip_count = entries > 0 ? iterations / entries : 0;
+    while (unroll_factor > 4 && average_trip_count < 4 * unroll_factor) {
+      unroll_factor /= 2;
+    }
+    is_enabled = execution_profile.isHot(iterations) &&
+                 average_trip_count >= 4 * unroll_factor;
+    if (!is_enabled) {
+      reportOptimization("loop on " + counted_loop.counter->getId() +
+                         " not unrolled: not hot (average trip count " +
+                         std::to_string(average_trip_count) + ").");
     }
   }
-  function_context.removeScope();
-  // End of the statement label.
+  // Exit conditions like != cannot be moved by unroll_factor - 1 steps.
+  const std::string& relational_type = counted_loop.relational_type;
+  if (!is_enabled || unroll_factor < 2 || relational_type == "!=" ||
+      counted_loop.size * unroll_factor > AGGRESSIVE_UNROLL_MAX_NODES) {
+    return;
+  }
+  if (entries >= 0) {
+    reportOptimization("loop on " + counted_loop.counter->getId() + " unrolled by " +
+                       std::to_string(unroll_factor) + " (average trip count " +
+                       std::to_string(iterations / std::max(entries, 1LL)) + ").");
+  }
 
-  asm_out << end_if_id << ":" << std::endl;
-  asm_out << "## End else body and the whole if statement ##" << std::endl;
+  // counter < limit - (unroll_factor - 1) * step
+  IntegerConstant distance((long long)(unroll_factor - 1) * counted_loop.step);
+  AdditiveExpression unrolled_limit(counted_loop.limit, "-", &distance);
+  RelationalExpression unrolled_condition(counted_loop.counter, relational_type,
+                                          &unrolled_limit);
+
+  std::string top_unrolled_id = CompilerUtil::makeUniqueId("top_unrolled");
+  std::string end_unrolled_id = CompilerUtil::makeUniqueId("end_unrolled");
+  compileLoopConditionBranch(asm_out, &unrolled_condition, "beq", end_unrolled_id,
+                             function_context, register_allocator, scope_id);
+  asm_out << top_unrolled_id << ":" << std::endl;
+  for (int i = 0; i < unroll_factor; i++) {
+    // A continue statement jumps to the increment of its copy of the body.
+    std::string unrolled_increment_id = CompilerUtil::makeUniqueId("unrolled_increment");
+    function_context.insertForLabels(unrolled_increment_id, break_label);
+    compileProfileCounterIncrement(asm_out, counted_loop.loop, 1, register_allocator);
+    for (const Node* statement : counted_loop.body) {
+      compileStatement(asm_out, statement, function_context, register_allocator,
+                       scope_id);
+    }
+    function_context.removeForLabels();
+    asm_out << unrolled_increment_id << ":" << std::endl;
+    compileStatement(asm_out, counted_loop.increment, function_context,
+                     register_allocator, scope_id);
+  }
+  compileLoopConditionBranch(asm_out, &unrolled_condition, "bne", top_unrolled_id,
+                             function_context, register_allocator, scope_id);
+  asm_out << end_unrolled_id << ":" << std::endl;
 }
 
-void compileWhileStatement(std::ofstream& asm_out, const WhileStatement* while_statement,
+// Loops are rotated: the condition is checked once before entering the loop, and then at
+// the bottom of the body, so that each iteration takes a single branch.
+void compileWhileStatement(std::ostream& asm_out, const WhileStatement* while_statement,
                            FunctionContext& function_context,
                            RegisterAllocator& register_allocator,
-                           const std::string& scope_id) {
+                           const std::string& scope_id, const Node* loop_init) {
   if (Util::DEBUG) {
     std::cerr << "==> Compile while statement." << std::endl;
   }
 
-  std::string top_while_id = CompilerUtil::makeUniqueId("top_while");
-  asm_out <<top_while_id << ":" << std::endl;
-
-  // Compile condition.
-  std::string cond_reg = register_allocator.requestFreeRegister();
-  compileArithmeticOrLogicalExpression(asm_out, while_statement->getCondition(), cond_reg,
-                                       function_context, register_allocator, scope_id);
+  if (isLoopWithoutEffects(while_statement, while_statement->getCondition(),
+                           function_context)) {
+    reportOptimization("removed while loop without effects.");
+    return;
+  }
+  compileProfileCounterIncrement(asm_out, while_statement, 0, register_allocator);
+
+  // A counted while loop has the increment as the last statement of the body. The
+  // continue statements would skip it, hence they prevent unrolling.
+  std::vector<const Node*> body_statements;
+  collectStatements(while_statement->getBody(), body_statements);
+  CountedLoop counted_loop;
+  bool is_counted_loop = false;
+  if (!body_statements.empty() &&
+      !CompilerUtil::containsNodeOfType(while_statement->getBody(), "BreakStatement") &&
+      !CompilerUtil::containsNodeOfType(while_statement->getBody(), "ContinueStatement")) {
+    const Node* increment = body_statements.back();
+    body_statements.pop_back();
+    is_counted_loop = matchCountedLoop(loop_init, while_statement->getCondition(),
+                                       body_statements, increment, function_context,
+                                       counted_loop);
+    counted_loop.loop = while_statement;
+  }
+  if (is_counted_loop) {
+    std::string unrolled_scope = CompilerUtil::makeUniqueId("while_scope");
+    function_context.insertScope(unrolled_scope);
+    bool is_fully_unrolled =
+      compileClosedFormLoop(asm_out, counted_loop, nullptr, function_context,
+                            register_allocator, unrolled_scope) ||
+      compileFullyUnrolledLoop(asm_out, counted_loop, function_context,
+                               register_allocator, unrolled_scope);
+    if (!is_fully_unrolled) {
+      compilePartiallyUnrolledLoop(asm_out, counted_loop, "", function_context,
+                                   register_allocator, unrolled_scope);
+    }
+    function_context.removeScope();
+    if (is_fully_unrolled) {
+      return;
+    }
+  }
 
+  std::string top_while_id = CompilerUtil::makeUniqueId("top_while");
+  std::string condition_while_id = CompilerUtil::makeUniqueId("condition_while");
   std::string end_while_id = CompilerUtil::makeUniqueId("end_while");
-  function_context.insertWhileLabels(top_while_id, end_while_id);
 
-  asm_out << "beq\t " << cond_reg << ", $0, " << end_while_id
-          << "\t# Checking the condition of the while." << std::endl;
-  asm_out << "nop" << std::endl;
+  // Checking the condition of the while before the first iteration.
+  compileLoopConditionBranch(asm_out, while_statement->getCondition(), "beq",
+                             end_while_id, function_context, register_allocator,
+                             scope_id);
+  asm_out << top_while_id << ":" << std::endl;
 
-  register_allocator.freeRegister(cond_reg);
+  // A continue statement jumps to the condition.
+  function_context.insertWhileLabels(condition_while_id, end_while_id);
   // Compile while body.
   std::string while_scope = CompilerUtil::makeUniqueId("while_scope");
   function_context.insertScope(while_scope);
+  compileProfileCounterIncrement(asm_out, while_statement, 1, register_allocator);
   // We could have a single statement (no brackets) or a compound statement.
   if (while_statement->getBody()->getType() == "CompoundStatement") {
     // Compound statement (brackets).
@@ -1446,16 +3600,18 @@ void compileWhileStatement(std::ofstream& asm_out, const WhileStatement* while_s
     compileStatement(asm_out, while_statement->getBody(), function_context,
                      register_allocator, while_scope);
   }
-
-  asm_out << "b\t " << top_while_id << "\t# Back to the start of the loop." << std::endl;
-  asm_out << "nop" << std::endl;
-  asm_out << end_while_id << ":" << std::endl;
-
   function_context.removeWhileLabels();
   function_context.removeScope();
+
+  // Back to the start of the loop if the condition holds.
+  asm_out << condition_while_id << ":" << std::endl;
+  compileLoopConditionBranch(asm_out, while_statement->getCondition(), "bne",
+                             top_while_id, function_context, register_allocator,
+                             scope_id);
+  asm_out << end_while_id << ":" << std::endl;
 }
 
-void compileForStatement(std::ofstream& asm_out, const ForStatement* for_statement,
+void compileForStatement(std::ostream& asm_out, const ForStatement* for_statement,
                            FunctionContext& function_context,
                            RegisterAllocator& register_allocator,
                            const std::string& scope_id) {
@@ -1463,31 +3619,64 @@ void compileForStatement(std::ofstream& asm_out, const ForStatement* for_stateme
     std::cerr << "==> Compile for statement." << std::endl;
   }
 
+  if (isLoopWithoutEffects(for_statement, for_statement->getCondition(),
+                           function_context)) {
+    reportOptimization("removed for loop without effects.");
+    return;
+  }
+  compileProfileCounterIncrement(asm_out, for_statement, 0, register_allocator);
+
   std::string for_scope = CompilerUtil::makeUniqueId("for_scope");
   function_context.insertScope(for_scope);
+
+  CountedLoop counted_loop;
+  std::vector<const Node*> body_statements;
+  collectStatements(for_statement->getBody(), body_statements);
+  const bool is_counted_loop =
+    for_statement->hasIncrement() &&
+    matchCountedLoop(for_statement->getInit(), for_statement->getCondition(),
+                     body_statements, for_statement->getIncrement(), function_context,
+                     counted_loop);
+  counted_loop.loop = for_statement;
+  if (is_counted_loop &&
+      compileClosedFormLoop(asm_out, counted_loop, for_statement->getInit(),
+                            function_context, register_allocator, for_scope)) {
+    function_context.removeScope();
+    return;
+  }
+  // The init of a fully unrolled loop is not compiled: it only assigns the start value to
+  // the counter, which is stored at the end.
+  if (is_counted_loop && counted_loop.has_start &&
+      for_statement->getInit()->getType() == "AssignmentExpression" &&
+      compileFullyUnrolledLoop(asm_out, counted_loop, function_context,
+                               register_allocator, for_scope)) {
+    function_context.removeScope();
+    return;
+  }
+
   // Compile init.
   compileStatement(asm_out, for_statement->getInit(), function_context,
                    register_allocator, for_scope);
 
   std::string top_for_id = CompilerUtil::makeUniqueId("top_for");
-  asm_out <<top_for_id << ":" << std::endl;
-
   std::string top_increment_id = CompilerUtil::makeUniqueId("top_increment");
-
   std::string end_for_id = CompilerUtil::makeUniqueId("end_for");
-  function_context.insertForLabels(top_increment_id, end_for_id);
-  // Compile condition.
-  if (for_statement->getCondition()->getType() != "EmptyExpression"){
-    std::string cond_reg = register_allocator.requestFreeRegister();
-    compileArithmeticOrLogicalExpression(asm_out, for_statement->getCondition(), cond_reg,
-                                         function_context, register_allocator, for_scope);
 
-    asm_out << "beq\t " << cond_reg << ", $0, " << end_for_id
-            << "\t# Checking the condition of the for." << std::endl;
-    asm_out << "nop" << std::endl;
+  if (is_counted_loop) {
+    compilePartiallyUnrolledLoop(asm_out, counted_loop, end_for_id, function_context,
+                                 register_allocator, for_scope);
+  }
 
-    register_allocator.freeRegister(cond_reg);
+  // Checking the condition of the for before the first iteration.
+  const bool has_condition = for_statement->getCondition()->getType() != "EmptyExpression";
+  if (has_condition) {
+    compileLoopConditionBranch(asm_out, for_statement->getCondition(), "beq", end_for_id,
+                               function_context, register_allocator, for_scope);
   }
+  asm_out << top_for_id << ":" << std::endl;
+
+  function_context.insertForLabels(top_increment_id, end_for_id);
+  compileProfileCounterIncrement(asm_out, for_statement, 1, register_allocator);
   // Compile for body.
   // We could have a single statement (no brackets) or a compound statement.
   if (for_statement->getBody()->getType() == "CompoundStatement") {
@@ -1501,6 +3690,7 @@ void compileForStatement(std::ofstream& asm_out, const ForStatement* for_stateme
     compileStatement(asm_out, for_statement->getBody(), function_context,
                      register_allocator, for_scope);
   }
+  function_context.removeForLabels();
 
   // Compile increment
   asm_out << top_increment_id << ":  \t# Here jumps a continue statement. " << std::endl;
@@ -1509,15 +3699,20 @@ void compileForStatement(std::ofstream& asm_out, const ForStatement* for_stateme
                      register_allocator, for_scope);
   }
 
-  asm_out << "b\t " << top_for_id << "\t# Back to the start of the loop." << std::endl;
-  asm_out << "nop" << std::endl;
+  // Back to the start of the loop if the condition holds.
+  if (has_condition) {
+    compileLoopConditionBranch(asm_out, for_statement->getCondition(), "bne", top_for_id,
+                               function_context, register_allocator, for_scope);
+  } else {
+    asm_out << "b\t " << top_for_id << "\t# Back to the start of the loop." << std::endl;
+    asm_out << "nop" << std::endl;
+  }
   asm_out << end_for_id << ":" << std::endl;
 
-  function_context.removeForLabels();
   function_context.removeScope();
 }
 
-void compileSwitchStatement(std::ofstream& asm_out,
+void compileSwitchStatement(std::ostream& asm_out,
                             const SwitchStatement* switch_statement,
                             FunctionContext& function_context,
                             RegisterAllocator& register_allocator,
@@ -1558,7 +3753,7 @@ void compileSwitchStatement(std::ofstream& asm_out,
   function_context.removeSwitchLabels();
 }
 
-void compileCaseStatementList(std::ofstream& asm_out,
+void compileCaseStatementList(std::ostream& asm_out,
                           const CaseStatementListNode* case_statement_list_node,
                           const std::string& test_reg, const Node* switch_test,
                           const std::string& def_reg,
@@ -1630,7 +3825,7 @@ void compileCaseStatementList(std::ofstream& asm_out,
   }
 }
 
-void compileCaseStatement(std::ofstream& asm_out,
+void compileCaseStatement(std::ostream& asm_out,
                           const CaseStatement* case_statement,
                           const std::string& test_reg, const Node* switch_test,
                           const std::string& def_reg, FunctionContext& function_context,
@@ -1665,7 +3860,7 @@ void compileCaseStatement(std::ofstream& asm_out,
   asm_out << end_case_id << ":" << std::endl;
 }
 
-void compileDefaultStatement(std::ofstream& asm_out,
+void compileDefaultStatement(std::ostream& asm_out,
                           const DefaultStatement* default_statement,
                           const std::string& def_reg,
                           FunctionContext& function_context,
@@ -1699,10 +3894,10 @@ void compileDefaultStatement(std::ofstream& asm_out,
 // - while
 // - return
 // - any logical or arithmetic expression.
-void compileStatement(std::ofstream& asm_out, const Node* statement,
+void compileStatement(std::ostream& asm_out, const Node* statement,
                       FunctionContext& function_context,
                       RegisterAllocator& register_allocator,
-                      const std::string& scope_id) {
+                      const std::string& scope_id, const Node* previous_statement) {
   if (Util::DEBUG) {
     std::cerr << "==> Compiling statement." << std::endl;
   }
@@ -1743,7 +3938,7 @@ void compileStatement(std::ofstream& asm_out, const Node* statement,
     const WhileStatement* while_statement =
       dynamic_cast<const WhileStatement*>(statement);
     compileWhileStatement(asm_out, while_statement, function_context,
-                           register_allocator, scope_id);
+                          register_allocator, scope_id, previous_statement);
   }
   else if (statement_type == "ForStatement") {
     const ForStatement* for_statement =
@@ -1807,11 +4002,12 @@ void compileStatement(std::ofstream& asm_out, const Node* statement,
 // node(nullptr, nullptr)          --> statement list is empty.
 // node(statement, nullptr)        --> only one statement left.
 // node(statement, next_statement) --> statement exists and has successor.
-void compileStatementList(std::ofstream& asm_out,
+void compileStatementList(std::ostream& asm_out,
                           const StatementListNode* statement_list_node,
                           FunctionContext& function_context,
                           RegisterAllocator& register_allocator,
-                          const std::string& scope_id) {
+                          const std::string& scope_id,
+                          const Node* previous_statement) {
   if (Util::DEBUG) {
     std::cerr << "==> Compiling statement list." << std::endl;
   }
@@ -1824,7 +4020,8 @@ void compileStatementList(std::ofstream& asm_out,
   else if(!statement_list_node->hasNextStatement()) {
     // Only one statement left.
     const Node* statement = statement_list_node->getStatement();
-    compileStatement(asm_out, statement, function_context, register_allocator, scope_id);
+    compileStatement(asm_out, statement, function_context, register_allocator, scope_id,
+                     previous_statement);
   }
   // Recursive case.
   else if (statement_list_node->hasNextStatement()) {
@@ -1832,13 +4029,14 @@ void compileStatementList(std::ofstream& asm_out,
     const Node* statement = statement_list_node->getStatement();
     const StatementListNode* next_statement =
       dynamic_cast<const StatementListNode*>(statement_list_node->getNextStatement());
-    compileStatement(asm_out, statement, function_context, register_allocator, scope_id);
+    compileStatement(asm_out, statement, function_context, register_allocator, scope_id,
+                     previous_statement);
     compileStatementList(asm_out, next_statement, function_context, register_allocator,
-                         scope_id);
+                         scope_id, statement);
   }
 }
 
-void compileCompoundStatement(std::ofstream& asm_out,
+void compileCompoundStatement(std::ostream& asm_out,
                               const CompoundStatement* compound_statement,
                               FunctionContext& function_context,
                               RegisterAllocator& register_allocator,
@@ -1855,7 +4053,7 @@ void compileCompoundStatement(std::ofstream& asm_out,
   }
 }
 
-void compileFunctionDefinition(std::ofstream& asm_out,
+void compileFunctionDefinition(std::ostream& asm_out,
                                const FunctionDefinition* function_definition,
                                RegisterAllocator& register_allocator) {
   if (Util::DEBUG) {
@@ -1879,8 +4077,18 @@ void compileFunctionDefinition(std::ofstream& asm_out,
     }
     Util::abort();
   }
+  function_id_being_compiled = id;
+  function_definition_being_compiled = function_definition;
+  address_taken_variables.clear();
+  CompilerUtil::collectAddressTakenVariables(body, address_taken_variables);
+  tail_recursion_operator = findTailRecursionOperator(body);
   int bytes_to_allocate =
-    CompilerUtil::countBytesForDeclarationsInFunction(function_definition);
+    CompilerUtil::countBytesForDeclarationsInFunction(function_definition) +
+    countBytesForInlinedCalls(body);
+  if (!tail_recursion_operator.empty()) {
+    // Accumulator of the tail recursion.
+    bytes_to_allocate += WORD_LENGTH;
+  }
   // At least 6 words in each function frame.
   // See: https://minnie.tuhs.org/CompArch/Labs/week4.html section 3.5
   int frame_size = bytes_to_allocate + 6 * WORD_LENGTH;
@@ -1892,7 +4100,122 @@ void compileFunctionDefinition(std::ofstream& asm_out,
   const std::string& epilogue_label = CompilerUtil::makeUniqueId(id + "_epilogue");
 
   // Create function context.
-  FunctionContext function_context(frame_size, epilogue_label);
+  const std::string frame_register = compiler_options.omit_frame_pointer ? "$sp" : "$fp";
+  FunctionContext function_context(frame_size, epilogue_label, frame_register);
+
+  // Save scope in the scope list.
+  std::string func_scope = CompilerUtil::makeUniqueId(id);
+  function_context.insertScope(func_scope);
+
+  std::vector<std::string> argument_names =
+    CompilerUtil::getArgumentNamesFromFunctionDeclaration(argument_list_node);
+  // The first 4 arguments of the function are stored in the previous function frame.
+  // Only if not main.
+  if (id != "main") {
+    for (int i = 0; i < 4; i++) {
+      function_context.saveOffsetForArgument(argument_names.at(i),
+                                             i * WORD_LENGTH + frame_size, func_scope);
+    }
+  }
+
+  if (!tail_recursion_operator.empty()) {
+    tail_recursion_accumulator_offset =
+      function_context.placeVariableInStack(TAIL_RECURSION_ACCUMULATOR, func_scope,
+                                            /*is_declaration=*/true);
+  }
+
+  // Function body.
+  // The body is compiled first, so that it can be optimized before knowing what the
+  // prologue and the epilogue have to save and restore.
+  function_has_tail_recursion = false;
+  std::stringstream statements_out;
+  compileProfileCounterIncrement(statements_out, function_definition, 0,
+                                 register_allocator);
+  compileCompoundStatement(statements_out, body, function_context, register_allocator,
+                           func_scope);
+  if (!function_context.getOutOfLineCode().empty()) {
+    // The paths run rarely, after the body.
+    statements_out << "b\t " << epilogue_label << "\t# End of the body." << std::endl;
+    statements_out << "nop" << std::endl;
+    statements_out << "## Out of line code ##" << std::endl;
+    statements_out << function_context.getOutOfLineCode();
+  }
+  std::stringstream body_out;
+  if (!tail_recursion_operator.empty()) {
+    // The accumulator starts from the identity of the operator.
+    const std::string tmp_reg = register_allocator.requestFreeRegister();
+    body_out << "li\t " << tmp_reg << ", " << (tail_recursion_operator == "+" ? 0 : 1)
+             << "\t# Initialize the accumulator of the tail recursion." << std::endl;
+    body_out << "sw\t " << tmp_reg << ", " << tail_recursion_accumulator_offset << "("
+             << function_context.getFrameRegister() << ")"
+             << "\t# Store the accumulator of the tail recursion." << std::endl;
+    register_allocator.freeRegister(tmp_reg);
+  }
+  if (function_has_tail_recursion) {
+    // The loop of the tail recursion starts after the arguments are homed.
+    body_out << "# Start of the body, target of the tail recursion." << std::endl;
+    body_out << function_context.getTailRecursionLabel() << ":" << std::endl;
+  }
+  body_out << statements_out.str();
+  AsmFunction asm_body(body_out.str());
+  AsmOptimizer::optimizeCallerSavedRegisters(asm_body, function_context);
+  AsmOptimizer::hoistLoopInvariantCode(asm_body, function_context);
+  AsmOptimizer::propagateCopies(asm_body, function_context);
+  AsmOptimizer::reduceInductionVariables(asm_body, function_context);
+  AsmOptimizer::promoteLocalVariables(asm_body, function_context);
+  AsmOptimizer::promoteGlobalVariablesInLoops(asm_body, function_context);
+  AsmOptimizer::optimizeMemoryAccesses(asm_body, function_context);
+  AsmOptimizer::propagateCopies(asm_body, function_context);
+  AsmOptimizer::eliminateTailCalls(asm_body, function_context);
+
+  // Set up of the stack frame. It is placed in the body only on the paths that need it
+  // (see AsmOptimizer::shrinkWrap).
+  std::stringstream frame_setup_out;
+  frame_setup_out << "# Set up the stack frame." << std::endl;
+  // Move stack pointer to bottom of the frame.
+  frame_setup_out << "addiu\t $sp, $sp, -" << frame_size << std::endl;
+  // Save return address at the top of the frame.
+  frame_setup_out << "sw\t $ra, " << frame_size - WORD_LENGTH << "($sp)" << std::endl;
+  if (!function_context.isFramePointerOmitted()) {
+    // Save previous frame pointer in the second word from the top of this frame.
+    frame_setup_out << "sw\t $fp, " << frame_size - 2 * WORD_LENGTH << "($sp)"
+                    << std::endl;
+  }
+  // Save the callee saved registers used by the body.
+  for (const auto& callee_saved_register : function_context.getCalleeSavedRegisters()) {
+    frame_setup_out << "sw\t " << callee_saved_register.first << ", "
+                    << callee_saved_register.second << "($sp)" << std::endl;
+  }
+  if (!function_context.isFramePointerOmitted()) {
+    // Move frame pointer to the end of this frame.
+    frame_setup_out << "move\t $fp, $sp" << std::endl;
+  }
+  // Release of the stack frame, before returning or jumping to a tail call.
+  std::stringstream frame_teardown_out;
+  if (!function_context.isFramePointerOmitted()) {
+    // Move stack pointer to frame pointer.
+    frame_teardown_out << "move\t $sp, $fp" << std::endl;
+  }
+  // Restore the callee saved registers.
+  for (const auto& callee_saved_register : function_context.getCalleeSavedRegisters()) {
+    frame_teardown_out << "lw\t " << callee_saved_register.first << ", "
+                       << callee_saved_register.second << "($sp)" << std::endl;
+  }
+  // Restore the return address.
+  frame_teardown_out << "lw\t $ra, " << frame_size - WORD_LENGTH << "($sp)" << std::endl;
+  if (!function_context.isFramePointerOmitted()) {
+    // Restore the previous frame pointer.
+    frame_teardown_out << "lw\t $fp, " << frame_size - 2 * WORD_LENGTH << "($sp)"
+                       << std::endl;
+  }
+  // Restore stack pointer to the previous frame bottom.
+  frame_teardown_out << "addiu\t $sp, $sp, " << frame_size << std::endl;
+
+  const std::string fast_epilogue_label = epilogue_label + "_fast";
+  const std::string& frame_usage =
+    AsmOptimizer::shrinkWrap(asm_body, function_context, frame_setup_out.str(),
+                             frame_teardown_out.str(), fast_epilogue_label);
+  AsmOptimizer::optimizeBranches(asm_body, function_context);
 
   asm_out << std::endl;
   asm_out << "#### Function: " << id << " ####" << std::endl;
@@ -1907,66 +4230,42 @@ void compileFunctionDefinition(std::ofstream& asm_out,
           << ".type  " << id << ", @function" << std::endl;
   // Label.
   asm_out << id << ":" << std::endl;
-  // Move stack pointer to bottom of the frame.
-  asm_out << "addiu\t $sp, $sp, -" << frame_size << std::endl;
-  // Save return address at the top of the frame.
-  asm_out << "sw\t $ra, " << frame_size - WORD_LENGTH << "($sp)" << std::endl;
-  // Save previous frame pointer in the second word from the top of this frame.
-  asm_out << "sw\t $fp, " << frame_size - 2 * WORD_LENGTH << "($sp)" << std::endl;
-  // Move frame pointer to the end of this frame.
-  asm_out << "move\t $fp, $sp" << std::endl;
-
-  // Save scope in the scope list.
-  std::string func_scope = CompilerUtil::makeUniqueId(id);
-  function_context.insertScope(func_scope);
 
-  std::vector<std::string> argument_names =
-    CompilerUtil::getArgumentNamesFromFunctionDeclaration(argument_list_node);
   // Store the first 4 arguments of the function in the previous function frame.
   // Only if not main.
   if (id != "main") {
-    asm_out << "sw\t $a0, " << 0 * WORD_LENGTH + frame_size << "($sp)" << std::endl;
-    function_context.saveOffsetForArgument(argument_names.at(0),
-                                           0 * WORD_LENGTH + frame_size, func_scope);
-    asm_out << "sw\t $a1, " << 1 * WORD_LENGTH + frame_size << "($sp)" << std::endl;
-    function_context.saveOffsetForArgument(argument_names.at(1),
-                                           1 * WORD_LENGTH + frame_size, func_scope);
-    asm_out << "sw\t $a2, " << 2 * WORD_LENGTH + frame_size << "($sp)" << std::endl;
-    function_context.saveOffsetForArgument(argument_names.at(2),
-                                           2 * WORD_LENGTH + frame_size, func_scope);
-    asm_out << "sw\t $a3, " << 3 * WORD_LENGTH + frame_size << "($sp)" << std::endl;
-    function_context.saveOffsetForArgument(argument_names.at(3),
-                                           3 * WORD_LENGTH + frame_size, func_scope);
+    asm_out << "sw\t $a0, " << 0 * WORD_LENGTH << "($sp)" << std::endl;
+    asm_out << "sw\t $a1, " << 1 * WORD_LENGTH << "($sp)" << std::endl;
+    asm_out << "sw\t $a2, " << 2 * WORD_LENGTH << "($sp)" << std::endl;
+    asm_out << "sw\t $a3, " << 3 * WORD_LENGTH << "($sp)" << std::endl;
+  }
+
+  if (AsmOptimizer::usesGlobalPointer(asm_body)) {
+    // $gp is used to access small global variables and the address of externally defined
+    // functions. It is the same for all the functions of the program, hence it is set up
+    // only once, at the entry.
+    asm_out << "lui\t $28, %hi(__gnu_local_gp)" << std::endl;
+    asm_out << "addiu\t $28, $28, %lo(__gnu_local_gp)" << std::endl;
   }
 
-  // Function body.
   asm_out << "## Body ##" << std::endl;
-  compileCompoundStatement(asm_out, body, function_context, register_allocator,
-                           func_scope);
+  asm_body.print(asm_out);
 
   // Function epilogue.
   asm_out << "## Epilogue ##" << std::endl;
   asm_out << epilogue_label << ":" << std::endl;
-  // Restore the first 4 arguments of the function from the previous function frame.
-  // Only if not main.
-  if (id != "main") {
-    asm_out << "lw\t $a0, " << 0 * WORD_LENGTH + frame_size << "($fp)" << std::endl;
-    asm_out << "lw\t $a1, " << 1 * WORD_LENGTH + frame_size << "($fp)" << std::endl;
-    asm_out << "lw\t $a2, " << 2 * WORD_LENGTH + frame_size << "($fp)" << std::endl;
-    asm_out << "lw\t $a3, " << 3 * WORD_LENGTH + frame_size << "($fp)" << std::endl;
+  if (frame_usage != "none") {
+    asm_out << frame_teardown_out.str();
   }
-
-  // Move stack pointer to frame pointer.
-  asm_out << "move\t $sp, $fp" << std::endl;
-  // Restore the return address.
-  asm_out << "lw\t $ra, " << frame_size - WORD_LENGTH << "($sp)" << std::endl;
-  // Restore the previous frame pointer.
-  asm_out << "lw\t $fp, " << frame_size - 2 * WORD_LENGTH << "($sp)" << std::endl;
-  // Restore stack pointer to the previous frame bottom.
-  asm_out << "addiu\t $sp, $sp, " << frame_size << std::endl;
   // Jump to caller next instruction.
   asm_out << "j\t $ra" << std::endl;
   asm_out << "nop" << std::endl;
+  if (frame_usage == "partial") {
+    // Return from the paths that did not set up the stack frame.
+    asm_out << fast_epilogue_label << ":" << std::endl;
+    asm_out << "j\t $ra" << std::endl;
+    asm_out << "nop" << std::endl;
+  }
   asm_out << std::endl;
 
   asm_out << ".set macro" << std::endl
@@ -1978,7 +4277,7 @@ void compileFunctionDefinition(std::ofstream& asm_out,
 }
 
 void compileGlobalVariableDeclarationList(
-  std::ofstream& asm_out, const DeclarationExpressionList* declaration_expression_list) {
+  const DeclarationExpressionList* declaration_expression_list) {
   if (Util::DEBUG) {
     std::cerr << "==> Compiling global variable declaration." << std::endl;
   }
@@ -1993,7 +4292,16 @@ void compileGlobalVariableDeclarationList(
       dynamic_cast<const Variable*>(declaration_node->getVariable());
     const std::string& variable_info = variable->getInfo();
     const std::string& variable_id = variable->getId();
-    global_variables.addNewGlobalVariable(variable_id, variable_info);
+
+    if (drop_unreachable_symbols && reachable_symbols.count(variable_id) == 0) {
+      dropped_symbols.push_back("global variable " + variable_id + ": not referenced.");
+      if (declaration_node->hasNext()) {
+        declaration_node = dynamic_cast<const DeclarationExpressionListNode*>
+          (declaration_node->getNext());
+        continue;
+      }
+      break;
+    }
 
     // Check type of the function. Only supported so far: int.
     if (type != "int") {
@@ -2004,36 +4312,60 @@ void compileGlobalVariableDeclarationList(
       Util::abort();
     }
 
+    // Integer and pointers are a full word in memory.
+    int size_in_bytes = 4;
+    if (variable_info == "array") {
+      size_in_bytes =
+        4 * CompilerUtil::evaluateConstantExpression(variable->getArrayIndexOrSize());
+    }
+    global_variables.addNewGlobalVariable(variable_id, variable_info, size_in_bytes);
+    // Arrays are zero initialized.
+    int value = 0;
+    if (declaration_node->hasRhs()) {
+      value = CompilerUtil::evaluateConstantExpression(declaration_node->getRhs());
+    }
+
+    GlobalVariableDefinition global_variable_definition;
+    global_variable_definition.references = variable_references[variable_id];
+    // Choose the section:
+    // - .rodata: never written, only known when compiling the whole program. The value
+    //            of a normal variable is used as a constant.
+    // - .sdata/.sbss: small variables, addressed from $gp.
+    // - .data/.bss: the others.
+    // Zero initialized variables go to .sbss and .bss, which take no space in the binary.
+    if (compiler_options.whole_program && written_variables.count(variable_id) == 0) {
+      global_variables.markReadOnly(variable_id);
+      global_variable_definition.section = ".rodata";
+      if (variable_info == "normal") {
+        compile_time_constants.addNewConstant(variable_id, value);
+      }
+    } else if (global_variables.isSmallData(variable_id)) {
+      global_variable_definition.section = value == 0 ? ".sbss" : ".sdata";
+    } else {
+      global_variable_definition.section = value == 0 ? ".bss" : ".data";
+    }
+    const std::string& section = global_variable_definition.section;
+
+    std::stringstream definition_out;
+    if (size_in_bytes >= (1 << CACHE_LINE_ALIGNMENT)) {
+      definition_out << ".align " << CACHE_LINE_ALIGNMENT << std::endl;
+    }
+    if (section == ".sbss" || section == ".bss" || variable_info == "array") {
+      definition_out << variable_id << ": \t .space " << size_in_bytes;
+    } else {
+      definition_out << variable_id << ": \t .word " << value;
+    }
     // Normal variable (i.e. nor array, nor pointer etc...).
     if (variable_info == "normal") {
-      // Integer is a full word in memory.
-      if (declaration_node->hasRhs()) {
-        int rhs_constant =
-          CompilerUtil::evaluateConstantExpression(declaration_node->getRhs());
-        asm_out << variable_id << ": \t .word " << rhs_constant
-                << "\t # Normal variable: " << variable_id << "." << std::endl;
-      } else {
-        // No constant value specified, initialize as zero.
-        asm_out << variable_id << ": \t .word 0" << "\t # Normal variable: " << variable_id
-                << "." << std::endl;
-      }
+      definition_out << "\t # Normal variable: " << variable_id << "." << std::endl;
     } else if (variable_info == "array") {
-      int size_in_bytes =
-        4 * CompilerUtil::evaluateConstantExpression(variable->getArrayIndexOrSize());
-      asm_out << variable_id << ": \t .space " << size_in_bytes << "\t # Array of "
-              << size_in_bytes / 4 << " int: " << variable_id << "." << std::endl;
+      definition_out << "\t # Array of " << size_in_bytes / 4 << " int: " << variable_id
+                     << "." << std::endl;
     } else if (variable_info == "pointer") {
-      if (declaration_node->hasRhs()) {
-        int rhs_constant =
-          CompilerUtil::evaluateConstantExpression(declaration_node->getRhs());
-        asm_out << variable_id << ": \t .word " << rhs_constant
-                << "\t # Pointer variable: " << variable_id << "." << std::endl;
-      } else {
-        // No constant value specified, initialize as zero.
-        asm_out << variable_id << ": \t .word 0" << "\t # Pointer variable: "
-                << variable_id << "." << std::endl;
-      }
+      definition_out << "\t # Pointer variable: " << variable_id << "." << std::endl;
     }
+    global_variable_definition.definition = definition_out.str();
+    global_variable_definitions.push_back(global_variable_definition);
 
     // Next declaration.
     if (declaration_node->hasNext()) {
@@ -2045,7 +4377,7 @@ void compileGlobalVariableDeclarationList(
   }
 }
 
-void compileEnumDeclaration(std::ofstream& asm_out,
+void compileEnumDeclaration(std::ostream& asm_out,
                             const EnumDeclaration* enum_declaration,
                             int& prev_num) {
   if (Util::DEBUG) {
@@ -2061,14 +4393,13 @@ void compileEnumDeclaration(std::ofstream& asm_out,
     value = prev_num + 1;
   }
 
-  global_variables.addNewGlobalVariable(id, "enum");
-  asm_out << id << ": \t .word " << value << "\t # Enum: " << id << "." << std::endl;
+  compile_time_constants.addNewConstant(id, value);
 
   prev_num = value;
 }
 
 void compileEnumDeclarationList(
-  std::ofstream& asm_out, const EnumDeclarationListNode* enum_declaration_list_node,
+  std::ostream& asm_out, const EnumDeclarationListNode* enum_declaration_list_node,
   int prev_num) {
   if (Util::DEBUG) {
     std::cerr << "==> Compiling global enum declaration list." << std::endl;
@@ -2090,7 +4421,80 @@ void compileEnumDeclarationList(
   }
 }
 
-void compileAst(std::ofstream& asm_out, const std::vector<const Node*>& ast_roots,
+// Counters of -fprofile-generate (see ExecutionProfile), and the routine that writes them
+// to the profile file when the program exits. A constructor registers it with atexit. It
+// uses the open, write and close system calls, and gives up if the file cannot be opened.
+void compileProfileRuntime(std::ostream& asm_out) {
+  const int counters = execution_profile.countCounters();
+  asm_out << std::endl;
+  asm_out << "#### Profile counters ####" << std::endl;
+  asm_out << ".data" << std::endl << ".align 2" << std::endl;
+  asm_out << PROFILE_COUNTERS << ":" << std::endl;
+  asm_out << ".word " << PROFILE_MAGIC << "\t# Magic number." << std::endl;
+  asm_out << ".word " << counters << "\t# Number of counters." << std::endl;
+  asm_out << ".word " << execution_profile.getChecksum() << "\t# Checksum of the source."
+          << std::endl;
+  if (counters > 0) {
+    asm_out << ".space " << counters * WORD_LENGTH << std::endl;
+  }
+  asm_out << ".section .rodata" << std::endl;
+  asm_out << "__profile_file_name:" << std::endl;
+  asm_out << ".asciiz \"";
+  for (char c : compiler_options.profile_generate_file) {
+    if (c == '"' || c == '\\') {
+      asm_out << '\\';
+    }
+    asm_out << c;
+  }
+  asm_out << "\"" << std::endl;
+  asm_out << ".section .init_array,\"aw\"" << std::endl;
+  asm_out << ".align 2" << std::endl;
+  asm_out << ".word __profile_init" << std::endl;
+
+  asm_out << std::endl;
+  asm_out << "#### Profile runtime ####" << std::endl;
+  asm_out << ".text" << std::endl;
+  for (const std::string& id : {"__profile_init", "__profile_dump"}) {
+    asm_out << ".align 2" << std::endl
+            << ".ent   " << id << std::endl
+            << ".type  " << id << ", @function" << std::endl;
+    asm_out << id << ":" << std::endl;
+    if (id == "__profile_init") {
+      asm_out << "lui\t $28, %hi(__gnu_local_gp)" << std::endl;
+      asm_out << "addiu\t $28, $28, %lo(__gnu_local_gp)" << std::endl;
+      asm_out << "lui\t $a0, %hi(__profile_dump)" << std::endl;
+      asm_out << "addiu\t $a0, $a0, %lo(__profile_dump)" << std::endl;
+      asm_out << "lw\t $25, %call16(atexit)($28)" << std::endl;
+      asm_out << "jr\t $25\t# Tail call: atexit returns to the caller." << std::endl;
+      asm_out << "nop" << std::endl;
+    } else {
+      asm_out << "lui\t $a0, %hi(__profile_file_name)" << std::endl;
+      asm_out << "addiu\t $a0, $a0, %lo(__profile_file_name)" << std::endl;
+      asm_out << "li\t $a1, 769\t# O_WRONLY | O_CREAT | O_TRUNC." << std::endl;
+      asm_out << "li\t $a2, 420\t# Mode 0644." << std::endl;
+      asm_out << "li\t $v0, 4005\t# open." << std::endl;
+      asm_out << "syscall" << std::endl;
+      asm_out << "bne\t $a3, $0, __profile_dump_end\t# $a3 is set on errors." << std::endl;
+      asm_out << "nop" << std::endl;
+      asm_out << "move\t $a0, $v0" << std::endl;
+      asm_out << "lui\t $a1, %hi(" << PROFILE_COUNTERS << ")" << std::endl;
+      asm_out << "addiu\t $a1, $a1, %lo(" << PROFILE_COUNTERS << ")" << std::endl;
+      asm_out << "li\t $a2, " << (PROFILE_HEADER_WORDS + counters) * WORD_LENGTH
+              << "\t# Bytes to write: the header and the counters." << std::endl;
+      asm_out << "li\t $v0, 4004\t# write." << std::endl;
+      asm_out << "syscall" << std::endl;
+      asm_out << "li\t $v0, 4006\t# close, the descriptor is still in $a0." << std::endl;
+      asm_out << "syscall" << std::endl;
+      asm_out << "__profile_dump_end:" << std::endl;
+      asm_out << "j\t $ra" << std::endl;
+      asm_out << "nop" << std::endl;
+    }
+    asm_out << ".end " << id << std::endl
+            << ".size " << id << ", .-" << id << std::endl;
+  }
+}
+
+void compileAst(std::ostream& asm_out, const std::vector<const Node*>& ast_roots,
                 RegisterAllocator& register_allocator) {
   // Assembly output is made of two parts:
   // .data -> declares variable names used in program; storage allocated in main memory.
@@ -2111,11 +4515,65 @@ void compileAst(std::ofstream& asm_out, const std::vector<const Node*>& ast_root
     }
   }
 
+  // Graph of the symbols referenced by each function: the functions it calls, and the
+  // variables and functions it names.
+  std::unordered_map<std::string, std::vector<std::string>> symbol_references;
+  for (const Node* ast : ast_roots) {
+    if (ast->getType() == "FunctionDefinition") {
+      const FunctionDefinition* function_definition =
+        dynamic_cast<const FunctionDefinition*>(ast);
+      call_graph.addFunctionDefinition(function_definition);
+      const std::string& id =
+        dynamic_cast<const Variable*>(function_definition->getName())->getId();
+      std::unordered_map<std::string, int> references;
+      CompilerUtil::countVariableReferences(ast, references);
+      for (const auto& reference : references) {
+        symbol_references[id].push_back(reference.first);
+      }
+    }
+  }
+
+  call_graph.findRecursiveFunctions();
+
+  // When compiling the whole program, what cannot be reached from main or from the
+  // exported symbols is not emitted.
+  std::vector<std::string> entry_points;
+  if (compiler_options.whole_program) {
+    if (call_graph.getFunctionDefinition("main") != nullptr) {
+      entry_points.push_back("main");
+    }
+    entry_points.insert(entry_points.end(), compiler_options.exported_symbols.begin(),
+                        compiler_options.exported_symbols.end());
+    // Other files may write the exported variables.
+    written_variables.insert(compiler_options.exported_symbols.begin(),
+                             compiler_options.exported_symbols.end());
+  }
+  drop_unreachable_symbols = !entry_points.empty();
+  if (drop_unreachable_symbols) {
+    std::unordered_map<std::string, std::vector<std::string>> call_and_symbol_references =
+      symbol_references;
+    for (const auto& function_references : symbol_references) {
+      const std::vector<std::string>& callees =
+        call_graph.getCallees(function_references.first);
+      call_and_symbol_references[function_references.first].insert(
+        call_and_symbol_references[function_references.first].end(), callees.begin(),
+        callees.end());
+    }
+    reachable_symbols = findReachableSymbols(entry_points, call_and_symbol_references);
+  }
+
+  // Find how the functions use the global variables, to choose where to place them.
+  for (const Node* ast : ast_roots) {
+    if (ast->getType() == "FunctionDefinition" && isReachableFunction(ast)) {
+      CompilerUtil::collectWrittenVariables(ast, written_variables);
+      CompilerUtil::countVariableReferences(ast, variable_references);
+    }
+  }
+
   // Data.
   asm_out << "##################" << std::endl
           << "## Data section ##" << std::endl
           << "##################" << std::endl;
-  asm_out << ".data" << std::endl;
   for (const Node* ast : ast_roots) {
     if(Util::DEBUG) {
       std::cerr << std::endl << std::endl
@@ -2127,7 +4585,7 @@ void compileAst(std::ofstream& asm_out, const std::vector<const Node*>& ast_root
     if (ast->getType() == "DeclarationExpressionList") {
       const DeclarationExpressionList* declaration_expression_list =
         dynamic_cast<const DeclarationExpressionList*>(ast);
-      compileGlobalVariableDeclarationList(asm_out, declaration_expression_list);
+      compileGlobalVariableDeclarationList(declaration_expression_list);
     } else if (ast->getType() == "EnumDeclarationListNode") {
       const EnumDeclarationListNode* enum_declaration_list_node =
         dynamic_cast<const EnumDeclarationListNode*>(ast);
@@ -2139,21 +4597,59 @@ void compileAst(std::ofstream& asm_out, const std::vector<const Node*>& ast_root
         dynamic_cast<const Variable*>(function_declaration->getName())->getId());
     }
   }
+  // Variables are grouped by section, the most referenced first, so that the hot small
+  // variables share the same cache lines.
+  std::stable_sort(global_variable_definitions.begin(), global_variable_definitions.end(),
+                   [](const GlobalVariableDefinition& a,
+                      const GlobalVariableDefinition& b) {
+                     return a.references > b.references;
+                   });
+  for (const std::string& section : {".sdata", ".sbss", ".data", ".bss", ".rodata"}) {
+    bool is_empty = true;
+    for (const GlobalVariableDefinition& global_variable_definition :
+         global_variable_definitions) {
+      if (global_variable_definition.section != section) {
+        continue;
+      }
+      if (is_empty) {
+        asm_out << section << std::endl;
+        asm_out << ".align 2" << std::endl;
+        is_empty = false;
+      }
+      asm_out << global_variable_definition.definition;
+    }
+  }
 
-  // Text.
-  asm_out << std::endl;
-  asm_out << "##################" << std::endl
-          << "## Code section ##" << std::endl
-          << "##################" << std::endl;
-  asm_out << ".text" << std::endl;
-  // State global variable as .globl to allow them to be used in different files.
-  asm_out << "# Global variables." << std::endl;
-  for (std::string id : global_variables.getAllGlobalVariableIds()) {
-    asm_out << ".globl " << id << std::endl;
+  // Which global variables each function may read and write, so that the loads can be
+  // kept across the stores and the calls that do not alias them.
+  std::vector<const FunctionDefinition*> function_definitions;
+  for (const Node* ast : ast_roots) {
+    if (ast->getType() == "FunctionDefinition") {
+      function_definitions.push_back(dynamic_cast<const FunctionDefinition*>(ast));
+    }
+  }
+  mod_ref_summaries.analyze(function_definitions, global_variables,
+                            compiler_options.whole_program,
+                            compiler_options.exported_symbols);
+  // The calls to pure functions with constant arguments are evaluated at compile time.
+  pure_function_evaluator.analyze(function_definitions);
+
+  // Profile counters, incremented by every function with -fprofile-generate, and the
+  // counts of a previous run with -fprofile-use.
+  execution_profile.analyze(function_definitions);
+  if (compiler_options.profile_generate) {
+    mod_ref_summaries.addGlobalAccessedByAllFunctions(PROFILE_COUNTERS);
+  }
+  if (!compiler_options.profile_use_file.empty()) {
+    std::string error;
+    if (!execution_profile.load(compiler_options.profile_use_file, error)) {
+      std::cerr << "Profile " << compiler_options.profile_use_file << " ignored: "
+                << error << "." << std::endl;
+    }
   }
-  asm_out << "# End global variables." << std::endl;
 
   // Compile all functions definitions.
+  std::vector<std::pair<std::string, std::string>> compiled_functions;
   for (const Node* ast : ast_roots) {
     if(Util::DEBUG) {
       std::cerr << std::endl << std::endl
@@ -2165,13 +4661,86 @@ void compileAst(std::ofstream& asm_out, const std::vector<const Node*>& ast_root
     if (ast->getType() == "FunctionDefinition") {
       const FunctionDefinition* function_definition =
         dynamic_cast<const FunctionDefinition*>(ast);
-      compileFunctionDefinition(asm_out, function_definition, register_allocator);
+      const std::string& id =
+        dynamic_cast<const Variable*>(function_definition->getName())->getId();
+      if (!isReachableFunction(ast)) {
+        dropped_symbols.push_back("function " + id + ": unreachable.");
+        continue;
+      }
+      std::stringstream function_out;
+      compileFunctionDefinition(function_out, function_definition, register_allocator);
+      compiled_functions.emplace_back(id, function_out.str());
+    }
+  }
+
+  // Once the calls are inlined, a function may not be called anymore: follow the calls
+  // left in the code instead of the calls in the source.
+  std::unordered_set<std::string> called_symbols;
+  if (drop_unreachable_symbols) {
+    std::unordered_map<std::string, std::vector<std::string>> call_and_symbol_references =
+      symbol_references;
+    for (const auto& function_calls : emitted_calls) {
+      call_and_symbol_references[function_calls.first].insert(
+        call_and_symbol_references[function_calls.first].end(),
+        function_calls.second.begin(), function_calls.second.end());
+    }
+    called_symbols = findReachableSymbols(entry_points, call_and_symbol_references);
+  }
+
+  // Text.
+  asm_out << std::endl;
+  asm_out << "##################" << std::endl
+          << "## Code section ##" << std::endl
+          << "##################" << std::endl;
+  asm_out << ".text" << std::endl;
+  // State global variable as .globl to allow them to be used in different files.
+  asm_out << "# Global variables." << std::endl;
+  for (std::string id : global_variables.getAllGlobalVariableIds()) {
+    asm_out << ".globl " << id << std::endl;
+  }
+  asm_out << "# End global variables." << std::endl;
+
+  for (const auto& compiled_function : compiled_functions) {
+    if (drop_unreachable_symbols && called_symbols.count(compiled_function.first) == 0) {
+      dropped_symbols.push_back("function " + compiled_function.first +
+                                ": inlined at every call.");
+      continue;
+    }
+    asm_out << compiled_function.second;
+  }
+
+  if (compiler_options.profile_generate) {
+    compileProfileRuntime(asm_out);
+  }
+
+  // Summary of what is not emitted.
+  if (!dropped_symbols.empty()) {
+    asm_out << std::endl << "# Not emitted:" << std::endl;
+    for (const std::string& dropped_symbol : dropped_symbols) {
+      asm_out << "# - " << dropped_symbol << std::endl;
+      if (compiler_options.opt_report) {
+        std::cerr << "not emitted " << dropped_symbol << std::endl;
+      }
     }
   }
 }
 
 int compile(const std::string& source_file_name,
-            const std::string& destination_file_name) {
+            const std::string& destination_file_name,
+            const CompilerOptions& options) {
+  compiler_options = options;
+  if (compiler_options.profile_generate &&
+      compiler_options.profile_generate_file.empty()) {
+    // e.g. dir/prog.c gives dir/prog.profile.
+    size_t extension = source_file_name.rfind('.');
+    if (extension == std::string::npos ||
+        source_file_name.find('/', extension) != std::string::npos) {
+      extension = source_file_name.size();
+    }
+    compiler_options.profile_generate_file =
+      source_file_name.substr(0, extension) + ".profile";
+  }
+
   FILE* file_in;
   if (!(file_in = fopen(source_file_name.c_str(), "r"))) {
     std::cerr << "Cannot open source file: '" << source_file_name << "'." << std::endl;
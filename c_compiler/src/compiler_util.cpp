@@ -1,5 +1,9 @@
 #include "../inc/compiler_util.hpp"
 
+#include <algorithm>
+#include <climits>
+#include <fstream>
+
 // CompilerUtil.
 
 unsigned int unique_id_counter = 0;
@@ -19,20 +23,35 @@ int CompilerUtil::countBytesForDeclarationsInFunction(const Node* ast_node) {
   }
   
   else if (node_type == "StatementListNode") {
+    // The variables declared in the list live until its end, while the ones declared in
+    // a nested statement are freed at its end (see FunctionContext::removeScope): the
+    // nested statements reuse the same space, so only the largest one counts.
+    int declared_bytes = 0;
+    int nested_bytes = 0;
     const StatementListNode* statement_list_node =
       dynamic_cast<const StatementListNode*>(ast_node);
-    if(statement_list_node->isEmptyStatementList()) {
-      return 0;
-    } else if (!statement_list_node->hasNextStatement()) {
-      return countBytesForDeclarationsInFunction(statement_list_node->getStatement());
-    } else if (statement_list_node->hasNextStatement()) {
-      return countBytesForDeclarationsInFunction(statement_list_node->getStatement()) +
-             countBytesForDeclarationsInFunction(statement_list_node->getNextStatement());
+    while (statement_list_node != nullptr && !statement_list_node->isEmptyStatementList()) {
+      const Node* statement = statement_list_node->getStatement();
+      const int bytes = countBytesForDeclarationsInFunction(statement);
+      // A switch has no scope of its own, its variables live until the end of the list.
+      if (statement->getType() == "DeclarationExpressionList" ||
+          statement->getType() == "SwitchStatement") {
+        declared_bytes += bytes;
+      } else {
+        nested_bytes = std::max(nested_bytes, bytes);
+      }
+      statement_list_node = statement_list_node->hasNextStatement() ?
+        dynamic_cast<const StatementListNode*>(statement_list_node->getNextStatement()) :
+        nullptr;
     }
+    return declared_bytes + nested_bytes;
   }
   else if (node_type == "CompoundStatement") {
     const CompoundStatement* compound_statement =
       dynamic_cast<const CompoundStatement*>(ast_node);
+    if (!compound_statement->hasStatementList()) {
+      return 0;
+    }
     return countBytesForDeclarationsInFunction(compound_statement->getStatementList());
   }
 
@@ -41,16 +60,33 @@ int CompilerUtil::countBytesForDeclarationsInFunction(const Node* ast_node) {
       dynamic_cast<const WhileStatement*>(ast_node)->getBody());
   }
 
+  else if(node_type == "ForStatement") {
+    const ForStatement* for_statement = dynamic_cast<const ForStatement*>(ast_node);
+    return countBytesForDeclarationsInFunction(for_statement->getInit()) +
+           countBytesForDeclarationsInFunction(for_statement->getBody());
+  }
+
   else if(node_type == "IfStatement") {
+    // The if and else bodies are separate scopes, they share the same space.
     const IfStatement* if_statement = dynamic_cast<const IfStatement*>(ast_node);
     if (!if_statement->hasElseBody()) {
       return countBytesForDeclarationsInFunction(if_statement->getIfBody());
     } else {
-      return countBytesForDeclarationsInFunction(if_statement->getIfBody()) +
-             countBytesForDeclarationsInFunction(if_statement->getElseBody());
+      return std::max(countBytesForDeclarationsInFunction(if_statement->getIfBody()),
+                      countBytesForDeclarationsInFunction(if_statement->getElseBody()));
     }
   }
 
+  else if (node_type == "SwitchStatement" || node_type == "CaseStatementListNode" ||
+           node_type == "CaseStatement" || node_type == "DefaultStatement") {
+    // The cases are in the scope of the switch, their variables add up.
+    int total_bytes = 0;
+    for (const Node* child : getChildren(ast_node)) {
+      total_bytes += countBytesForDeclarationsInFunction(child);
+    }
+    return total_bytes;
+  }
+
   else if(node_type == "DeclarationExpressionList") {
     const DeclarationExpressionList* declaration_expression_list =
       dynamic_cast<const DeclarationExpressionList*>(ast_node);
@@ -151,6 +187,12 @@ int CompilerUtil::evaluateConstantExpression(const Node* expr) {
     return integer_constant->getValue();
   }
 
+  else if (expr->getType() == "Variable") {
+    // Enumerator or read only global variable.
+    const Variable* variable = dynamic_cast<const Variable*>(expr);
+    return compile_time_constants.getValueOfConstant(variable->getId());
+  }
+
   // Recursive cases.
   else if (expr->getType() == "UnaryExpression") {
     const UnaryExpression* unary_expression = dynamic_cast<const UnaryExpression*>(expr);
@@ -325,6 +367,20 @@ int CompilerUtil::evaluateConstantExpression(const Node* expr) {
     return cond ? expr1 : expr2;
   }
 
+  else if (expr->getType() == "FunctionCall") {
+    // Call to a pure function with constant arguments.
+    int result;
+    if (!pure_function_evaluator.evaluateCall(dynamic_cast<const FunctionCall*>(expr),
+                                              result)) {
+      if (Util::DEBUG) {
+        std::cerr << "Function call that cannot be evaluated at compile time: "
+                  << dynamic_cast<const FunctionCall*>(expr)->getFunctionId() << std::endl;
+      }
+      Util::abort();
+    }
+    return result;
+  }
+
   // Unknown or unexpected node.
   else {
     if (Util::DEBUG) {
@@ -335,12 +391,319 @@ int CompilerUtil::evaluateConstantExpression(const Node* expr) {
   }
 }
 
+bool CompilerUtil::isConstantExpression(const Node* expr) {
+  if (expr == nullptr) {
+    return false;
+  }
+  const std::string& type = expr->getType();
+  if (type == "IntegerConstant") {
+    return true;
+  }
+  else if (type == "Variable") {
+    const Variable* variable = dynamic_cast<const Variable*>(expr);
+    return variable->getInfo() == "normal" && compile_time_constants.isConstant(variable->getId());
+  }
+  else if (type == "UnaryExpression") {
+    const UnaryExpression* unary_expression = dynamic_cast<const UnaryExpression*>(expr);
+    const std::string& unary_type = unary_expression->getUnaryType();
+    return (unary_type == "-" || unary_type == "~" || unary_type == "!") &&
+           isConstantExpression(unary_expression->getUnaryExpression());
+  }
+  else if (type == "MultiplicativeExpression") {
+    const MultiplicativeExpression* multiplicative_expression =
+      dynamic_cast<const MultiplicativeExpression*>(expr);
+    if (!isConstantExpression(multiplicative_expression->getLhs()) ||
+        !isConstantExpression(multiplicative_expression->getRhs())) {
+      return false;
+    }
+    // Division by zero is left to run time.
+    return multiplicative_expression->getMultiplicativeType() == "*" ||
+           evaluateConstantExpression(multiplicative_expression->getRhs()) != 0;
+  }
+  else if (type == "AdditiveExpression" || type == "ShiftExpression" ||
+           type == "RelationalExpression" || type == "EqualityExpression" ||
+           type == "AndExpression" || type == "ExclusiveOrExpression" ||
+           type == "InclusiveOrExpression" || type == "LogicalAndExpression" ||
+           type == "LogicalOrExpression" || type == "ConditionalExpression") {
+    for (const Node* child : getChildren(expr)) {
+      if (!isConstantExpression(child)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  else if (type == "FunctionCall") {
+    int result;
+    return pure_function_evaluator.evaluateCall(dynamic_cast<const FunctionCall*>(expr),
+                                                result);
+  }
+  return false;
+}
+
+std::vector<const Node*> CompilerUtil::getChildren(const Node* ast_node) {
+  std::vector<const Node*> children;
+  const std::string& node_type = ast_node->getType();
+
+  if (node_type == "StatementListNode") {
+    const StatementListNode* node = dynamic_cast<const StatementListNode*>(ast_node);
+    children = {node->getStatement(), node->getNextStatement()};
+  }
+  else if (node_type == "CompoundStatement") {
+    children = {dynamic_cast<const CompoundStatement*>(ast_node)->getStatementList()};
+  }
+  else if (node_type == "ReturnStatement") {
+    children = {dynamic_cast<const ReturnStatement*>(ast_node)->getExpression()};
+  }
+  else if (node_type == "WhileStatement") {
+    const WhileStatement* node = dynamic_cast<const WhileStatement*>(ast_node);
+    children = {node->getCondition(), node->getBody()};
+  }
+  else if (node_type == "ForStatement") {
+    const ForStatement* node = dynamic_cast<const ForStatement*>(ast_node);
+    children = {node->getInit(), node->getCondition(), node->getBody(),
+                node->getIncrement()};
+  }
+  else if (node_type == "IfStatement") {
+    const IfStatement* node = dynamic_cast<const IfStatement*>(ast_node);
+    children = {node->getCondition(), node->getIfBody()};
+    if (node->hasElseBody()) {
+      children.push_back(node->getElseBody());
+    }
+  }
+  else if (node_type == "SwitchStatement") {
+    const SwitchStatement* node = dynamic_cast<const SwitchStatement*>(ast_node);
+    children = {node->getTest(), node->getBody()};
+  }
+  else if (node_type == "CaseStatementListNode") {
+    const CaseStatementListNode* node = dynamic_cast<const CaseStatementListNode*>(ast_node);
+    children = {node->getCaseStatement(), node->getNextCaseStatement()};
+  }
+  else if (node_type == "CaseStatement") {
+    const CaseStatement* node = dynamic_cast<const CaseStatement*>(ast_node);
+    children = {node->getCaseExpr(), node->getBody()};
+  }
+  else if (node_type == "DefaultStatement") {
+    children = {dynamic_cast<const DefaultStatement*>(ast_node)->getBody()};
+  }
+  else if (node_type == "Variable") {
+    const Variable* node = dynamic_cast<const Variable*>(ast_node);
+    if (node->hasArrayIndexOrSize()) {
+      children = {node->getArrayIndexOrSize()};
+    }
+  }
+  else if (node_type == "EnumDeclarationListNode") {
+    const EnumDeclarationListNode* node =
+      dynamic_cast<const EnumDeclarationListNode*>(ast_node);
+    children = {node->getEnumDeclaration(), node->getNextEnumDeclaration()};
+  }
+  else if (node_type == "EnumDeclaration") {
+    children = {dynamic_cast<const EnumDeclaration*>(ast_node)->getInitializationValue()};
+  }
+  else if (node_type == "FunctionDeclaration") {
+    const FunctionDeclaration* node = dynamic_cast<const FunctionDeclaration*>(ast_node);
+    children = {node->getName(), node->getArgumentList()};
+  }
+  else if (node_type == "FunctionDefinition") {
+    const FunctionDefinition* node = dynamic_cast<const FunctionDefinition*>(ast_node);
+    children = {node->getName(), node->getArgumentList(), node->getBody()};
+  }
+  else if (node_type == "ArgumentListNode") {
+    const ArgumentListNode* node = dynamic_cast<const ArgumentListNode*>(ast_node);
+    children = {node->getArgument(), node->getNextArgument()};
+  }
+  else if (node_type == "FunctionCall") {
+    children = {dynamic_cast<const FunctionCall*>(ast_node)->getParametersList()};
+  }
+  else if (node_type == "ParametersListNode") {
+    const ParametersListNode* node = dynamic_cast<const ParametersListNode*>(ast_node);
+    children = {node->getParameter(), node->getNextParameter()};
+  }
+  else if (node_type == "DeclarationExpressionList") {
+    children = {
+      dynamic_cast<const DeclarationExpressionList*>(ast_node)->getDeclarationList()};
+  }
+  else if (node_type == "DeclarationExpressionListNode") {
+    const DeclarationExpressionListNode* node =
+      dynamic_cast<const DeclarationExpressionListNode*>(ast_node);
+    children = {node->getVariable(), node->getRhs(), node->getNext()};
+  }
+  else if (node_type == "PostfixExpression") {
+    children = {dynamic_cast<const PostfixExpression*>(ast_node)->getPostfixExpression()};
+  }
+  else if (node_type == "UnaryExpression") {
+    children = {dynamic_cast<const UnaryExpression*>(ast_node)->getUnaryExpression()};
+  }
+  else if (node_type == "MultiplicativeExpression") {
+    const MultiplicativeExpression* node =
+      dynamic_cast<const MultiplicativeExpression*>(ast_node);
+    children = {node->getLhs(), node->getRhs()};
+  }
+  else if (node_type == "AdditiveExpression") {
+    const AdditiveExpression* node = dynamic_cast<const AdditiveExpression*>(ast_node);
+    children = {node->getLhs(), node->getRhs()};
+  }
+  else if (node_type == "ShiftExpression") {
+    const ShiftExpression* node = dynamic_cast<const ShiftExpression*>(ast_node);
+    children = {node->getLhs(), node->getRhs()};
+  }
+  else if (node_type == "RelationalExpression") {
+    const RelationalExpression* node = dynamic_cast<const RelationalExpression*>(ast_node);
+    children = {node->getLhs(), node->getRhs()};
+  }
+  else if (node_type == "EqualityExpression") {
+    const EqualityExpression* node = dynamic_cast<const EqualityExpression*>(ast_node);
+    children = {node->getLhs(), node->getRhs()};
+  }
+  else if (node_type == "AndExpression") {
+    const AndExpression* node = dynamic_cast<const AndExpression*>(ast_node);
+    children = {node->getLhs(), node->getRhs()};
+  }
+  else if (node_type == "ExclusiveOrExpression") {
+    const ExclusiveOrExpression* node =
+      dynamic_cast<const ExclusiveOrExpression*>(ast_node);
+    children = {node->getLhs(), node->getRhs()};
+  }
+  else if (node_type == "InclusiveOrExpression") {
+    const InclusiveOrExpression* node =
+      dynamic_cast<const InclusiveOrExpression*>(ast_node);
+    children = {node->getLhs(), node->getRhs()};
+  }
+  else if (node_type == "LogicalAndExpression") {
+    const LogicalAndExpression* node = dynamic_cast<const LogicalAndExpression*>(ast_node);
+    children = {node->getLhs(), node->getRhs()};
+  }
+  else if (node_type == "LogicalOrExpression") {
+    const LogicalOrExpression* node = dynamic_cast<const LogicalOrExpression*>(ast_node);
+    children = {node->getLhs(), node->getRhs()};
+  }
+  else if (node_type == "ConditionalExpression") {
+    const ConditionalExpression* node =
+      dynamic_cast<const ConditionalExpression*>(ast_node);
+    children = {node->getCondition(), node->getExpression1(), node->getExpression2()};
+  }
+  else if (node_type == "AssignmentExpression") {
+    const AssignmentExpression* node = dynamic_cast<const AssignmentExpression*>(ast_node);
+    children = {node->getVariable(), node->getRhs()};
+  }
+
+  // Optional children are null when missing.
+  children.erase(std::remove(children.begin(), children.end(), nullptr), children.end());
+  return children;
+}
+
+bool CompilerUtil::containsFunctionCall(const Node* ast_node) {
+  if (ast_node->getType() == "FunctionCall") {
+    return true;
+  }
+  for (const Node* child : getChildren(ast_node)) {
+    if (containsFunctionCall(child)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void CompilerUtil::collectWrittenVariables(const Node* ast_node,
+                                           std::unordered_set<std::string>& ids) {
+  const Node* written = nullptr;
+  if (ast_node->getType() == "AssignmentExpression") {
+    written = dynamic_cast<const AssignmentExpression*>(ast_node)->getVariable();
+  }
+  else if (ast_node->getType() == "DeclarationExpressionListNode") {
+    written = dynamic_cast<const DeclarationExpressionListNode*>(ast_node)->getVariable();
+  }
+  else if (ast_node->getType() == "PostfixExpression") {
+    written = dynamic_cast<const PostfixExpression*>(ast_node)->getPostfixExpression();
+  }
+  else if (ast_node->getType() == "UnaryExpression") {
+    const UnaryExpression* unary_expression =
+      dynamic_cast<const UnaryExpression*>(ast_node);
+    const std::string& unary_type = unary_expression->getUnaryType();
+    if (unary_type == "++" || unary_type == "--" || unary_type == "&") {
+      written = unary_expression->getUnaryExpression();
+    }
+  }
+  if (written != nullptr && written->getType() == "Variable") {
+    ids.insert(dynamic_cast<const Variable*>(written)->getId());
+  }
+
+  for (const Node* child : getChildren(ast_node)) {
+    collectWrittenVariables(child, ids);
+  }
+}
+
+void CompilerUtil::countVariableReferences(
+  const Node* ast_node, std::unordered_map<std::string, int>& references) {
+  if (ast_node->getType() == "Variable") {
+    references[dynamic_cast<const Variable*>(ast_node)->getId()]++;
+  }
+  for (const Node* child : getChildren(ast_node)) {
+    countVariableReferences(child, references);
+  }
+}
+
+void CompilerUtil::collectAddressTakenVariables(const Node* ast_node,
+                                                std::unordered_set<std::string>& ids) {
+  if (ast_node->getType() == "UnaryExpression") {
+    const UnaryExpression* unary_expression =
+      dynamic_cast<const UnaryExpression*>(ast_node);
+    const Node* operand = unary_expression->getUnaryExpression();
+    if (unary_expression->getUnaryType() == "&" && operand->getType() == "Variable") {
+      ids.insert(dynamic_cast<const Variable*>(operand)->getId());
+    }
+  }
+  for (const Node* child : getChildren(ast_node)) {
+    collectAddressTakenVariables(child, ids);
+  }
+}
+
+int CompilerUtil::countNodes(const Node* ast_node) {
+  int count = 1;
+  for (const Node* child : getChildren(ast_node)) {
+    count += countNodes(child);
+  }
+  return count;
+}
+
+void CompilerUtil::collectFunctionCalls(const Node* ast_node,
+                                        std::vector<std::string>& ids) {
+  if (ast_node->getType() == "FunctionCall") {
+    ids.push_back(dynamic_cast<const FunctionCall*>(ast_node)->getFunctionId());
+  }
+  for (const Node* child : getChildren(ast_node)) {
+    collectFunctionCalls(child, ids);
+  }
+}
+
+bool CompilerUtil::containsNodeOfType(const Node* ast_node, const std::string& type) {
+  if (ast_node->getType() == type) {
+    return true;
+  }
+  for (const Node* child : getChildren(ast_node)) {
+    if (containsNodeOfType(child, type)) {
+      return true;
+    }
+  }
+  return false;
+}
+
 // RegisterAllocator.
 
 RegisterAllocator::RegisterAllocator() {
   tmp_reg_used_ = std::vector<bool>(tmp_reg_size_, false);
 }
 
+RegisterAllocator RegisterAllocator::makeTrial() const {
+  RegisterAllocator register_allocator;
+  register_allocator.tmp_reg_used_ = tmp_reg_used_;
+  register_allocator.is_trial_ = true;
+  return register_allocator;
+}
+
+void RegisterAllocator::commitTrial(const RegisterAllocator& trial) {
+  tmp_reg_used_ = trial.tmp_reg_used_;
+}
+
 std::string RegisterAllocator::requestFreeRegister() {
   for (int i = 0; i < tmp_reg_size_; i++) {
     if (!tmp_reg_used_[i]) {
@@ -348,6 +711,10 @@ std::string RegisterAllocator::requestFreeRegister() {
       return "$t" + std::to_string(i); 
     }
   }
+  if (is_trial_) {
+    is_exhausted_ = true;
+    return "$t" + std::to_string(tmp_reg_size_ - 1);
+  }
   if (Util::DEBUG) {
     std::cerr << "No more temporary registers available." << std::endl;
   }
@@ -364,6 +731,9 @@ void RegisterAllocator::freeRegister(const std::string& reg) {
   }
 
   if(!tmp_reg_used_[reg_id]) {
+    if (is_trial_) {
+      return;
+    }
     if (Util::DEBUG) {
       std::cerr << "Trying to free an unused register: " << reg << std::endl;
     }
@@ -383,15 +753,49 @@ std::vector<std::string> RegisterAllocator::getTemporaryRegistersInUse() {
   return used_registers;
 }
 
+int RegisterAllocator::countFreeRegisters() const {
+  return std::count(tmp_reg_used_.begin(), tmp_reg_used_.end(), false);
+}
+
+bool RegisterAllocator::isExhausted() const {
+  return is_exhausted_;
+}
+
 // FunctionContext.
 
-FunctionContext::FunctionContext(int frame_size, const std::string& function_epilogue_label)
-  : frame_size_(frame_size), function_epilogue_label_(function_epilogue_label) {}
+FunctionContext::FunctionContext(int frame_size, const std::string& function_epilogue_label,
+                                 const std::string& frame_register)
+  : function_epilogue_label_(function_epilogue_label),
+    tail_call_label_(function_epilogue_label + "_tail_call"),
+    tail_recursion_label_(function_epilogue_label + "_tail_recursion"),
+    frame_register_(frame_register), frame_size_(frame_size) {
+  spill_area_offset_ = frame_size_ - 2 * word_length_ - spill_area_size_;
+}
 
 const std::string& FunctionContext::getFunctionEpilogueLabel() const {
   return function_epilogue_label_;
 }
 
+const std::string& FunctionContext::getTailCallLabel() const {
+  return tail_call_label_;
+}
+
+const std::string& FunctionContext::getTailRecursionLabel() const {
+  return tail_recursion_label_;
+}
+
+const std::string& FunctionContext::getFrameRegister() const {
+  return frame_register_;
+}
+
+int FunctionContext::getFrameSize() const {
+  return frame_size_;
+}
+
+bool FunctionContext::isFramePointerOmitted() const {
+  return frame_register_ == "$sp";
+}
+
 int FunctionContext::placeVariableInStack(const std::string& var_name, 
                                           const std::string& scope_id,
                                           const bool& is_declaration) {
@@ -408,7 +812,7 @@ int FunctionContext::placeVariableInStack(const std::string& var_name,
       return variable_to_offset_in_stack_frame_[var_scope];
     }
 
-    for (int i = call_arguments_size_; i < frame_size_ - 2 * word_length_;
+    for (int i = call_arguments_size_; i < spill_area_offset_;
          i += word_length_) {
       // Check if the current place is already used (already placed in the map).
       if (offset_in_stack_frame_to_variable_.find(i) ==
@@ -429,7 +833,7 @@ int FunctionContext::placeVariableInStack(const std::string& var_name,
   }
   // An Assignment.
   else {
-    for (int i = scopes_list_.size() - 1; i >= 0; i--){
+    for (int i = scopes_list_.size() - 1; i >= getFirstVisibleScope(); i--){
       std::pair<std::string, std::string> var_scope(var_name, scopes_list_[i]);
 
       if (variable_to_offset_in_stack_frame_.find(var_scope) !=
@@ -445,7 +849,7 @@ int FunctionContext::placeVariableInStack(const std::string& var_name,
 }
 
 int FunctionContext::getOffsetForVariable(const std::string& var_name) {
-  for(int i = scopes_list_.size() - 1; i >= 0; i--){
+  for(int i = scopes_list_.size() - 1; i >= getFirstVisibleScope(); i--){
     std::pair<std::string, std::string> var_scope = {var_name, scopes_list_[i]};
     if (variable_to_offset_in_stack_frame_.find(var_scope) !=
         variable_to_offset_in_stack_frame_.end()) {
@@ -493,7 +897,7 @@ void FunctionContext::reserveSpaceForArray(const std::string& array_name, int si
 
   // Look for a free space to reserve for the array.
   int start_index = -1;
-  for (int i = call_arguments_size_; i < frame_size_ - 2 * word_length_;
+  for (int i = call_arguments_size_; i < spill_area_offset_;
         i += word_length_) {
     // Check if the current place is already used (already placed in the map).
     if (offset_in_stack_frame_to_variable_.find(i) ==
@@ -507,7 +911,7 @@ void FunctionContext::reserveSpaceForArray(const std::string& array_name, int si
   // Place the array in memory.
   int position = 0;
   for (int i = start_index; position < size; i += word_length_) {
-    if (i >= frame_size_ - 2 * word_length_) {
+    if (i >= spill_area_offset_) {
       if (Util::DEBUG) {
         std::cerr << "Not enough space in stack frame to allocate array: " << array_name
                   << "." << std::endl;
@@ -524,6 +928,7 @@ void FunctionContext::reserveSpaceForArray(const std::string& array_name, int si
       Util::abort();
     }
     
+    array_offsets_.insert(i);
     std::pair<std::string, std::string> array_scope =
       {array_name + "@" + std::to_string(position), scope_id};
     variable_to_offset_in_stack_frame_.insert(
@@ -543,7 +948,7 @@ void FunctionContext::reserveSpaceForArray(const std::string& array_name, int si
 }
 
 int FunctionContext::getBaseOffsetForArray(const std::string& array_name) {
-  for(int i = scopes_list_.size() - 1; i >= 0; i--){
+  for(int i = scopes_list_.size() - 1; i >= getFirstVisibleScope(); i--){
     std::string array_base_name = array_name + "@0";
     std::pair<std::string, std::string> array_scope = {array_base_name, scopes_list_[i]};
     if (variable_to_offset_in_stack_frame_.find(array_scope) !=
@@ -629,12 +1034,98 @@ void FunctionContext::insertScope(const std::string& scope_id){
 }
 
 void FunctionContext::removeScope(){
+  const std::string& scope_id = scopes_list_.back();
+  for (auto it = offset_in_stack_frame_to_variable_.begin();
+       it != offset_in_stack_frame_to_variable_.end();) {
+    if (it->second.second == scope_id) {
+      it = offset_in_stack_frame_to_variable_.erase(it);
+    } else {
+      it++;
+    }
+  }
+  for (auto it = variable_to_offset_in_stack_frame_.begin();
+       it != variable_to_offset_in_stack_frame_.end();) {
+    if (it->first.second == scope_id) {
+      it = variable_to_offset_in_stack_frame_.erase(it);
+    } else {
+      it++;
+    }
+  }
   scopes_list_.pop_back();
 }
 
+int FunctionContext::getFirstVisibleScope() const {
+  for (auto it = inlined_calls_.rbegin(); it != inlined_calls_.rend(); it++) {
+    if (it->first_scope >= 0) {
+      return it->first_scope;
+    }
+  }
+  return 0;
+}
+
+void FunctionContext::insertInlinedCall(const std::string& return_label,
+                                        const std::string& return_register) {
+  InlinedCall inlined_call;
+  inlined_call.first_scope = -1;
+  inlined_call.return_label = return_label;
+  inlined_call.return_register = return_register;
+  for (const auto& offset_to_variable : offset_in_stack_frame_to_variable_) {
+    inlined_call.used_offsets.insert(offset_to_variable.first);
+  }
+  inlined_calls_.push_back(inlined_call);
+}
+
+void FunctionContext::insertInlinedCallScope(const std::string& scope_id) {
+  inlined_calls_.back().first_scope = scopes_list_.size();
+  insertScope(scope_id);
+}
+
+void FunctionContext::removeInlinedCall() {
+  const InlinedCall& inlined_call = inlined_calls_.back();
+  if (inlined_call.first_scope >= 0) {
+    removeScope();
+  }
+  for (auto it = offset_in_stack_frame_to_variable_.begin();
+       it != offset_in_stack_frame_to_variable_.end();) {
+    if (inlined_call.used_offsets.count(it->first) == 0) {
+      variable_to_offset_in_stack_frame_.erase(it->second);
+      it = offset_in_stack_frame_to_variable_.erase(it);
+    } else {
+      it++;
+    }
+  }
+  inlined_calls_.pop_back();
+}
+
+bool FunctionContext::isCompilingInlinedCall() const {
+  return !inlined_calls_.empty();
+}
+
+const std::string& FunctionContext::getInlinedReturnLabel() const {
+  if (inlined_calls_.empty()) {
+    if (Util::DEBUG) {
+      std::cerr << "Requesting the return label when not inside an inlined call."
+                << std::endl;
+    }
+    Util::abort();
+  }
+  return inlined_calls_.back().return_label;
+}
+
+const std::string& FunctionContext::getInlinedReturnRegister() const {
+  if (inlined_calls_.empty()) {
+    if (Util::DEBUG) {
+      std::cerr << "Requesting the return register when not inside an inlined call."
+                << std::endl;
+    }
+    Util::abort();
+  }
+  return inlined_calls_.back().return_register;
+}
+
 bool FunctionContext::isLocalVariable(const std::string& id) {
-  for (std::string scope : scopes_list_) {
-    std::pair<std::string, std::string> key(id, scope);
+  for (int i = scopes_list_.size() - 1; i >= getFirstVisibleScope(); i--) {
+    std::pair<std::string, std::string> key(id, scopes_list_[i]);
     if (variable_to_offset_in_stack_frame_.find(key) !=
         variable_to_offset_in_stack_frame_.end()) {
       return true;
@@ -643,10 +1134,55 @@ bool FunctionContext::isLocalVariable(const std::string& id) {
   return false;
 }
 
+int FunctionContext::getSpillOffsetForRegister(const std::string& reg) const {
+  if (reg.size() != 3 || reg.substr(0, 2) != "$t" || reg[2] < '0' || reg[2] > '7') {
+    if (Util::DEBUG) {
+      std::cerr << "No spill slot for register: " << reg << "." << std::endl;
+    }
+    Util::abort();
+  }
+  return spill_area_offset_ + std::stoi(reg.substr(2, 1)) * word_length_;
+}
+
+bool FunctionContext::isSpillOffset(int offset) const {
+  return offset >= spill_area_offset_ && offset < spill_area_offset_ + spill_area_size_;
+}
+
+bool FunctionContext::isScalarVariableOffset(int offset) const {
+  return offset >= call_arguments_size_ && offset < spill_area_offset_ &&
+         offset % word_length_ == 0 && array_offsets_.count(offset) == 0;
+}
+
+std::vector<std::string> FunctionContext::getSpillRegisters() const {
+  std::vector<std::string> spill_registers;
+  for (int i = 0; i < spill_area_size_ / word_length_; i++) {
+    spill_registers.push_back("$t" + std::to_string(i));
+  }
+  return spill_registers;
+}
+
+void FunctionContext::addCalleeSavedRegister(const std::string& reg, int offset) {
+  callee_saved_registers_.push_back({reg, offset});
+}
+
+const std::vector<std::pair<std::string, int>>&
+FunctionContext::getCalleeSavedRegisters() const {
+  return callee_saved_registers_;
+}
+
+void FunctionContext::addOutOfLineCode(const std::string& code) {
+  out_of_line_code_ += code;
+}
+
+const std::string& FunctionContext::getOutOfLineCode() const {
+  return out_of_line_code_;
+}
+
 // GlobalVariables.
 
 void GlobalVariables::addNewGlobalVariable(const std::string& id,
-                                           const std::string& info) {
+                                           const std::string& info,
+                                           int size_in_bytes) {
   if (id_to_info_.find(id) != id_to_info_.end()) {
     if (Util::DEBUG) {
       std::cerr << "Redeclaration of global variable: " << id << "." << std::endl;
@@ -655,12 +1191,26 @@ void GlobalVariables::addNewGlobalVariable(const std::string& id,
   }
 
   id_to_info_.insert(std::pair<std::string, std::string>(id, info));
+  id_to_size_.insert(std::pair<std::string, int>(id, size_in_bytes));
 }
 
 bool GlobalVariables::isGlobalVariable(const std::string& id) const {
   return id_to_info_.find(id) != id_to_info_.end();
 }
 
+void GlobalVariables::markReadOnly(const std::string& id) {
+  read_only_ids_.insert(id);
+}
+
+bool GlobalVariables::isReadOnly(const std::string& id) const {
+  return read_only_ids_.find(id) != read_only_ids_.end();
+}
+
+bool GlobalVariables::isSmallData(const std::string& id) const {
+  auto it = id_to_size_.find(id);
+  return it != id_to_size_.end() && it->second <= SMALL_DATA_MAX_SIZE && !isReadOnly(id);
+}
+
 const std::string& GlobalVariables::getInfoForVariable(const std::string& id) const {
   if (!isGlobalVariable(id)) {
     if (Util::DEBUG) {
@@ -681,6 +1231,981 @@ const std::vector<std::string> GlobalVariables::getAllGlobalVariableIds() const
   return ids;
 }
 
+// CompileTimeConstants.
+
+CompileTimeConstants compile_time_constants;
+
+void CompileTimeConstants::addNewConstant(const std::string& id, int value) {
+  if (isConstant(id)) {
+    if (Util::DEBUG) {
+      std::cerr << "Redeclaration of constant: " << id << "." << std::endl;
+    }
+    Util::abort();
+  }
+
+  id_to_value_.insert(std::pair<std::string, int>(id, value));
+}
+
+void CompileTimeConstants::removeConstant(const std::string& id) {
+  if (!isConstant(id)) {
+    if (Util::DEBUG) {
+      std::cerr << "Id " << id << " does not match any constant." << std::endl;
+    }
+    Util::abort();
+  }
+
+  id_to_value_.erase(id);
+}
+
+bool CompileTimeConstants::isConstant(const std::string& id) const {
+  return id_to_value_.find(id) != id_to_value_.end();
+}
+
+int CompileTimeConstants::getValueOfConstant(const std::string& id) const {
+  if (!isConstant(id)) {
+    if (Util::DEBUG) {
+      std::cerr << "Id " << id << " does not match any constant." << std::endl;
+    }
+    Util::abort();
+  }
+
+  return id_to_value_.at(id);
+}
+
+// CallGraph.
+
+CallGraph call_graph;
+
+void CallGraph::addFunctionDefinition(const FunctionDefinition* function_definition) {
+  const std::string& id =
+    dynamic_cast<const Variable*>(function_definition->getName())->getId();
+  id_to_definition_[id] = function_definition;
+  std::vector<std::string>& callees = id_to_callees_[id];
+  CompilerUtil::collectFunctionCalls(function_definition->getBody(), callees);
+  for (const std::string& callee : callees) {
+    id_to_calls_[callee]++;
+  }
+}
+
+void CallGraph::findRecursiveFunctions() {
+  for (const auto& id_to_definition : id_to_definition_) {
+    const std::string& id = id_to_definition.first;
+    // Look for a path from the function back to itself.
+    std::unordered_set<std::string> visited;
+    std::vector<std::string> to_visit = id_to_callees_[id];
+    while (!to_visit.empty()) {
+      std::string callee = to_visit.back();
+      to_visit.pop_back();
+      if (callee == id) {
+        recursive_ids_.insert(id);
+        break;
+      }
+      if (!visited.insert(callee).second) {
+        continue;
+      }
+      const std::vector<std::string>& next_callees = id_to_callees_[callee];
+      to_visit.insert(to_visit.end(), next_callees.begin(), next_callees.end());
+    }
+  }
+}
+
+const FunctionDefinition* CallGraph::getFunctionDefinition(const std::string& id) const {
+  auto it = id_to_definition_.find(id);
+  return it == id_to_definition_.end() ? nullptr : it->second;
+}
+
+bool CallGraph::isRecursive(const std::string& id) const {
+  return recursive_ids_.find(id) != recursive_ids_.end();
+}
+
+int CallGraph::countCalls(const std::string& id) const {
+  auto it = id_to_calls_.find(id);
+  return it == id_to_calls_.end() ? 0 : it->second;
+}
+
+const std::vector<std::string>& CallGraph::getCallees(const std::string& id) const {
+  static const std::vector<std::string> no_callees;
+  auto it = id_to_callees_.find(id);
+  return it == id_to_callees_.end() ? no_callees : it->second;
+}
+
+// ModRefSummaries.
+
+ModRefSummaries mod_ref_summaries;
+
+namespace {
+
+// Collect the ids of the variables declared in the subtree, e.g. the locals of a function.
+void collectDeclaredVariables(const Node* ast_node, std::unordered_set<std::string>& ids) {
+  if (ast_node->getType() == "DeclarationExpressionListNode") {
+    const Node* variable =
+      dynamic_cast<const DeclarationExpressionListNode*>(ast_node)->getVariable();
+    if (variable != nullptr && variable->getType() == "Variable") {
+      ids.insert(dynamic_cast<const Variable*>(variable)->getId());
+    }
+  }
+  for (const Node* child : CompilerUtil::getChildren(ast_node)) {
+    collectDeclaredVariables(child, ids);
+  }
+}
+
+// Memory accessed through pointers in the subtree: a dereference (*p), or an element of
+// an array that is not a global array (a local array, or a pointer indexed as an array).
+void collectPointerAccesses(const Node* ast_node, const GlobalVariables& global_variables,
+                            const std::unordered_set<std::string>& local_ids,
+                            bool is_written, ModRefSummary& summary) {
+  if (ast_node->getType() == "Variable") {
+    const Variable* variable = dynamic_cast<const Variable*>(ast_node);
+    const std::string& id = variable->getId();
+    bool is_global_array = global_variables.isGlobalVariable(id) &&
+                           global_variables.getInfoForVariable(id) == "array" &&
+                           local_ids.count(id) == 0;
+    if (variable->getInfo() == "pointer" ||
+        (variable->getInfo() == "array" && !is_global_array)) {
+      summary.reads_through_pointers = true;
+      summary.writes_through_pointers = summary.writes_through_pointers || is_written;
+    }
+  }
+
+  const Node* written = nullptr;
+  if (ast_node->getType() == "AssignmentExpression") {
+    written = dynamic_cast<const AssignmentExpression*>(ast_node)->getVariable();
+  }
+  else if (ast_node->getType() == "PostfixExpression") {
+    written = dynamic_cast<const PostfixExpression*>(ast_node)->getPostfixExpression();
+  }
+  else if (ast_node->getType() == "UnaryExpression") {
+    const UnaryExpression* unary_expression =
+      dynamic_cast<const UnaryExpression*>(ast_node);
+    const std::string& unary_type = unary_expression->getUnaryType();
+    if (unary_type == "++" || unary_type == "--") {
+      written = unary_expression->getUnaryExpression();
+    }
+  }
+  // The declarator of a local (e.g. int *p) is not an access.
+  const Node* declared = ast_node->getType() == "DeclarationExpressionListNode" ?
+    dynamic_cast<const DeclarationExpressionListNode*>(ast_node)->getVariable() : nullptr;
+  for (const Node* child : CompilerUtil::getChildren(ast_node)) {
+    if (child != declared) {
+      collectPointerAccesses(child, global_variables, local_ids, child == written, summary);
+    }
+  }
+}
+
+} // namespace
+
+void ModRefSummaries::analyze(
+  const std::vector<const FunctionDefinition*>& function_definitions,
+  const GlobalVariables& global_variables, bool whole_program,
+  const std::vector<std::string>& exported_symbols) {
+  // A pointer may point to the global variables whose address is taken, to the global
+  // arrays named without an index, and to what other files can see.
+  all_globals_pointed_ = !whole_program;
+  pointed_globals_.insert(exported_symbols.begin(), exported_symbols.end());
+  for (const FunctionDefinition* function_definition : function_definitions) {
+    CompilerUtil::collectAddressTakenVariables(function_definition, pointed_globals_);
+    std::unordered_map<std::string, int> references;
+    CompilerUtil::countVariableReferences(function_definition, references);
+    for (const auto& reference : references) {
+      if (global_variables.isGlobalVariable(reference.first) &&
+          global_variables.getInfoForVariable(reference.first) == "array") {
+        pointed_globals_.insert(reference.first);
+      }
+    }
+  }
+
+  // Direct effects of each function.
+  for (const FunctionDefinition* function_definition : function_definitions) {
+    const std::string& id =
+      dynamic_cast<const Variable*>(function_definition->getName())->getId();
+    ModRefSummary& summary = id_to_summary_[id];
+    std::unordered_set<std::string> written;
+    CompilerUtil::collectWrittenVariables(function_definition->getBody(), written);
+    std::unordered_map<std::string, int> references;
+    CompilerUtil::countVariableReferences(function_definition->getBody(), references);
+    for (const std::string& written_id : written) {
+      if (global_variables.isGlobalVariable(written_id)) {
+        summary.written_globals.insert(written_id);
+      }
+    }
+    for (const auto& reference : references) {
+      if (global_variables.isGlobalVariable(reference.first)) {
+        summary.read_globals.insert(reference.first);
+      }
+    }
+    std::unordered_set<std::string> local_ids;
+    collectDeclaredVariables(function_definition, local_ids);
+    for (const std::string& argument_name :
+         CompilerUtil::getArgumentNamesFromFunctionDeclaration(
+           dynamic_cast<const ArgumentListNode*>(function_definition->getArgumentList()))) {
+      local_ids.insert(argument_name);
+    }
+    collectPointerAccesses(function_definition->getBody(), global_variables, local_ids,
+                           false, summary);
+    for (const std::string& callee : call_graph.getCallees(id)) {
+      if (call_graph.getFunctionDefinition(callee) == nullptr) {
+        summary.is_unknown = true;
+      }
+    }
+  }
+
+  // A function has the effects of its callees. Iterate until nothing changes, since the
+  // call graph may have cycles.
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto& id_to_summary : id_to_summary_) {
+      ModRefSummary& summary = id_to_summary.second;
+      for (const std::string& callee : call_graph.getCallees(id_to_summary.first)) {
+        auto callee_summary = id_to_summary_.find(callee);
+        if (callee_summary == id_to_summary_.end() || callee == id_to_summary.first) {
+          continue;
+        }
+        const ModRefSummary& effects = callee_summary->second;
+        size_t sizes = summary.read_globals.size() + summary.written_globals.size();
+        summary.read_globals.insert(effects.read_globals.begin(), effects.read_globals.end());
+        summary.written_globals.insert(effects.written_globals.begin(),
+                                       effects.written_globals.end());
+        if (sizes != summary.read_globals.size() + summary.written_globals.size() ||
+            (effects.reads_through_pointers && !summary.reads_through_pointers) ||
+            (effects.writes_through_pointers && !summary.writes_through_pointers) ||
+            (effects.is_unknown && !summary.is_unknown)) {
+          changed = true;
+        }
+        summary.reads_through_pointers =
+          summary.reads_through_pointers || effects.reads_through_pointers;
+        summary.writes_through_pointers =
+          summary.writes_through_pointers || effects.writes_through_pointers;
+        summary.is_unknown = summary.is_unknown || effects.is_unknown;
+      }
+    }
+  }
+}
+
+const ModRefSummary& ModRefSummaries::getSummary(const std::string& id) const {
+  static const ModRefSummary unknown = [] {
+    ModRefSummary summary;
+    summary.reads_through_pointers = true;
+    summary.writes_through_pointers = true;
+    summary.is_unknown = true;
+    return summary;
+  }();
+  auto it = id_to_summary_.find(id);
+  return it == id_to_summary_.end() ? unknown : it->second;
+}
+
+bool ModRefSummaries::mayPointTo(const std::string& global_id) const {
+  return all_globals_pointed_ || pointed_globals_.count(global_id) > 0;
+}
+
+void ModRefSummaries::addGlobalAccessedByAllFunctions(const std::string& global_id) {
+  for (auto& id_to_summary : id_to_summary_) {
+    id_to_summary.second.read_globals.insert(global_id);
+    id_to_summary.second.written_globals.insert(global_id);
+  }
+}
+
+// PureFunctionEvaluator.
+
+#define PURE_CALL_MAX_STEPS 1000000
+#define PURE_CALL_MAX_DEPTH 256
+
+PureFunctionEvaluator pure_function_evaluator;
+
+namespace {
+
+// Interpreter of the pure functions, on 32 bits integers with the semantics of the
+// generated code. Each call to execute or evaluate is a step of the budget.
+class PureFunctionInterpreter {
+ public:
+  // How a statement completes.
+  enum Flow { NEXT, BREAK, CONTINUE, RETURN, FAILURE };
+
+ private:
+  const PureFunctionEvaluator& evaluator_;
+  // Innermost scope last. A variable declared without a value is uninitialized.
+  std::vector<std::unordered_map<std::string, std::pair<bool, int>>> scopes_;
+  int return_value_ = 0;
+  int steps_ = 0;
+  int depth_ = 0;
+
+  bool isOverBudget() {
+    return ++steps_ > PURE_CALL_MAX_STEPS;
+  }
+
+  std::pair<bool, int>* findVariable(const std::string& id) {
+    for (auto scope = scopes_.rbegin(); scope != scopes_.rend(); scope++) {
+      auto variable = scope->find(id);
+      if (variable != scope->end()) {
+        return &variable->second;
+      }
+    }
+    return nullptr;
+  }
+
+  // The local variable written by an assignment or an increment.
+  std::pair<bool, int>* findWrittenVariable(const Node* expr) {
+    if (expr->getType() != "Variable" ||
+        dynamic_cast<const Variable*>(expr)->getInfo() != "normal") {
+      return nullptr;
+    }
+    return findVariable(dynamic_cast<const Variable*>(expr)->getId());
+  }
+
+  // Binary operation as computed by the generated code: wrapping arithmetic. Division by
+  // zero, overflowing division, out of range shifts and right shifts of negative numbers
+  // are not evaluated.
+  static bool applyOperator(const std::string& op, int lhs, int rhs, int& value) {
+    const unsigned int u_lhs = lhs;
+    const unsigned int u_rhs = rhs;
+    if (op == "+") {
+      value = u_lhs + u_rhs;
+    } else if (op == "-") {
+      value = u_lhs - u_rhs;
+    } else if (op == "*") {
+      value = u_lhs * u_rhs;
+    } else if (op == "/" || op == "%") {
+      if (rhs == 0 || (lhs == INT_MIN && rhs == -1)) {
+        return false;
+      }
+      value = op == "/" ? lhs / rhs : lhs % rhs;
+    } else if (op == "<<" || op == ">>") {
+      if (rhs < 0 || rhs > 31 || (op == ">>" && lhs < 0)) {
+        return false;
+      }
+      value = op == "<<" ? u_lhs << rhs : u_lhs >> rhs;
+    } else if (op == "&") {
+      value = lhs & rhs;
+    } else if (op == "^") {
+      value = lhs ^ rhs;
+    } else if (op == "|") {
+      value = lhs | rhs;
+    } else if (op == "<") {
+      value = lhs < rhs;
+    } else if (op == ">") {
+      value = lhs > rhs;
+    } else if (op == "<=") {
+      value = lhs <= rhs;
+    } else if (op == ">=") {
+      value = lhs >= rhs;
+    } else if (op == "==") {
+      value = lhs == rhs;
+    } else if (op == "!=") {
+      value = lhs != rhs;
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  bool evaluateBinary(const Node* lhs, const std::string& op, const Node* rhs,
+                      int& value) {
+    int lhs_value;
+    int rhs_value;
+    return evaluate(lhs, lhs_value) && evaluate(rhs, rhs_value) &&
+           applyOperator(op, lhs_value, rhs_value, value);
+  }
+
+  bool evaluateCall(const FunctionCall* function_call, int& value) {
+    std::vector<int> arguments;
+    const ParametersListNode* parameters_list_node =
+      dynamic_cast<const ParametersListNode*>(function_call->getParametersList());
+    while (!parameters_list_node->isEmptyParameterList()) {
+      int argument;
+      if (!evaluate(parameters_list_node->getParameter(), argument)) {
+        return false;
+      }
+      arguments.push_back(argument);
+      if (!parameters_list_node->hasNextParameter()) {
+        break;
+      }
+      parameters_list_node =
+        dynamic_cast<const ParametersListNode*>(parameters_list_node->getNextParameter());
+    }
+    return call(function_call->getFunctionId(), arguments, value);
+  }
+
+  bool declare(const DeclarationExpressionList* declaration_expression_list) {
+    if (declaration_expression_list->getTypeSpecifier() != "int") {
+      return false;
+    }
+    const DeclarationExpressionListNode* declaration_node =
+      dynamic_cast<const DeclarationExpressionListNode*>(
+        declaration_expression_list->getDeclarationList());
+    while (declaration_node != nullptr) {
+      const Variable* variable =
+        dynamic_cast<const Variable*>(declaration_node->getVariable());
+      if (variable == nullptr || variable->getInfo() != "normal") {
+        return false;
+      }
+      std::pair<bool, int> initial_value(false, 0);
+      if (declaration_node->hasRhs()) {
+        if (!evaluate(declaration_node->getRhs(), initial_value.second)) {
+          return false;
+        }
+        initial_value.first = true;
+      }
+      scopes_.back()[variable->getId()] = initial_value;
+      declaration_node = declaration_node->hasNext() ?
+        dynamic_cast<const DeclarationExpressionListNode*>(declaration_node->getNext()) :
+        nullptr;
+    }
+    return true;
+  }
+
+  Flow executeSwitch(const SwitchStatement* switch_statement) {
+    int test;
+    if (!evaluate(switch_statement->getTest(), test)) {
+      return FAILURE;
+    }
+    // The bodies of the cases, and the first one to run: the matching case, else the
+    // default.
+    std::vector<const Node*> bodies;
+    int first = -1;
+    int default_index = -1;
+    const CaseStatementListNode* case_list =
+      dynamic_cast<const CaseStatementListNode*>(switch_statement->getBody());
+    while (case_list != nullptr && !case_list->isEmptyCaseStatementList()) {
+      const Node* case_node = case_list->getCaseStatement();
+      if (case_node->getType() == "CaseStatement") {
+        const CaseStatement* case_statement = dynamic_cast<const CaseStatement*>(case_node);
+        int case_value;
+        if (!evaluate(case_statement->getCaseExpr(), case_value)) {
+          return FAILURE;
+        }
+        if (case_value == test && first < 0) {
+          first = bodies.size();
+        }
+        bodies.push_back(case_statement->hasBody() ? case_statement->getBody() : nullptr);
+      } else {
+        const DefaultStatement* default_statement =
+          dynamic_cast<const DefaultStatement*>(case_node);
+        default_index = bodies.size();
+        bodies.push_back(default_statement->hasBody() ? default_statement->getBody() :
+                                                        nullptr);
+      }
+      case_list = case_list->hasNextCaseStatement() ?
+        dynamic_cast<const CaseStatementListNode*>(case_list->getNextCaseStatement()) :
+        nullptr;
+    }
+    if (first < 0) {
+      first = default_index;
+    }
+    if (first < 0) {
+      return NEXT;
+    }
+    scopes_.emplace_back();
+    Flow flow = NEXT;
+    for (unsigned int i = first; i < bodies.size() && flow == NEXT; i++) {
+      flow = execute(bodies[i]);
+    }
+    scopes_.pop_back();
+    return flow == BREAK ? NEXT : flow;
+  }
+
+  // Loops: while, and for with its initialization in its own scope.
+  Flow executeLoop(const Node* init, const Node* condition, const Node* increment,
+                   const Node* body) {
+    scopes_.emplace_back();
+    Flow flow = init == nullptr ? NEXT : execute(init);
+    while (flow == NEXT) {
+      int is_true = 1;
+      if (condition->getType() != "EmptyExpression" && !evaluate(condition, is_true)) {
+        flow = FAILURE;
+        break;
+      }
+      if (!is_true) {
+        break;
+      }
+      flow = execute(body);
+      if (flow == BREAK) {
+        flow = NEXT;
+        break;
+      }
+      if (flow == CONTINUE) {
+        flow = NEXT;
+      }
+      int ignored;
+      if (flow == NEXT && increment != nullptr && !evaluate(increment, ignored)) {
+        flow = FAILURE;
+      }
+    }
+    scopes_.pop_back();
+    return flow;
+  }
+
+ public:
+  explicit PureFunctionInterpreter(const PureFunctionEvaluator& evaluator)
+    : evaluator_(evaluator) {}
+
+  bool call(const std::string& id, const std::vector<int>& arguments, int& result) {
+    const FunctionDefinition* function_definition = evaluator_.getPureFunction(id);
+    if (function_definition == nullptr || depth_ >= PURE_CALL_MAX_DEPTH) {
+      return false;
+    }
+    std::vector<std::string> argument_names =
+      CompilerUtil::getArgumentNamesFromFunctionDeclaration(
+        dynamic_cast<const ArgumentListNode*>(function_definition->getArgumentList()));
+    argument_names.erase(std::remove(argument_names.begin(), argument_names.end(),
+                                     CompilerUtil::NO_ARGUMENT),
+                         argument_names.end());
+    if (argument_names.size() != arguments.size()) {
+      return false;
+    }
+    // The callee does not see the variables of the caller.
+    std::vector<std::unordered_map<std::string, std::pair<bool, int>>> caller_scopes;
+    caller_scopes.swap(scopes_);
+    scopes_.emplace_back();
+    for (unsigned int i = 0; i < arguments.size(); i++) {
+      scopes_.back()[argument_names[i]] = std::make_pair(true, arguments[i]);
+    }
+    depth_++;
+    Flow flow = execute(function_definition->getBody());
+    depth_--;
+    scopes_.swap(caller_scopes);
+    // Falling off the end of the function returns no value.
+    if (flow != RETURN) {
+      return false;
+    }
+    result = return_value_;
+    return true;
+  }
+
+  Flow execute(const Node* statement) {
+    if (statement == nullptr) {
+      return NEXT;
+    }
+    if (isOverBudget()) {
+      return FAILURE;
+    }
+    const std::string& type = statement->getType();
+    if (type == "CompoundStatement") {
+      scopes_.emplace_back();
+      Flow flow =
+        execute(dynamic_cast<const CompoundStatement*>(statement)->getStatementList());
+      scopes_.pop_back();
+      return flow;
+    }
+    else if (type == "StatementListNode") {
+      const StatementListNode* statement_list =
+        dynamic_cast<const StatementListNode*>(statement);
+      while (statement_list != nullptr) {
+        Flow flow = execute(statement_list->getStatement());
+        if (flow != NEXT) {
+          return flow;
+        }
+        statement_list = statement_list->hasNextStatement() ?
+          dynamic_cast<const StatementListNode*>(statement_list->getNextStatement()) :
+          nullptr;
+      }
+      return NEXT;
+    }
+    else if (type == "ReturnStatement") {
+      const ReturnStatement* return_statement =
+        dynamic_cast<const ReturnStatement*>(statement);
+      if (!return_statement->hasExpression() ||
+          !evaluate(return_statement->getExpression(), return_value_)) {
+        return FAILURE;
+      }
+      return RETURN;
+    }
+    else if (type == "BreakStatement") {
+      return BREAK;
+    }
+    else if (type == "ContinueStatement") {
+      return CONTINUE;
+    }
+    else if (type == "IfStatement") {
+      const IfStatement* if_statement = dynamic_cast<const IfStatement*>(statement);
+      int condition;
+      if (!evaluate(if_statement->getCondition(), condition)) {
+        return FAILURE;
+      }
+      if (condition) {
+        return execute(if_statement->getIfBody());
+      }
+      return if_statement->hasElseBody() ? execute(if_statement->getElseBody()) : NEXT;
+    }
+    else if (type == "WhileStatement") {
+      const WhileStatement* while_statement = dynamic_cast<const WhileStatement*>(statement);
+      return executeLoop(nullptr, while_statement->getCondition(), nullptr,
+                         while_statement->getBody());
+    }
+    else if (type == "ForStatement") {
+      const ForStatement* for_statement = dynamic_cast<const ForStatement*>(statement);
+      return executeLoop(for_statement->getInit(), for_statement->getCondition(),
+                         for_statement->hasIncrement() ? for_statement->getIncrement() :
+                                                         nullptr,
+                         for_statement->getBody());
+    }
+    else if (type == "SwitchStatement") {
+      return executeSwitch(dynamic_cast<const SwitchStatement*>(statement));
+    }
+    else if (type == "DeclarationExpressionList") {
+      return declare(dynamic_cast<const DeclarationExpressionList*>(statement)) ?
+             NEXT : FAILURE;
+    }
+    else if (type == "EmptyExpression") {
+      return NEXT;
+    }
+    int ignored;
+    return evaluate(statement, ignored) ? NEXT : FAILURE;
+  }
+
+  bool evaluate(const Node* expr, int& value) {
+    if (expr == nullptr || isOverBudget()) {
+      return false;
+    }
+    const std::string& type = expr->getType();
+    if (type == "IntegerConstant") {
+      value = dynamic_cast<const IntegerConstant*>(expr)->getValue();
+      return true;
+    }
+    else if (type == "Variable") {
+      const Variable* variable = dynamic_cast<const Variable*>(expr);
+      if (variable->getInfo() != "normal") {
+        return false;
+      }
+      const std::pair<bool, int>* local = findVariable(variable->getId());
+      if (local != nullptr) {
+        value = local->second;
+        return local->first;
+      }
+      const CompileTimeConstants& global_constants = evaluator_.getGlobalConstants();
+      if (!global_constants.isConstant(variable->getId())) {
+        return false;
+      }
+      value = global_constants.getValueOfConstant(variable->getId());
+      return true;
+    }
+    else if (type == "UnaryExpression") {
+      const UnaryExpression* unary_expression = dynamic_cast<const UnaryExpression*>(expr);
+      const std::string& unary_type = unary_expression->getUnaryType();
+      if (unary_type == "++" || unary_type == "--") {
+        std::pair<bool, int>* local =
+          findWrittenVariable(unary_expression->getUnaryExpression());
+        if (local == nullptr || !local->first) {
+          return false;
+        }
+        applyOperator(unary_type == "++" ? "+" : "-", local->second, 1, local->second);
+        value = local->second;
+        return true;
+      }
+      int operand;
+      if (!evaluate(unary_expression->getUnaryExpression(), operand)) {
+        return false;
+      }
+      if (unary_type == "-") {
+        return applyOperator("-", 0, operand, value);
+      } else if (unary_type == "+") {
+        value = operand;
+      } else if (unary_type == "~") {
+        value = ~operand;
+      } else if (unary_type == "!") {
+        value = !operand;
+      } else {
+        return false;
+      }
+      return true;
+    }
+    else if (type == "PostfixExpression") {
+      const PostfixExpression* postfix_expression =
+        dynamic_cast<const PostfixExpression*>(expr);
+      std::pair<bool, int>* local =
+        findWrittenVariable(postfix_expression->getPostfixExpression());
+      if (local == nullptr || !local->first) {
+        return false;
+      }
+      value = local->second;
+      applyOperator(postfix_expression->getPostfixType() == "++" ? "+" : "-",
+                    local->second, 1, local->second);
+      return true;
+    }
+    else if (type == "MultiplicativeExpression") {
+      const MultiplicativeExpression* multiplicative_expression =
+        dynamic_cast<const MultiplicativeExpression*>(expr);
+      return evaluateBinary(multiplicative_expression->getLhs(),
+                            multiplicative_expression->getMultiplicativeType(),
+                            multiplicative_expression->getRhs(), value);
+    }
+    else if (type == "AdditiveExpression") {
+      const AdditiveExpression* additive_expression =
+        dynamic_cast<const AdditiveExpression*>(expr);
+      return evaluateBinary(additive_expression->getLhs(),
+                            additive_expression->getAdditiveType(),
+                            additive_expression->getRhs(), value);
+    }
+    else if (type == "ShiftExpression") {
+      const ShiftExpression* shift_expression = dynamic_cast<const ShiftExpression*>(expr);
+      return evaluateBinary(shift_expression->getLhs(), shift_expression->getShiftType(),
+                            shift_expression->getRhs(), value);
+    }
+    else if (type == "RelationalExpression") {
+      const RelationalExpression* relational_expression =
+        dynamic_cast<const RelationalExpression*>(expr);
+      return evaluateBinary(relational_expression->getLhs(),
+                            relational_expression->getRelationalType(),
+                            relational_expression->getRhs(), value);
+    }
+    else if (type == "EqualityExpression") {
+      const EqualityExpression* equality_expression =
+        dynamic_cast<const EqualityExpression*>(expr);
+      return evaluateBinary(equality_expression->getLhs(),
+                            equality_expression->getEqualityType(),
+                            equality_expression->getRhs(), value);
+    }
+    else if (type == "AndExpression") {
+      const AndExpression* and_expression = dynamic_cast<const AndExpression*>(expr);
+      return evaluateBinary(and_expression->getLhs(), "&", and_expression->getRhs(), value);
+    }
+    else if (type == "ExclusiveOrExpression") {
+      const ExclusiveOrExpression* exclusive_or_expression =
+        dynamic_cast<const ExclusiveOrExpression*>(expr);
+      return evaluateBinary(exclusive_or_expression->getLhs(), "^",
+                            exclusive_or_expression->getRhs(), value);
+    }
+    else if (type == "InclusiveOrExpression") {
+      const InclusiveOrExpression* inclusive_or_expression =
+        dynamic_cast<const InclusiveOrExpression*>(expr);
+      return evaluateBinary(inclusive_or_expression->getLhs(), "|",
+                            inclusive_or_expression->getRhs(), value);
+    }
+    else if (type == "LogicalAndExpression" || type == "LogicalOrExpression") {
+      // The right hand side is only evaluated if needed.
+      const bool is_and = type == "LogicalAndExpression";
+      const Node* lhs = is_and ?
+        dynamic_cast<const LogicalAndExpression*>(expr)->getLhs() :
+        dynamic_cast<const LogicalOrExpression*>(expr)->getLhs();
+      const Node* rhs = is_and ?
+        dynamic_cast<const LogicalAndExpression*>(expr)->getRhs() :
+        dynamic_cast<const LogicalOrExpression*>(expr)->getRhs();
+      int lhs_value;
+      if (!evaluate(lhs, lhs_value)) {
+        return false;
+      }
+      if ((lhs_value != 0) != is_and) {
+        value = !is_and;
+        return true;
+      }
+      int rhs_value;
+      if (!evaluate(rhs, rhs_value)) {
+        return false;
+      }
+      value = rhs_value != 0;
+      return true;
+    }
+    else if (type == "ConditionalExpression") {
+      const ConditionalExpression* conditional_expression =
+        dynamic_cast<const ConditionalExpression*>(expr);
+      int condition;
+      if (!evaluate(conditional_expression->getCondition(), condition)) {
+        return false;
+      }
+      return evaluate(condition ? conditional_expression->getExpression1() :
+                                  conditional_expression->getExpression2(), value);
+    }
+    else if (type == "AssignmentExpression") {
+      const AssignmentExpression* assignment_expression =
+        dynamic_cast<const AssignmentExpression*>(expr);
+      std::pair<bool, int>* local = findWrittenVariable(assignment_expression->getVariable());
+      int rhs_value;
+      if (local == nullptr || !evaluate(assignment_expression->getRhs(), rhs_value)) {
+        return false;
+      }
+      const std::string& assignment_type = assignment_expression->getAssignmentType();
+      if (assignment_type == "=") {
+        value = rhs_value;
+      } else if (!local->first ||
+                 !applyOperator(assignment_type.substr(0, assignment_type.size() - 1),
+                                local->second, rhs_value, value)) {
+        return false;
+      }
+      *local = std::make_pair(true, value);
+      return true;
+    }
+    else if (type == "FunctionCall") {
+      return evaluateCall(dynamic_cast<const FunctionCall*>(expr), value);
+    }
+    return false;
+  }
+};
+
+} // namespace
+
+void PureFunctionEvaluator::analyze(
+  const std::vector<const FunctionDefinition*>& function_definitions) {
+  global_constants_ = compile_time_constants;
+  for (const FunctionDefinition* function_definition : function_definitions) {
+    const std::string& id =
+      dynamic_cast<const Variable*>(function_definition->getName())->getId();
+    const ModRefSummary& summary = mod_ref_summaries.getSummary(id);
+    if (function_definition->getTypeSpecifier() != "int" || summary.is_unknown ||
+        !summary.written_globals.empty() || summary.reads_through_pointers ||
+        summary.writes_through_pointers) {
+      continue;
+    }
+    // Only int arguments.
+    bool has_int_arguments = true;
+    const ArgumentListNode* argument_list_node =
+      dynamic_cast<const ArgumentListNode*>(function_definition->getArgumentList());
+    while (argument_list_node != nullptr && !argument_list_node->isEmptyArgumentList()) {
+      const DeclarationExpressionList* argument =
+        dynamic_cast<const DeclarationExpressionList*>(argument_list_node->getArgument());
+      const Variable* variable = dynamic_cast<const Variable*>(
+        dynamic_cast<const DeclarationExpressionListNode*>(
+          argument->getDeclarationList())->getVariable());
+      if (argument->getTypeSpecifier() != "int" || variable->getInfo() != "normal") {
+        has_int_arguments = false;
+      }
+      argument_list_node = argument_list_node->hasNextArgument() ?
+        dynamic_cast<const ArgumentListNode*>(argument_list_node->getNextArgument()) :
+        nullptr;
+    }
+    if (has_int_arguments) {
+      id_to_definition_[id] = function_definition;
+    }
+  }
+}
+
+bool PureFunctionEvaluator::evaluateCall(const FunctionCall* function_call, int& result) {
+  if (getPureFunction(function_call->getFunctionId()) == nullptr) {
+    return false;
+  }
+  std::vector<int> arguments;
+  const ParametersListNode* parameters_list_node =
+    dynamic_cast<const ParametersListNode*>(function_call->getParametersList());
+  while (!parameters_list_node->isEmptyParameterList()) {
+    if (!CompilerUtil::isConstantExpression(parameters_list_node->getParameter())) {
+      return false;
+    }
+    arguments.push_back(
+      CompilerUtil::evaluateConstantExpression(parameters_list_node->getParameter()));
+    if (!parameters_list_node->hasNextParameter()) {
+      break;
+    }
+    parameters_list_node =
+      dynamic_cast<const ParametersListNode*>(parameters_list_node->getNextParameter());
+  }
+  auto key = std::make_pair(function_call->getFunctionId(), arguments);
+  auto cached = results_.find(key);
+  if (cached == results_.end()) {
+    std::pair<bool, int> evaluation(false, 0);
+    PureFunctionInterpreter interpreter(*this);
+    evaluation.first = interpreter.call(function_call->getFunctionId(), arguments,
+                                        evaluation.second);
+    cached = results_.emplace(key, evaluation).first;
+  }
+  result = cached->second.second;
+  return cached->second.first;
+}
+
+const FunctionDefinition* PureFunctionEvaluator::getPureFunction(
+  const std::string& id) const {
+  auto it = id_to_definition_.find(id);
+  return it == id_to_definition_.end() ? nullptr : it->second;
+}
+
+const CompileTimeConstants& PureFunctionEvaluator::getGlobalConstants() const {
+  return global_constants_;
+}
+
+// ExecutionProfile.
+
+// Counts of at least 1 / PROFILE_HOT_RATIO of the largest count are hot.
+#define PROFILE_HOT_RATIO 100
+
+ExecutionProfile execution_profile;
+
+void ExecutionProfile::analyze(
+  const std::vector<const FunctionDefinition*>& function_definitions) {
+  std::vector<const Node*> nodes(function_definitions.rbegin(),
+                                 function_definitions.rend());
+  while (!nodes.empty()) {
+    const Node* node = nodes.back();
+    nodes.pop_back();
+    const std::string& type = node->getType();
+    int counters = 0;
+    std::string name = type;
+    if (type == "FunctionDefinition") {
+      counters = 1;
+      name += " " + dynamic_cast<const Variable*>(
+        dynamic_cast<const FunctionDefinition*>(node)->getName())->getId();
+    } else if (type == "FunctionCall") {
+      counters = 1;
+      name += " " + dynamic_cast<const FunctionCall*>(node)->getFunctionId();
+    } else if (type == "IfStatement" || type == "WhileStatement" ||
+               type == "ForStatement") {
+      counters = 2;
+    }
+    if (counters > 0) {
+      node_to_counter_[node] = counters_size_;
+      counters_size_ += counters;
+      // FNV-1a.
+      for (char c : name + ";") {
+        checksum_ = (checksum_ ^ (unsigned char)c) * 16777619u;
+      }
+    }
+    // Preorder: the first child is visited next.
+    std::vector<const Node*> children = CompilerUtil::getChildren(node);
+    nodes.insert(nodes.end(), children.rbegin(), children.rend());
+  }
+}
+
+int ExecutionProfile::getCounter(const Node* node, int which) const {
+  auto it = node_to_counter_.find(node);
+  return it == node_to_counter_.end() ? -1 : it->second + which;
+}
+
+int ExecutionProfile::countCounters() const {
+  return counters_size_;
+}
+
+unsigned int ExecutionProfile::getChecksum() const {
+  return checksum_;
+}
+
+bool ExecutionProfile::load(const std::string& file_name, std::string& error) {
+  std::ifstream profile_in(file_name, std::ios::binary);
+  if (!profile_in) {
+    error = "cannot open the file";
+    return false;
+  }
+  std::vector<unsigned int> words;
+  unsigned char bytes[4];
+  while (profile_in.read(reinterpret_cast<char*>(bytes), 4)) {
+    words.push_back((unsigned int)bytes[0] << 24 | (unsigned int)bytes[1] << 16 |
+                    (unsigned int)bytes[2] << 8 | (unsigned int)bytes[3]);
+  }
+  if (words.size() < PROFILE_HEADER_WORDS || words[0] != PROFILE_MAGIC ||
+      words.size() != PROFILE_HEADER_WORDS + words[1]) {
+    error = "not a profile file";
+    return false;
+  }
+  if ((int)words[1] != counters_size_ || words[2] != checksum_) {
+    error = "written for another source";
+    return false;
+  }
+  counts_.assign(words.begin() + PROFILE_HEADER_WORDS, words.end());
+  max_count_ = counts_.empty() ? 0 : *std::max_element(counts_.begin(), counts_.end());
+  return true;
+}
+
+bool ExecutionProfile::hasCounts() const {
+  return !counts_.empty();
+}
+
+long long ExecutionProfile::getCount(const Node* node, int which) const {
+  const int counter = getCounter(node, which);
+  if (counter < 0 || counts_.empty()) {
+    return -1;
+  }
+  return counts_[counter];
+}
+
+bool ExecutionProfile::isHot(long long count) const {
+  return count > 0 && count * PROFILE_HOT_RATIO >= max_count_;
+}
+
 // FunctionDeclarations.
 
 bool FunctionDeclarations::isIdOfDeclaredOnlyFunction(const std::string& id) {
@@ -1,18 +1,55 @@
 #include<iostream>
+#include<vector>
 
 #include "c_compiler/inc/compiler.hpp"
 #include "c_translator/inc/translator.hpp"
 
 int main(int argc, char** argv) {
-  if (argc == 5 && std::string(argv[1]) == "-S" && std::string(argv[3]) == "-o") {
-    return compile(std::string(argv[2]), std::string(argv[4]));
+  // Options (e.g. -fomit-frame-pointer, -march=mips1) can be given before or after the
+  // files.
+  std::vector<std::string> arguments;
+  CompilerOptions compiler_options;
+  for (int i = 1; i < argc; i++) {
+    std::string argument(argv[i]);
+    if (argument.size() > 2 &&
+        (argument.substr(0, 2) == "-f" || argument.substr(0, 2) == "-m")) {
+      if (!compiler_options.parseOption(argument)) {
+        std::cerr << "Unknown option: " << argument << std::endl;
+        return 1;
+      }
+    } else {
+      arguments.push_back(argument);
+    }
   }
-  if (argc == 5 && std::string(argv[1]) == "--translate" && std::string(argv[3]) == "-o"){
-    return translate(std::string(argv[2]), std::string(argv[4]));
+
+  if (arguments.size() == 4 && arguments[0] == "-S" && arguments[2] == "-o") {
+    return compile(arguments[1], arguments[3], compiler_options);
+  }
+  if (arguments.size() == 4 && arguments[0] == "--translate" && arguments[2] == "-o"){
+    return translate(arguments[1], arguments[3]);
   }
   std::cout << "Usage:" << std::endl
-            << "-> for compiler: -S source_file -o destination_file" << std::endl
+            << "-> for compiler: [options] -S source_file -o destination_file" << std::endl
             << "-> for translator: --translate source_file -o destination_file"
-            << std::endl;
+            << std::endl
+            << "Compiler options:" << std::endl
+            << "   -fomit-frame-pointer  Address the stack frame from $sp." << std::endl
+            << "   -fwhole-program       The source file is the whole program." << std::endl
+            << "   -fexport=NAME,...     With -fwhole-program, symbols used by other files."
+            << std::endl
+            << "   -funroll-loops        Unroll loops also when the trip count is unknown."
+            << std::endl
+            << "   -fno-unroll-loops     Do not unroll loops, not even small ones."
+            << std::endl
+            << "   -funroll-factor=N     Copies of the body in an unrolled loop (4)."
+            << std::endl
+            << "   -fno-inline           Do not inline function calls." << std::endl
+            << "   -fno-optimize-sibling-calls  Do not turn tail calls into jumps."
+            << std::endl
+            << "   -fno-if-conversion    Keep the branches of conditionals." << std::endl
+            << "   -march=mips1          Target without conditional moves." << std::endl
+            << "   -fprofile-generate[=FILE]  Count the executions into FILE." << std::endl
+            << "   -fprofile-use=FILE    Optimize with the counts of FILE." << std::endl
+            << "   -fopt-report          Report the optimization decisions." << std::endl;
   return 1;
 }
@@ -0,0 +1,5 @@
+int alias_analysis(int n);
+
+int main() {
+  return alias_analysis(12) % 256;
+}
@@ -0,0 +1,5 @@
+int branch_layout(int n);
+
+int main() {
+  return branch_layout(40) % 256;
+}
@@ -0,0 +1,7 @@
+int g(int x);
+int h(int a, int b, int c, int d);
+int call_arguments_order(int a, int b);
+
+int main() {
+  return call_arguments_order(1, 2) % 256;
+}
@@ -0,0 +1,5 @@
+int closed_form_loops(int n);
+
+int main() {
+  return closed_form_loops(100) % 256;
+}
@@ -0,0 +1,5 @@
+int dead_stores(int a, int b);
+
+int main() {
+  return dead_stores(5, 7) % 256;
+}
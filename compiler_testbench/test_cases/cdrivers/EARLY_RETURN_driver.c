@@ -0,0 +1,7 @@
+int half(int n);
+int shrink(int n);
+int early_return(int n);
+
+int main() {
+  return early_return(100) % 256;
+}
@@ -0,0 +1,5 @@
+int enum_state_machine();
+
+int main() {
+  return enum_state_machine();
+}
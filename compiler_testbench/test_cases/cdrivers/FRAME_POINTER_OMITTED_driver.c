@@ -0,0 +1,5 @@
+int frame_pointer_omitted(int n);
+
+int main() {
+  return frame_pointer_omitted(10) % 256;
+}
@@ -0,0 +1,5 @@
+int globals_in_loops(int n);
+
+int main() {
+  return globals_in_loops(15) % 256;
+}
@@ -0,0 +1,5 @@
+int global_layout(int n);
+
+int main() {
+  return global_layout(30) % 256;
+}
@@ -0,0 +1,5 @@
+int if_conversion(int n);
+
+int main() {
+  return if_conversion(10) % 256;
+}
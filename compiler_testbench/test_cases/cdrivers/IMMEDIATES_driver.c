@@ -0,0 +1,5 @@
+int immediates(int x);
+
+int main() {
+  return (immediates(7) + immediates(300)) % 256;
+}
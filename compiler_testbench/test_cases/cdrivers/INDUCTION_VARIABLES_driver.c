@@ -0,0 +1,5 @@
+int induction_variables(int n);
+
+int main() {
+  return induction_variables(10) % 256;
+}
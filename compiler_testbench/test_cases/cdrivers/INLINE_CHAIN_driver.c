@@ -0,0 +1,5 @@
+int inline_chain(int x);
+
+int main() {
+  return inline_chain(5) % 256;
+}
@@ -0,0 +1,5 @@
+int inline_pressure(int n);
+
+int main() {
+  return inline_pressure(5) % 256;
+}
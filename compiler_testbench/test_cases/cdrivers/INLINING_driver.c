@@ -0,0 +1,5 @@
+int inlining(int n);
+
+int main() {
+  return inlining(6) % 256;
+}
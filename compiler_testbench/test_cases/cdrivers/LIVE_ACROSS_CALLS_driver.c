@@ -0,0 +1,7 @@
+int sq(int x);
+int add3(int a, int b, int c);
+int live_across_calls();
+
+int main() {
+  return live_across_calls();
+}
@@ -0,0 +1,5 @@
+int loop_invariant(int n);
+
+int main() {
+  return loop_invariant(4) % 256;
+}
@@ -0,0 +1,5 @@
+int loop_rotation(int n);
+
+int main() {
+  return (loop_rotation(10) + loop_rotation(0)) % 256;
+}
@@ -0,0 +1,5 @@
+int loop_unrolling(int n);
+
+int main() {
+  return loop_unrolling(11) % 256;
+}
@@ -0,0 +1,5 @@
+int profile_use(int n);
+
+int main() {
+  return profile_use(200) % 256;
+}
@@ -0,0 +1,5 @@
+int promote_locals(int n);
+
+int main() {
+  return promote_locals(20) % 256;
+}
@@ -0,0 +1,5 @@
+int pure_calls(int a);
+
+int main() {
+  return pure_calls(10) % 256;
+}
@@ -0,0 +1,5 @@
+int select_pressure(int n);
+
+int main() {
+  return select_pressure(9) % 256;
+}
@@ -0,0 +1,9 @@
+int shrink_wrap_call(int x);
+
+int shrink_wrap_helper(int x) {
+  return x + 41;
+}
+
+int main() {
+  return shrink_wrap_call(0) + shrink_wrap_call(5);
+}
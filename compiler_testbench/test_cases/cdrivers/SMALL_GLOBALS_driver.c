@@ -0,0 +1,5 @@
+int small_globals(int n);
+
+int main() {
+  return small_globals(20) % 256;
+}
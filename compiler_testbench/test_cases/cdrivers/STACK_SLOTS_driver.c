@@ -0,0 +1,5 @@
+int stack_slots(int n);
+
+int main() {
+  return stack_slots(10) % 256;
+}
@@ -0,0 +1,5 @@
+int tail_calls(int n);
+
+int main() {
+  return tail_calls(10000) % 256;
+}
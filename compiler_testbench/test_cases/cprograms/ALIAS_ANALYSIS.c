@@ -0,0 +1,25 @@
+int scale;
+int offset;
+int calls;
+int hist[8];
+
+int weight(int x) {
+  calls++;
+  return x * scale;
+}
+
+int alias_analysis(int n) {
+  int i;
+  int total;
+  int local[8];
+  scale = 3;
+  offset = n;
+  calls = 0;
+  total = 0;
+  for (i = 0; i < n; i++) {
+    local[i % 8] = offset + i;
+    hist[i % 8] = hist[i % 8] + 1;
+    total = total + weight(local[i % 8]) + offset;
+  }
+  return total + calls + hist[3];
+}
@@ -0,0 +1,56 @@
+int find(int n, int key) {
+  int i;
+  for (i = 0; i < n; i++) {
+    if (i * 7 % 50 == key) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+int classify(int a, int b, int c) {
+  int s = 0;
+  if (a && b) {
+    s = s + 1;
+  }
+  if (a || c) {
+    s = s + 2;
+  } else {
+    s = s + 4;
+  }
+  if (a > b) {
+    s = s * 2;
+  } else {
+  }
+  return s;
+}
+
+int count(int n) {
+  int s = 0;
+  int i = 0;
+  while (i < n && s < 1000) {
+    switch (i % 4) {
+      case 0: s = s + 3; break;
+      case 1: s = s + 5; break;
+      case 2: s = s - 1; break;
+      default: s = s + 7;
+    }
+    if (s == 52) {
+      break;
+    }
+    i++;
+  }
+  return s + i;
+}
+
+int branch_layout(int n) {
+  int s = 0;
+  int a;
+  int b;
+  for (a = 0; a < 3; a++) {
+    for (b = 0; b < 3; b++) {
+      s = s + classify(a, b, a - b);
+    }
+  }
+  return s + find(n, 21) + find(n, 3) + count(n);
+}
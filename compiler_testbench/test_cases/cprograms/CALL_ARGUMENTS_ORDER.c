@@ -0,0 +1,15 @@
+int g(int x);
+int h(int a, int b, int c, int d);
+int call_arguments_order(int a, int b);
+
+int call_arguments_order(int a, int b) {
+  return h(a + 1, g(b), a * 2, 3) + h(g(a), 1, g(b), b);
+}
+
+int g(int x) {
+  return x * 3;
+}
+
+int h(int a, int b, int c, int d) {
+  return a * 1000 + b * 100 + c * 10 + d;
+}
@@ -0,0 +1,42 @@
+int sum_up(int n) {
+  int s = 0;
+  int i;
+  for (i = 0; i < n; i++) {
+    s += i;
+  }
+  return s;
+}
+
+int count_down(int n, int m) {
+  int s = 7;
+  int c = 0;
+  int i;
+  for (i = n; i >= m; --i) {
+    s = s - 3 * i + m;
+    ++c;
+  }
+  return s + c + i;
+}
+
+int strided(int k) {
+  int s = 0;
+  int i;
+  for (i = 2; i < 40; i += 3) {
+    s += 2 * i + k;
+  }
+  return s + i;
+}
+
+int dead_loop(int n) {
+  int j = 0;
+  int w = 0;
+  while (j < n) {
+    w = w + j;
+    j++;
+  }
+  return n;
+}
+
+int closed_form_loops(int n) {
+  return sum_up(n) + count_down(n, -4) + strided(n) + dead_loop(n) + sum_up(-3);
+}
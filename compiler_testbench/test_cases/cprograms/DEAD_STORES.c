@@ -0,0 +1,25 @@
+int shared;
+
+void bump(int* p) {
+  *p = *p + 3;
+}
+
+int dead_stores(int a, int b) {
+  int x;
+  int y;
+  int z;
+  int* p;
+  x = a;
+  x = b;
+  y = x + a;
+  shared = y;
+  shared = y * 2;
+  z = shared;
+  p = &y;
+  *p = z + 1;
+  bump(&y);
+  x = y;
+  shared = a;
+  bump(&shared);
+  return x + z + shared;
+}
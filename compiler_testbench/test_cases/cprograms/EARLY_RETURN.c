@@ -0,0 +1,28 @@
+int half(int n);
+int shrink(int n);
+int early_return(int n);
+
+int half(int n) {
+  if (n <= 1) {
+    return n;
+  }
+  return half(n / 2) + 1;
+}
+
+int shrink(int n) {
+  while (n > 40) {
+    n = n - half(n);
+  }
+  if (n < 0) {
+    return 0;
+  }
+  return n;
+}
+
+int early_return(int n) {
+  if (n == 0) {
+    return 1;
+  }
+  int x = shrink(n);
+  return x + half(x) + early_return(n - 1);
+}
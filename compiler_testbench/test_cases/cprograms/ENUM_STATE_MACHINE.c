@@ -0,0 +1,27 @@
+enum state { IDLE, RUN = 3, STOP, DONE = RUN * 3 };
+
+int history[DONE];
+
+int step(int s) {
+  switch (s) {
+    case IDLE:
+      return RUN;
+    case RUN:
+      return STOP;
+    case STOP:
+      return DONE;
+    default:
+      return IDLE;
+  }
+}
+
+int enum_state_machine() {
+  int s = IDLE;
+  int n = 0;
+  while (s != DONE) {
+    history[n] = s;
+    s = step(s);
+    n++;
+  }
+  return n + history[n - 1] * 10 + (s == DONE) + (RUN << 2);
+}
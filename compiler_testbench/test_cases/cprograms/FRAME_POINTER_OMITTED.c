@@ -0,0 +1,41 @@
+int step(int x) {
+  if (x <= 1) {
+    return 1;
+  }
+  return step(x - 2) + x;
+}
+
+int frame_pointer_omitted(int n) {
+  int a[8];
+  int b = n + 1;
+  int c = n + 2;
+  int d = n + 3;
+  int e = n + 4;
+  int f = n + 5;
+  int g = n + 6;
+  int h = n + 7;
+  int k = n + 8;
+  int m = n + 9;
+  int s = 0;
+  int i;
+  for (i = 0; i < 8; i++) {
+    a[i] = i * n;
+  }
+  for (i = 0; i < n; i++) {
+    s = s + step(i);
+    b = b + s;
+    c = c ^ b;
+    d = d + c;
+    e = e - d;
+    f = f + (e & 255);
+    g = g ^ f;
+    h = h + g;
+    k = k - h;
+    m = m + (k | 3);
+    a[i % 8] = a[i % 8] + m;
+  }
+  for (i = 0; i < 8; i++) {
+    s = s + a[i];
+  }
+  return s + b + c + d + e + f + g + h + k + m;
+}
@@ -0,0 +1,25 @@
+int counter;
+int total;
+int last;
+
+int note(int x) {
+  last = x + counter;
+  return x + 1;
+}
+
+int globals_in_loops(int n) {
+  int i;
+  int j;
+  counter = 0;
+  total = 0;
+  for (i = 0; i < n; i++) {
+    for (j = 0; j < i; j++) {
+      counter++;
+      total = total + j;
+    }
+    if (i % 3 == 0) {
+      total = total + note(i);
+    }
+  }
+  return total + counter + last;
+}
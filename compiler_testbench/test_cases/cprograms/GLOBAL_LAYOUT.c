@@ -0,0 +1,14 @@
+int total = 0;
+int scale = 5;
+int offset = -2;
+int buffer[40];
+int lookup[40];
+
+int global_layout(int n) {
+  int i;
+  for (i = 0; i < n; i++) {
+    buffer[i] = i * scale + offset;
+    total += buffer[i] + lookup[i];
+  }
+  return total;
+}
@@ -0,0 +1,40 @@
+int data[10];
+int calls;
+
+int next(int x) {
+  calls++;
+  return x + 1;
+}
+
+int clamp(int x, int lo, int hi) {
+  if (x < lo) {
+    x = lo;
+  }
+  if (x > hi) {
+    x = hi;
+  }
+  return x;
+}
+
+int if_conversion(int n) {
+  int i;
+  int v;
+  int lo = 0;
+  int hi = 0;
+  int s = 0;
+  for (i = 0; i < 10; i++) {
+    data[i] = (i * 7) % 11 - 5;
+  }
+  for (i = 0; i < n; i++) {
+    v = data[i];
+    if (v < lo) lo = v;
+    if (v > hi) {
+      hi = v;
+    } else {
+      hi = hi - 1;
+    }
+    s = s + (v < 0 ? -v : v) + clamp(v, -5, 10);
+  }
+  s = s + (n > 5 ? next(n) : next(-n)) + (calls ? s : i++);
+  return s + lo * 3 + hi + i + calls;
+}
@@ -0,0 +1,16 @@
+int big[4];
+
+int immediates(int x) {
+  int local[3];
+  int r = 0;
+  local[0] = x + 70000;
+  local[2] = x - 32768;
+  big[3] = 0x12340000;
+  r = r + (local[0] > 70004) + (5 < x) + (x <= -3) + (x >= 32767) + (x == 7);
+  r = r + (3 != x) * 8 + (x & 0xff00) + (x | 3) + (x ^ 65535);
+  x <<= 3;
+  x >>= 1;
+  x -= 20;
+  r = r + x * 4 + local[2] + big[3] / 65536 - 2 * local[0];
+  return r;
+}
@@ -0,0 +1,32 @@
+int values[20];
+
+int induction_variables(int n) {
+  int i;
+  int j;
+  int s = 0;
+  int local[10];
+  for (i = 0; i < 20; i++) {
+    values[i] = i * 3;
+  }
+  for (i = 0; i < 10; i++) {
+    local[i] = values[i + 5];
+  }
+  for (i = 0; i < 20; i++) {
+    s = s + values[i];
+  }
+  for (i = 1; i < n; i += 3) {
+    s = s + values[i] - local[i - 1];
+  }
+  s = s + i;
+  j = 9;
+  while (j >= 0) {
+    s = s + local[j] * j;
+    j--;
+  }
+  for (i = 0; i < 4; i++) {
+    for (j = 0; j < 5; j++) {
+      s = s + values[i * 5 + j] + values[j];
+    }
+  }
+  return s;
+}
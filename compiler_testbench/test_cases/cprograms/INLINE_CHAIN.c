@@ -0,0 +1,103 @@
+int f_0(int x) {
+  return x + 1;
+}
+
+int f_1(int x) {
+  return f_0(x) * 3 % 1009;
+}
+
+int f_2(int x) {
+  return f_1(x) * 3 % 1009;
+}
+
+int f_3(int x) {
+  return f_2(x) * 3 % 1009;
+}
+
+int f_4(int x) {
+  return f_3(x) * 3 % 1009;
+}
+
+int f_5(int x) {
+  return f_4(x) * 3 % 1009;
+}
+
+int f_6(int x) {
+  return f_5(x) * 3 % 1009;
+}
+
+int f_7(int x) {
+  return f_6(x) * 3 % 1009;
+}
+
+int f_8(int x) {
+  return f_7(x) * 3 % 1009;
+}
+
+int f_9(int x) {
+  return f_8(x) * 3 % 1009;
+}
+
+int f_10(int x) {
+  return f_9(x) * 3 % 1009;
+}
+
+int f_11(int x) {
+  return f_10(x) * 3 % 1009;
+}
+
+int f_12(int x) {
+  return f_11(x) * 3 % 1009;
+}
+
+int f_13(int x) {
+  return f_12(x) * 3 % 1009;
+}
+
+int f_14(int x) {
+  return f_13(x) * 3 % 1009;
+}
+
+int f_15(int x) {
+  return f_14(x) * 3 % 1009;
+}
+
+int f_16(int x) {
+  return f_15(x) * 3 % 1009;
+}
+
+int f_17(int x) {
+  return f_16(x) * 3 % 1009;
+}
+
+int f_18(int x) {
+  return f_17(x) * 3 % 1009;
+}
+
+int f_19(int x) {
+  return f_18(x) * 3 % 1009;
+}
+
+int f_20(int x) {
+  return f_19(x) * 3 % 1009;
+}
+
+int f_21(int x) {
+  return f_20(x) * 3 % 1009;
+}
+
+int f_22(int x) {
+  return f_21(x) * 3 % 1009;
+}
+
+int f_23(int x) {
+  return f_22(x) * 3 % 1009;
+}
+
+int f_24(int x) {
+  return f_23(x) * 3 % 1009;
+}
+
+int inline_chain(int x) {
+  return f_24(x);
+}
@@ -0,0 +1,12 @@
+int mix(int p, int q, int r) {
+  return p * (q + (r - (p * (q + (r - (p * (q + r)))))));
+}
+
+int inline_pressure(int n) {
+  int acc = 1;
+  int i;
+  for (i = 0; i < n; i++) {
+    acc = acc * 31 + mix(i, acc % 7, n - i);
+  }
+  return acc;
+}
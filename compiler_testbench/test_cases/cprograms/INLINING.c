@@ -0,0 +1,57 @@
+int x = 7;
+int counter;
+
+int get_x() {
+  return x;
+}
+
+int abs_value(int v) {
+  if (v < 0) {
+    return -v;
+  }
+  return v;
+}
+
+int max(int a, int b) {
+  if (a > b) {
+    return a;
+  }
+  return b;
+}
+
+void count(int step) {
+  if (step == 0) {
+    return;
+  }
+  counter = counter + step;
+}
+
+int factorial(int n) {
+  if (n <= 1) {
+    return 1;
+  }
+  return n * factorial(n - 1);
+}
+
+int sum_of_squares(int n) {
+  int i;
+  int s = 0;
+  for (i = 1; i <= n; i++) {
+    s = s + i * i;
+  }
+  return s;
+}
+
+int inlining(int n) {
+  int x = 100;
+  int i;
+  int s = 0;
+  for (i = 0; i < 4; i++) {
+    s = s + max(abs_value(i - 2), get_x()) + abs_value(i - n);
+    count(i);
+  }
+  s = s + x + get_x() * max(n, abs_value(-n));
+  s = s + max(n, max(3, abs_value(-n)));
+  s = s + factorial(5) + sum_of_squares(n);
+  return s + counter;
+}
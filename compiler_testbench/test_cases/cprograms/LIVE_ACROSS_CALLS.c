@@ -0,0 +1,20 @@
+int sq(int x);
+int add3(int a, int b, int c);
+int live_across_calls();
+
+int live_across_calls() {
+  int a = 3;
+  int b = 4;
+  int r = sq(a) + sq(b) * sq(2);
+  r = r + add3(sq(1), sq(2), 5);
+  r = r + sq(a + sq(b));
+  return r % 251;
+}
+
+int sq(int x) {
+  return x * x;
+}
+
+int add3(int a, int b, int c) {
+  return a + b + c;
+}
@@ -0,0 +1,31 @@
+int table[8];
+int scale = 3;
+int total;
+
+int twice(int x) {
+  return x + x;
+}
+
+int loop_invariant(int n) {
+  int i;
+  int j;
+  int s = 0;
+  for (i = 0; i < 8; i++) {
+    table[i] = i * scale;
+  }
+  for (i = 0; i < n; i++) {
+    for (j = 0; j < n * 2; j++) {
+      s = s + table[j % 8] + scale;
+    }
+  }
+  i = 0;
+  while (i < n) {
+    total = total + scale;
+    scale = scale + 1;
+    i++;
+  }
+  for (i = 0; i < 3; i++) {
+    s = s + twice(n * 3) + table[2];
+  }
+  return s + total;
+}
@@ -0,0 +1,34 @@
+int loop_rotation(int n) {
+  int i;
+  int j = 0;
+  int s = 0;
+  for (i = n; i < 0; i++) {
+    s = s + 100;
+  }
+  while (j < n) {
+    j++;
+    if (j % 3 == 0) {
+      continue;
+    }
+    s = s + j;
+  }
+  while (1) {
+    if (j <= 0) {
+      break;
+    }
+    j = j - 4;
+  }
+  for (i = 0; ; i++) {
+    if (i == 5) {
+      break;
+    }
+    if (i == 2) {
+      continue;
+    }
+    s = s + i;
+  }
+  while (0) {
+    s = 0;
+  }
+  return s + j;
+}
@@ -0,0 +1,45 @@
+int weights[4];
+
+int add(int a, int b) {
+  return a + b;
+}
+
+int loop_unrolling(int n) {
+  int i;
+  int j;
+  int s = 0;
+  int k = 0;
+  int local[6];
+  for (i = 0; i < 4; i++) {
+    weights[i] = i + 1;
+  }
+  for (i = 5; i >= 0; i--) {
+    local[i] = weights[i % 4] * i;
+  }
+  for (i = 0; i < n; i++) {
+    s = s + local[i % 6];
+    if (s > 1000) {
+      break;
+    }
+    if (i == 3) {
+      continue;
+    }
+    s = s + i;
+  }
+  s = s + i;
+  while (k != 12) {
+    s = add(s, k);
+    k += 3;
+  }
+  for (i = n; i > 0; i -= 2) {
+    for (j = 0; j < i && j < 3; j++) {
+      s = s + j * i;
+    }
+  }
+  i = 1;
+  while (i <= n) {
+    s = s + weights[i % 4];
+    i = i + 1;
+  }
+  return s + i + k;
+}
@@ -0,0 +1,20 @@
+int rare_adjust(int x) {
+  return x * 7 - 3;
+}
+
+int profile_use(int n) {
+  int s = 0;
+  int i;
+  for (i = 0; i < n; i++) {
+    if (i % 50 != 49) {
+      s = s + i;
+    } else {
+      s = s - rare_adjust(i);
+      s = s ^ (i << 2);
+    }
+    if (s > 100000) {
+      s = s - 100000;
+    }
+  }
+  return s;
+}
@@ -0,0 +1,22 @@
+int add_to(int* p, int v) {
+  *p = *p + v;
+  return *p;
+}
+
+int promote_locals(int n) {
+  int total;
+  int sum;
+  int i;
+  int j;
+  int a[4];
+  total = 0;
+  sum = 0;
+  for (i = 0; i < n; i++) {
+    for (j = 0; j < 4; j++) {
+      a[j] = i + j;
+      sum = sum + a[j];
+    }
+    add_to(&total, sum % 7);
+  }
+  return total + sum;
+}
@@ -0,0 +1,48 @@
+enum limits { SHIFT = 5 };
+
+int calls;
+
+int fib(int n) {
+  if (n < 2) {
+    return n;
+  }
+  return fib(n - 1) + fib(n - 2);
+}
+
+int pow2(int k) {
+  int r = 1;
+  int i;
+  for (i = 0; i < k; i++) {
+    r *= 2;
+  }
+  return r;
+}
+
+int pick(int x) {
+  switch (x) {
+    case 1:
+      return 10;
+    case 2:
+    case 3:
+      x = x + SHIFT;
+      break;
+    default:
+      x = -x;
+  }
+  return x;
+}
+
+int counted(int x) {
+  calls++;
+  return x + calls;
+}
+
+int pure_calls(int a) {
+  int i;
+  int s = 0;
+  for (i = 0; i < 3; i++) {
+    s += pow2(i);
+  }
+  return fib(20) + pow2(SHIFT) + pick(1) + pick(3) + pick(7) + s + fib(a) +
+         counted(1) + counted(1);
+}
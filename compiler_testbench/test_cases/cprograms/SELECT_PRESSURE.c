@@ -0,0 +1,21 @@
+int select_pressure(int n) {
+  int a = 3;
+  int b = 5;
+  int c = 7;
+  int s = 0;
+  int i;
+  for (i = 0; i < n; i++) {
+    switch (i % 3) {
+      case 0:
+        s = s + a * (i > 2 ? (a < b ? a - i : b + i) : (c > i ? c : i));
+        break;
+      default:
+        if (i > 1) {
+          s = s - b + (i > 3 ? (s > 0 ? i : a) : (b > i ? b - c : c - b));
+        }
+        break;
+    }
+    if (s > 1000) a = s - b; else a = s + c * i;
+  }
+  return s;
+}
@@ -0,0 +1,8 @@
+int shrink_wrap_helper(int x);
+
+int shrink_wrap_call(int x) {
+  if (x) {
+    return 1;
+  }
+  return shrink_wrap_helper(x) + 1;
+}
@@ -0,0 +1,17 @@
+int counter;
+int step = 3;
+int pair[2];
+int table[16];
+int *cursor;
+
+int small_globals(int n) {
+  int i;
+  cursor = &counter;
+  for (i = 0; i < n; i++) {
+    counter = counter + step;
+    table[i % 16] = counter;
+  }
+  pair[0] = *cursor;
+  pair[1] = table[(n - 1) % 16];
+  return pair[0] - pair[1] + *cursor;
+}
@@ -0,0 +1,54 @@
+int stack_slots(int n) {
+  int total;
+  int i;
+  total = 0;
+  if (n > 5) {
+    int a[8];
+    for (i = 0; i < 8; i++) {
+      a[i] = i * n;
+    }
+    total = total + a[7];
+  } else {
+    int b[8];
+    for (i = 0; i < 8; i++) {
+      b[i] = i + n;
+    }
+    total = total + b[3];
+  }
+  {
+    int x;
+    x = total * 2;
+    {
+      int y;
+      y = x + 1;
+      total = total + y;
+    }
+    {
+      int z[4];
+      z[0] = x;
+      z[3] = total;
+      total = z[0] + z[3];
+    }
+  }
+  for (i = 0; i < 3; i++) {
+    int c;
+    int d[2];
+    c = i * 3;
+    d[0] = c;
+    d[1] = total;
+    total = d[0] + d[1];
+  }
+  switch (n) {
+    case 10:
+      total = total + 1;
+      break;
+    default:
+      total = total + 2;
+  }
+  if (n > 0) {
+    int rest;
+    rest = stack_slots(n - 1);
+    total = total + rest;
+  }
+  return total;
+}
@@ -0,0 +1,46 @@
+int sum_to(int n, int acc) {
+  if (n == 0) {
+    return acc;
+  }
+  return sum_to(n - 1, acc + n);
+}
+
+int sum_down(int n) {
+  if (n == 0) {
+    return 0;
+  }
+  return n + sum_down(n - 1);
+}
+
+int power(int base, int e) {
+  if (e == 0) {
+    return 1;
+  }
+  return base * power(base, e - 1);
+}
+
+int is_odd(int n);
+
+int is_even(int n) {
+  if (n == 0) {
+    return 1;
+  }
+  return is_odd(n - 1);
+}
+
+int is_odd(int n) {
+  if (n == 0) {
+    return 0;
+  }
+  return is_even(n - 1);
+}
+
+int sum_from(int n) {
+  return sum_to(n, n);
+}
+
+int tail_calls(int n) {
+  int s = sum_to(n, 0) + sum_down(n) + power(3, n % 8);
+  s = s + is_even(n) * 7 + is_odd(n + 1) * 11;
+  return s + sum_from(n / 2);
+}
@@ -0,0 +1,33 @@
+int offset;
+int unused_table[64];
+int unused_scale = 3;
+int calls;
+
+int unused_helper(int x) {
+  unused_scale = x;
+  return unused_table[x] * unused_scale;
+}
+
+int add_offset(int x) {
+  return x + offset;
+}
+
+int sum_squares(int n) {
+  int i;
+  int s;
+  s = 0;
+  for (i = 0; i < n; i++) {
+    s = s + add_offset(i) * i;
+    calls++;
+  }
+  return s;
+}
+
+int unused_entry(int n) {
+  return sum_squares(n) + unused_helper(n);
+}
+
+int main() {
+  offset = 2;
+  return (sum_squares(10) + calls) % 256;
+}
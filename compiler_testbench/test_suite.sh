@@ -39,11 +39,18 @@ for i in compiler_testbench/test_cases/cprograms/*.c; do
     # Declare paths.
     WORKING_DIR="compiler_testbench/working/${program_name}"
     DRIVER_DIR="compiler_testbench/test_cases/cdrivers"
+    FLAGS_DIR="compiler_testbench/test_cases/cflags"
 
     echo
     echo "%%%%%%%%%%%%% 1. Compile program using c_compiler. %%%%%%%%%%%%%"
     # Compile the cprogram using the compiler under testing.
-    bin/c_compiler -S ${i} -o ${WORKING_DIR}/${program_name}.s
+    # Extra options can be passed with COMPILER_FLAGS, e.g. COMPILER_FLAGS=-fomit-frame-pointer.
+    # Tests of an option give it in ${FLAGS_DIR}/<program>_flags.txt.
+    TEST_FLAGS=""
+    if [[ -f ${FLAGS_DIR}/${program_name}_flags.txt ]]; then
+        TEST_FLAGS=$(cat ${FLAGS_DIR}/${program_name}_flags.txt)
+    fi
+    bin/c_compiler ${COMPILER_FLAGS} ${TEST_FLAGS} -S ${i} -o ${WORKING_DIR}/${program_name}.s
 
     if [[ $? -ne 0 ]]; then
         echo "  FAIL!"
@@ -51,6 +58,35 @@ for i in compiler_testbench/test_cases/cprograms/*.c; do
         continue
     fi
 
+    # The hint for the linker of an external call (".reloc 1f,R_MIPS_JALR" and "1:") must
+    # be just before the call.
+    awk '/^\.reloc 1f,R_MIPS_JALR/ { reloc = NR; next }
+         reloc && NR == reloc + 1 && !/^1:/ { misplaced = 1 }
+         reloc && NR == reloc + 2 { if (!/^jalr/) misplaced = 1; reloc = 0 }
+         END { exit misplaced }' ${WORKING_DIR}/${program_name}.s
+    if [[ $? -ne 0 ]]; then
+        echo "  Misplaced .reloc of a call."
+        echo "  FAIL!"
+        TESTSFAILED+=("${program_name}")
+        continue
+    fi
+
+    # Symbols listed in ${FLAGS_DIR}/<program>_dropped.txt must not be defined.
+    if [[ -f ${FLAGS_DIR}/${program_name}_dropped.txt ]]; then
+        DEFINED=0
+        for symbol in $(cat ${FLAGS_DIR}/${program_name}_dropped.txt); do
+            if grep -q "^${symbol}:" ${WORKING_DIR}/${program_name}.s; then
+                echo "  ${symbol} is defined."
+                DEFINED=1
+            fi
+        done
+        if [[ ${DEFINED} -ne 0 ]]; then
+            echo "  FAIL!"
+            TESTSFAILED+=("${program_name}")
+            continue
+        fi
+    fi
+
     echo
     echo "%%%%%%%%%%%%% 2. Compile program using gcc. %%%%%%%%%%%%%"
     # Compile the cprogram using the reference compiler.